@@ -0,0 +1,489 @@
+// Behavior checks of the components that parse untrusted input.
+//
+// Every check runs its cases and prints ok or the failed expectations with
+// their line; the exit status is the number of failed checks.
+//
+// usage: checks.out [name filter]
+
+#include <functional>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <cinttypes>
+#include <cstdlib>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "../src/ChunkedDecoder.h"
+#include "../src/Hpack.h"
+#include "../src/Http2Session.h"
+#include "../src/HttpRange.h"
+#include "../src/Logger.h"
+#include "../src/OutputBuffer.h"
+
+namespace
+{
+
+int g_failures = 0;
+
+#define EXPECT(cond)                                                                 \
+    do                                                                               \
+    {                                                                                \
+        if (!(cond))                                                                 \
+        {                                                                            \
+            std::cout << "  " << __FILE__ << ":" << __LINE__ << ": " #cond "\n";     \
+            g_failures++;                                                            \
+        }                                                                            \
+    } while (0)
+
+struct Check
+{
+    std::string name;
+    std::function<void()> run;
+};
+
+// "82 86 84" -> the bytes, spaces are ignored
+std::string fromHex(std::string_view hex)
+{
+    std::string res;
+    int high = -1;
+    for (const char c : hex)
+    {
+        if (c == ' ')
+            continue;
+        const int value = c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10;
+        if (high == -1)
+            high = value;
+        else
+        {
+            res.push_back(static_cast<char>(high << 4 | value));
+            high = -1;
+        }
+    }
+    return res;
+}
+
+using HeaderList = std::vector<std::pair<std::string, std::string>>;
+
+bool isSameHeaders(const std::vector<HpackHeader> &headers, const HeaderList &expected)
+{
+    if (headers.size() != expected.size())
+        return false;
+    for (std::size_t i = 0; i < headers.size(); i++)
+        if (headers[i].name != expected[i].first || headers[i].value != expected[i].second)
+            return false;
+    return true;
+}
+
+// decodes the blocks of one RFC 7541 appendix C example in order, on one decoder
+void expectHpackSequence(const std::vector<std::pair<std::string_view, HeaderList>> &blocks)
+{
+    HpackDecoder decoder;
+    for (const auto &[hex, expected] : blocks)
+    {
+        std::vector<HpackHeader> headers;
+        EXPECT(decoder.decode(fromHex(hex), headers, 64 * 1024));
+        EXPECT(isSameHeaders(headers, expected));
+    }
+}
+
+bool decodeOnce(std::string_view hex)
+{
+    HpackDecoder decoder;
+    std::vector<HpackHeader> headers;
+    return decoder.decode(fromHex(hex), headers, 64 * 1024);
+}
+
+struct Frame
+{
+    uint8_t type;
+    uint8_t flags;
+    uint32_t stream_id;
+    std::string payload;
+};
+
+std::string frameBytes(uint8_t type, uint8_t flags, uint32_t stream_id, std::string_view payload)
+{
+    std::string res;
+    res.push_back(static_cast<char>(payload.size() >> 16));
+    res.push_back(static_cast<char>(payload.size() >> 8));
+    res.push_back(static_cast<char>(payload.size()));
+    res.push_back(static_cast<char>(type));
+    res.push_back(static_cast<char>(flags));
+    for (int shift = 24; shift >= 0; shift -= 8)
+        res.push_back(static_cast<char>(stream_id >> shift));
+    return res.append(payload);
+}
+
+// everything the session queued, cut into frames
+std::vector<Frame> takeFrames(Http2Session &session)
+{
+    OutputBuffer out;
+    session.fillOutput(out);
+    int fds[2];
+    if (::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1)
+        return {};
+    std::string bytes;
+    char buffer[4096];
+    while (!out.empty() && out.sendTo(fds[0]) > 0)
+    {
+        long retval;
+        while ((retval = ::recv(fds[1], buffer, sizeof(buffer), MSG_DONTWAIT)) > 0)
+            bytes.append(buffer, retval);
+    }
+    ::close(fds[0]);
+    ::close(fds[1]);
+
+    std::vector<Frame> frames;
+    for (std::size_t pos = 0; pos + 9 <= bytes.size();)
+    {
+        const auto *header = reinterpret_cast<const unsigned char *>(bytes.data() + pos);
+        const uint32_t length = (uint32_t{header[0]} << 16) | (uint32_t{header[1]} << 8) | header[2];
+        const uint32_t stream_id = ((uint32_t{header[5]} << 24) | (uint32_t{header[6]} << 16) |
+                                    (uint32_t{header[7]} << 8) | header[8]) & 0x7fffffff;
+        frames.push_back({header[3], header[4], stream_id, bytes.substr(pos + 9, length)});
+        pos += 9 + length;
+    }
+    return frames;
+}
+
+constexpr uint8_t kHeaders = 0x1, kSettings = 0x4, kPing = 0x6, kGoaway = 0x7;
+constexpr uint8_t kFlagAck = 0x1, kFlagEndStream = 0x1, kFlagEndHeaders = 0x4;
+
+bool hasFrame(const std::vector<Frame> &frames, uint8_t type, uint8_t flags, uint32_t stream_id)
+{
+    for (const auto &frame : frames)
+        if (frame.type == type && (frame.flags & flags) == flags && frame.stream_id == stream_id)
+            return true;
+    return false;
+}
+
+std::vector<Check> hpackChecks()
+{
+    std::vector<Check> res;
+    res.push_back({"Hpack/C.2 literal and indexed fields", []
+                   {
+                       expectHpackSequence({{"400a 6375 7374 6f6d 2d6b 6579 0d63 7573 746f 6d2d 6865 6164 6572",
+                                             {{"custom-key", "custom-header"}}}});
+                       expectHpackSequence({{"040c 2f73 616d 706c 652f 7061 7468", {{":path", "/sample/path"}}}});
+                       expectHpackSequence({{"1008 7061 7373 776f 7264 0673 6563 7265 74", {{"password", "secret"}}}});
+                       expectHpackSequence({{"82", {{":method", "GET"}}}});
+                   }});
+    res.push_back({"Hpack/C.3 requests without Huffman", []
+                   {
+                       expectHpackSequence(
+                           {{"8286 8441 0f77 7777 2e65 7861 6d70 6c65 2e63 6f6d",
+                             {{":method", "GET"}, {":scheme", "http"}, {":path", "/"}, {":authority", "www.example.com"}}},
+                            {"8286 84be 5808 6e6f 2d63 6163 6865",
+                             {{":method", "GET"}, {":scheme", "http"}, {":path", "/"}, {":authority", "www.example.com"},
+                              {"cache-control", "no-cache"}}},
+                            {"8287 85bf 400a 6375 7374 6f6d 2d6b 6579 0c63 7573 746f 6d2d 7661 6c75 65",
+                             {{":method", "GET"}, {":scheme", "https"}, {":path", "/index.html"},
+                              {":authority", "www.example.com"}, {"custom-key", "custom-value"}}}});
+                   }});
+    res.push_back({"Hpack/C.4 requests with Huffman", []
+                   {
+                       expectHpackSequence(
+                           {{"8286 8441 8cf1 e3c2 e5f2 3a6b a0ab 90f4 ff",
+                             {{":method", "GET"}, {":scheme", "http"}, {":path", "/"}, {":authority", "www.example.com"}}},
+                            {"8286 84be 5886 a8eb 1064 9cbf",
+                             {{":method", "GET"}, {":scheme", "http"}, {":path", "/"}, {":authority", "www.example.com"},
+                              {"cache-control", "no-cache"}}},
+                            {"8287 85bf 4088 25a8 49e9 5ba9 7d7f 8925 a849 e95b b8e8 b4bf",
+                             {{":method", "GET"}, {":scheme", "https"}, {":path", "/index.html"},
+                              {":authority", "www.example.com"}, {"custom-key", "custom-value"}}}});
+                   }});
+    res.push_back({"Hpack/C.6 responses with Huffman and eviction", []
+                   {
+                       // the example runs with a 256 byte table, announced by a size update in front
+                       expectHpackSequence(
+                           {{"3fe1 01 4882 6402 5885 aec3 771a 4b61 96d0 7abe 9410 54d4 44a8 2005 9504 0b81 66e0 82a6 "
+                             "2d1b ff6e 919d 29ad 1718 63c7 8f0b 97c8 e9ae 82ae 43d3",
+                             {{":status", "302"}, {"cache-control", "private"}, {"date", "Mon, 21 Oct 2013 20:13:21 GMT"},
+                              {"location", "https://www.example.com"}}},
+                            {"4883 640e ff c1 c0 bf",
+                             {{":status", "307"}, {"cache-control", "private"}, {"date", "Mon, 21 Oct 2013 20:13:21 GMT"},
+                              {"location", "https://www.example.com"}}},
+                            {"88c1 6196 d07a be94 1054 d444 a820 0595 040b 8166 e084 a62d 1bff c05a 839b d9ab 77ad 94e7 "
+                             "821d d7f2 e6c7 b335 dfdf cd5b 3960 d5af 2708 7f36 72c1 ab27 0fb5 291f 9587 3160 65c0 03ed "
+                             "4ee5 b106 3d50 07",
+                             {{":status", "200"}, {"cache-control", "private"}, {"date", "Mon, 21 Oct 2013 20:13:22 GMT"},
+                              {"location", "https://www.example.com"}, {"content-encoding", "gzip"},
+                              {"set-cookie", "foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600; version=1"}}}});
+                   }});
+    res.push_back({"Hpack/table size updates", []
+                   {
+                       EXPECT(decodeOnce("3fe11f 82"));  // 4096, our SETTINGS_HEADER_TABLE_SIZE
+                       EXPECT(!decodeOnce("3fe21f 82")); // 4097
+                       EXPECT(!decodeOnce("3fff ffff ffff ffff ffff ff01"));
+                       EXPECT(!decodeOnce("82 20"));     // not at the start of the block
+                       EXPECT(decodeOnce("20 3fe11f 82"));
+                   }});
+    res.push_back({"Hpack/malformed blocks", []
+                   {
+                       EXPECT(!decodeOnce("80"));        // index 0
+                       EXPECT(!decodeOnce("be"));        // index 62, the dynamic table is empty
+                       EXPECT(!decodeOnce("400a 6375")); // string longer than the block
+                       EXPECT(!decodeOnce("4082 ffff 00")); // Huffman name holding EOS
+                       EXPECT(!decodeOnce("4081 00 00"));   // Huffman padding that is not all ones
+                       HpackDecoder decoder;
+                       std::vector<HpackHeader> headers;
+                       EXPECT(!decoder.decode(fromHex("400a 6375 7374 6f6d 2d6b 6579 0d63 7573 746f 6d2d 6865 6164 6572"),
+                                              headers, 40)); // header list larger than allowed
+                   }});
+    return res;
+}
+
+std::vector<Check> http2Checks()
+{
+    std::vector<Check> res;
+    const std::string preface(Http2Session::kConnectionPreface);
+    res.push_back({"Http2Session/SETTINGS and PING are acknowledged", [preface]
+                   {
+                       Http2Session session("/nonexistent");
+                       EXPECT(session.receive(preface + frameBytes(kSettings, 0, 0, "") +
+                                              frameBytes(kPing, 0, 0, "12345678")));
+                       const auto frames = takeFrames(session);
+                       EXPECT(hasFrame(frames, kSettings, 0, 0));
+                       EXPECT(hasFrame(frames, kSettings, kFlagAck, 0));
+                       EXPECT(hasFrame(frames, kPing, kFlagAck, 0));
+                   }});
+    res.push_back({"Http2Session/preface split anywhere", [preface]
+                   {
+                       Http2Session session("/nonexistent");
+                       const auto bytes = preface + frameBytes(kSettings, 0, 0, "");
+                       for (const char c : bytes)
+                           EXPECT(session.receive(std::string_view(&c, 1)));
+                       EXPECT(hasFrame(takeFrames(session), kSettings, kFlagAck, 0));
+                   }});
+    res.push_back({"Http2Session/connection errors", [preface]
+                   {
+                       EXPECT(!Http2Session("/nonexistent").receive("GET / HTTP/1.1\r\n\r\n"));
+                       // the first frame must be SETTINGS
+                       EXPECT(!Http2Session("/nonexistent").receive(preface + frameBytes(kPing, 0, 0, "12345678")));
+                       // larger than SETTINGS_MAX_FRAME_SIZE
+                       EXPECT(!Http2Session("/nonexistent").receive(preface + frameBytes(kSettings, 0, 0, "") +
+                                                                    frameBytes(kPing, 0, 0, std::string(16385, 'x'))));
+                       EXPECT(!Http2Session("/nonexistent").receive(preface + frameBytes(kSettings, 0, 0, "") +
+                                                                    frameBytes(kPing, 0, 0, "1234")));
+                       // a header block that does not decode
+                       Http2Session session("/nonexistent");
+                       EXPECT(!session.receive(preface + frameBytes(kSettings, 0, 0, "") +
+                                               frameBytes(kHeaders, kFlagEndStream | kFlagEndHeaders, 1, fromHex("be"))));
+                       EXPECT(hasFrame(takeFrames(session), kGoaway, 0, 0));
+                   }});
+    res.push_back({"Http2Session/request is answered on its stream", [preface]
+                   {
+                       Http2Session session("/nonexistent");
+                       // GET http://www.example.com/, RFC 7541 C.3.1
+                       EXPECT(session.receive(preface + frameBytes(kSettings, 0, 0, "") +
+                                              frameBytes(kHeaders, kFlagEndStream | kFlagEndHeaders, 1,
+                                                         fromHex("8286 8441 0f77 7777 2e65 7861 6d70 6c65 2e63 6f6d"))));
+                       HpackDecoder decoder;
+                       bool is_answered = false;
+                       for (const auto &frame : takeFrames(session))
+                       {
+                           if (frame.type != kHeaders || frame.stream_id != 1)
+                               continue;
+                           std::vector<HpackHeader> headers;
+                           EXPECT(decoder.decode(frame.payload, headers, 64 * 1024));
+                           EXPECT(!headers.empty() && headers[0].name == ":status" && headers[0].value == "404");
+                           is_answered = true;
+                       }
+                       EXPECT(is_answered);
+                   }});
+    return res;
+}
+
+ChunkedDecoder::Result decodeChunked(std::string_view in, std::string &out, uint64_t max_size = UINT64_MAX)
+{
+    ChunkedDecoder decoder;
+    decoder.clear(max_size);
+    return decoder.decode(in, out);
+}
+
+std::vector<Check> chunkedChecks()
+{
+    using Result = ChunkedDecoder::Result;
+    std::vector<Check> res;
+    static constexpr std::string_view kBody = "5;name=value\r\nhello\r\n6\r\n world\r\n0\r\n"
+                                              "X-Checksum: 1\r\nX-Other: 2\r\n\r\nGET /next";
+    res.push_back({"ChunkedDecoder/extensions and trailers", []
+                   {
+                       ChunkedDecoder decoder;
+                       decoder.clear(UINT64_MAX);
+                       std::string_view in = kBody;
+                       std::string out;
+                       EXPECT(decoder.decode(in, out) == Result::DONE);
+                       EXPECT(out == "hello world");
+                       EXPECT(decoder.size() == 11);
+                       EXPECT(in == "GET /next"); // the next request is left alone
+                   }});
+    res.push_back({"ChunkedDecoder/input cut anywhere", []
+                   {
+                       ChunkedDecoder decoder;
+                       decoder.clear(UINT64_MAX);
+                       std::string out;
+                       const auto body = kBody.substr(0, kBody.find("GET"));
+                       for (std::size_t i = 0; i < body.size(); i++)
+                       {
+                           std::string_view in = body.substr(i, 1);
+                           EXPECT(decoder.decode(in, out) == (i + 1 == body.size() ? Result::DONE : Result::NEED_MORE));
+                           EXPECT(in.empty());
+                       }
+                       EXPECT(out == "hello world");
+                   }});
+    res.push_back({"ChunkedDecoder/chunk sizes", []
+                   {
+                       std::string out;
+                       EXPECT(decodeChunked("fffffffffffffff\r\n", out) == Result::NEED_MORE);
+                       EXPECT(decodeChunked("1000000000000000\r\n", out) == Result::ERROR); // 16 digits could overflow
+                       EXPECT(decodeChunked("000000000000000000001\r\n", out) == Result::ERROR);
+                       EXPECT(decodeChunked("fffffffffffffff\r\n", out, 1024 * 1024) == Result::TOO_LARGE);
+                       out.clear();
+                       // checked on each size line, before the data of the chunk
+                       EXPECT(decodeChunked("5\r\nhello\r\n4\r\nXXXX", out, 8) == Result::TOO_LARGE);
+                       EXPECT(out == "hello");
+                       EXPECT(decodeChunked("5\r\nhello\r\n3\r\nabc\r\n0\r\n\r\n", out, 8) == Result::DONE);
+                   }});
+    res.push_back({"ChunkedDecoder/malformed framing", []
+                   {
+                       std::string out;
+                       EXPECT(decodeChunked("5\nhello\r\n", out) == Result::ERROR);      // bare LF
+                       EXPECT(decodeChunked("5\r\nhelloX\r\n", out) == Result::ERROR);  // data longer than its size
+                       EXPECT(decodeChunked(";ext\r\n", out) == Result::ERROR);          // no size
+                       EXPECT(decodeChunked("-1\r\n", out) == Result::ERROR);
+                       EXPECT(decodeChunked("0x5\r\n", out) == Result::ERROR);
+                       EXPECT(decodeChunked("0\r\nX-Trailer: a\n\r\n", out) == Result::ERROR);
+                       EXPECT(decodeChunked("0\r\n\nX: a\r\n\r\n", out) == Result::ERROR);
+                       EXPECT(decodeChunked("5;a\nb\r\nhello\r\n", out) == Result::ERROR);
+                       EXPECT(decodeChunked("0\r\n\r\r", out) == Result::ERROR);
+                       EXPECT(decodeChunked("0\r\nX: " + std::string(5000, 'a') + "\r\n\r\n", out) == Result::ERROR);
+                       EXPECT(decodeChunked("5;" + std::string(5000, 'a') + "\r\n", out) == Result::ERROR);
+                   }});
+    res.push_back({"ChunkedDecoder/clear starts a new body", []
+                   {
+                       ChunkedDecoder decoder;
+                       decoder.clear(UINT64_MAX);
+                       std::string out;
+                       std::string_view in = "3\r\nabc\r\n0\r\n\r\n";
+                       EXPECT(decoder.decode(in, out) == Result::DONE);
+                       decoder.clear(UINT64_MAX);
+                       in = "2\r\nde\r\n0\r\n\r\n";
+                       EXPECT(decoder.decode(in, out) == Result::DONE);
+                       EXPECT(out == "abcde");
+                       EXPECT(decoder.size() == 2);
+                   }});
+    return res;
+}
+
+// "first-last,first-last" of the ranges parsed from header, empty when not SATISFIABLE
+std::string parseRangeList(std::string_view header, off_t size, RangeParseResult expected)
+{
+    std::vector<ByteRange> ranges;
+    const auto result = parseRange(header, size, ranges);
+    EXPECT(result == expected);
+    std::string res;
+    if (result != RangeParseResult::SATISFIABLE)
+        return res; // ranges may hold the specs read before the bad one
+    for (const auto &range : ranges)
+    {
+        EXPECT(range.first <= range.last && range.last < size);
+        res += (res.empty() ? "" : ",") + std::to_string(range.first) + "-" + std::to_string(range.last);
+    }
+    return res;
+}
+
+std::vector<Check> rangeChecks()
+{
+    static constexpr auto kOk = RangeParseResult::SATISFIABLE;
+    static constexpr auto kIgnored = RangeParseResult::IGNORED;
+    static constexpr auto kNotSatisfiable = RangeParseResult::NOT_SATISFIABLE;
+    std::vector<Check> res;
+    res.push_back({"HttpRange/single ranges", []
+                   {
+                       EXPECT(parseRangeList("bytes=0-499", 10000, kOk) == "0-499");
+                       EXPECT(parseRangeList("bytes=9500-", 10000, kOk) == "9500-9999");
+                       EXPECT(parseRangeList("bytes=9000-20000", 10000, kOk) == "9000-9999"); // last clamped
+                       EXPECT(parseRangeList(" BYTES=5-5 ", 10000, kOk) == "5-5");
+                   }});
+    res.push_back({"HttpRange/suffix ranges", []
+                   {
+                       EXPECT(parseRangeList("bytes=-500", 10000, kOk) == "9500-9999");
+                       EXPECT(parseRangeList("bytes=-20000", 10000, kOk) == "0-9999");
+                       EXPECT(parseRangeList("bytes=-0", 10000, kNotSatisfiable).empty());
+                       EXPECT(parseRangeList("bytes=-0,0-0", 10000, kOk) == "0-0");
+                   }});
+    res.push_back({"HttpRange/overlapping ranges are coalesced", []
+                   {
+                       EXPECT(parseRangeList("bytes=500-600,601-999", 10000, kOk) == "500-999"); // adjacent
+                       EXPECT(parseRangeList("bytes=500-700,601-999", 10000, kOk) == "500-999");
+                       EXPECT(parseRangeList("bytes=9000-9100,0-10,5-20", 10000, kOk) == "0-20,9000-9100");
+                       EXPECT(parseRangeList("bytes=0-,-100", 10000, kOk) == "0-9999");
+                       EXPECT(parseRangeList("bytes=0-0, -1", 10000, kOk) == "0-0,9999-9999");
+                   }});
+    res.push_back({"HttpRange/not satisfiable", []
+                   {
+                       // 416, every range starts past the end
+                       EXPECT(parseRangeList("bytes=10000-", 10000, kNotSatisfiable).empty());
+                       EXPECT(parseRangeList("bytes=10000-10005,20000-", 10000, kNotSatisfiable).empty());
+                       EXPECT(parseRangeList("bytes=0-10", 0, kNotSatisfiable).empty());
+                       EXPECT(parseRangeList("bytes=-10", 0, kNotSatisfiable).empty());
+                       // one satisfiable range is enough
+                       EXPECT(parseRangeList("bytes=20000-,0-0", 10000, kOk) == "0-0");
+                   }});
+    res.push_back({"HttpRange/ignored headers", []
+                   {
+                       EXPECT(parseRangeList("", 10000, kIgnored).empty());
+                       EXPECT(parseRangeList("bytes=", 10000, kIgnored).empty());
+                       EXPECT(parseRangeList("bytes=,", 10000, kIgnored).empty());
+                       EXPECT(parseRangeList("items=0-5", 10000, kIgnored).empty());
+                       EXPECT(parseRangeList("bytes=5-1", 10000, kIgnored).empty());
+                       EXPECT(parseRangeList("bytes=5", 10000, kIgnored).empty());
+                       EXPECT(parseRangeList("bytes=0-5,x-9", 10000, kIgnored).empty());
+                       EXPECT(parseRangeList("bytes=--5", 10000, kIgnored).empty());
+                       EXPECT(parseRangeList("bytes=0-99999999999999999999", 10000, kIgnored).empty());
+                       std::string many = "bytes=0-0";
+                       for (std::size_t i = 1; i < kMaxByteRanges; i++)
+                           many += "," + std::to_string(i * 2) + "-" + std::to_string(i * 2);
+                       EXPECT(parseRangeList(many, 10000, kOk).size() > 0);
+                       EXPECT(parseRangeList(many + ",100-100", 10000, kIgnored).empty());
+                   }});
+    return res;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    const std::string_view filter = argc > 1 ? argv[1] : "";
+
+    if (!Logger::instance().setLevel(LogLevel::ERROR).setPath("/dev/null").start())
+    {
+        std::cerr << "Failed to start logger" << std::endl;
+        return 1;
+    }
+
+    std::vector<Check> checks;
+    for (auto group : {hpackChecks, http2Checks, chunkedChecks, rangeChecks})
+        for (auto &check : group())
+            checks.push_back(std::move(check));
+
+    int failed_checks = 0;
+    for (const auto &check : checks)
+    {
+        if (check.name.find(filter) == std::string::npos)
+            continue;
+        const int failures = g_failures;
+        std::cout << check.name << "\n";
+        check.run();
+        if (g_failures != failures)
+            failed_checks++;
+        std::cout << (g_failures == failures ? "  ok\n" : "  FAILED\n");
+    }
+    std::cout << failed_checks << " failed" << std::endl;
+    std::_Exit(failed_checks); // Logger has no stop path
+}
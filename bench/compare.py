@@ -0,0 +1,33 @@
+#!/usr/bin/env python3
+"""Compare two bench/results/<label> directories produced by bench/run.sh."""
+import json
+import pathlib
+import sys
+
+
+def load(path):
+    return {p.stem: json.loads(p.read_text()) for p in sorted(pathlib.Path(path).glob("*.json"))}
+
+
+def change(old, new):
+    return f"{(new - old) / old * 100:+.1f}%" if old else "n/a"
+
+
+def main():
+    if len(sys.argv) != 3:
+        print(f"usage: {sys.argv[0]} <old results dir> <new results dir>")
+        return 1
+
+    old, new = load(sys.argv[1]), load(sys.argv[2])
+    print(f"{'run':<28}{'req/s':>12}{'':>9}{'p50 us':>10}{'':>9}{'p99 us':>10}{'':>9}")
+    for name in sorted(old.keys() & new.keys()):
+        o, n = old[name], new[name]
+        print(f"{name:<28}"
+              f"{n['requests_per_s']:>12.0f}{change(o['requests_per_s'], n['requests_per_s']):>9}"
+              f"{n['latency_us']['p50']:>10.0f}{change(o['latency_us']['p50'], n['latency_us']['p50']):>9}"
+              f"{n['latency_us']['p99']:>10.0f}{change(o['latency_us']['p99'], n['latency_us']['p99']):>9}")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
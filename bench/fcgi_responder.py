@@ -0,0 +1,179 @@
+#!/usr/bin/env python3
+"""A small multiplexing FastCGI responder for the FastCGI (-F) tests and benchmarks.
+
+It answers FCGI_GET_VALUES with FCGI_MPXS_CONNS=1 and runs the requests of a
+connection concurrently. The last segments of SCRIPT_NAME pick the response:
+
+  .../hello           a small text/plain page with Content-Length
+  .../bytes/N         N bytes in 8 KB stdout records, without Content-Length
+  .../sleep/MS        answers after MS milliseconds
+  .../status/CODE     "Status: CODE"
+  .../redirect        "Location: /" without a Status
+  .../env             the request's params
+  .../stderr          a line to FCGI_STDERR and a page
+  POST/PUT            the request body echoed back
+
+usage: bench/fcgi_responder.py PORT | unix:/path
+"""
+import asyncio
+import os
+import struct
+import sys
+
+BEGIN_REQUEST, ABORT_REQUEST, END_REQUEST, PARAMS, STDIN, STDOUT, STDERR = 1, 2, 3, 4, 5, 6, 7
+GET_VALUES, GET_VALUES_RESULT = 9, 10
+MAX_REQS = 32
+
+
+def record(type_, request_id, content=b""):
+    return struct.pack(">BBHHBB", 1, type_, request_id, len(content), 0, 0) + content
+
+
+def stream(type_, request_id, content):
+    out = b""
+    for i in range(0, len(content), 65535):
+        out += record(type_, request_id, content[i:i + 65535])
+    return out
+
+
+def encode_pairs(pairs):
+    out = b""
+    for name, value in pairs:
+        for length in (len(name), len(value)):
+            out += bytes([length]) if length < 128 else struct.pack(">I", length | 0x80000000)
+        out += name + value
+    return out
+
+
+def decode_pairs(data):
+    pairs, pos = {}, 0
+    while pos < len(data):
+        lengths = []
+        for _ in range(2):
+            if data[pos] < 128:
+                lengths.append(data[pos])
+                pos += 1
+            else:
+                lengths.append(struct.unpack(">I", data[pos:pos + 4])[0] & 0x7FFFFFFF)
+                pos += 4
+        name = data[pos:pos + lengths[0]]
+        value = data[pos + lengths[0]:pos + lengths[0] + lengths[1]]
+        pairs[name.decode("latin-1")] = value.decode("latin-1")
+        pos += lengths[0] + lengths[1]
+    return pairs
+
+
+class Connection:
+    def __init__(self, reader, writer):
+        self.reader, self.writer = reader, writer
+        self.requests = {}  # id -> [params bytes, stdin bytes, task]
+
+    def send(self, data):
+        if not self.writer.is_closing():
+            self.writer.write(data)
+
+    async def run(self):
+        try:
+            while True:
+                header = await self.reader.readexactly(8)
+                _, type_, request_id, length, padding, _ = struct.unpack(">BBHHBB", header)
+                content = await self.reader.readexactly(length + padding)
+                self.handle(type_, request_id, content[:length])
+        except (asyncio.IncompleteReadError, ConnectionError):
+            pass
+        finally:
+            for state in self.requests.values():
+                if state[2]:
+                    state[2].cancel()
+            self.writer.close()
+
+    def handle(self, type_, request_id, content):
+        if type_ == GET_VALUES:
+            values = {b"FCGI_MPXS_CONNS": b"1", b"FCGI_MAX_REQS": str(MAX_REQS).encode(), b"FCGI_MAX_CONNS": b"1024"}
+            names = decode_pairs(content)
+            self.send(record(GET_VALUES_RESULT, 0, encode_pairs((n.encode(), values[n.encode()]) for n in names
+                                                                  if n.encode() in values)))
+        elif type_ == BEGIN_REQUEST:
+            self.requests[request_id] = [b"", b"", None]
+        elif type_ == PARAMS and request_id in self.requests:
+            self.requests[request_id][0] += content
+        elif type_ == STDIN and request_id in self.requests:
+            state = self.requests[request_id]
+            if content:
+                state[1] += content
+            elif state[2] is None:
+                state[2] = asyncio.ensure_future(self.respond(request_id, decode_pairs(state[0]), state[1]))
+        elif type_ == ABORT_REQUEST and request_id in self.requests:
+            state = self.requests[request_id]
+            if state[2]:
+                state[2].cancel()
+            self.end(request_id)
+
+    def end(self, request_id):
+        if self.requests.pop(request_id, None) is not None:
+            self.send(record(END_REQUEST, request_id, struct.pack(">IB3x", 0, 0)))
+
+    async def respond(self, request_id, params, body):
+        try:
+            parts = params.get("SCRIPT_NAME", "/").rstrip("/").split("/")
+            method = params.get("REQUEST_METHOD", "GET")
+            if method in ("POST", "PUT"):
+                out = b"Content-Type: %s\r\n\r\n" % params.get("CONTENT_TYPE", "application/octet-stream").encode() + body
+            elif parts[-2:-1] == ["bytes"] and parts[-1].isdigit():
+                self.send(record(STDOUT, request_id, b"Content-Type: application/octet-stream\r\n\r\n"))
+                left = int(parts[-1])
+                while left > 0:
+                    size = min(left, 8192)
+                    self.send(record(STDOUT, request_id, b"z" * size))
+                    left -= size
+                    await self.writer.drain()
+                out = b""
+            elif parts[-2:-1] == ["sleep"] and parts[-1].isdigit():
+                await asyncio.sleep(int(parts[-1]) / 1000)
+                out = b"Content-Type: text/plain\r\n\r\nslept %s ms\n" % parts[-1].encode()
+            elif parts[-2:-1] == ["status"] and parts[-1].isdigit():
+                out = b"Status: %s Custom\r\nContent-Type: text/plain\r\n\r\nstatus %s\n" % (parts[-1].encode(), parts[-1].encode())
+            elif parts[-1] == "redirect":
+                out = b"Location: /\r\n\r\n"
+            elif parts[-1] == "env":
+                text = "".join(f"{k}={v}\n" for k, v in sorted(params.items())).encode()
+                out = b"Content-Type: text/plain\r\n\r\n" + text
+            elif parts[-1] == "stderr":
+                self.send(record(STDERR, request_id, b"something went sideways\n"))
+                out = b"Content-Type: text/plain\r\n\r\nlogged\n"
+            else:
+                text = b"hello from %s\n" % params.get("SCRIPT_NAME", "").encode()
+                out = b"Content-Type: text/plain\r\nContent-Length: %d\r\n\r\n" % len(text) + text
+            if out:
+                self.send(stream(STDOUT, request_id, out))
+            self.send(record(STDOUT, request_id))
+            self.end(request_id)
+        except asyncio.CancelledError:
+            pass
+
+
+async def serve(address):
+    async def on_connection(reader, writer):
+        await Connection(reader, writer).run()
+
+    if address.startswith("unix:"):
+        path = address[len("unix:"):]
+        if os.path.exists(path):
+            os.unlink(path)
+        server = await asyncio.start_unix_server(on_connection, path, backlog=1024)
+    else:
+        server = await asyncio.start_server(on_connection, "127.0.0.1", int(address), backlog=1024)
+    async with server:
+        await server.serve_forever()
+
+
+def main():
+    if len(sys.argv) != 2:
+        print(__doc__)
+        return 1
+    asyncio.run(serve(sys.argv[1]))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
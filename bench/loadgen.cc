@@ -0,0 +1,1035 @@
+// Multithreaded epoll based HTTP/1.x load generator.
+//
+// closed loop: every connection keeps `pipeline` requests in flight and sends
+//              the next one as soon as a response completes.
+// open loop:   requests are scheduled at a fixed rate regardless of responses.
+//              Latency is measured from the scheduled start time, so a stalled
+//              server is charged for the requests it delayed (no coordinated
+//              omission).
+//
+// Results are written as JSON so runs can be compared across commits.
+//
+// -S speaks HTTPS (HTTP/1.1 over TLS, no certificate check) when built with
+// WITH_OPENSSL=1, the handshake is part of every connect.
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstddef>
+#include <cstring>
+#include <ctime>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#ifdef WEBSERVER_WITH_OPENSSL
+#include <openssl/ssl.h>
+#endif
+
+#include "../src/LatencyHistogram.h"
+
+namespace
+{
+
+enum class LoopMode
+{
+    CLOSED,
+    OPEN,
+};
+
+struct Options
+{
+    std::string name{"unnamed"};
+    std::string host{"127.0.0.1"};
+    uint16_t port{12345};
+    std::string unix_path; // connect to this Unix socket ("@name": abstract) instead of host:port
+    int threads{1};
+    int connections{16};
+    double duration_s{10.0};
+    double warmup_s{1.0};
+    LoopMode mode{LoopMode::CLOSED};
+    double rate{1000.0}; // requests per second over all threads, open loop only
+    bool keep_alive{true};
+    bool is_connection_sent{true}; // false: HTTP/1.1 requests without a Connection header
+    bool is_tls{false};
+    int pipeline{1};
+    long expected_interval_us{0}; // closed loop coordinated omission back-fill
+    std::string scenario_path;
+    std::string output_path;
+};
+
+struct ScenarioRequest
+{
+    std::string raw; // serialized request, without the Connection header
+    bool is_head{false};
+    int weight{1};
+};
+
+struct Scenario
+{
+    std::string name;
+    std::vector<ScenarioRequest> requests;
+    std::vector<int> weighted_index;
+};
+
+int64_t nowNs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1'000'000'000ll + ts.tv_nsec;
+}
+
+std::string_view trim(std::string_view sv)
+{
+    while (!sv.empty() && std::isspace(static_cast<unsigned char>(sv.front())))
+        sv.remove_prefix(1);
+    while (!sv.empty() && std::isspace(static_cast<unsigned char>(sv.back())))
+        sv.remove_suffix(1);
+    return sv;
+}
+
+bool iequals(std::string_view lhs, std::string_view rhs)
+{
+    return lhs.size() == rhs.size() &&
+           std::equal(lhs.begin(), lhs.end(), rhs.begin(), [](char a, char b)
+                      { return std::tolower(static_cast<unsigned char>(a)) == std::tolower(static_cast<unsigned char>(b)); });
+}
+
+// scenario line: <weight> <METHOD> <path> [| Header: value]...
+bool loadScenario(const std::string &path, const Options &opts, Scenario &scenario)
+{
+    std::ifstream in(path);
+    if (!in)
+    {
+        std::cerr << "Cannot open scenario file " << path << std::endl;
+        return false;
+    }
+
+    scenario.name = path.substr(path.find_last_of('/') == std::string::npos ? 0 : path.find_last_of('/') + 1);
+    std::string line;
+    int line_no = 0;
+    while (std::getline(in, line))
+    {
+        line_no++;
+        std::string_view sv = trim(line);
+        if (sv.empty() || sv.front() == '#')
+            continue;
+
+        std::vector<std::string_view> parts;
+        while (true)
+        {
+            const auto bar_pos = sv.find('|');
+            parts.push_back(trim(sv.substr(0, bar_pos)));
+            if (bar_pos == std::string_view::npos)
+                break;
+            sv.remove_prefix(bar_pos + 1);
+        }
+
+        std::istringstream head{std::string(parts[0])};
+        ScenarioRequest req;
+        std::string method, target;
+        if (!(head >> req.weight >> method >> target) || req.weight <= 0)
+        {
+            std::cerr << path << ":" << line_no << ": expected '<weight> <METHOD> <path>'" << std::endl;
+            return false;
+        }
+
+        req.is_head = method == "HEAD";
+        req.raw.append(method).append(" ").append(target).append(" HTTP/1.1\r\n");
+        req.raw.append("Host: ").append(opts.host).append("\r\n");
+        for (std::size_t i = 1; i < parts.size(); i++)
+            if (!parts[i].empty())
+                req.raw.append(parts[i]).append("\r\n");
+
+        for (int i = 0; i < req.weight; i++)
+            scenario.weighted_index.push_back(scenario.requests.size());
+        scenario.requests.push_back(std::move(req));
+    }
+
+    if (scenario.requests.empty())
+    {
+        std::cerr << "Scenario " << path << " has no request" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Incremental HTTP/1.x response parser, only what a load generator needs.
+class ResponseParser
+{
+public:
+    enum class Result
+    {
+        NEED_MORE,
+        DONE,
+        ERROR,
+    };
+
+    void reset(bool is_head)
+    {
+        state_ = State::HEAD;
+        is_head_ = is_head;
+        status_ = 0;
+        body_left_ = 0;
+        is_chunked_ = false;
+        is_close_ = false;
+        head_.clear();
+    }
+
+    // consumes bytes from data, returns DONE once one full response is read
+    Result feed(std::string_view &data)
+    {
+        while (!data.empty())
+        {
+            switch (state_)
+            {
+            case State::HEAD:
+            {
+                const auto prev_size = head_.size();
+                head_.append(data);
+                const auto end_pos = head_.find("\r\n\r\n", prev_size >= 3 ? prev_size - 3 : 0);
+                if (end_pos == std::string::npos)
+                {
+                    data = {};
+                    if (head_.size() > kMaxHeadSize)
+                        return Result::ERROR;
+                    return Result::NEED_MORE;
+                }
+                data.remove_prefix(end_pos + 4 - prev_size);
+                head_.resize(end_pos + 4);
+                if (!parseHead())
+                    return Result::ERROR;
+                head_.clear();
+
+                if (is_head_ || status_ == 204 || status_ == 304 || (status_ >= 100 && status_ < 200))
+                    return finish();
+                if (is_chunked_)
+                    state_ = State::CHUNK_SIZE;
+                else if (body_left_ == 0)
+                    return finish();
+                else
+                    state_ = State::BODY;
+                break;
+            }
+            case State::BODY:
+            {
+                const auto len = std::min<uint64_t>(body_left_, data.size());
+                body_left_ -= len;
+                data.remove_prefix(len);
+                if (body_left_ == 0)
+                    return finish();
+                break;
+            }
+            case State::CHUNK_SIZE:
+            {
+                const auto prev_size = head_.size();
+                head_.append(data.substr(0, 64));
+                const auto crlf_pos = head_.find("\r\n");
+                if (crlf_pos == std::string::npos)
+                {
+                    data.remove_prefix(head_.size() - prev_size);
+                    if (head_.size() > 64)
+                        return Result::ERROR;
+                    break;
+                }
+                data.remove_prefix(crlf_pos + 2 - prev_size);
+                body_left_ = std::strtoull(head_.c_str(), nullptr, 16);
+                head_.clear();
+                state_ = body_left_ == 0 ? State::CHUNK_TRAILER : State::CHUNK_DATA;
+                break;
+            }
+            case State::CHUNK_DATA:
+            {
+                const auto len = std::min<uint64_t>(body_left_, data.size());
+                body_left_ -= len;
+                data.remove_prefix(len);
+                if (body_left_ == 0)
+                {
+                    body_left_ = 2; // CRLF after chunk data
+                    state_ = State::CHUNK_DATA_END;
+                }
+                break;
+            }
+            case State::CHUNK_DATA_END:
+            {
+                const auto len = std::min<uint64_t>(body_left_, data.size());
+                body_left_ -= len;
+                data.remove_prefix(len);
+                if (body_left_ == 0)
+                    state_ = State::CHUNK_SIZE;
+                break;
+            }
+            case State::CHUNK_TRAILER:
+            {
+                const auto prev_size = head_.size();
+                head_.append(data);
+                if (head_.compare(0, 2, "\r\n") == 0)
+                {
+                    data.remove_prefix(2 - prev_size);
+                    return finish();
+                }
+                const auto end_pos = head_.find("\r\n\r\n");
+                if (end_pos == std::string::npos)
+                {
+                    data = {};
+                    break;
+                }
+                data.remove_prefix(end_pos + 4 - prev_size);
+                return finish();
+            }
+            }
+        }
+        return Result::NEED_MORE;
+    }
+
+    [[nodiscard]] int status() const noexcept { return status_; }
+    [[nodiscard]] bool isClose() const noexcept { return is_close_; }
+
+private:
+    static constexpr std::size_t kMaxHeadSize = 64 * 1024;
+
+    enum class State
+    {
+        HEAD,
+        BODY,
+        CHUNK_SIZE,
+        CHUNK_DATA,
+        CHUNK_DATA_END,
+        CHUNK_TRAILER,
+    };
+
+    State state_{State::HEAD};
+    bool is_head_{false};
+    int status_{0};
+    uint64_t body_left_{0};
+    bool is_chunked_{false};
+    bool is_close_{false};
+    std::string head_;
+
+    Result finish()
+    {
+        head_.clear();
+        state_ = State::HEAD;
+        return Result::DONE;
+    }
+
+    bool parseHead()
+    {
+        // HTTP/1.x SP status
+        if (head_.size() < 12 || head_.compare(0, 5, "HTTP/") != 0)
+            return false;
+        status_ = std::atoi(head_.c_str() + 9);
+        if (head_.compare(0, 8, "HTTP/1.0") == 0)
+            is_close_ = true;
+
+        std::string_view rest(head_);
+        rest.remove_prefix(rest.find("\r\n") + 2);
+        while (!rest.empty())
+        {
+            const auto crlf_pos = rest.find("\r\n");
+            const auto line = rest.substr(0, crlf_pos);
+            rest.remove_prefix(crlf_pos + 2);
+            const auto colon_pos = line.find(':');
+            if (colon_pos == std::string_view::npos)
+                continue;
+            const auto name = trim(line.substr(0, colon_pos));
+            const auto value = trim(line.substr(colon_pos + 1));
+            if (iequals(name, "Content-Length"))
+                body_left_ = std::strtoull(std::string(value).c_str(), nullptr, 10);
+            else if (iequals(name, "Transfer-Encoding"))
+                is_chunked_ = iequals(value, "chunked");
+            else if (iequals(name, "Connection"))
+            {
+                if (iequals(value, "close"))
+                    is_close_ = true;
+                else if (iequals(value, "keep-alive"))
+                    is_close_ = false;
+            }
+        }
+        return true;
+    }
+};
+
+struct Stats
+{
+    LatencyHistogram latency; // nanoseconds
+    uint64_t requests{0};
+    uint64_t bytes{0};
+    uint64_t connects{0};
+    uint64_t connect_errors{0};
+    uint64_t read_errors{0};
+    uint64_t write_errors{0};
+    uint64_t parse_errors{0};
+    uint64_t peer_closed{0};
+    uint64_t dropped{0}; // open loop requests never sent before the end
+    std::array<uint64_t, 6> status_class{}; // index = status / 100
+    double latency_sum_ns{0};
+
+    void record(int64_t latency_ns)
+    {
+        latency.record(latency_ns);
+        latency_sum_ns += latency_ns;
+    }
+
+    void merge(const Stats &other)
+    {
+        latency.merge(other.latency);
+        requests += other.requests;
+        bytes += other.bytes;
+        connects += other.connects;
+        connect_errors += other.connect_errors;
+        read_errors += other.read_errors;
+        write_errors += other.write_errors;
+        parse_errors += other.parse_errors;
+        peer_closed += other.peer_closed;
+        dropped += other.dropped;
+        for (std::size_t i = 0; i < status_class.size(); i++)
+            status_class[i] += other.status_class[i];
+        latency_sum_ns += other.latency_sum_ns;
+    }
+};
+
+struct Connection
+{
+    int fd{-1};
+    bool is_connected{false};
+#ifdef WEBSERVER_WITH_OPENSSL
+    SSL *ssl{nullptr};
+    bool is_handshaking{false};
+#endif
+    std::string out;
+    std::size_t out_index{0};
+    std::deque<std::pair<int64_t, const ScenarioRequest *>> in_flight; // <start ns, request>
+    ResponseParser parser;
+    bool is_parsing{false};
+    bool has_pending_close{false};
+};
+
+class Worker
+{
+public:
+    Worker(const Options &opts, const Scenario &scenario, int connection_count, double rate, unsigned seed)
+        : opts_(opts), scenario_(scenario), connections_(connection_count), rate_(rate), rng_(seed)
+    {
+    }
+
+    void run(int64_t start_ns, int64_t measure_start_ns, int64_t end_ns);
+    Stats &stats() noexcept { return stats_; }
+
+private:
+    static constexpr std::size_t kReadBufferSize = 64 * 1024;
+
+    const Options &opts_;
+    const Scenario &scenario_;
+    std::vector<Connection> connections_;
+    double rate_;
+    std::mt19937 rng_;
+    int epfd_{-1};
+    int64_t measure_start_ns_{0};
+    Stats stats_;
+    std::deque<int64_t> backlog_; // open loop: scheduled but not yet sent
+    std::array<char, kReadBufferSize> read_buffer_;
+#ifdef WEBSERVER_WITH_OPENSSL
+    SSL_CTX *ssl_ctx_{nullptr};
+#endif
+
+    const ScenarioRequest &pickRequest()
+    {
+        const auto &index = scenario_.weighted_index;
+        return scenario_.requests[index[rng_() % index.size()]];
+    }
+
+    bool openConnection(Connection &conn);
+    void closeConnection(Connection &conn);
+    // TCP is up, starts TLS when -S; false on error
+    bool startConnection(Connection &conn, int64_t now_ns);
+    // ::send/::recv or their TLS counterparts, same return conventions
+    long sendSome(Connection &conn, const char *data, std::size_t len);
+    long recvSome(Connection &conn, char *buf, std::size_t len);
+    void enqueueRequest(Connection &conn, int64_t start_ns);
+    bool flush(Connection &conn);
+    bool readResponses(Connection &conn, int64_t now_ns);
+    void updateEvents(Connection &conn);
+    void fill(Connection &conn, int64_t now_ns);
+};
+
+bool Worker::openConnection(Connection &conn)
+{
+    conn = Connection{};
+    const bool is_unix = !opts_.unix_path.empty();
+    conn.fd = ::socket(is_unix ? AF_UNIX : AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (conn.fd == -1)
+    {
+        stats_.connect_errors++;
+        return false;
+    }
+
+    sockaddr_storage addr{};
+    socklen_t addr_len;
+    if (is_unix)
+    {
+        auto &un = reinterpret_cast<sockaddr_un &>(addr);
+        un.sun_family = AF_UNIX;
+        opts_.unix_path.copy(un.sun_path, sizeof(un.sun_path) - 1);
+        addr_len = offsetof(sockaddr_un, sun_path) + opts_.unix_path.size();
+        // abstract names start with a NUL and are not NUL terminated
+        if (un.sun_path[0] == '@')
+            un.sun_path[0] = '\0';
+        else
+            addr_len++;
+    }
+    else
+    {
+        const int one = 1;
+        setsockopt(conn.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        auto &in = reinterpret_cast<sockaddr_in &>(addr);
+        in.sin_family = AF_INET;
+        in.sin_port = htons(opts_.port);
+        in.sin_addr.s_addr = inet_addr(opts_.host.c_str());
+        addr_len = sizeof(in);
+    }
+    // a Unix socket with a full backlog answers EAGAIN rather than EINPROGRESS
+    if (::connect(conn.fd, reinterpret_cast<sockaddr *>(&addr), addr_len) == -1 && errno != EINPROGRESS)
+    {
+        stats_.connect_errors++;
+        ::close(conn.fd);
+        conn.fd = -1;
+        return false;
+    }
+    stats_.connects++;
+
+    epoll_event event{};
+    event.events = EPOLLOUT;
+    event.data.ptr = &conn;
+    epoll_ctl(epfd_, EPOLL_CTL_ADD, conn.fd, &event);
+    return true;
+}
+
+void Worker::closeConnection(Connection &conn)
+{
+#ifdef WEBSERVER_WITH_OPENSSL
+    SSL_free(conn.ssl);
+    conn.ssl = nullptr;
+    conn.is_handshaking = false;
+#endif
+    if (conn.fd != -1)
+    {
+        epoll_ctl(epfd_, EPOLL_CTL_DEL, conn.fd, nullptr);
+        ::close(conn.fd);
+    }
+    conn.fd = -1;
+    conn.is_connected = false;
+}
+
+bool Worker::startConnection(Connection &conn, int64_t now_ns)
+{
+#ifdef WEBSERVER_WITH_OPENSSL
+    if (opts_.is_tls)
+    {
+        if (conn.ssl == nullptr)
+        {
+            conn.ssl = SSL_new(ssl_ctx_);
+            if (conn.ssl == nullptr || SSL_set_fd(conn.ssl, conn.fd) != 1)
+                return false;
+            SSL_set_connect_state(conn.ssl);
+            conn.is_handshaking = true;
+        }
+        const int retval = SSL_do_handshake(conn.ssl);
+        if (retval != 1)
+        {
+            const int err = SSL_get_error(conn.ssl, retval);
+            return err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE;
+        }
+        conn.is_handshaking = false;
+    }
+#endif
+    conn.is_connected = true;
+    fill(conn, now_ns);
+    return true;
+}
+
+long Worker::sendSome(Connection &conn, const char *data, std::size_t len)
+{
+#ifdef WEBSERVER_WITH_OPENSSL
+    if (conn.ssl)
+    {
+        const int retval = SSL_write(conn.ssl, data, len);
+        if (retval > 0)
+            return retval;
+        const int err = SSL_get_error(conn.ssl, retval);
+        errno = err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE ? EAGAIN : EPIPE;
+        return -1;
+    }
+#endif
+    return ::send(conn.fd, data, len, MSG_NOSIGNAL);
+}
+
+long Worker::recvSome(Connection &conn, char *buf, std::size_t len)
+{
+#ifdef WEBSERVER_WITH_OPENSSL
+    if (conn.ssl)
+    {
+        const int retval = SSL_read(conn.ssl, buf, len);
+        if (retval > 0)
+            return retval;
+        const int err = SSL_get_error(conn.ssl, retval);
+        if (err == SSL_ERROR_ZERO_RETURN || (err == SSL_ERROR_SYSCALL && errno == 0))
+            return 0;
+        errno = err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE ? EAGAIN : ECONNRESET;
+        return -1;
+    }
+#endif
+    return ::recv(conn.fd, buf, len, 0);
+}
+
+void Worker::enqueueRequest(Connection &conn, int64_t start_ns)
+{
+    const auto &req = pickRequest();
+    conn.out.append(req.raw);
+    if (!opts_.keep_alive)
+        conn.out.append("Connection: close\r\n\r\n");
+    else
+        conn.out.append(opts_.is_connection_sent ? "Connection: keep-alive\r\n\r\n" : "\r\n");
+    conn.in_flight.emplace_back(start_ns, &req);
+}
+
+bool Worker::flush(Connection &conn)
+{
+    while (conn.out_index < conn.out.size())
+    {
+        const auto retval = sendSome(conn, conn.out.data() + conn.out_index, conn.out.size() - conn.out_index);
+        if (retval == -1)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return true;
+            stats_.write_errors++;
+            return false;
+        }
+        conn.out_index += retval;
+    }
+    conn.out.clear();
+    conn.out_index = 0;
+    return true;
+}
+
+bool Worker::readResponses(Connection &conn, int64_t now_ns)
+{
+    while (true)
+    {
+        errno = 0;
+        const auto retval = recvSome(conn, read_buffer_.data(), read_buffer_.size());
+        if (retval == 0)
+        {
+            if (!conn.in_flight.empty())
+                stats_.peer_closed++;
+            return false;
+        }
+        if (retval == -1)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return true;
+            stats_.read_errors++;
+            return false;
+        }
+
+        if (now_ns >= measure_start_ns_)
+            stats_.bytes += retval;
+
+        std::string_view data(read_buffer_.data(), retval);
+        while (!data.empty())
+        {
+            if (conn.in_flight.empty())
+            {
+                stats_.parse_errors++;
+                return false;
+            }
+            if (!conn.is_parsing)
+            {
+                conn.parser.reset(conn.in_flight.front().second->is_head);
+                conn.is_parsing = true;
+            }
+
+            const auto res = conn.parser.feed(data);
+            if (res == ResponseParser::Result::ERROR)
+            {
+                stats_.parse_errors++;
+                return false;
+            }
+            if (res == ResponseParser::Result::NEED_MORE)
+                break;
+
+            conn.is_parsing = false;
+            const auto [start_ns, req] = conn.in_flight.front();
+            conn.in_flight.pop_front();
+            if (start_ns >= measure_start_ns_)
+            {
+                stats_.requests++;
+                stats_.status_class[std::min(conn.parser.status() / 100, 5)]++;
+                const int64_t latency = now_ns - start_ns;
+                stats_.record(latency);
+
+                // back-fill the samples a stalled closed loop never issued
+                if (opts_.mode == LoopMode::CLOSED && opts_.expected_interval_us > 0)
+                {
+                    const int64_t interval = opts_.expected_interval_us * 1000;
+                    for (int64_t missing = latency - interval; missing >= interval; missing -= interval)
+                        stats_.latency.record(missing);
+                }
+            }
+
+            if (conn.parser.isClose() || !opts_.keep_alive)
+            {
+                conn.has_pending_close = true;
+                return false;
+            }
+        }
+    }
+}
+
+void Worker::updateEvents(Connection &conn)
+{
+    epoll_event event{};
+    event.events = conn.out.empty() ? EPOLLIN : (EPOLLIN | EPOLLOUT);
+#ifdef WEBSERVER_WITH_OPENSSL
+    if (conn.is_handshaking)
+        event.events = SSL_want_write(conn.ssl) ? EPOLLOUT : EPOLLIN;
+#endif
+    event.data.ptr = &conn;
+    epoll_ctl(epfd_, EPOLL_CTL_MOD, conn.fd, &event);
+}
+
+void Worker::fill(Connection &conn, int64_t now_ns)
+{
+    if (!conn.is_connected)
+        return;
+
+    if (opts_.mode == LoopMode::CLOSED)
+    {
+        while (static_cast<int>(conn.in_flight.size()) < opts_.pipeline)
+            enqueueRequest(conn, now_ns);
+    }
+    else
+    {
+        while (!backlog_.empty() && static_cast<int>(conn.in_flight.size()) < opts_.pipeline)
+        {
+            enqueueRequest(conn, backlog_.front());
+            backlog_.pop_front();
+        }
+    }
+}
+
+void Worker::run(int64_t start_ns, int64_t measure_start_ns, int64_t end_ns)
+{
+    measure_start_ns_ = measure_start_ns;
+#ifdef WEBSERVER_WITH_OPENSSL
+    if (opts_.is_tls)
+    {
+        ssl_ctx_ = SSL_CTX_new(TLS_client_method());
+        SSL_CTX_set_mode(ssl_ctx_, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+    }
+#endif
+    epfd_ = epoll_create1(0);
+    for (auto &conn : connections_)
+        openConnection(conn);
+
+    const int64_t interval_ns = rate_ > 0 ? static_cast<int64_t>(1e9 / rate_) : 0;
+    int64_t next_schedule_ns = start_ns;
+
+    std::vector<epoll_event> events(connections_.size() + 1);
+    int64_t now_ns = nowNs();
+    while (now_ns < end_ns)
+    {
+        if (opts_.mode == LoopMode::OPEN)
+        {
+            for (; next_schedule_ns <= now_ns; next_schedule_ns += interval_ns)
+                backlog_.push_back(next_schedule_ns);
+            for (auto &conn : connections_)
+                if (conn.is_connected && !backlog_.empty() && conn.in_flight.size() < static_cast<std::size_t>(opts_.pipeline))
+                {
+                    fill(conn, now_ns);
+                    if (!flush(conn))
+                        closeConnection(conn);
+                    else
+                        updateEvents(conn);
+                }
+        }
+
+        int timeout_ms = std::max<int64_t>(0, (end_ns - now_ns) / 1'000'000);
+        if (opts_.mode == LoopMode::OPEN)
+            timeout_ms = std::min<int64_t>(timeout_ms, std::max<int64_t>(0, (next_schedule_ns - now_ns) / 1'000'000));
+
+        const int event_count = epoll_wait(epfd_, events.data(), events.size(), timeout_ms);
+        now_ns = nowNs();
+        if (event_count == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        for (int i = 0; i < event_count; i++)
+        {
+            auto &conn = *static_cast<Connection *>(events[i].data.ptr);
+            if (conn.fd == -1)
+                continue;
+
+            bool is_ok = true;
+            if (!conn.is_connected)
+            {
+                int err = 0;
+                socklen_t len = sizeof(err);
+                getsockopt(conn.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+                if (err != 0 || !startConnection(conn, now_ns))
+                {
+                    stats_.connect_errors++;
+                    is_ok = false;
+                }
+                else if (!conn.is_connected)
+                {
+                    updateEvents(conn); // TLS handshake in progress
+                    continue;
+                }
+            }
+
+            if (is_ok && events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+                is_ok = readResponses(conn, now_ns);
+            if (is_ok)
+            {
+                fill(conn, now_ns);
+                is_ok = flush(conn);
+            }
+
+            if (is_ok)
+                updateEvents(conn);
+            else
+            {
+                // requests lost with the connection are rescheduled in open loop
+                if (opts_.mode == LoopMode::OPEN)
+                    for (auto iter = conn.in_flight.rbegin(); iter != conn.in_flight.rend(); ++iter)
+                        backlog_.push_front(iter->first);
+                closeConnection(conn);
+                if (now_ns < end_ns)
+                    openConnection(conn);
+            }
+        }
+    }
+
+    for (const auto scheduled_ns : backlog_)
+        if (scheduled_ns >= measure_start_ns_)
+            stats_.dropped++;
+    for (auto &conn : connections_)
+        closeConnection(conn);
+    ::close(epfd_);
+#ifdef WEBSERVER_WITH_OPENSSL
+    SSL_CTX_free(ssl_ctx_);
+#endif
+}
+
+void printUsage(const char *prog)
+{
+    std::cerr << "Usage: " << prog << " -s scenario [options]\n"
+              << "  -s FILE     scenario file\n"
+              << "  -H HOST     server ipv4 address (default 127.0.0.1)\n"
+              << "  -p PORT     server port (default 12345)\n"
+              << "  -u PATH     connect to the Unix socket at PATH (@NAME: abstract) instead, HOST is only the Host header\n"
+              << "  -t N        threads (default 1)\n"
+              << "  -c N        connections over all threads (default 16)\n"
+              << "  -d SEC      measured duration (default 10)\n"
+              << "  -w SEC      warmup before measuring (default 1)\n"
+              << "  -R RATE     open loop with RATE requests/s over all threads\n"
+              << "  -P N        pipelined requests per connection (default 1)\n"
+              << "  -C          close the connection after every response\n"
+              << "  -N          no Connection header, connections persist as long as the server keeps them\n"
+              << "  -S          HTTPS, needs a build with WITH_OPENSSL=1\n"
+              << "  -i USEC     closed loop expected interval for coordinated omission correction\n"
+              << "  -n NAME     run name written to the result\n"
+              << "  -o FILE     write JSON result to FILE instead of stdout\n";
+}
+
+bool parseOptions(int argc, char *argv[], Options &opts)
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "s:H:p:u:t:c:d:w:R:P:CNSi:n:o:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 's':
+            opts.scenario_path = optarg;
+            break;
+        case 'H':
+            opts.host = optarg;
+            break;
+        case 'p':
+            opts.port = std::atoi(optarg);
+            break;
+        case 'u':
+            opts.unix_path = optarg;
+            break;
+        case 't':
+            opts.threads = std::max(1, std::atoi(optarg));
+            break;
+        case 'c':
+            opts.connections = std::max(1, std::atoi(optarg));
+            break;
+        case 'd':
+            opts.duration_s = std::atof(optarg);
+            break;
+        case 'w':
+            opts.warmup_s = std::atof(optarg);
+            break;
+        case 'R':
+            opts.mode = LoopMode::OPEN;
+            opts.rate = std::atof(optarg);
+            break;
+        case 'P':
+            opts.pipeline = std::max(1, std::atoi(optarg));
+            break;
+        case 'C':
+            opts.keep_alive = false;
+            break;
+        case 'N':
+            opts.is_connection_sent = false;
+            break;
+        case 'S':
+#ifdef WEBSERVER_WITH_OPENSSL
+            opts.is_tls = true;
+            break;
+#else
+            std::cerr << "built without OpenSSL\n";
+            return false;
+#endif
+        case 'i':
+            opts.expected_interval_us = std::atol(optarg);
+            break;
+        case 'n':
+            opts.name = optarg;
+            break;
+        case 'o':
+            opts.output_path = optarg;
+            break;
+        default:
+            return false;
+        }
+    }
+    if (opts.mode == LoopMode::OPEN && opts.rate <= 0)
+        return false;
+    if (opts.unix_path.size() >= sizeof(sockaddr_un::sun_path))
+        return false;
+    opts.connections = std::max(opts.connections, opts.threads);
+    if (!opts.keep_alive)
+        opts.pipeline = 1;
+    return !opts.scenario_path.empty();
+}
+
+std::string toJson(const Options &opts, const Scenario &scenario, const Stats &stats, double elapsed_s)
+{
+    const auto us = [](uint64_t ns)
+    { return ns / 1000.0; };
+
+    std::ostringstream out;
+    out.setf(std::ios::fixed);
+    out.precision(3);
+    out << "{\n"
+        << "  \"name\": \"" << opts.name << "\",\n"
+        << "  \"scenario\": \"" << scenario.name << "\",\n"
+        << "  \"mode\": \"" << (opts.mode == LoopMode::OPEN ? "open" : "closed") << "\",\n"
+        << "  \"threads\": " << opts.threads << ",\n"
+        << "  \"connections\": " << opts.connections << ",\n"
+        << "  \"keep_alive\": " << (opts.keep_alive ? "true" : "false") << ",\n"
+        << "  \"connection_header\": " << (opts.keep_alive && opts.is_connection_sent ? "true" : "false") << ",\n"
+        << "  \"transport\": \"" << (opts.unix_path.empty() ? "tcp" : "unix") << "\",\n"
+        << "  \"tls\": " << (opts.is_tls ? "true" : "false") << ",\n"
+        << "  \"pipeline\": " << opts.pipeline << ",\n"
+        << "  \"target_rate\": " << (opts.mode == LoopMode::OPEN ? opts.rate : 0.0) << ",\n"
+        << "  \"duration_s\": " << elapsed_s << ",\n"
+        << "  \"requests\": " << stats.requests << ",\n"
+        << "  \"requests_per_s\": " << stats.requests / elapsed_s << ",\n"
+        << "  \"bytes\": " << stats.bytes << ",\n"
+        << "  \"mbytes_per_s\": " << stats.bytes / elapsed_s / (1024.0 * 1024.0) << ",\n"
+        << "  \"connects\": " << stats.connects << ",\n"
+        << "  \"requests_per_connection\": " << (stats.connects ? static_cast<double>(stats.requests) / stats.connects : 0.0) << ",\n"
+        << "  \"status\": {\"1xx\": " << stats.status_class[1] << ", \"2xx\": " << stats.status_class[2]
+        << ", \"3xx\": " << stats.status_class[3] << ", \"4xx\": " << stats.status_class[4]
+        << ", \"5xx\": " << stats.status_class[5] << "},\n"
+        << "  \"errors\": {\"connect\": " << stats.connect_errors << ", \"read\": " << stats.read_errors
+        << ", \"write\": " << stats.write_errors << ", \"parse\": " << stats.parse_errors
+        << ", \"peer_closed\": " << stats.peer_closed << ", \"dropped\": " << stats.dropped << "},\n"
+        << "  \"latency_us\": {\"mean\": " << (stats.requests ? us(stats.latency_sum_ns / stats.requests) : 0.0)
+        << ", \"p50\": " << us(stats.latency.percentile(50.0))
+        << ", \"p90\": " << us(stats.latency.percentile(90.0))
+        << ", \"p99\": " << us(stats.latency.percentile(99.0))
+        << ", \"p999\": " << us(stats.latency.percentile(99.9))
+        << ", \"max\": " << us(stats.latency.max()) << "}\n"
+        << "}\n";
+    return out.str();
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    Options opts;
+    if (!parseOptions(argc, argv, opts))
+    {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    Scenario scenario;
+    if (!loadScenario(opts.scenario_path, opts, scenario))
+        return 1;
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    for (int i = 0; i < opts.threads; i++)
+    {
+        const int connection_count = opts.connections / opts.threads + (i < opts.connections % opts.threads);
+        workers.push_back(std::make_unique<Worker>(opts, scenario, connection_count, opts.rate / opts.threads, 1234u + i));
+    }
+
+    const int64_t start_ns = nowNs();
+    const int64_t measure_start_ns = start_ns + static_cast<int64_t>(opts.warmup_s * 1e9);
+    const int64_t end_ns = measure_start_ns + static_cast<int64_t>(opts.duration_s * 1e9);
+
+    std::vector<std::thread> threads;
+    for (auto &worker : workers)
+        threads.emplace_back([&worker, start_ns, measure_start_ns, end_ns]()
+                             { worker->run(start_ns, measure_start_ns, end_ns); });
+    for (auto &thread : threads)
+        thread.join();
+
+    Stats total;
+    for (auto &worker : workers)
+        total.merge(worker->stats());
+
+    const auto json = toJson(opts, scenario, total, (end_ns - measure_start_ns) / 1e9);
+    if (opts.output_path.empty())
+        std::cout << json;
+    else
+    {
+        std::ofstream out(opts.output_path);
+        out << json;
+    }
+    return 0;
+}
@@ -0,0 +1,651 @@
+// Microbenchmarks of the hot server components.
+//
+// Every benchmark reports ns/op, heap allocations/op and, when
+// perf_event_open is permitted, instructions/op and cache misses/op.
+//
+// usage: microbench.out [name filter]
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <cinttypes>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "../src/HttpParser.h"
+#include "../src/HttpResponseBuilder.h"
+#include "../src/TimerQueue.h"
+#include "../src/Logger.h"
+#include "../src/Mime.h"
+#include "../src/CachePolicy.h"
+#include "../src/Hpack.h"
+#include "../src/RateLimiter.h"
+#include "../src/ChunkedDecoder.h"
+#include "../src/Router.h"
+#include "../src/util/Queue.h"
+#include "../src/util/utils.h"
+
+static std::atomic<uint64_t> g_allocations{0};
+
+void *operator new(std::size_t size)
+{
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *ptr = std::malloc(size ? size : 1))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+void operator delete(void *ptr, std::size_t) noexcept { std::free(ptr); }
+
+namespace
+{
+
+int64_t nowNs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1'000'000'000ll + ts.tv_nsec;
+}
+
+// Counts one hardware event of this process, including threads created later.
+class PerfCounter
+{
+public:
+    PerfCounter(uint32_t type, uint64_t config)
+    {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.inherit = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd_ = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+    ~PerfCounter()
+    {
+        if (fd_ != -1)
+            close(fd_);
+    }
+
+    [[nodiscard]] bool valid() const noexcept { return fd_ != -1; }
+    void start()
+    {
+        if (valid())
+        {
+            ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+    uint64_t stop()
+    {
+        uint64_t value = 0;
+        if (valid())
+        {
+            ioctl(fd_, PERF_EVENT_IOC_DISABLE, 0);
+            if (read(fd_, &value, sizeof(value)) != sizeof(value))
+                value = 0;
+        }
+        return value;
+    }
+
+private:
+    int fd_{-1};
+};
+
+struct Result
+{
+    uint64_t ops{0};
+    int64_t ns{0};
+    uint64_t allocations{0};
+    uint64_t instructions{0};
+    uint64_t cache_misses{0};
+};
+
+// Measures the part of a benchmark body between start() and stop(), so
+// setup and teardown are excluded.
+class Stopwatch
+{
+public:
+    void start();
+    void stop();
+    [[nodiscard]] const Result &result() const noexcept { return res_; }
+
+private:
+    bool is_running_{false};
+    int64_t start_ns_{0};
+    uint64_t start_allocations_{0};
+    Result res_;
+};
+
+// A benchmark body runs `ops` operations after calling Stopwatch::start()
+// and returns the number it really ran. Stopwatch::stop() is optional when
+// nothing expensive is destroyed at return.
+using BenchFn = std::function<uint64_t(uint64_t ops, Stopwatch &)>;
+
+struct Benchmark
+{
+    std::string name;
+    BenchFn fn;
+    uint64_t max_ops;
+};
+
+PerfCounter &instructionCounter()
+{
+    static PerfCounter counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    return counter;
+}
+
+PerfCounter &cacheMissCounter()
+{
+    static PerfCounter counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    return counter;
+}
+
+void Stopwatch::start()
+{
+    is_running_ = true;
+    start_allocations_ = g_allocations.load(std::memory_order_relaxed);
+    instructionCounter().start();
+    cacheMissCounter().start();
+    start_ns_ = nowNs();
+}
+
+void Stopwatch::stop()
+{
+    if (!is_running_)
+        return;
+    is_running_ = false;
+    res_.ns = nowNs() - start_ns_;
+    res_.cache_misses = cacheMissCounter().stop();
+    res_.instructions = instructionCounter().stop();
+    res_.allocations = g_allocations.load(std::memory_order_relaxed) - start_allocations_;
+}
+
+Result measure(const BenchFn &fn, uint64_t ops)
+{
+    Stopwatch stopwatch;
+    const uint64_t done = fn(ops, stopwatch);
+    stopwatch.stop();
+
+    Result res = stopwatch.result();
+    res.ops = done;
+    return res;
+}
+
+void run(const Benchmark &bench)
+{
+    static constexpr int64_t kTargetNs = 200'000'000;
+
+    // grow the op count until one run takes kTargetNs
+    uint64_t ops = 1;
+    Result res = measure(bench.fn, ops);
+    while (res.ns < kTargetNs && ops < bench.max_ops)
+    {
+        const uint64_t scale = res.ns > 0 ? std::clamp<uint64_t>(kTargetNs / res.ns, 2, 100) : 100;
+        ops = std::min(ops * scale, bench.max_ops);
+        res = measure(bench.fn, ops);
+    }
+
+    const double n = std::max<uint64_t>(res.ops, 1);
+    std::cout << std::left << std::setw(44) << bench.name << std::right << std::fixed
+              << std::setprecision(1) << std::setw(12) << res.ns / n
+              << std::setprecision(2) << std::setw(12) << res.allocations / n;
+    if (res.instructions)
+        std::cout << std::setprecision(0) << std::setw(14) << res.instructions / n
+                  << std::setprecision(3) << std::setw(14) << res.cache_misses / n;
+    else
+        std::cout << std::setw(14) << "-" << std::setw(14) << "-";
+    std::cout << std::setw(12) << res.ops << "\n";
+}
+
+// request headers captured from common clients
+const std::vector<std::string> kRequestCorpus = {
+    "GET / HTTP/1.1\r\n"
+    "Host: localhost:12345\r\n"
+    "User-Agent: curl/7.88.1\r\n"
+    "Accept: */*\r\n"
+    "\r\n",
+
+    "GET /index.html HTTP/1.1\r\n"
+    "Host: localhost:12345\r\n"
+    "Connection: keep-alive\r\n"
+    "sec-ch-ua: \"Chromium\";v=\"118\", \"Google Chrome\";v=\"118\", \"Not=A?Brand\";v=\"99\"\r\n"
+    "sec-ch-ua-mobile: ?0\r\n"
+    "sec-ch-ua-platform: \"Linux\"\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/118.0.0.0 Safari/537.36\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,image/apng,*/*;q=0.8,application/signed-exchange;v=b3;q=0.7\r\n"
+    "Sec-Fetch-Site: none\r\n"
+    "Sec-Fetch-Mode: navigate\r\n"
+    "Sec-Fetch-User: ?1\r\n"
+    "Sec-Fetch-Dest: document\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Accept-Language: en-US,en;q=0.9\r\n"
+    "\r\n",
+
+    "GET /login.gif HTTP/1.1\r\n"
+    "Host: localhost:12345\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:109.0) Gecko/20100101 Firefox/118.0\r\n"
+    "Accept: image/avif,image/webp,*/*\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Connection: keep-alive\r\n"
+    "Referer: http://localhost:12345/picture.html\r\n"
+    "Sec-Fetch-Dest: image\r\n"
+    "Sec-Fetch-Mode: no-cors\r\n"
+    "Sec-Fetch-Site: same-origin\r\n"
+    "If-Modified-Since: Sun, 02 Apr 2023 08:00:00 GMT\r\n"
+    "\r\n",
+
+    "GET /picture.html?from=index HTTP/1.0\r\n"
+    "Host: 127.0.0.1\r\n"
+    "User-Agent: ApacheBench/2.3\r\n"
+    "Accept: */*\r\n"
+    "\r\n",
+};
+
+std::vector<Benchmark> parserBenchmarks()
+{
+    std::vector<Benchmark> res;
+    res.push_back({"HttpParser::parse/corpus", [](uint64_t ops, Stopwatch &stopwatch)
+                   {
+                       HttpParser parser;
+                       uint64_t sink = 0;
+                       stopwatch.start();
+                       for (uint64_t i = 0; i < ops; i++)
+                           sink += parser.parse(kRequestCorpus[i % kRequestCorpus.size()]);
+                       if (sink == 0)
+                           std::abort();
+                       return ops;
+                   },
+                   10'000'000});
+    res.push_back({"HttpParser::isKeepAlive+getContentLength", [](uint64_t ops, Stopwatch &stopwatch)
+                   {
+                       HttpParser parser;
+                       if (!parser.parse(kRequestCorpus[1]))
+                           std::abort();
+                       uint64_t sink = 0;
+                       stopwatch.start();
+                       for (uint64_t i = 0; i < ops; i++)
+                           sink += parser.isKeepAlive() + parser.getContentLength();
+                       return ops + (sink & 0);
+                   },
+                   100'000'000});
+    return res;
+}
+
+std::vector<Benchmark> builderBenchmarks()
+{
+    std::vector<Benchmark> res;
+    res.push_back({"HttpResponseBuilder::buildOnce/200", [](uint64_t ops, Stopwatch &stopwatch)
+                   {
+                       HttpResponseBuilder builder;
+                       std::size_t sink = 0;
+                       stopwatch.start();
+                       for (uint64_t i = 0; i < ops; i++)
+                           sink += builder.addHeader("Content-Length", lexicalCast(346833))
+                                       .addHeader("Content-Type", "image/gif")
+                                       .addHeader("Connection", "keep-alive")
+                                       .buildOnce()
+                                       .size();
+                       return ops + (sink & 0);
+                   },
+                   10'000'000});
+    res.push_back({"HttpResponseBuilder::buildOnce/404", [](uint64_t ops, Stopwatch &stopwatch)
+                   {
+                       HttpResponseBuilder builder;
+                       std::size_t sink = 0;
+                       stopwatch.start();
+                       for (uint64_t i = 0; i < ops; i++)
+                       {
+                           builder.setStatusCode(HttpStatusCode::NOT_FOUND).setDefaultErrorPage(HttpStatusCode::NOT_FOUND);
+                           sink += builder.addHeader("Content-Length", lexicalCast(builder.bodySize()))
+                                       .addHeader("Content-Type", "text/html")
+                                       .buildOnce()
+                                       .size();
+                       }
+                       return ops + (sink & 0);
+                   },
+                   10'000'000});
+    return res;
+}
+
+std::vector<Benchmark> timerBenchmarks()
+{
+    std::vector<Benchmark> res;
+    for (const int size : {10'000, 100'000, 1'000'000})
+    {
+        const auto prefill = [size](TimerQueue &timers, std::vector<TimerQueue::TimerId> &ids)
+        {
+            std::mt19937 rng(size);
+            ids.reserve(size);
+            for (int i = 0; i < size; i++)
+                ids.push_back(timers.addTimer([]() {}, 60'000 + rng() % 60'000));
+        };
+
+        res.push_back({"TimerQueue::addTimer+removeTimer/" + std::to_string(size), [prefill](uint64_t ops, Stopwatch &stopwatch)
+                       {
+                           TimerQueue timers;
+                           std::vector<TimerQueue::TimerId> ids;
+                           prefill(timers, ids);
+                           stopwatch.start();
+                           for (uint64_t i = 0; i < ops; i++)
+                               timers.removeTimer(timers.addTimer([]() {}, 5000 + i % 1000));
+                           stopwatch.stop();
+                           return ops;
+                       },
+                       2'000'000});
+        res.push_back({"TimerQueue::resetTimer/" + std::to_string(size), [prefill](uint64_t ops, Stopwatch &stopwatch)
+                       {
+                           TimerQueue timers;
+                           std::vector<TimerQueue::TimerId> ids;
+                           prefill(timers, ids);
+                           stopwatch.start();
+                           for (uint64_t i = 0; i < ops; i++)
+                               timers.resetTimer(ids[(i * 7919) % ids.size()], 5000 + i % 1000);
+                           stopwatch.stop();
+                           return ops;
+                       },
+                       2'000'000});
+        res.push_back({"TimerQueue::tick(none expired)/" + std::to_string(size), [prefill](uint64_t ops, Stopwatch &stopwatch)
+                       {
+                           TimerQueue timers;
+                           std::vector<TimerQueue::TimerId> ids;
+                           prefill(timers, ids);
+                           stopwatch.start();
+                           long sink = 0;
+                           for (uint64_t i = 0; i < ops; i++)
+                               sink += timers.tick();
+                           stopwatch.stop();
+                           return ops + (sink & 0);
+                       },
+                       10'000'000});
+        res.push_back({"TimerQueue::addTimer+tick(expired)/" + std::to_string(size), [size](uint64_t ops, Stopwatch &stopwatch)
+                       {
+                           uint64_t fired = 0;
+                           stopwatch.start();
+                           for (uint64_t round = 0; fired < ops; round++)
+                           {
+                               TimerQueue timers;
+                               for (int i = 0; i < size; i++)
+                                   timers.addTimer([&fired]()
+                                                   { fired++; },
+                                                   0);
+                               timers.tick();
+                           }
+                           return fired;
+                       },
+                       static_cast<uint64_t>(size)});
+    }
+    return res;
+}
+
+std::vector<Benchmark> queueBenchmarks()
+{
+    std::vector<Benchmark> res;
+    for (const int thread_num : {1, 2, 4, 8, 16, 32})
+    {
+        // thread_num producers and thread_num consumers
+        res.push_back({"Queue<int>::enqueue+dequeue/threads:" + std::to_string(thread_num), [thread_num](uint64_t ops, Stopwatch &stopwatch)
+                       {
+                           Queue<int> queue;
+                           const uint64_t per_thread = std::max<uint64_t>(ops / thread_num, 1);
+                           std::vector<std::thread> threads;
+                           stopwatch.start();
+                           for (int i = 0; i < thread_num; i++)
+                           {
+                               threads.emplace_back([&queue, per_thread]()
+                                                    {
+                                                        for (uint64_t j = 0; j < per_thread; j++)
+                                                            queue.enqueue(static_cast<int>(j));
+                                                    });
+                               threads.emplace_back([&queue, per_thread]()
+                                                    {
+                                                        for (uint64_t j = 0; j < per_thread; j++)
+                                                            if (!queue.dequeue().has_value())
+                                                                return;
+                                                    });
+                           }
+                           for (auto &thread : threads)
+                               thread.join();
+                           return per_thread * thread_num;
+                       },
+                       20'000'000});
+    }
+    return res;
+}
+
+std::vector<Benchmark> miscBenchmarks()
+{
+    std::vector<Benchmark> res;
+    res.push_back({"getMime/known", [](uint64_t ops, Stopwatch &stopwatch)
+                   {
+                       static constexpr std::string_view kExts[] = {"html", "gif", "jpg", "ico", "css", "js", "png", "json"};
+                       std::size_t sink = 0;
+                       stopwatch.start();
+                       for (uint64_t i = 0; i < ops; i++)
+                           sink += getMime(kExts[i % std::size(kExts)]).size();
+                       return ops + (sink & 0);
+                   },
+                   100'000'000});
+    res.push_back({"getMime/unknown", [](uint64_t ops, Stopwatch &stopwatch)
+                   {
+                       std::size_t sink = 0;
+                       stopwatch.start();
+                       for (uint64_t i = 0; i < ops; i++)
+                           sink += getMime("unknownext").size();
+                       return ops + (sink & 0);
+                   },
+                   1'000'000});
+    res.push_back({"lexicalCast<long>", [](uint64_t ops, Stopwatch &stopwatch)
+                   {
+                       std::size_t sink = 0;
+                       stopwatch.start();
+                       for (uint64_t i = 0; i < ops; i++)
+                           sink += lexicalCast(static_cast<long>(i * 2654435761u)).size();
+                       return ops + (sink & 0);
+                   },
+                   100'000'000});
+    res.push_back({"CachePolicy::lookup", [](uint64_t ops, Stopwatch &stopwatch)
+                   {
+                       static constexpr std::pair<std::string_view, std::string_view> kRequests[] = {
+                           {"/index.html", "text/html"}, {"/login.gif", "image/gif"}, {"/static/js/app.js", "text/javascript"},
+                           {"/favicon.ico", "image/vnd.microsoft.icon"}, {"/docs/a/b/c.pdf", "application/pdf"}};
+                       auto &policy = CachePolicy::instance();
+                       policy.clear();
+                       policy.addRule("path:/static/", "public, max-age=86400");
+                       policy.addRule("path:/docs/", "no-cache");
+                       policy.addRule("glob:/favicon.ico", "public, max-age=86400");
+                       policy.addRule("glob:*.map", "no-store");
+                       policy.addRule("mime:image/*", "public, max-age=604800");
+                       policy.addRule("mime:text/html", "max-age=60");
+                       policy.addRule("mime:*/*", "no-cache");
+                       std::size_t sink = 0;
+                       stopwatch.start();
+                       for (uint64_t i = 0; i < ops; i++)
+                       {
+                           const auto &[url, mime] = kRequests[i % std::size(kRequests)];
+                           sink += policy.lookup(url, mime)->max_age;
+                       }
+                       return ops + (sink & 0);
+                   },
+                   10'000'000});
+    // 1k clients that stay in the table, then distinct addresses that evict on every miss
+    res.push_back({"RateLimiter::acquire/hit", [](uint64_t ops, Stopwatch &stopwatch)
+                   {
+                       auto &rate_limiter = RateLimiter::instance();
+                       rate_limiter.start(1e9, 1e9, 65536, RateLimiter::Action::TOO_MANY_REQUESTS);
+                       std::size_t sink = 0;
+                       stopwatch.start();
+                       for (uint64_t i = 0; i < ops; i++)
+                           sink += rate_limiter.acquire(0x0a000000u + i % 1000);
+                       return ops + (sink & 0);
+                   },
+                   10'000'000});
+    res.push_back({"RateLimiter::acquire/scan", [](uint64_t ops, Stopwatch &stopwatch)
+                   {
+                       auto &rate_limiter = RateLimiter::instance();
+                       rate_limiter.start(1e9, 1e9, 65536, RateLimiter::Action::TOO_MANY_REQUESTS);
+                       std::size_t sink = 0;
+                       stopwatch.start();
+                       for (uint64_t i = 0; i < ops; i++)
+                           sink += rate_limiter.acquire(static_cast<uint32_t>(i * 2654435761u));
+                       return ops + (sink & 0);
+                   },
+                   10'000'000});
+    // 100 API style routes, looked up by hits with parameters and by static file misses
+    res.push_back({"Router::lookup", [](uint64_t ops, Stopwatch &stopwatch)
+                   {
+                       static constexpr std::string_view kUrls[] = {
+                           "/api/v1/users/1234", "/api/v1/users/1234/posts/99", "/api/v1/items/42",
+                           "/index.html", "/login.gif", "/static/js/app.js"};
+                       auto &router = Router::instance();
+                       router.clear();
+                       const auto handler = [](const HttpParser &, const RouteParams &, const RequestBody *, HttpResponse &) {};
+                       for (int i = 0; i < 32; i++)
+                       {
+                           const auto prefix = "/api/v" + lexicalCast(i + 1);
+                           router.add(HttpMethod::GET, prefix + "/users/:id", handler);
+                           router.add(HttpMethod::GET, prefix + "/users/:id/posts/:post", handler);
+                           router.add(HttpMethod::GET, prefix + "/items/:id", handler);
+                       }
+                       router.add(HttpMethod::POST, "/0", handler);
+                       router.add(HttpMethod::POST, "/1", handler);
+                       router.add(HttpMethod::GET, "/healthz", handler);
+                       router.add(HttpMethod::GET, "/files/*path", handler);
+                       std::size_t sink = 0;
+                       stopwatch.start();
+                       for (uint64_t i = 0; i < ops; i++)
+                       {
+                           RouteParams params;
+                           sink += router.lookup(HttpMethod::GET, kUrls[i % std::size(kUrls)], params) != nullptr;
+                           sink += params.size();
+                       }
+                       router.clear();
+                       return ops + (sink & 0);
+                   },
+                   10'000'000});
+    // a 64 KB upload in 4 KB chunks, read in 1448 byte segments as from a socket
+    res.push_back({"ChunkedDecoder::decode/64KB", [](uint64_t ops, Stopwatch &stopwatch)
+                   {
+                       std::string body;
+                       for (int i = 0; i < 16; i++)
+                           body.append("1000;ext=1\r\n").append(4096, 'a' + i).append("\r\n");
+                       body.append("0\r\nTrailer: x\r\n\r\n");
+                       ChunkedDecoder decoder;
+                       std::string out;
+                       std::size_t sink = 0;
+                       stopwatch.start();
+                       for (uint64_t i = 0; i < ops; i++)
+                       {
+                           decoder.clear(UINT64_MAX);
+                           out.clear();
+                           for (std::size_t pos = 0; pos < body.size(); pos += 1448)
+                           {
+                               std::string_view in = std::string_view(body).substr(pos, 1448);
+                               sink += static_cast<int>(decoder.decode(in, out));
+                           }
+                           sink += out.size();
+                       }
+                       return ops + (sink & 0);
+                   },
+                   100'000});
+    res.push_back({"HpackEncoder::encode", [](uint64_t ops, Stopwatch &stopwatch)
+                   {
+                       const std::vector<std::string> headers = {
+                           "Accept-Ranges", "bytes", "ETag", "\"11e025-24a-175221b61bfdd200\"",
+                           "Last-Modified", "Sun, 02 Apr 2023 13:37:57 GMT", "Vary", "Accept-Encoding",
+                           "Cache-Control", "public, max-age=604800", "Content-Length", "257002", "Content-Type", "image/gif"};
+                       HpackEncoder encoder;
+                       std::string block;
+                       std::size_t sink = 0;
+                       stopwatch.start();
+                       for (uint64_t i = 0; i < ops; i++)
+                       {
+                           block.clear();
+                           encoder.encode(200, headers, block);
+                           sink += block.size();
+                       }
+                       return ops + (sink & 0);
+                   },
+                   1'000'000});
+    res.push_back({"HpackDecoder::decode", [](uint64_t ops, Stopwatch &stopwatch)
+                   {
+                       // first request of a connection, huffman coded strings as sent by curl
+                       static constexpr unsigned char kBlock[] = {
+                           0x82, 0x86, 0x04, 0x88, 0x62, 0x83, 0xcc, 0x6a, 0x97, 0x98, 0xd2, 0xff, 0x41, 0x8c, 0xf1, 0xe3,
+                           0xc2, 0xe5, 0xf2, 0x3a, 0x6b, 0xa0, 0xab, 0x90, 0xf4, 0xff, 0x7a, 0x88, 0x25, 0xb6, 0x50, 0xc3,
+                           0xcb, 0xb6, 0xb8, 0x3f, 0x53, 0x03, 0x2a, 0x2f, 0x2a};
+                       const std::string_view block(reinterpret_cast<const char *>(kBlock), sizeof(kBlock));
+                       HpackDecoder decoder;
+                       std::vector<HpackHeader> headers;
+                       std::size_t sink = 0;
+                       stopwatch.start();
+                       for (uint64_t i = 0; i < ops; i++)
+                       {
+                           headers.clear();
+                           if (decoder.decode(block, headers, 64 * 1024))
+                               sink += headers.size();
+                       }
+                       return ops + (sink & 0);
+                   },
+                   1'000'000});
+    res.push_back({"Logger::log", [](uint64_t ops, Stopwatch &stopwatch)
+                   {
+                       stopwatch.start();
+                       for (uint64_t i = 0; i < ops; i++)
+                           Logger::instance().log("Failed to call open with parameter(/index.html), reason: No such file", LogLevel::WARNING, __FILE__, __LINE__, __func__);
+                       return ops;
+                   },
+                   1'000'000});
+    return res;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    const std::string_view filter = argc > 1 ? argv[1] : "";
+
+    // consumer thread writes to /dev/null so Logger::log and getMime/unknown do not pile up
+    if (!Logger::instance().setLevel(LogLevel::WARNING).setPath("/dev/null").start())
+    {
+        std::cerr << "Failed to start logger" << std::endl;
+        return 1;
+    }
+
+    std::vector<Benchmark> benchmarks;
+    for (auto group : {parserBenchmarks, builderBenchmarks, timerBenchmarks, queueBenchmarks, miscBenchmarks})
+        for (auto &bench : group())
+            benchmarks.push_back(std::move(bench));
+
+    std::cout << std::left << std::setw(44) << "benchmark" << std::right
+              << std::setw(12) << "ns/op" << std::setw(12) << "allocs/op"
+              << std::setw(14) << "instrs/op" << std::setw(14) << "llc-miss/op"
+              << std::setw(12) << "ops" << "\n";
+    for (const auto &bench : benchmarks)
+        if (bench.name.find(filter) != std::string::npos)
+            run(bench);
+
+    std::cout.flush();
+    std::_Exit(0); // Logger has no stop path
+}
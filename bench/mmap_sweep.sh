@@ -0,0 +1,52 @@
+#!/usr/bin/env bash
+# File size sweep of the two file backends: sendfile (-m 0) against shared
+# mappings (-m covering every size). The sizes where mmap stops winning give
+# the -m threshold for the machine. Files are created in a temporary root.
+#
+# usage: bench/mmap_sweep.sh [label]
+# env:   DURATION (s, default 5), CONNECTIONS (default 64), THREADS (default 2),
+#        PORT (default 18080), SIZES (bytes, default "1024 4096 16384 65536 262144 1048576")
+set -euo pipefail
+
+cd "$(dirname "$0")/.."
+LABEL=${1:-mmap-$(git rev-parse --short HEAD 2>/dev/null || echo local)}
+
+DURATION=${DURATION:-5}
+CONNECTIONS=${CONNECTIONS:-64}
+THREADS=${THREADS:-2}
+PORT=${PORT:-18080}
+SIZES=${SIZES:-"1024 4096 16384 65536 262144 1048576"}
+OUT_DIR=bench/results/$LABEL
+
+make -s server bench >/dev/null
+mkdir -p "$OUT_DIR"
+ROOT_DIR=$(mktemp -d)
+SERVER_PID=
+trap 'kill $SERVER_PID 2>/dev/null || true; rm -rf "$ROOT_DIR"' EXIT
+
+for size in $SIZES; do
+    head -c "$size" /dev/urandom >"$ROOT_DIR/$size.bin"
+    echo "1 GET /$size.bin" >"$ROOT_DIR/$size.txt"
+done
+
+max_kb=0
+for size in $SIZES; do
+    max_kb=$((size / 1024 + 1 > max_kb ? size / 1024 + 1 : max_kb))
+done
+
+printf '%-10s %14s %14s\n' size sendfile mmap
+for size in $SIZES; do
+    row=()
+    for backend in sendfile mmap; do
+        [[ $backend == mmap ]] && kb=$max_kb || kb=0
+        ./server.out -a 127.0.0.1 -p "$PORT" -r "$ROOT_DIR" -m "$kb" -l error -L "$OUT_DIR/server.log" >/dev/null &
+        SERVER_PID=$!
+        sleep 0.5
+        ./loadgen.out -p "$PORT" -t "$THREADS" -c "$CONNECTIONS" -d "$DURATION" -s "$ROOT_DIR/$size.txt" \
+            -n "$size-$backend" -o "$OUT_DIR/$size-$backend.json"
+        kill $SERVER_PID
+        wait $SERVER_PID 2>/dev/null || true
+        row+=("$(grep -oE '"requests_per_s": [0-9.]+' "$OUT_DIR/$size-$backend.json" | grep -oE '[0-9.]+$')")
+    done
+    printf '%-10s %14s %14s\n' "$size" "${row[0]}" "${row[1]}"
+done
@@ -0,0 +1,45 @@
+#!/usr/bin/env bash
+# End-to-end benchmark: starts server.out on a private port and runs every
+# scenario with loadgen.out. Results go to bench/results/<label>/*.json.
+#
+# usage: bench/run.sh [label] [-- extra server.out options]
+# env:   DURATION (s, default 10), CONNECTIONS (default 64), THREADS (default 2),
+#        RATE (open loop requests/s, default 2000), PORT (default 18080)
+set -euo pipefail
+
+cd "$(dirname "$0")/.."
+LABEL=${1:-$(git rev-parse --short HEAD 2>/dev/null || echo local)}
+shift || true
+[[ ${1:-} == "--" ]] && shift
+SERVER_ARGS=("$@")
+
+DURATION=${DURATION:-10}
+CONNECTIONS=${CONNECTIONS:-64}
+THREADS=${THREADS:-2}
+RATE=${RATE:-2000}
+PORT=${PORT:-18080}
+OUT_DIR=bench/results/$LABEL
+
+make -s server bench >/dev/null
+mkdir -p "$OUT_DIR"
+
+./server.out -a 127.0.0.1 -p "$PORT" -l error -L "$OUT_DIR/server.log" "${SERVER_ARGS[@]}" >/dev/null &
+SERVER_PID=$!
+trap 'kill $SERVER_PID 2>/dev/null || true' EXIT
+sleep 0.5
+
+run() {
+    local name=$1
+    shift
+    echo "== $name"
+    ./loadgen.out -p "$PORT" -t "$THREADS" -d "$DURATION" -n "$name" -o "$OUT_DIR/$name.json" "$@"
+    grep -E '"requests_per_s"|"latency_us"' "$OUT_DIR/$name.json"
+}
+
+for scenario in bench/scenarios/*.txt; do
+    base=$(basename "$scenario" .txt)
+    run "$base-keepalive" -s "$scenario" -c "$CONNECTIONS"
+    run "$base-close" -s "$scenario" -c "$CONNECTIONS" -C
+    run "$base-pipeline8" -s "$scenario" -c "$CONNECTIONS" -P 8
+    run "$base-open" -s "$scenario" -c "$CONNECTIONS" -R "$RATE"
+done
@@ -0,0 +1,64 @@
+#!/usr/bin/env bash
+# HTTPS benchmark: server.out terminating TLS itself (-T, kTLS when the kernel
+# has the tls module) against nghttpx terminating TLS in front of plain HTTP.
+# A throwaway self-signed certificate is created under bench/results/<label>/.
+#
+# usage: bench/tls.sh [label] [-- extra server.out options]
+# env:   DURATION (s, default 10), CONNECTIONS (default 64), THREADS (default 2),
+#        PORT (plain, default 18080), TLS_PORT (default 18443), PROXY_PORT (default 18444),
+#        NGHTTPX (default nghttpx, the proxy run is skipped when it is missing)
+set -euo pipefail
+
+cd "$(dirname "$0")/.."
+LABEL=${1:-tls-$(git rev-parse --short HEAD 2>/dev/null || echo local)}
+shift || true
+[[ ${1:-} == "--" ]] && shift
+SERVER_ARGS=("$@")
+
+DURATION=${DURATION:-10}
+CONNECTIONS=${CONNECTIONS:-64}
+THREADS=${THREADS:-2}
+PORT=${PORT:-18080}
+TLS_PORT=${TLS_PORT:-18443}
+PROXY_PORT=${PROXY_PORT:-18444}
+NGHTTPX=${NGHTTPX:-nghttpx}
+OUT_DIR=bench/results/$LABEL
+
+make -s server bench >/dev/null
+mkdir -p "$OUT_DIR"
+
+openssl req -x509 -newkey ec -pkeyopt ec_paramgen_curve:prime256v1 -nodes -days 1 -subj /CN=localhost \
+    -keyout "$OUT_DIR/key.pem" -out "$OUT_DIR/cert.pem" 2>/dev/null
+
+./server.out -a 127.0.0.1 -p "$PORT" -T "$TLS_PORT" -C "$OUT_DIR/cert.pem" -K "$OUT_DIR/key.pem" \
+    -l error -L "$OUT_DIR/server.log" "${SERVER_ARGS[@]}" >/dev/null &
+PIDS=($!)
+trap 'kill "${PIDS[@]}" 2>/dev/null || true' EXIT
+
+HAS_PROXY=0
+if command -v "$NGHTTPX" >/dev/null; then
+    "$NGHTTPX" -f"127.0.0.1,$PROXY_PORT" -b"127.0.0.1,$PORT" -n "$THREADS" --no-ocsp \
+        "$OUT_DIR/key.pem" "$OUT_DIR/cert.pem" >"$OUT_DIR/nghttpx.log" 2>&1 &
+    PIDS+=($!)
+    HAS_PROXY=1
+fi
+sleep 0.5
+
+run() {
+    local name=$1
+    shift
+    echo "== $name"
+    ./loadgen.out -t "$THREADS" -d "$DURATION" -n "$name" -o "$OUT_DIR/$name.json" "$@"
+    grep -E '"requests_per_s"|"latency_us"' "$OUT_DIR/$name.json"
+}
+
+for scenario in bench/scenarios/small_html.txt bench/scenarios/large_gif.txt; do
+    base=$(basename "$scenario" .txt)
+    run "$base-plain" -s "$scenario" -c "$CONNECTIONS" -p "$PORT"
+    run "$base-tls" -s "$scenario" -c "$CONNECTIONS" -p "$TLS_PORT" -S
+    run "$base-tls-close" -s "$scenario" -c "$CONNECTIONS" -p "$TLS_PORT" -S -C
+    if ((HAS_PROXY)); then
+        run "$base-proxy" -s "$scenario" -c "$CONNECTIONS" -p "$PROXY_PORT" -S
+        run "$base-proxy-close" -s "$scenario" -c "$CONNECTIONS" -p "$PROXY_PORT" -S -C
+    fi
+done
@@ -0,0 +1,55 @@
+#!/usr/bin/env bash
+# Loopback TCP against Unix domain sockets: one server.out listens on both, a
+# socket file under bench/results/<label>/ and an abstract name, and every
+# scenario runs over each with keep-alive, a new connection per request and
+# pipelining.
+#
+# usage: bench/unix.sh [label] [-- extra server.out options]
+# env:   DURATION (s, default 10), CONNECTIONS (default 64), THREADS (default 2),
+#        PORT (default 18080)
+set -euo pipefail
+
+cd "$(dirname "$0")/.."
+LABEL=${1:-unix-$(git rev-parse --short HEAD 2>/dev/null || echo local)}
+shift || true
+[[ ${1:-} == "--" ]] && shift
+SERVER_ARGS=("$@")
+
+DURATION=${DURATION:-10}
+CONNECTIONS=${CONNECTIONS:-64}
+THREADS=${THREADS:-2}
+PORT=${PORT:-18080}
+OUT_DIR=bench/results/$LABEL
+SOCKET=$PWD/$OUT_DIR/server.sock
+ABSTRACT=@webserver-bench-$$
+
+make -s server bench >/dev/null
+mkdir -p "$OUT_DIR"
+
+./server.out -a 127.0.0.1 -p "$PORT" -u "$SOCKET" -u "$ABSTRACT" -l error -L "$OUT_DIR/server.log" \
+    "${SERVER_ARGS[@]}" >/dev/null &
+SERVER_PID=$!
+trap 'kill "$SERVER_PID" 2>/dev/null || true' EXIT
+sleep 0.5
+
+run() {
+    local name=$1
+    shift
+    echo "== $name"
+    ./loadgen.out -t "$THREADS" -d "$DURATION" -n "$name" -o "$OUT_DIR/$name.json" "$@"
+    grep -E '"requests_per_s"|"latency_us"' "$OUT_DIR/$name.json"
+}
+
+for scenario in bench/scenarios/small_html.txt bench/scenarios/large_gif.txt; do
+    base=$(basename "$scenario" .txt)
+    for transport in tcp unix abstract; do
+        case $transport in
+        tcp) target=(-p "$PORT") ;;
+        unix) target=(-u "$SOCKET") ;;
+        abstract) target=(-u "$ABSTRACT") ;;
+        esac
+        run "$base-$transport" -s "$scenario" -c "$CONNECTIONS" "${target[@]}"
+        run "$base-$transport-close" -s "$scenario" -c "$CONNECTIONS" -C "${target[@]}"
+        run "$base-$transport-pipeline" -s "$scenario" -c "$CONNECTIONS" -P 8 "${target[@]}"
+    done
+done
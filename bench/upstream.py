@@ -0,0 +1,93 @@
+#!/usr/bin/env python3
+"""A keep-alive HTTP/1.1 backend for the reverse proxy (-X) benchmarks.
+
+  GET  /.../bytes/N    N bytes with Content-Length
+  GET  /.../chunked/N  N bytes, chunked
+  POST|PUT /...        the request body echoed back
+  GET  /healthz        200
+  anything else        a small text body
+
+usage: bench/upstream.py PORT | unix:/path
+"""
+import os
+import socket
+import socketserver
+import sys
+from http.server import BaseHTTPRequestHandler
+
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+    disable_nagle_algorithm = True
+
+    def log_message(self, *args):
+        pass
+
+    def address_string(self):
+        return str(self.client_address)
+
+    def reply(self, body, content_type="text/plain"):
+        self.send_response(200)
+        self.send_header("Content-Type", content_type)
+        self.send_header("Content-Length", str(len(body)))
+        self.end_headers()
+        if self.command != "HEAD":
+            self.wfile.write(body)
+
+    def do_GET(self):
+        parts = self.path.rstrip("/").split("/")
+        if len(parts) >= 3 and parts[-2] == "bytes" and parts[-1].isdigit():
+            return self.reply(b"x" * int(parts[-1]), "application/octet-stream")
+        if len(parts) >= 3 and parts[-2] == "chunked" and parts[-1].isdigit():
+            self.send_response(200)
+            self.send_header("Content-Type", "application/octet-stream")
+            self.send_header("Transfer-Encoding", "chunked")
+            self.end_headers()
+            left = int(parts[-1])
+            while left > 0:
+                size = min(left, 8192)
+                self.wfile.write(b"%x\r\n" % size + b"y" * size + b"\r\n")
+                left -= size
+            self.wfile.write(b"0\r\n\r\n")
+            return
+        self.reply(f"{self.command} {self.path}\n".encode())
+
+    do_HEAD = do_GET
+
+    def do_POST(self):
+        body = self.rfile.read(int(self.headers.get("Content-Length", 0)))
+        self.reply(body, self.headers.get("Content-Type", "application/octet-stream"))
+
+    do_PUT = do_POST
+
+
+class TcpServer(socketserver.ThreadingMixIn, socketserver.TCPServer):
+    daemon_threads = True
+    allow_reuse_address = True
+    request_queue_size = 1024
+
+
+class UnixServer(socketserver.ThreadingMixIn, socketserver.UnixStreamServer):
+    daemon_threads = True
+    request_queue_size = 1024
+
+
+def main():
+    if len(sys.argv) != 2:
+        print(__doc__)
+        return 1
+    if sys.argv[1].startswith("unix:"):
+        path = sys.argv[1][len("unix:"):]
+        if os.path.exists(path):
+            os.unlink(path)
+        server = UnixServer(path, Handler)
+        # BaseHTTPRequestHandler expects (host, port)
+        server.get_request = lambda: (server.socket.accept()[0], ("unix", 0))
+    else:
+        server = TcpServer(("127.0.0.1", int(sys.argv[1])), Handler)
+    server.serve_forever()
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
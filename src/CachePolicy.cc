@@ -0,0 +1,242 @@
+#include <algorithm>
+#include <array>
+#include <fstream>
+#include <string>
+#include <string_view>
+
+#include <cctype>
+#include <cstdlib>
+#include <ctime>
+
+#include "./CachePolicy.h"
+#include "./HttpDate.h"
+#include "./Logger.h"
+
+static std::string_view trimSpace(std::string_view sv)
+{
+    while (!sv.empty() && std::isspace(static_cast<unsigned char>(sv.front())))
+        sv.remove_prefix(1);
+    while (!sv.empty() && std::isspace(static_cast<unsigned char>(sv.back())))
+        sv.remove_suffix(1);
+    return sv;
+}
+
+// '*' matches any string, '?' any single char
+static bool globMatch(std::string_view pattern, std::string_view str)
+{
+    std::size_t p = 0, s = 0;
+    std::size_t star_p = std::string_view::npos, star_s = 0;
+    while (s < str.size())
+    {
+        if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == str[s]))
+        {
+            p++;
+            s++;
+        }
+        else if (p < pattern.size() && pattern[p] == '*')
+        {
+            star_p = p++;
+            star_s = s;
+        }
+        else if (star_p != std::string_view::npos)
+        {
+            p = star_p + 1;
+            s = ++star_s;
+        }
+        else
+            return false;
+    }
+    while (p < pattern.size() && pattern[p] == '*')
+        p++;
+    return p == pattern.size();
+}
+
+static long parseMaxAge(std::string_view cache_control)
+{
+    // s-maxage is for shared caches only, skip it
+    static constexpr std::string_view kMaxAge = "max-age=";
+    std::size_t pos = 0;
+    while ((pos = cache_control.find(kMaxAge, pos)) != std::string_view::npos)
+    {
+        if (pos == 0 || cache_control[pos - 1] == ' ' || cache_control[pos - 1] == ',')
+            return std::strtol(cache_control.data() + pos + kMaxAge.size(), nullptr, 10);
+        pos += kMaxAge.size();
+    }
+    return -1;
+}
+
+int CachePolicy::addEntry(std::string_view cache_control)
+{
+    Entry entry;
+    entry.cache_control = std::string(cache_control);
+    entry.max_age = parseMaxAge(cache_control);
+    entries_.push_back(std::move(entry));
+    return entries_.size() - 1;
+}
+
+int CachePolicy::findChild(int node, char c) const
+{
+    const auto &children = nodes_[node].children;
+    const auto iter = std::lower_bound(children.begin(), children.end(), c, [](const std::pair<char, int> &child, char ch)
+                                       { return child.first < ch; });
+    return iter != children.end() && iter->first == c ? iter->second : -1;
+}
+
+int CachePolicy::insertPrefix(std::string_view prefix)
+{
+    int node = 0;
+    for (const char c : prefix)
+    {
+        int child = findChild(node, c);
+        if (child == -1)
+        {
+            child = nodes_.size();
+            nodes_.emplace_back();
+            auto &children = nodes_[node].children;
+            children.insert(std::upper_bound(children.begin(), children.end(), c, [](char ch, const std::pair<char, int> &child)
+                                             { return ch < child.first; }),
+                            {c, child});
+        }
+        node = child;
+    }
+    return node;
+}
+
+bool CachePolicy::addRule(std::string_view match, std::string_view cache_control)
+{
+    const auto colon_pos = match.find(':');
+    if (colon_pos == std::string_view::npos || cache_control.empty())
+        return false;
+    const auto kind = match.substr(0, colon_pos);
+    const auto pattern = match.substr(colon_pos + 1);
+    if (pattern.empty())
+        return false;
+
+    if (kind == "path")
+    {
+        auto &node = nodes_[insertPrefix(pattern)];
+        if (node.prefix_entry == -1)
+            node.prefix_entry = addEntry(cache_control);
+    }
+    else if (kind == "glob")
+    {
+        const auto wildcard_pos = std::min(pattern.find('*'), pattern.find('?'));
+        const auto literal = pattern.substr(0, std::min(wildcard_pos, pattern.size()));
+        const int node = insertPrefix(literal);
+        const int entry = addEntry(cache_control);
+        nodes_[node].globs.emplace_back(std::string(pattern.substr(literal.size())), entry);
+    }
+    else if (kind == "mime")
+    {
+        const auto slash_pos = pattern.find('/');
+        if (slash_pos == std::string_view::npos)
+            return false;
+        if (pattern == "*/*")
+        {
+            if (any_mime_entry_ == -1)
+                any_mime_entry_ = addEntry(cache_control);
+        }
+        else if (pattern.substr(slash_pos) == "/*")
+            mime_type_entries_.emplace_back(std::string(pattern.substr(0, slash_pos)), addEntry(cache_control));
+        else
+            mime_entries_.emplace_back(std::string(pattern), addEntry(cache_control));
+    }
+    else
+        return false;
+    return true;
+}
+
+bool CachePolicy::loadFile(const std::string &path)
+{
+    std::ifstream ifs(path);
+    if (!ifs)
+    {
+        LOG_ERROR("Failed to open cache policy file ", path);
+        return false;
+    }
+
+    std::string line;
+    int line_no = 0;
+    while (std::getline(ifs, line))
+    {
+        line_no++;
+        std::string_view sv(line);
+        sv = trimSpace(sv.substr(0, sv.find('#')));
+        if (sv.empty())
+            continue;
+
+        const auto space_pos = std::find_if(sv.begin(), sv.end(), [](char c)
+                                            { return std::isspace(static_cast<unsigned char>(c)); }) -
+                               sv.begin();
+        if (!addRule(sv.substr(0, space_pos), trimSpace(sv.substr(std::min<std::size_t>(space_pos, sv.size())))))
+        {
+            LOG_ERROR("Invalid cache policy at ", path, ":", line_no, ": ", line);
+            return false;
+        }
+    }
+    LOG_INFO("Cache policy loaded from ", path, ", ", entries_.size(), " rules");
+    return true;
+}
+
+void CachePolicy::clear()
+{
+    entries_.clear();
+    nodes_.assign(1, Node());
+    mime_entries_.clear();
+    mime_type_entries_.clear();
+    any_mime_entry_ = -1;
+}
+
+const CachePolicy::Entry *CachePolicy::lookup(std::string_view url, std::string_view mime) const
+{
+    if (entries_.empty())
+        return nullptr;
+
+    // collect the trie nodes along url, then try the longest literal prefix first
+    static constexpr std::size_t kMaxDepth = 256;
+    std::array<int, kMaxDepth> path;
+    std::size_t depth = 0;
+    int node = 0;
+    path[depth++] = 0;
+    for (std::size_t i = 0; i < url.size() && depth < kMaxDepth; i++)
+    {
+        if ((node = findChild(node, url[i])) == -1)
+            break;
+        path[depth++] = node;
+    }
+
+    while (depth > 0)
+    {
+        const auto &cur = nodes_[path[--depth]];
+        for (const auto &[pattern, entry] : cur.globs)
+            if (globMatch(pattern, url.substr(depth)))
+                return &entries_[entry];
+        if (cur.prefix_entry != -1)
+            return &entries_[cur.prefix_entry];
+    }
+
+    for (const auto &[mime_str, entry] : mime_entries_)
+        if (mime_str == mime)
+            return &entries_[entry];
+    const auto type = mime.substr(0, mime.find('/'));
+    for (const auto &[type_str, entry] : mime_type_entries_)
+        if (type_str == type)
+            return &entries_[entry];
+    return any_mime_entry_ == -1 ? nullptr : &entries_[any_mime_entry_];
+}
+
+std::string CachePolicy::expiresStr(const Entry &entry)
+{
+    thread_local time_t cached_now = 0;
+    thread_local std::string cached_date;
+    thread_local long cached_max_age = -1;
+
+    const time_t now = time(nullptr);
+    if (now != cached_now || entry.max_age != cached_max_age)
+    {
+        cached_now = now;
+        cached_max_age = entry.max_age;
+        cached_date = formatHttpDate(now + entry.max_age);
+    }
+    return cached_date;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <ctime>
+
+#include "./util/Singleton.h"
+
+// Cache-Control (and Expires for max-age) of static responses, chosen by
+// URL path or mime type. Rules are read before the server starts and
+// compiled into a prefix trie over URL paths, lookups are read only.
+//
+// Rule file, one rule per line, '#' starts a comment:
+//   path:/static/   public, max-age=86400    # URL prefix
+//   glob:*.gif      public, max-age=604800   # '*' any string, '?' any char
+//   mime:image/*    public, max-age=604800   # exact type or type/*
+//   mime:*/*        no-cache                 # fallback
+// The path or glob rule with the longest literal prefix wins, globs before
+// prefixes on a tie and earlier rules first. Mime rules only apply when no
+// path or glob rule matches.
+class CachePolicy : public Singleton<CachePolicy>
+{
+public:
+    struct Entry
+    {
+        std::string cache_control;
+        long max_age{-1}; // -1 if cache_control has no max-age, then no Expires is sent
+    };
+
+    bool addRule(std::string_view match, std::string_view cache_control);
+    bool loadFile(const std::string &path);
+    void clear();
+
+    [[nodiscard]] bool empty() const noexcept { return entries_.empty(); }
+
+    // nullptr if no rule matches
+    [[nodiscard]] const Entry *lookup(std::string_view url, std::string_view mime) const;
+
+    // Expires value of entry for responses sent now, formatted at most once a second per thread
+    [[nodiscard]] static std::string expiresStr(const Entry &entry);
+
+private:
+    struct Node
+    {
+        std::vector<std::pair<char, int>> children; // sorted by char
+        int prefix_entry{-1};
+        std::vector<std::pair<std::string, int>> globs; // pattern after the literal prefix, entry
+    };
+
+    std::vector<Entry> entries_;
+    std::vector<Node> nodes_{Node()};
+    // few mime rules, a linear scan is cheaper than hashing
+    std::vector<std::pair<std::string, int>> mime_entries_;      // "text/html"
+    std::vector<std::pair<std::string, int>> mime_type_entries_; // "image" of "image/*"
+    int any_mime_entry_{-1};
+
+    int addEntry(std::string_view cache_control);
+    int insertPrefix(std::string_view prefix);
+    [[nodiscard]] int findChild(int node, char c) const;
+};
@@ -0,0 +1,119 @@
+#include <algorithm>
+#include <string>
+#include <string_view>
+
+#include "./ChunkedDecoder.h"
+
+static int hexValue(char c) noexcept
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+void ChunkedDecoder::clear(uint64_t max_size) noexcept
+{
+    state_ = State::SIZE;
+    chunk_left_ = 0;
+    size_digits_ = 0;
+    line_length_ = 0;
+    size_ = 0;
+    max_size_ = max_size;
+}
+
+ChunkedDecoder::Result ChunkedDecoder::decode(std::string_view &in, std::string &out)
+{
+    while (!in.empty() && state_ != State::DONE)
+    {
+        if (state_ == State::DATA)
+        {
+            const auto length = std::min<uint64_t>(chunk_left_, in.size());
+            out.append(in.data(), length);
+            in.remove_prefix(length);
+            chunk_left_ -= length;
+            if (chunk_left_ == 0)
+                state_ = State::DATA_CR;
+            continue;
+        }
+
+        const char c = in.front();
+        in.remove_prefix(1);
+        switch (state_)
+        {
+        case State::SIZE:
+            if (const int value = hexValue(c); value != -1)
+            {
+                // 15 digits keep the sum below 2^64 with any max_size
+                if (++size_digits_ > 15)
+                    return Result::ERROR;
+                chunk_left_ = chunk_left_ * 16 + value;
+            }
+            else if (size_digits_ == 0)
+                return Result::ERROR;
+            else if (c == '\r')
+                state_ = State::SIZE_LF;
+            else if (c == ';' || c == ' ' || c == '\t')
+                state_ = State::EXTENSION;
+            else
+                return Result::ERROR;
+            break;
+        case State::EXTENSION:
+            if (c == '\r')
+                state_ = State::SIZE_LF;
+            else if (c == '\n' || ++line_length_ > kMaxLineLength)
+                return Result::ERROR;
+            break;
+        case State::SIZE_LF:
+            if (c != '\n')
+                return Result::ERROR;
+            // checked before any data of the chunk is taken
+            if (chunk_left_ > max_size_ - size_)
+                return Result::TOO_LARGE;
+            size_ += chunk_left_;
+            size_digits_ = 0;
+            line_length_ = 0;
+            state_ = chunk_left_ == 0 ? State::TRAILER_START : State::DATA;
+            break;
+        case State::DATA_CR:
+            if (c != '\r')
+                return Result::ERROR;
+            state_ = State::DATA_LF;
+            break;
+        case State::DATA_LF:
+            if (c != '\n')
+                return Result::ERROR;
+            state_ = State::SIZE;
+            break;
+        case State::TRAILER_START:
+            if (c == '\n')
+                return Result::ERROR;
+            state_ = c == '\r' ? State::LAST_LF : State::TRAILER;
+            break;
+        case State::TRAILER:
+            // a bare LF ends the line for a lenient proxy, but not for us
+            if (c == '\r')
+                state_ = State::TRAILER_LF;
+            else if (c == '\n' || ++line_length_ > kMaxLineLength)
+                return Result::ERROR;
+            break;
+        case State::TRAILER_LF:
+            if (c != '\n')
+                return Result::ERROR;
+            line_length_ = 0;
+            state_ = State::TRAILER_START;
+            break;
+        case State::LAST_LF:
+            if (c != '\n')
+                return Result::ERROR;
+            state_ = State::DONE;
+            break;
+        default:
+            return Result::ERROR;
+        }
+    }
+    return state_ == State::DONE ? Result::DONE : Result::NEED_MORE;
+}
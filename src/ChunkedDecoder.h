@@ -0,0 +1,56 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+#include <cinttypes>
+
+// Incremental decoder of a Transfer-Encoding: chunked body (RFC 9112 sec 7.1).
+// The input may be cut anywhere, chunk extensions and trailer fields are
+// skipped. Lines must end with CRLF, a lenient parser here would read a
+// body differently than a proxy in front of us.
+class ChunkedDecoder
+{
+public:
+    enum class Result
+    {
+        NEED_MORE,
+        DONE,
+        ERROR,
+        TOO_LARGE, // the chunk sizes add up to more than max_size
+    };
+
+    // chunk data of in is appended to out, in is consumed up to the end of the body on
+    // DONE, the rest belongs to the next request
+    [[nodiscard]] Result decode(std::string_view &in, std::string &out);
+    void clear(uint64_t max_size) noexcept;
+
+    // chunk data so far
+    [[nodiscard]] uint64_t size() const noexcept { return size_; }
+
+private:
+    // a chunk size line or a trailer field longer than this is an error
+    static constexpr std::size_t kMaxLineLength = 4096;
+
+    enum class State
+    {
+        SIZE,
+        EXTENSION,
+        SIZE_LF,
+        DATA,
+        DATA_CR,
+        DATA_LF,
+        TRAILER_START,
+        TRAILER,
+        TRAILER_LF,
+        LAST_LF,
+        DONE,
+    };
+
+    State state_{State::SIZE};
+    uint64_t chunk_left_{0};
+    int size_digits_{0};
+    std::size_t line_length_{0};
+    uint64_t size_{0};
+    uint64_t max_size_{UINT64_MAX};
+};
@@ -0,0 +1,222 @@
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+#ifdef WEBSERVER_WITH_ZLIB
+#include <zlib.h>
+#endif
+#ifdef WEBSERVER_WITH_BROTLI
+#include <brotli/encode.h>
+#endif
+#ifdef WEBSERVER_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+#include "./Compression.h"
+#include "./ContentEncoding.h"
+#include "./Logger.h"
+#include "./Mime.h"
+
+static constexpr std::uintmax_t kMinPrecompressSize = 256;
+
+#ifdef WEBSERVER_WITH_ZLIB
+static bool compressGzip(std::string_view input, std::string &out)
+{
+    z_stream stream;
+    explicit_bzero(&stream, sizeof(stream));
+
+    static constexpr int kGzipWindowBits = 16 + MAX_WBITS;
+    if (deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, kGzipWindowBits, 9, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        LOG_WARNING("deflateInit2 failed");
+        return false;
+    }
+
+    out.resize(deflateBound(&stream, input.size()));
+    stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(input.data()));
+    stream.avail_in = input.size();
+    stream.next_out = reinterpret_cast<Bytef *>(out.data());
+    stream.avail_out = out.size();
+
+    const int retval = deflate(&stream, Z_FINISH);
+    deflateEnd(&stream);
+    if (retval != Z_STREAM_END)
+    {
+        LOG_WARNING("deflate failed, retval = ", retval);
+        return false;
+    }
+    out.resize(stream.total_out);
+    return true;
+}
+#endif
+
+#ifdef WEBSERVER_WITH_BROTLI
+static bool compressBrotli(std::string_view input, std::string &out)
+{
+    std::size_t out_size = BrotliEncoderMaxCompressedSize(input.size());
+    out.resize(out_size);
+    if (!BrotliEncoderCompress(BROTLI_MAX_QUALITY, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT,
+                               input.size(), reinterpret_cast<const uint8_t *>(input.data()),
+                               &out_size, reinterpret_cast<uint8_t *>(out.data())))
+    {
+        LOG_WARNING("BrotliEncoderCompress failed");
+        return false;
+    }
+    out.resize(out_size);
+    return true;
+}
+#endif
+
+#ifdef WEBSERVER_WITH_ZSTD
+static bool compressZstd(std::string_view input, std::string &out)
+{
+    out.resize(ZSTD_compressBound(input.size()));
+    const std::size_t retval = ZSTD_compress(out.data(), out.size(), input.data(), input.size(), 19);
+    if (ZSTD_isError(retval))
+    {
+        LOG_WARNING("ZSTD_compress failed, reason: ", ZSTD_getErrorName(retval));
+        return false;
+    }
+    out.resize(retval);
+    return true;
+}
+#endif
+
+bool isEncodingSupported(ContentEncoding encoding) noexcept
+{
+    switch (encoding)
+    {
+#ifdef WEBSERVER_WITH_ZLIB
+    case ContentEncoding::GZIP:
+        return true;
+#endif
+#ifdef WEBSERVER_WITH_BROTLI
+    case ContentEncoding::BROTLI:
+        return true;
+#endif
+#ifdef WEBSERVER_WITH_ZSTD
+    case ContentEncoding::ZSTD:
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+bool compress(ContentEncoding encoding, std::string_view input, std::string &out)
+{
+    switch (encoding)
+    {
+#ifdef WEBSERVER_WITH_ZLIB
+    case ContentEncoding::GZIP:
+        return compressGzip(input, out);
+#endif
+#ifdef WEBSERVER_WITH_BROTLI
+    case ContentEncoding::BROTLI:
+        return compressBrotli(input, out);
+#endif
+#ifdef WEBSERVER_WITH_ZSTD
+    case ContentEncoding::ZSTD:
+        return compressZstd(input, out);
+#endif
+    default:
+        (void)input;
+        (void)out;
+        return false;
+    }
+}
+
+static bool isSidecar(const std::filesystem::path &path)
+{
+    const auto ext = path.extension().string();
+    for (int i = 1; i < kContentEncodingCount; i++)
+        if (ext == kContentEncodingSuffix[i])
+            return true;
+    return false;
+}
+
+int precompressDir(const std::string &root_dir)
+{
+    namespace fs = std::filesystem;
+
+    std::error_code ec;
+    auto iter = fs::recursive_directory_iterator(root_dir, ec);
+    if (ec)
+    {
+        LOG_ERROR("Failed to iterate dir ", root_dir, ", reason: ", ec.message());
+        return -1;
+    }
+
+    int written = 0;
+    for (const auto &entry : iter)
+    {
+        if (!entry.is_regular_file(ec) || entry.is_symlink(ec) || isSidecar(entry.path()))
+            continue;
+
+        const auto ext = entry.path().extension().string();
+        if (ext.empty() || !isCompressibleMime(getMime(std::string_view(ext).substr(1))))
+            continue;
+
+        const auto file_size = entry.file_size(ec);
+        if (ec || file_size < kMinPrecompressSize)
+            continue;
+
+        const auto mtime = entry.last_write_time(ec);
+        std::string content;
+        for (int i = 1; i < kContentEncodingCount; i++)
+        {
+            const auto encoding = static_cast<ContentEncoding>(i);
+            if (!isEncodingSupported(encoding))
+                continue;
+
+            const fs::path sidecar = entry.path().string() + kContentEncodingSuffix[i];
+            if (fs::exists(sidecar, ec) && fs::last_write_time(sidecar, ec) >= mtime)
+                continue;
+
+            if (content.empty())
+            {
+                std::ifstream in(entry.path(), std::ios::binary);
+                content.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+                if (!in && !in.eof())
+                {
+                    LOG_WARNING("Failed to read ", entry.path().string());
+                    break;
+                }
+            }
+
+            std::string compressed;
+            if (!compress(encoding, content, compressed))
+                continue;
+            if (compressed.size() >= content.size())
+            {
+                fs::remove(sidecar, ec);
+                continue;
+            }
+
+            // write to a temp file first so the server never sends a partial sidecar
+            const fs::path temp_path = sidecar.string() + ".tmp";
+            {
+                std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+                out.write(compressed.data(), compressed.size());
+                if (!out)
+                {
+                    LOG_WARNING("Failed to write ", temp_path.string());
+                    fs::remove(temp_path, ec);
+                    continue;
+                }
+            }
+            fs::rename(temp_path, sidecar, ec);
+            if (ec)
+            {
+                LOG_WARNING("Failed to rename ", temp_path.string(), ", reason: ", ec.message());
+                continue;
+            }
+            LOG_INFO("Write sidecar ", sidecar.string(), ", ", content.size(), " -> ", compressed.size(), " bytes");
+            written++;
+        }
+    }
+    return written;
+}
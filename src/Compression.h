@@ -0,0 +1,19 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+#include "./ContentEncoding.h"
+
+// Encoders compiled in with WEBSERVER_WITH_ZLIB, WEBSERVER_WITH_BROTLI and
+// WEBSERVER_WITH_ZSTD, see Makefile.
+[[nodiscard]] bool isEncodingSupported(ContentEncoding encoding) noexcept;
+
+// compress input into out with the best ratio of the encoder,
+// returns false if the encoding is not supported or the encoder fails
+[[nodiscard]] bool compress(ContentEncoding encoding, std::string_view input, std::string &out);
+
+// Writes missing or stale sidecars (index.html.gz, .br, .zst) next to every
+// compressible file under root_dir. Sidecars not smaller than the original
+// are not kept. Returns the number of sidecars written, -1 on error.
+int precompressDir(const std::string &root_dir);
@@ -0,0 +1,189 @@
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+#include <cerrno>
+#include <ctime>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "./CompressionCache.h"
+#include "./Compression.h"
+#include "./Logger.h"
+#include "./util/FdHolder.h"
+
+static bool isSameVersion(const timespec &mtime, off_t file_size, const struct stat &file_stat)
+{
+    return mtime.tv_sec == file_stat.st_mtim.tv_sec && mtime.tv_nsec == file_stat.st_mtim.tv_nsec &&
+           file_size == file_stat.st_size;
+}
+
+static uint64_t threadCpuNs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1'000'000'000ull + ts.tv_nsec;
+}
+
+bool CompressionCache::start(std::size_t memory_budget, int thread_num)
+{
+    if (is_running_.load(std::memory_order_relaxed) || memory_budget == 0 || thread_num <= 0)
+        return false;
+
+    memory_budget_ = memory_budget;
+    pool_.start(thread_num);
+    // publishes memory_budget_ and the pool to the workers
+    is_running_.store(true, std::memory_order_release);
+    LOG_INFO("CompressionCache start, memory budget = ", memory_budget, ", threads = ", thread_num);
+    return true;
+}
+
+void CompressionCache::stop()
+{
+    if (!is_running_.exchange(false))
+        return;
+    pool_.stop();
+}
+
+CompressionCache::Body CompressionCache::get(std::string_view path, const struct stat &file_stat, ContentEncoding encoding)
+{
+    if (!is_running_.load(std::memory_order_acquire) || !isEncodingSupported(encoding) ||
+        file_stat.st_size < static_cast<off_t>(kMinCompressSize) || file_stat.st_size > static_cast<off_t>(kMaxCompressSize))
+        return nullptr;
+
+    std::string key(kContentEncodingSuffix[static_cast<int>(encoding)]);
+    key.append(path);
+
+    {
+        const std::lock_guard lock(mutex_);
+        if (auto iter = entries_.find(key); iter != entries_.end())
+        {
+            auto &entry = iter->second;
+            if (isSameVersion(entry.mtime, entry.file_size, file_stat))
+            {
+                if (entry.is_pending || !entry.body)
+                    return nullptr;
+                lru_.splice(lru_.begin(), lru_, entry.lru_iter);
+                hits_.fetch_add(1, std::memory_order_relaxed);
+                return entry.body;
+            }
+
+            // file changed, drop the stale variant
+            if (entry.is_pending)
+                return nullptr;
+            if (entry.body)
+                memory_used_ -= entry.body->size();
+            lru_.erase(entry.lru_iter);
+            entries_.erase(iter);
+        }
+
+        lru_.push_front(key);
+        Entry entry;
+        entry.mtime = file_stat.st_mtim;
+        entry.file_size = file_stat.st_size;
+        entry.lru_iter = lru_.begin();
+        entries_.emplace(key, std::move(entry));
+    }
+
+    misses_.fetch_add(1, std::memory_order_relaxed);
+    pool_.run([this, key = std::move(key), path = std::string(path), encoding, mtime = file_stat.st_mtim, file_size = file_stat.st_size]() mutable
+              { compressFile(std::move(key), std::move(path), encoding, mtime, file_size); });
+    return nullptr;
+}
+
+void CompressionCache::compressFile(std::string key, std::string path, ContentEncoding encoding, timespec mtime, off_t file_size)
+{
+    const auto cpu_start = threadCpuNs();
+    std::string content(file_size, '\0');
+    bool is_ok = false;
+    {
+        const FdHolder fd(::open(path.c_str(), O_RDONLY));
+        if (fd.fd() == -1)
+            LOG_WARNING("Failed to open ", path, ", reason: ", logErrStr(errno));
+        else
+        {
+            std::size_t pos = 0;
+            long retval;
+            while (pos < content.size() && (retval = ::read(fd.fd(), content.data() + pos, content.size() - pos)) > 0)
+                pos += retval;
+            is_ok = pos == content.size();
+        }
+    }
+
+    auto compressed = std::make_shared<std::string>();
+    if (is_ok)
+        is_ok = compress(encoding, content, *compressed);
+    if (is_ok && compressed->size() >= content.size())
+    {
+        not_compressible_.fetch_add(1, std::memory_order_relaxed);
+        is_ok = false;
+    }
+    compressed->shrink_to_fit();
+    cpu_ns_.fetch_add(threadCpuNs() - cpu_start, std::memory_order_relaxed);
+
+    const std::lock_guard lock(mutex_);
+    auto iter = entries_.find(key);
+    if (iter == entries_.end() || !iter->second.is_pending ||
+        iter->second.mtime.tv_sec != mtime.tv_sec || iter->second.mtime.tv_nsec != mtime.tv_nsec)
+        return;
+
+    // failures stay cached as empty entries so the file is not compressed again
+    iter->second.is_pending = false;
+    if (!is_ok)
+        return;
+
+    compressions_.fetch_add(1, std::memory_order_relaxed);
+    bytes_in_.fetch_add(content.size(), std::memory_order_relaxed);
+    bytes_out_.fetch_add(compressed->size(), std::memory_order_relaxed);
+    memory_used_ += compressed->size();
+    iter->second.body = std::move(compressed);
+    evictLocked();
+}
+
+void CompressionCache::evictLocked()
+{
+    auto lru_iter = lru_.end();
+    while (memory_used_ > memory_budget_ && lru_iter != lru_.begin())
+    {
+        --lru_iter;
+        auto iter = entries_.find(*lru_iter);
+        if (iter != entries_.end())
+        {
+            if (iter->second.is_pending)
+                continue;
+            if (iter->second.body)
+            {
+                memory_used_ -= iter->second.body->size();
+                evictions_.fetch_add(1, std::memory_order_relaxed);
+            }
+            entries_.erase(iter);
+        }
+        lru_iter = lru_.erase(lru_iter);
+    }
+}
+
+std::string CompressionCache::report() const
+{
+    std::size_t entry_count, memory_used;
+    {
+        const std::lock_guard lock(mutex_);
+        entry_count = entries_.size();
+        memory_used = memory_used_;
+    }
+
+    const auto bytes_in = bytes_in_.load(std::memory_order_relaxed);
+    const auto bytes_out = bytes_out_.load(std::memory_order_relaxed);
+    return logstr("compression_cache entries=", entry_count,
+                  " memory=", memory_used, "/", memory_budget_,
+                  " hits=", hits_.load(std::memory_order_relaxed),
+                  " misses=", misses_.load(std::memory_order_relaxed),
+                  " compressions=", compressions_.load(std::memory_order_relaxed),
+                  " not_compressible=", not_compressible_.load(std::memory_order_relaxed),
+                  " evictions=", evictions_.load(std::memory_order_relaxed),
+                  " bytes_in=", bytes_in, " bytes_out=", bytes_out,
+                  " ratio=", bytes_out ? static_cast<double>(bytes_in) / bytes_out : 0.0,
+                  " cpu_ms=", cpu_ns_.load(std::memory_order_relaxed) / 1'000'000, "\n");
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include <sys/stat.h>
+
+#include "./ContentEncoding.h"
+#include "./ThreadPool.h"
+#include "./util/Singleton.h"
+
+// Compressed variants of files without sidecars, keyed by path, mtime, size
+// and encoding. A miss schedules the compression on the cache's own
+// ThreadPool and the caller sends the identity body meanwhile; later hits
+// are served from memory. Entries are evicted in LRU order to stay within
+// the memory budget.
+class CompressionCache : public Singleton<CompressionCache>
+{
+public:
+    using Body = std::shared_ptr<const std::string>;
+
+    static constexpr std::size_t kMinCompressSize = 256;
+    static constexpr std::size_t kMaxCompressSize = 4 * 1024 * 1024;
+
+    bool start(std::size_t memory_budget, int thread_num);
+    void stop();
+    [[nodiscard]] bool isEnabled() const noexcept { return is_running_.load(std::memory_order_acquire); }
+
+    // returns the compressed body or nullptr if it is not ready (yet)
+    [[nodiscard]] Body get(std::string_view path, const struct stat &file_stat, ContentEncoding encoding);
+
+    [[nodiscard]] std::string report() const;
+
+private:
+    struct Entry
+    {
+        Body body; // nullptr while compressing or when compression did not pay off
+        bool is_pending{true};
+        timespec mtime;
+        off_t file_size;
+        std::list<std::string>::iterator lru_iter;
+    };
+
+    ThreadPool pool_;
+    // read by the workers in get(), set by start() and stop() on the main thread
+    std::atomic<bool> is_running_{false};
+    std::size_t memory_budget_{0};
+
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, Entry> entries_; // key: encoding suffix + path
+    std::list<std::string> lru_;                     // most recently used first
+    std::size_t memory_used_{0};
+
+    // statistics
+    std::atomic<uint64_t> hits_{0};
+    std::atomic<uint64_t> misses_{0};
+    std::atomic<uint64_t> compressions_{0};
+    std::atomic<uint64_t> not_compressible_{0};
+    std::atomic<uint64_t> evictions_{0};
+    std::atomic<uint64_t> bytes_in_{0};
+    std::atomic<uint64_t> bytes_out_{0};
+    std::atomic<uint64_t> cpu_ns_{0};
+
+    void compressFile(std::string key, std::string path, ContentEncoding encoding, timespec mtime, off_t file_size);
+    void evictLocked();
+};
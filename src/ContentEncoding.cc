@@ -0,0 +1,124 @@
+#include <algorithm>
+#include <array>
+#include <string_view>
+
+#include <cctype>
+#include <cstdlib>
+
+#include "./ContentEncoding.h"
+#include "./util/Ascii.h"
+
+static constexpr std::array<ContentEncoding, 3> kServerPreference = {
+    ContentEncoding::BROTLI,
+    ContentEncoding::ZSTD,
+    ContentEncoding::GZIP,
+};
+
+static std::string_view trimOWS(std::string_view sv)
+{
+    while (!sv.empty() && (sv.front() == ' ' || sv.front() == '\t'))
+        sv.remove_prefix(1);
+    while (!sv.empty() && (sv.back() == ' ' || sv.back() == '\t'))
+        sv.remove_suffix(1);
+    return sv;
+}
+
+// weight = OWS ";" OWS "q=" qvalue, returns q * 1000
+static int parseQValue(std::string_view params)
+{
+    while (!params.empty())
+    {
+        const auto semicolon_pos = params.find(';');
+        const auto param = trimOWS(params.substr(0, semicolon_pos));
+        if (param.size() >= 2 && (param[0] == 'q' || param[0] == 'Q') && param[1] == '=')
+        {
+            const auto value = param.substr(2);
+            if (value.empty() || (value[0] != '0' && value[0] != '1'))
+                return 0;
+
+            int res = (value[0] - '0') * 1000;
+            if (value.size() > 1 && value[1] == '.')
+            {
+                int scale = 100;
+                for (std::size_t i = 2; i < value.size() && i < 5 && std::isdigit(static_cast<unsigned char>(value[i])); i++, scale /= 10)
+                    res += (value[i] - '0') * scale;
+            }
+            return std::min(res, 1000);
+        }
+        if (semicolon_pos == std::string_view::npos)
+            break;
+        params.remove_prefix(semicolon_pos + 1);
+    }
+    return 1000;
+}
+
+AcceptedEncodings parseAcceptEncoding(std::string_view header)
+{
+    // q * 1000 of every encoding, -1 when not listed
+    std::array<int, kContentEncodingCount> qvalues;
+    qvalues.fill(-1);
+    int wildcard_qvalue = -1;
+
+    while (!header.empty())
+    {
+        const auto comma_pos = header.find(',');
+        const auto item = trimOWS(header.substr(0, comma_pos));
+        const auto semicolon_pos = item.find(';');
+        const auto coding = trimOWS(item.substr(0, semicolon_pos));
+        const int qvalue = semicolon_pos == std::string_view::npos ? 1000 : parseQValue(item.substr(semicolon_pos + 1));
+
+        if (coding == "*")
+            wildcard_qvalue = qvalue;
+        else if (equalsIgnoreCase(coding, "x-gzip"))
+            qvalues[static_cast<int>(ContentEncoding::GZIP)] = qvalue;
+        else
+            for (int i = 0; i < kContentEncodingCount; i++)
+                if (equalsIgnoreCase(coding, kContentEncodingStr[i]))
+                    qvalues[i] = qvalue;
+
+        if (comma_pos == std::string_view::npos)
+            break;
+        header.remove_prefix(comma_pos + 1);
+    }
+
+    AcceptedEncodings res;
+    std::array<std::pair<int, ContentEncoding>, kContentEncodingCount> candidates;
+    int count = 0;
+    for (const auto encoding : kServerPreference)
+    {
+        int qvalue = qvalues[static_cast<int>(encoding)];
+        if (qvalue == -1)
+            qvalue = wildcard_qvalue;
+        if (qvalue > 0)
+            candidates[count++] = {qvalue, encoding};
+    }
+    std::stable_sort(candidates.begin(), candidates.begin() + count, [](const auto &lhs, const auto &rhs)
+                     { return lhs.first > rhs.first; });
+    for (int i = 0; i < count; i++)
+        res.encodings[res.size++] = candidates[i].second;
+
+    // identity is acceptable unless refused explicitly, rfc7231 sec:5.3.4
+    const int identity_qvalue = qvalues[static_cast<int>(ContentEncoding::IDENTITY)];
+    if (identity_qvalue != 0 && !(identity_qvalue == -1 && wildcard_qvalue == 0))
+        res.encodings[res.size++] = ContentEncoding::IDENTITY;
+    return res;
+}
+
+bool isCompressibleMime(std::string_view mime)
+{
+    static constexpr std::string_view kCompressibleMimes[] = {
+        "application/json",
+        "application/xml",
+        "application/javascript",
+        "image/svg+xml",
+        "image/vnd.microsoft.icon",
+        "image/bmp",
+        "font/otf",
+        "font/ttf",
+        "application/vnd.ms-fontobject",
+    };
+
+    if (mime.substr(0, 5) == "text/")
+        return true;
+    return std::find(std::begin(kCompressibleMimes), std::end(kCompressibleMimes), mime) != std::end(kCompressibleMimes);
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <array>
+#include <string_view>
+
+enum class ContentEncoding : int
+{
+    IDENTITY = 0,
+    GZIP,
+    BROTLI,
+    ZSTD,
+    ENCODING_COUNT,
+};
+
+inline constexpr int kContentEncodingCount = static_cast<int>(ContentEncoding::ENCODING_COUNT);
+
+inline constexpr const char *kContentEncodingStr[] = {
+    "identity",
+    "gzip",
+    "br",
+    "zstd",
+};
+
+// suffix of the precompressed sidecar file, e.g. index.html.br
+inline constexpr const char *kContentEncodingSuffix[] = {
+    "",
+    ".gz",
+    ".br",
+    ".zst",
+};
+
+static_assert(std::size(kContentEncodingStr) == kContentEncodingCount);
+static_assert(std::size(kContentEncodingSuffix) == kContentEncodingCount);
+
+// Encodings acceptable to the client, best first. Ties on q-value are broken
+// by the server preference br > zstd > gzip. identity is always last unless
+// the client refused it.
+struct AcceptedEncodings
+{
+    std::array<ContentEncoding, kContentEncodingCount> encodings;
+    int size{0};
+
+    auto begin() const noexcept { return encodings.begin(); }
+    auto end() const noexcept { return encodings.begin() + size; }
+};
+
+// Accept-Encoding = #( codings [ weight ] ) # rfc7231 sec:5.3.4
+AcceptedEncodings parseAcceptEncoding(std::string_view header);
+
+// text like types worth compressing
+bool isCompressibleMime(std::string_view mime);
@@ -35,8 +35,13 @@
 #define FORBIDDEN_ERROR_MSG "403 Forbidden"
 #define NOT_FOUND_ERROR_MSG "404 Not Found"
 #define PROXY_AUTH_REQUIRED_ERROR_MSG "407 Proxy Authentication Required"
+#define CONFLICT_ERROR_MSG "409 Conflict"
+#define PAYLOAD_TOO_LARGE_ERROR_MSG "413 Payload Too Large"
+#define RANGE_NOT_SATISFIABLE_ERROR_MSG "416 Range Not Satisfiable"
+#define TOO_MANY_REQUESTS_ERROR_MSG "429 Too Many Requests"
 #define INTERNAL_SERVER_ERROR_ERROR_MSG "500 Internal Server Error"
 #define NOT_IMPLEMENTED_ERROR_MSG "501 Not Implemented"
+#define BAD_GATEWAY_ERROR_MSG "502 Bad Gateway"
 #define SERVICE_UNAVAILABLE_ERROR_MSG "503 Service Unavailable"
 #define HTTP_VERSION_NOT_SUPPORTED_ERROR_MSG "505 HTTP Version Not Supported"
 
@@ -45,8 +50,13 @@
 #define FORBIDDEN_TITLE TITLE(FORBIDDEN_ERROR_MSG)
 #define NOT_FOUND_TITLE TITLE(NOT_FOUND_ERROR_MSG)
 #define PROXY_AUTH_REQUIRED_TITLE TITLE(PROXY_AUTH_REQUIRED_ERROR_MSG)
+#define CONFLICT_TITLE TITLE(CONFLICT_ERROR_MSG)
+#define PAYLOAD_TOO_LARGE_TITLE TITLE(PAYLOAD_TOO_LARGE_ERROR_MSG)
+#define RANGE_NOT_SATISFIABLE_TITLE TITLE(RANGE_NOT_SATISFIABLE_ERROR_MSG)
+#define TOO_MANY_REQUESTS_TITLE TITLE(TOO_MANY_REQUESTS_ERROR_MSG)
 #define INTERNAL_SERVER_ERROR_TITLE TITLE(INTERNAL_SERVER_ERROR_ERROR_MSG)
 #define NOT_IMPLEMENTED_TITLE TITLE(NOT_IMPLEMENTED_ERROR_MSG)
+#define BAD_GATEWAY_TITLE TITLE(BAD_GATEWAY_ERROR_MSG)
 #define SERVICE_UNAVAILABLE_TITLE TITLE(SERVICE_UNAVAILABLE_ERROR_MSG)
 #define HTTP_VERSION_NOT_SUPPORTED_TITLE TITLE(HTTP_VERSION_NOT_SUPPORTED_ERROR_MSG)
 
@@ -55,8 +65,13 @@ static constexpr const char kUnauthorized[] = HTML(UNAUTHORIZED_TITLE, ERROR_MSG
 static constexpr const char kForbidden[] = HTML(FORBIDDEN_TITLE, ERROR_MSG(FORBIDDEN_ERROR_MSG));
 static constexpr const char kNotFound[] = HTML(NOT_FOUND_TITLE, ERROR_MSG(NOT_FOUND_ERROR_MSG));
 static constexpr const char kProxyAuthRequired[] = HTML(PROXY_AUTH_REQUIRED_TITLE, ERROR_MSG(PROXY_AUTH_REQUIRED_ERROR_MSG));
+static constexpr const char kConflict[] = HTML(CONFLICT_TITLE, ERROR_MSG(CONFLICT_ERROR_MSG));
+static constexpr const char kPayloadTooLarge[] = HTML(PAYLOAD_TOO_LARGE_TITLE, ERROR_MSG(PAYLOAD_TOO_LARGE_ERROR_MSG));
+static constexpr const char kRangeNotSatisfiable[] = HTML(RANGE_NOT_SATISFIABLE_TITLE, ERROR_MSG(RANGE_NOT_SATISFIABLE_ERROR_MSG));
+static constexpr const char kTooManyRequests[] = HTML(TOO_MANY_REQUESTS_TITLE, ERROR_MSG(TOO_MANY_REQUESTS_ERROR_MSG));
 static constexpr const char kInternalServerError[] = HTML(INTERNAL_SERVER_ERROR_TITLE, ERROR_MSG(INTERNAL_SERVER_ERROR_ERROR_MSG));
 static constexpr const char kNotImplemented[] = HTML(NOT_IMPLEMENTED_TITLE, ERROR_MSG(NOT_IMPLEMENTED_ERROR_MSG));
+static constexpr const char kBadGateway[] = HTML(BAD_GATEWAY_TITLE, ERROR_MSG(BAD_GATEWAY_ERROR_MSG));
 static constexpr const char kServiceUnavailable[] = HTML(SERVICE_UNAVAILABLE_TITLE, ERROR_MSG(SERVICE_UNAVAILABLE_ERROR_MSG));
 static constexpr const char kHttpVersionNotSupported[] = HTML(HTTP_VERSION_NOT_SUPPORTED_TITLE, ERROR_MSG(HTTP_VERSION_NOT_SUPPORTED_ERROR_MSG));
 
@@ -74,10 +89,20 @@ std::string_view getDefaultErrorPage(const HttpStatusCode status_code)
         return kNotFound;
     case HttpStatusCode::PROXY_AUTH_REQUIRED:
         return kProxyAuthRequired;
+    case HttpStatusCode::CONFLICT:
+        return kConflict;
+    case HttpStatusCode::PAYLOAD_TOO_LARGE:
+        return kPayloadTooLarge;
+    case HttpStatusCode::RANGE_NOT_SATISFIABLE:
+        return kRangeNotSatisfiable;
+    case HttpStatusCode::TOO_MANY_REQUESTS:
+        return kTooManyRequests;
     case HttpStatusCode::INTERNAL_SERVER_ERROR:
         return kInternalServerError;
     case HttpStatusCode::NOT_IMPLEMENTED:
         return kNotImplemented;
+    case HttpStatusCode::BAD_GATEWAY:
+        return kBadGateway;
     case HttpStatusCode::SERVICE_UNAVAILABLE:
         return kServiceUnavailable;
     case HttpStatusCode::HTTP_VERSION_NOT_SUPPORTED:
@@ -157,6 +182,58 @@ std::string getErrorPageWithExtraMsg(const HttpStatusCode status_code, const std
                         BODY_END
                     HTML_END);
         break;
+    case HttpStatusCode::CONFLICT:
+        res.append(HTML_BEGIN
+                        CONFLICT_TITLE 
+                        BODY_BEGIN
+                            _H1(CONFLICT_ERROR_MSG)
+                            P_BEGIN
+                            )
+           .append(msg)
+           .append(
+                            P_END
+                        BODY_END
+                    HTML_END);
+        break;
+    case HttpStatusCode::PAYLOAD_TOO_LARGE:
+        res.append(HTML_BEGIN
+                        PAYLOAD_TOO_LARGE_TITLE 
+                        BODY_BEGIN
+                            _H1(PAYLOAD_TOO_LARGE_ERROR_MSG)
+                            P_BEGIN
+                            )
+           .append(msg)
+           .append(
+                            P_END
+                        BODY_END
+                    HTML_END);
+        break;
+    case HttpStatusCode::RANGE_NOT_SATISFIABLE:
+        res.append(HTML_BEGIN
+                        RANGE_NOT_SATISFIABLE_TITLE 
+                        BODY_BEGIN
+                            _H1(RANGE_NOT_SATISFIABLE_ERROR_MSG)
+                            P_BEGIN
+                            )
+           .append(msg)
+           .append(
+                            P_END
+                        BODY_END
+                    HTML_END);
+        break;
+    case HttpStatusCode::TOO_MANY_REQUESTS:
+        res.append(HTML_BEGIN
+                        TOO_MANY_REQUESTS_TITLE 
+                        BODY_BEGIN
+                            _H1(TOO_MANY_REQUESTS_ERROR_MSG)
+                            P_BEGIN
+                            )
+           .append(msg)
+           .append(
+                            P_END
+                        BODY_END
+                    HTML_END);
+        break;
     case HttpStatusCode::INTERNAL_SERVER_ERROR:
         res.append(HTML_BEGIN
                         INTERNAL_SERVER_ERROR_TITLE 
@@ -183,6 +260,19 @@ std::string getErrorPageWithExtraMsg(const HttpStatusCode status_code, const std
                         BODY_END
                     HTML_END);
         break;
+    case HttpStatusCode::BAD_GATEWAY:
+        res.append(HTML_BEGIN
+                        BAD_GATEWAY_TITLE 
+                        BODY_BEGIN
+                            _H1(BAD_GATEWAY_ERROR_MSG)
+                            P_BEGIN
+                            )
+           .append(msg)
+           .append(
+                            P_END
+                        BODY_END
+                    HTML_END);
+        break;
     case HttpStatusCode::SERVICE_UNAVAILABLE:
         res.append(HTML_BEGIN
                         SERVICE_UNAVAILABLE_TITLE 
@@ -0,0 +1,129 @@
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include <cerrno>
+#include <ctime>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "./DirectoryListing.h"
+#include "./OutputBuffer.h"
+#include "./Logger.h"
+#include "./util/utils.h"
+
+static void appendHtmlEscaped(std::string &out, std::string_view text)
+{
+    for (const char c : text)
+    {
+        switch (c)
+        {
+        case '&':
+            out.append("&amp;");
+            break;
+        case '<':
+            out.append("&lt;");
+            break;
+        case '>':
+            out.append("&gt;");
+            break;
+        case '"':
+            out.append("&quot;");
+            break;
+        default:
+            out.push_back(c);
+        }
+    }
+}
+
+// a file name as a relative URL path segment, RFC 3986 sec 2.1
+static void appendPercentEncoded(std::string &out, std::string_view name)
+{
+    static constexpr char kHexDigits[] = "0123456789ABCDEF";
+    for (const char c : name)
+    {
+        const auto byte = static_cast<unsigned char>(c);
+        if ((byte >= 'a' && byte <= 'z') || (byte >= 'A' && byte <= 'Z') || (byte >= '0' && byte <= '9') ||
+            byte == '-' || byte == '.' || byte == '_' || byte == '~')
+            out.push_back(c);
+        else
+            out.append({'%', kHexDigits[byte >> 4], kHexDigits[byte & 0xf]});
+    }
+}
+
+std::unique_ptr<DirectoryListing> DirectoryListing::open(const std::string &path, std::string_view url)
+{
+    DIR *dir = ::opendir(path.c_str());
+    if (dir == nullptr)
+        return nullptr;
+    return std::unique_ptr<DirectoryListing>(new DirectoryListing(dir, url));
+}
+
+void DirectoryListing::appendEntry(std::string &out, std::string_view name, const struct stat &entry_stat)
+{
+    const bool is_dir = S_ISDIR(entry_stat.st_mode);
+    out.append("<tr><td><a href=\"");
+    appendPercentEncoded(out, name);
+    if (is_dir)
+        out.push_back('/');
+    out.append("\">");
+    appendHtmlEscaped(out, name);
+    if (is_dir)
+        out.push_back('/');
+    out.append("</a></td><td>");
+
+    std::tm tm;
+    char date[32];
+    if (gmtime_r(&entry_stat.st_mtim.tv_sec, &tm) && std::strftime(date, sizeof(date), "%Y-%m-%d %H:%M", &tm) > 0)
+        out.append(date);
+    out.append("</td><td align=\"right\">");
+    if (is_dir)
+        out.push_back('-');
+    else
+        out.append(lexicalCast(entry_stat.st_size));
+    out.append("</td></tr>\n");
+}
+
+ResponseStream::Result DirectoryListing::fill(OutputBuffer &out, std::size_t max_bytes)
+{
+    std::string piece;
+    piece.reserve(max_bytes + 512);
+    if (!is_head_sent_)
+    {
+        piece.append("<!DOCTYPE html>\n<html><head><meta charset=\"utf-8\"><title>Index of ");
+        appendHtmlEscaped(piece, url_);
+        piece.append("</title></head><body><h1>Index of ");
+        appendHtmlEscaped(piece, url_);
+        piece.append("</h1><hr><table>\n<tr><td><a href=\"../\">../</a></td><td></td><td></td></tr>\n");
+        is_head_sent_ = true;
+    }
+
+    while (piece.size() < max_bytes)
+    {
+        errno = 0;
+        const dirent *entry = ::readdir(dir_.get());
+        if (entry == nullptr)
+        {
+            if (errno != 0)
+            {
+                LOG_WARNING("Failed to read directory ", url_, ", reason: ", logErrStr(errno));
+                return Result::FAILED;
+            }
+            piece.append("</table><hr></body></html>\n");
+            out.append(std::move(piece));
+            return Result::DONE;
+        }
+        // ".", ".." and hidden files
+        if (entry->d_name[0] == '.')
+            continue;
+        // an entry that vanished meanwhile or a dangling link is left out
+        struct stat entry_stat;
+        if (::fstatat(::dirfd(dir_.get()), entry->d_name, &entry_stat, 0) == -1)
+            continue;
+        appendEntry(piece, entry->d_name, entry_stat);
+    }
+    out.append(std::move(piece));
+    return Result::MORE;
+}
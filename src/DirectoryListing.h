@@ -0,0 +1,38 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "./ResponseStream.h"
+
+// The HTML index of a directory, made while it is sent: entries are read and
+// stat'ed one piece at a time, so a directory with many entries neither waits
+// for all of them before the first byte nor holds them in memory. Entries
+// come in directory order, subdirectories end with '/', dot files are left
+// out.
+class DirectoryListing : public ResponseStream
+{
+public:
+    // url names the directory and ends with '/'; nullptr with errno set if path cannot be opened
+    [[nodiscard]] static std::unique_ptr<DirectoryListing> open(const std::string &path, std::string_view url);
+
+    [[nodiscard]] Result fill(OutputBuffer &out, std::size_t max_bytes) override;
+
+private:
+    struct DirCloser
+    {
+        void operator()(DIR *dir) const noexcept { ::closedir(dir); }
+    };
+
+    std::unique_ptr<DIR, DirCloser> dir_;
+    std::string url_;
+    bool is_head_sent_{false};
+
+    DirectoryListing(DIR *dir, std::string_view url) : dir_(dir), url_(url) {}
+
+    static void appendEntry(std::string &out, std::string_view name, const struct stat &entry_stat);
+};
@@ -0,0 +1,71 @@
+#include <algorithm>
+#include <string>
+#include <string_view>
+
+#include <cstdint>
+
+#include <sys/stat.h>
+
+#include "./ETag.h"
+
+static void appendHex(std::string &str, uint64_t num)
+{
+    static constexpr char kHexDigits[] = "0123456789abcdef";
+    const auto prev_size = str.size();
+    do
+    {
+        str.push_back(kHexDigits[num & 0xf]);
+        num >>= 4;
+    } while (num);
+    std::reverse(str.begin() + prev_size, str.end());
+}
+
+static std::string_view trimOWS(std::string_view sv)
+{
+    while (!sv.empty() && (sv.front() == ' ' || sv.front() == '\t'))
+        sv.remove_prefix(1);
+    while (!sv.empty() && (sv.back() == ' ' || sv.back() == '\t'))
+        sv.remove_suffix(1);
+    return sv;
+}
+
+std::string makeETag(const struct stat &file_stat, ContentEncoding encoding)
+{
+    std::string etag("\"");
+    etag.reserve(48);
+    appendHex(etag, file_stat.st_ino);
+    etag.push_back('-');
+    appendHex(etag, file_stat.st_size);
+    etag.push_back('-');
+    appendHex(etag, static_cast<uint64_t>(file_stat.st_mtim.tv_sec) * 1'000'000'000ull + file_stat.st_mtim.tv_nsec);
+    if (encoding != ContentEncoding::IDENTITY)
+        etag.append("-").append(kContentEncodingStr[static_cast<int>(encoding)]);
+    etag.push_back('"');
+    return etag;
+}
+
+bool isETagListMatched(std::string_view header, std::string_view etag)
+{
+    header = trimOWS(header);
+    if (header == "*")
+        return true;
+
+    while (!header.empty())
+    {
+        const auto comma_pos = header.find(',');
+        auto tag = trimOWS(header.substr(0, comma_pos));
+        if (tag.size() > 2 && tag[0] == 'W' && tag[1] == '/')
+            tag.remove_prefix(2);
+        if (tag == etag)
+            return true;
+        if (comma_pos == std::string_view::npos)
+            break;
+        header.remove_prefix(comma_pos + 1);
+    }
+    return false;
+}
+
+bool isETagStrongMatched(std::string_view header_etag, std::string_view etag)
+{
+    return trimOWS(header_etag) == etag;
+}
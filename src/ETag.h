@@ -0,0 +1,18 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+#include <sys/stat.h>
+
+#include "./ContentEncoding.h"
+
+// strong entity-tag of a file representation, "<inode>-<size>-<mtime>[-<coding>]"
+// in hex. Each content-coding is a different representation and gets its own tag.
+std::string makeETag(const struct stat &file_stat, ContentEncoding encoding);
+
+// If-None-Match = "*" / 1#entity-tag # rfc7232 sec:3.2, weak comparison
+bool isETagListMatched(std::string_view header, std::string_view etag);
+
+// strong comparison, a weak entity-tag never matches
+bool isETagStrongMatched(std::string_view header_etag, std::string_view etag);
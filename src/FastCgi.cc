@@ -0,0 +1,148 @@
+#include <algorithm>
+#include <string>
+#include <string_view>
+
+#include <cerrno>
+
+#include "./FastCgi.h"
+#include "./Proxy.h"
+#include "./Logger.h"
+
+int FastCgi::findOrAddBackend(const std::string &name)
+{
+    for (std::size_t i = 0; i < backends_.size(); i++)
+        if (backends_[i]->name == name)
+            return i;
+    auto backend = std::make_unique<Backend>();
+    if (!Proxy::parseAddress(name, backend->addr, backend->addr_len))
+        return -1;
+    backend->name = name;
+    backends_.push_back(std::move(backend));
+    return backends_.size() - 1;
+}
+
+static bool isExtension(std::string_view pattern)
+{
+    return pattern.size() > 2 && pattern[0] == '*' && pattern[1] == '.';
+}
+
+bool FastCgi::addRoute(std::string_view pattern, const std::vector<std::string> &backends)
+{
+    if ((pattern.empty() || pattern.front() != '/') && !isExtension(pattern))
+    {
+        LOG_ERROR("FastCGI pattern must be a prefix starting with '/' or \"*.ext\", pattern = ", pattern);
+        return false;
+    }
+    if (backends.empty())
+    {
+        LOG_ERROR("FastCGI pattern without backends, pattern = ", pattern);
+        return false;
+    }
+    Route route;
+    route.pattern = std::string(pattern);
+    for (const auto &name : backends)
+    {
+        const int index = findOrAddBackend(name);
+        if (index == -1)
+        {
+            LOG_ERROR("Invalid FastCGI backend address ", name, " for ", pattern);
+            return false;
+        }
+        route.backends.push_back(index);
+    }
+    routes_.push_back(std::move(route));
+    std::stable_sort(routes_.begin(), routes_.end(), [](const Route &lhs, const Route &rhs)
+                     {
+                         const bool is_lhs_prefix = !isExtension(lhs.pattern), is_rhs_prefix = !isExtension(rhs.pattern);
+                         if (is_lhs_prefix != is_rhs_prefix)
+                             return is_lhs_prefix;
+                         return is_lhs_prefix && lhs.pattern.size() > rhs.pattern.size(); });
+    return true;
+}
+
+const FastCgi::Route *FastCgi::match(std::string_view url) const noexcept
+{
+    for (const auto &route : routes_)
+    {
+        if (isExtension(route.pattern))
+        {
+            const auto extension = std::string_view(route.pattern).substr(1);
+            if (url.size() > extension.size() && url.substr(url.size() - extension.size()) == extension)
+                return &route;
+        }
+        else if (url.substr(0, route.pattern.size()) == route.pattern)
+            return &route;
+    }
+    return nullptr;
+}
+
+int FastCgi::pick(const Route &route, int skip) noexcept
+{
+    const auto count = route.backends.size();
+    const auto start = next_.fetch_add(1, std::memory_order_relaxed);
+    int best = -1, best_outstanding = 0;
+    for (std::size_t i = 0; i < count; i++)
+    {
+        const int index = route.backends[(start + i) % count];
+        if (index == skip && count > 1)
+            continue;
+        const int outstanding = backends_[index]->outstanding.load(std::memory_order_relaxed);
+        if (best == -1 || outstanding < best_outstanding)
+        {
+            best = index;
+            best_outstanding = outstanding;
+        }
+    }
+    return best;
+}
+
+int FastCgi::connectTo(int index) const
+{
+    const auto &backend = *backends_[index];
+    const int fd = Proxy::connectNonBlocking(backend.addr, backend.addr_len);
+    if (fd == -1)
+    {
+        // EAGAIN (a full Unix socket backlog) is told apart by the caller
+        const int saved_errno = errno;
+        LOG_WARNING("Failed to connect to FastCGI backend ", backend.name, ", reason: ", logErrStr(errno));
+        errno = saved_errno;
+    }
+    return fd;
+}
+
+static void appendLength(std::string &out, std::size_t length)
+{
+    // one byte below 128, else four with the high bit set
+    if (length < 128)
+    {
+        out.push_back(static_cast<char>(length));
+        return;
+    }
+    out.push_back(static_cast<char>((length >> 24) | 0x80));
+    out.push_back(static_cast<char>(length >> 16));
+    out.push_back(static_cast<char>(length >> 8));
+    out.push_back(static_cast<char>(length));
+}
+
+void FastCgi::appendParam(std::string &params, std::string_view name, std::string_view value)
+{
+    appendLength(params, name.size());
+    appendLength(params, value.size());
+    params.append(name).append(value);
+}
+
+std::string FastCgi::report() const
+{
+    std::string res;
+    for (const auto &backend : backends_)
+    {
+        res.append(logstr("fastcgi backend=", backend->name,
+                          " outstanding=", backend->outstanding.load(std::memory_order_relaxed),
+                          " requests=", backend->requests.load(std::memory_order_relaxed),
+                          " connects=", backend->connects.load(std::memory_order_relaxed),
+                          " multiplexed=", backend->multiplexed.load(std::memory_order_relaxed),
+                          " aborts=", backend->aborts.load(std::memory_order_relaxed),
+                          " failures=", backend->failures.load(std::memory_order_relaxed), "\n"));
+    }
+    return res;
+}
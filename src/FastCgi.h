@@ -0,0 +1,79 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <cinttypes>
+
+#include <sys/socket.h>
+
+#include "./util/Singleton.h"
+
+// FastCGI setup shared by the workers: URL patterns served by pools of
+// FastCGI responders (php-fpm and the like, TCP or Unix socket) and their
+// counters. Each worker keeps its own persistent connections to them, see
+// FastCgiPool.h; a request is run by FastCgiExchange.h.
+//
+// A pattern is a URL prefix ("/cgi-bin/") or an extension ("*.php"),
+// prefixes are tried longest first, then extensions. A request goes to the
+// backend of its pattern with the fewest outstanding requests.
+class FastCgi : public Singleton<FastCgi>
+{
+public:
+    struct Backend
+    {
+        std::string name; // as configured, "127.0.0.1:9000" or "unix:/run/php-fpm.sock"
+        sockaddr_storage addr;
+        socklen_t addr_len;
+
+        std::atomic<int> outstanding{0};
+
+        // statistics
+        std::atomic<uint64_t> requests{0};
+        std::atomic<uint64_t> connects{0};
+        std::atomic<uint64_t> multiplexed{0}; // requests that shared their connection with another
+        std::atomic<uint64_t> aborts{0};      // FCGI_ABORT_REQUEST for clients that went away
+        std::atomic<uint64_t> failures{0};
+    };
+
+    struct Route
+    {
+        std::string pattern; // "/prefix" or "*.ext"
+        std::vector<int> backends;
+    };
+
+    // false (logged) if a backend address cannot be resolved
+    bool addRoute(std::string_view pattern, const std::vector<std::string> &backends);
+    // between two records of a request
+    void setTimeout(int ms) noexcept { timeout_ms_ = ms; }
+    [[nodiscard]] int timeout() const noexcept { return timeout_ms_; }
+    [[nodiscard]] bool empty() const noexcept { return routes_.empty(); }
+
+    // the route of url, nullptr if none
+    [[nodiscard]] const Route *match(std::string_view url) const noexcept;
+    // the backend for the next request of route, other than skip if there is another
+    [[nodiscard]] int pick(const Route &route, int skip = -1) noexcept;
+    [[nodiscard]] Backend &backend(int index) noexcept { return *backends_[index]; }
+    [[nodiscard]] std::size_t backendCount() const noexcept { return backends_.size(); }
+
+    // a nonblocking socket connecting to the backend, -1 on errors
+    [[nodiscard]] int connectTo(int index) const;
+
+    [[nodiscard]] std::string report() const;
+
+    // a name-value pair of FCGI_PARAMS or FCGI_GET_VALUES
+    static void appendParam(std::string &params, std::string_view name, std::string_view value);
+
+private:
+    std::vector<Route> routes_; // prefixes, longest first, then extensions
+    std::vector<std::unique_ptr<Backend>> backends_;
+    std::atomic<unsigned> next_{0}; // where pick() starts, spreads ties
+
+    int timeout_ms_{60000};
+
+    // the backend's index, adding it if it is new, -1 if name is no address
+    int findOrAddBackend(const std::string &name);
+};
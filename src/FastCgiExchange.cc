@@ -0,0 +1,375 @@
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <string>
+#include <string_view>
+
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "./FastCgiExchange.h"
+#include "./HttpParser.h"
+#include "./OutputBuffer.h"
+#include "./RequestBody.h"
+#include "./Logger.h"
+#include "./util/utils.h"
+#include "./util/Ascii.h"
+
+// FCGI_END_REQUEST protocol status of a backend without room for the request
+static constexpr int kOverloaded = 2;
+
+// CGI response fields that describe the connection to the backend, not the response
+static bool isHopByHop(std::string_view name)
+{
+    static constexpr std::string_view kNames[] = {"Connection", "Keep-Alive", "Proxy-Connection", "TE",
+                                                  "Transfer-Encoding", "Upgrade"};
+    for (const auto kName : kNames)
+        if (equalsIgnoreCase(name, kName))
+            return true;
+    return false;
+}
+
+// the address and port of the peer or the local end of fd, unchanged for Unix sockets
+static void socketName(int fd, bool is_peer, std::string &addr, std::string &port)
+{
+    sockaddr_storage storage;
+    socklen_t storage_len = sizeof(storage);
+    auto *sa = reinterpret_cast<sockaddr *>(&storage);
+    if ((is_peer ? getpeername(fd, sa, &storage_len) : getsockname(fd, sa, &storage_len)) == -1)
+        return;
+    std::array<char, INET6_ADDRSTRLEN> name;
+    if (storage.ss_family == AF_INET)
+    {
+        const auto &in = reinterpret_cast<const sockaddr_in &>(storage);
+        if (inet_ntop(AF_INET, &in.sin_addr, name.data(), name.size()))
+            addr = name.data();
+        port = lexicalCast(ntohs(in.sin_port));
+    }
+    else if (storage.ss_family == AF_INET6)
+    {
+        const auto &in6 = reinterpret_cast<const sockaddr_in6 &>(storage);
+        if (inet_ntop(AF_INET6, &in6.sin6_addr, name.data(), name.size()))
+            addr = name.data();
+        port = lexicalCast(ntohs(in6.sin6_port));
+    }
+}
+
+// a "/../" segment would name a script outside the root
+static bool hasDotDotSegment(std::string_view url)
+{
+    for (std::size_t pos = url.find(".."); pos != std::string_view::npos; pos = url.find("..", pos + 2))
+        if (url[pos - 1] == '/' && (pos + 2 == url.size() || url[pos + 2] == '/'))
+            return true;
+    return false;
+}
+
+FastCgiExchange::~FastCgiExchange()
+{
+    if (request_)
+        pool_.end(request_);
+}
+
+bool FastCgiExchange::start(const HttpParser &request, const RequestBody &body, std::string_view root_dir,
+                            bool is_https, std::string_view client_keep_alive)
+{
+    const auto url = request.url();
+    if (url.empty() || url.front() != '/' || hasDotDotSegment(url))
+        return false;
+
+    const auto method = request.method();
+    is_idempotent_ = method != HttpMethod::POST && method != HttpMethod::PATCH && method != HttpMethod::CONNECT;
+    is_head_request_ = method == HttpMethod::HEAD;
+    is_client_http11_ = request.version() == HttpVersion::HTTP11;
+    is_client_keep_alive_ = !client_keep_alive.empty();
+    client_keep_alive_.assign(client_keep_alive);
+    body_ = &body;
+
+    // RFC 3875 sec 4.1, with the names PHP and the like expect
+    std::string remote_addr, remote_port, server_addr, server_port;
+    socketName(client_fd_, true, remote_addr, remote_port);
+    socketName(client_fd_, false, server_addr, server_port);
+    auto server_name = request.header(HttpHeader::HOST);
+    if (const auto colon = server_name.rfind(':'); colon != std::string_view::npos && server_name.back() != ']')
+        server_name = server_name.substr(0, colon);
+
+    params_.clear();
+    FastCgi::appendParam(params_, "GATEWAY_INTERFACE", "CGI/1.1");
+    FastCgi::appendParam(params_, "SERVER_SOFTWARE", "WebServer");
+    FastCgi::appendParam(params_, "SERVER_PROTOCOL", is_client_http11_ ? "HTTP/1.1" : "HTTP/1.0");
+    FastCgi::appendParam(params_, "REQUEST_METHOD", kHttpMethodStr[static_cast<int>(method)]);
+    FastCgi::appendParam(params_, "REQUEST_URI", request.hasQuery() ? std::string(url).append("?").append(request.query()) : std::string(url));
+    FastCgi::appendParam(params_, "SCRIPT_NAME", url);
+    FastCgi::appendParam(params_, "SCRIPT_FILENAME", std::string(root_dir).append(url));
+    FastCgi::appendParam(params_, "DOCUMENT_ROOT", root_dir);
+    FastCgi::appendParam(params_, "QUERY_STRING", request.query());
+    FastCgi::appendParam(params_, "REMOTE_ADDR", remote_addr);
+    FastCgi::appendParam(params_, "REMOTE_PORT", remote_port);
+    FastCgi::appendParam(params_, "SERVER_ADDR", server_addr);
+    FastCgi::appendParam(params_, "SERVER_PORT", server_port);
+    FastCgi::appendParam(params_, "SERVER_NAME", server_name.empty() ? std::string_view(server_addr) : server_name);
+    // php-cgi refuses requests without it (cgi.force_redirect)
+    FastCgi::appendParam(params_, "REDIRECT_STATUS", "200");
+    if (is_https)
+        FastCgi::appendParam(params_, "HTTPS", "on");
+    if (body.size() != 0 || method == HttpMethod::POST || method == HttpMethod::PUT || method == HttpMethod::PATCH)
+        FastCgi::appendParam(params_, "CONTENT_LENGTH", lexicalCast(body.size()));
+    if (const auto content_type = request.header(HttpHeader::CONTENT_TYPE); !content_type.empty())
+        FastCgi::appendParam(params_, "CONTENT_TYPE", content_type);
+
+    std::string name;
+    const auto appendHeader = [this, &name](std::string_view key, std::string_view value)
+    {
+        // "Proxy" would become HTTP_PROXY, which scripts take for their outgoing proxy (httpoxy)
+        if (equalsIgnoreCase(key, "Content-Length") || equalsIgnoreCase(key, "Content-Type") || equalsIgnoreCase(key, "Proxy"))
+            return;
+        name.assign("HTTP_");
+        for (const char c : key)
+            name.push_back(c == '-' ? '_' : static_cast<char>(std::toupper(static_cast<unsigned char>(c))));
+        FastCgi::appendParam(params_, name, value);
+    };
+    request.forEachHeader(appendHeader);
+    return true;
+}
+
+bool FastCgiExchange::begin()
+{
+    auto &fastcgi = FastCgi::instance();
+    while (true)
+    {
+        const int backend = fastcgi.pick(route_, failed_backend_);
+        request_ = pool_.begin(backend, client_fd_, params_, *body_);
+        if (request_)
+            return true;
+        const bool is_busy = errno == EAGAIN;
+        fastcgi.backend(backend).failures.fetch_add(1, std::memory_order_relaxed);
+        error_status_ = is_busy ? HttpStatusCode::SERVICE_UNAVAILABLE : HttpStatusCode::BAD_GATEWAY;
+        // a backend that does not connect leaves its turn to another one
+        if (is_busy || ++attempts_ >= kMaxAttempts)
+            return false;
+        failed_backend_ = backend;
+    }
+}
+
+FastCgiExchange::Result FastCgiExchange::retryOrFail()
+{
+    const int protocol_status = request_->protocol_status;
+    const int backend = request_->backend;
+    const bool is_unconnected = request_->is_unconnected;
+    // a refused request never ran, a reused connection may have been closed by the backend meanwhile
+    const bool is_retryable = is_unconnected || protocol_status != 0 || (request_->is_reused && is_idempotent_);
+    pool_.end(request_);
+    request_.reset();
+    if (is_retryable && ++attempts_ < kMaxAttempts)
+    {
+        // a backend that does not connect or is overloaded leaves its turn to another one
+        failed_backend_ = is_unconnected || protocol_status == kOverloaded ? backend : -1;
+        return begin() ? Result::WAIT_CLIENT : Result::FAILED;
+    }
+    error_status_ = protocol_status == kOverloaded ? HttpStatusCode::SERVICE_UNAVAILABLE : HttpStatusCode::BAD_GATEWAY;
+    return Result::FAILED;
+}
+
+FastCgiExchange::Result FastCgiExchange::resume(OutputBuffer &output)
+{
+    if (!request_ && !begin())
+        return Result::FAILED;
+
+    while (true)
+    {
+        data_.clear();
+        switch (pool_.take(request_, data_))
+        {
+        case FastCgiPool::Status::WAITING:
+            return Result::WAIT_BACKEND;
+        case FastCgiPool::Status::ENDED:
+            if (!is_head_done_)
+            {
+                LOG_WARNING("FastCGI response without a complete head from ", FastCgi::instance().backend(request_->backend).name);
+                error_status_ = HttpStatusCode::BAD_GATEWAY;
+                return Result::FAILED;
+            }
+            // a Content-Length the script did not keep; the client finds out by the close
+            if (body_mode_ == BodyMode::LENGTH && body_left_ != 0)
+                return Result::ABORTED;
+            if (body_mode_ == BodyMode::CHUNKED)
+                output.append("0\r\n\r\n");
+            return Result::DONE;
+        case FastCgiPool::Status::FAILED:
+            if (!is_head_done_ && head_.empty())
+            {
+                if (const auto res = retryOrFail(); res != Result::WAIT_CLIENT)
+                    return res;
+                continue;
+            }
+            if (!is_head_done_)
+            {
+                error_status_ = HttpStatusCode::BAD_GATEWAY;
+                return Result::FAILED;
+            }
+            return Result::ABORTED;
+        case FastCgiPool::Status::DATA:
+            break;
+        }
+
+        if (!is_head_done_)
+        {
+            head_.append(data_);
+            data_.clear();
+            // the head ends with an empty line, its lines end with LF or CRLF
+            for (auto end = head_.find('\n', head_scanned_); end != std::string::npos; end = head_.find('\n', head_scanned_))
+            {
+                const auto line_size = end - head_scanned_;
+                if (line_size == 0 || (line_size == 1 && head_[head_scanned_] == '\r'))
+                {
+                    if (!forwardHead(end + 1, output))
+                    {
+                        LOG_WARNING("Invalid FastCGI response head from ", FastCgi::instance().backend(request_->backend).name);
+                        error_status_ = HttpStatusCode::BAD_GATEWAY;
+                        return Result::FAILED;
+                    }
+                    is_head_done_ = true;
+                    data_.assign(head_, end + 1);
+                    head_ = std::string();
+                    break;
+                }
+                head_scanned_ = end + 1;
+            }
+            if (!is_head_done_)
+            {
+                if (head_.size() < kMaxHeadSize)
+                    continue;
+                LOG_WARNING("FastCGI response head from ", FastCgi::instance().backend(request_->backend).name, " is too long");
+                error_status_ = HttpStatusCode::BAD_GATEWAY;
+                return Result::FAILED;
+            }
+        }
+        forwardBody(data_, output);
+        if (!output.empty())
+            return Result::WAIT_CLIENT;
+    }
+}
+
+bool FastCgiExchange::forwardHead(std::size_t head_length, OutputBuffer &output)
+{
+    std::string_view lines(head_.data(), head_length);
+    int status = 200;
+    std::string_view reason = "OK";
+    bool has_status = false, has_location = false;
+    long long content_length = -1;
+    std::string fields;
+    while (!lines.empty())
+    {
+        auto line = lines.substr(0, lines.find('\n'));
+        lines.remove_prefix(std::min(lines.size(), line.size() + 1));
+        if (!line.empty() && line.back() == '\r')
+            line.remove_suffix(1);
+        if (line.empty())
+            break;
+        const auto colon = line.find(':');
+        if (colon == std::string_view::npos || colon == 0)
+            return false;
+        const auto name = line.substr(0, colon);
+        auto value = line.substr(colon + 1);
+        while (!value.empty() && (value.front() == ' ' || value.front() == '\t'))
+            value.remove_prefix(1);
+        while (!value.empty() && (value.back() == ' ' || value.back() == '\t'))
+            value.remove_suffix(1);
+
+        if (equalsIgnoreCase(name, "Status"))
+        {
+            // "404" or "404 Not Found"
+            if (value.size() < 3 || (value.size() > 3 && value[3] != ' ') ||
+                std::from_chars(value.data(), value.data() + 3, status).ptr != value.data() + 3 || status < 200)
+                return false;
+            reason = value.size() > 4 ? value.substr(4) : std::string_view();
+            has_status = true;
+        }
+        else if (equalsIgnoreCase(name, "Content-Length"))
+        {
+            char *end;
+            const auto length = std::strtoll(value.data(), &end, 10);
+            if (end != value.data() + value.size() || value.empty() || length < 0)
+                return false;
+            content_length = length;
+        }
+        else if (!isHopByHop(name))
+        {
+            has_location = has_location || equalsIgnoreCase(name, "Location");
+            fields.append(name).append(": ").append(value).append("\r\n");
+        }
+    }
+    // a Location without a Status is a client redirect, RFC 3875 sec 6.2.4
+    if (!has_status && has_location)
+    {
+        status = 302;
+        reason = "Found";
+    }
+
+    std::string out_head = std::string("HTTP/1.1 ").append(lexicalCast(status)).append(" ").append(reason).append("\r\n").append(fields);
+    if (is_head_request_ || status == 204 || status == 304)
+    {
+        body_mode_ = BodyMode::NONE;
+        if (content_length != -1 && is_head_request_)
+            out_head.append("Content-Length: ").append(lexicalCast(content_length)).append("\r\n");
+    }
+    else if (content_length != -1)
+    {
+        body_mode_ = BodyMode::LENGTH;
+        body_left_ = content_length;
+        out_head.append("Content-Length: ").append(lexicalCast(content_length)).append("\r\n");
+    }
+    else if (is_client_http11_)
+    {
+        body_mode_ = BodyMode::CHUNKED;
+        out_head.append("Transfer-Encoding: chunked\r\n");
+    }
+    else
+    {
+        body_mode_ = BodyMode::UNTIL_CLOSE;
+        is_client_keep_alive_ = false;
+    }
+    if (is_client_keep_alive_)
+        out_head.append("Connection: keep-alive\r\nKeep-Alive: ").append(client_keep_alive_).append("\r\n\r\n");
+    else
+        out_head.append("Connection: close\r\n\r\n");
+    output.append(std::move(out_head));
+    return true;
+}
+
+void FastCgiExchange::forwardBody(std::string &data, OutputBuffer &output)
+{
+    if (data.empty())
+        return;
+    switch (body_mode_)
+    {
+    case BodyMode::NONE:
+        return;
+    case BodyMode::LENGTH:
+        // what goes past Content-Length is dropped
+        if (data.size() > body_left_)
+            data.resize(body_left_);
+        body_left_ -= data.size();
+        if (!data.empty())
+            output.append(std::move(data));
+        return;
+    case BodyMode::CHUNKED:
+    {
+        std::array<char, 20> size_line;
+        auto *end = std::to_chars(size_line.data(), size_line.data() + size_line.size() - 2, data.size(), 16).ptr;
+        *end++ = '\r';
+        *end++ = '\n';
+        output.append(std::string(size_line.data(), end));
+        output.append(std::move(data));
+        output.append("\r\n");
+        return;
+    }
+    case BodyMode::UNTIL_CLOSE:
+        output.append(std::move(data));
+        return;
+    }
+}
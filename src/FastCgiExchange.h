@@ -0,0 +1,99 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+#include <cinttypes>
+
+#include "./FastCgi.h"
+#include "./FastCgiPool.h"
+#include "./HttpTypes.h"
+#include "./util/Noncopyable.h"
+
+class HttpParser;
+class OutputBuffer;
+class RequestBody;
+
+// One request run by a FastCGI responder, its stdout streamed back as the
+// HTTP response. The HttpContext drives it from the pool threads like a
+// ProxyExchange: resume() moves the stdout queued by the FastCgiPool into
+// the output until there is none, then the context sends the output, or
+// waits to be woken by the pool (wait()) if everything was sent.
+//
+// The CGI head of the stdout (Status, Location, Content-Length and the other
+// headers, RFC 3875 sec 6) becomes the response head. A body without
+// Content-Length is sent chunked to HTTP/1.1 clients and ended by close for
+// HTTP/1.0 ones. A request on a reused connection that broke before any
+// stdout is sent again once on a new one if it is idempotent.
+class FastCgiExchange : NonCopyable
+{
+public:
+    enum class Result
+    {
+        WAIT_BACKEND, // wait() once the output is sent
+        WAIT_CLIENT,  // resume() once the output is sent
+        DONE,         // the whole response is in the output
+        FAILED,       // nothing went to the client, answer with errorStatus()
+        ABORTED,      // the response broke off, close the client
+    };
+
+    FastCgiExchange(FastCgiPool &pool, const FastCgi::Route &route, int client_fd)
+        : pool_(pool), route_(route), client_fd_(client_fd) {}
+    ~FastCgiExchange();
+
+    // body is complete and stays valid until the exchange ends, root_dir holds the scripts;
+    // client_keep_alive is the Keep-Alive value of the response, empty if the client
+    // connection closes after it; false if the URL cannot name a script there
+    [[nodiscard]] bool start(const HttpParser &request, const RequestBody &body, std::string_view root_dir,
+                             bool is_https, std::string_view client_keep_alive);
+    [[nodiscard]] Result resume(OutputBuffer &output);
+    // false if stdout came meanwhile, resume() again
+    [[nodiscard]] bool wait() { return pool_.wait(request_); }
+
+    // after DONE, false if the response ends with the connection
+    [[nodiscard]] bool isClientKeepAlive() const noexcept { return is_client_keep_alive_; }
+    [[nodiscard]] HttpStatusCode errorStatus() const noexcept { return error_status_; }
+
+private:
+    static constexpr std::size_t kMaxHeadSize = 64 * 1024;
+    static constexpr int kMaxAttempts = 2;
+
+    enum class BodyMode
+    {
+        NONE,
+        LENGTH,
+        CHUNKED,
+        UNTIL_CLOSE,
+    };
+
+    FastCgiPool &pool_;
+    const FastCgi::Route &route_;
+    const int client_fd_;
+    const RequestBody *body_{nullptr};
+    std::string params_;
+    FastCgiPool::RequestPtr request_;
+    int attempts_{0};
+    int failed_backend_{-1};
+    HttpStatusCode error_status_{HttpStatusCode::BAD_GATEWAY};
+
+    bool is_idempotent_{false};
+    bool is_head_request_{false};
+    bool is_client_http11_{true};
+    bool is_client_keep_alive_{false};
+    std::string client_keep_alive_;
+
+    std::string head_;           // stdout until the end of the CGI head
+    std::size_t head_scanned_{0}; // the lines before are not the end
+    bool is_head_done_{false};
+    std::string data_;           // taken from the pool
+    BodyMode body_mode_{BodyMode::NONE};
+    uint64_t body_left_{0};
+
+    // the request goes to a backend, false if none takes it
+    [[nodiscard]] bool begin();
+    // a failed request before its head: another attempt, or FAILED
+    [[nodiscard]] Result retryOrFail();
+    // the CGI head is head_[0, head_length), false if it is malformed
+    [[nodiscard]] bool forwardHead(std::size_t head_length, OutputBuffer &output);
+    void forwardBody(std::string &data, OutputBuffer &output);
+};
@@ -0,0 +1,463 @@
+#include <algorithm>
+#include <array>
+#include <string>
+#include <string_view>
+
+#include <cerrno>
+#include <cstdlib>
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "./FastCgiPool.h"
+#include "./FastCgi.h"
+#include "./RequestBody.h"
+#include "./Logger.h"
+#include "./util/utils.h"
+
+// FastCGI 1.0 record types and constants
+static constexpr uint8_t kVersion = 1;
+static constexpr uint8_t kBeginRequest = 1;
+static constexpr uint8_t kAbortRequest = 2;
+static constexpr uint8_t kEndRequest = 3;
+static constexpr uint8_t kParams = 4;
+static constexpr uint8_t kStdin = 5;
+static constexpr uint8_t kStdout = 6;
+static constexpr uint8_t kStderr = 7;
+static constexpr uint8_t kGetValues = 9;
+static constexpr uint8_t kGetValuesResult = 10;
+static constexpr uint16_t kResponder = 1;
+static constexpr uint8_t kKeepConn = 1;
+static constexpr std::size_t kHeaderSize = 8;
+static constexpr std::size_t kMaxContentSize = 65535;
+
+static void appendRecord(std::string &out, uint8_t type, uint16_t id, std::string_view content)
+{
+    const char header[kHeaderSize] = {static_cast<char>(kVersion), static_cast<char>(type),
+                                      static_cast<char>(id >> 8), static_cast<char>(id),
+                                      static_cast<char>(content.size() >> 8), static_cast<char>(content.size()), 0, 0};
+    out.append(header, kHeaderSize).append(content);
+}
+
+// content in records of up to kMaxContentSize, then the empty record ending the stream
+static void appendStream(std::string &out, uint8_t type, uint16_t id, std::string_view content)
+{
+    while (!content.empty())
+    {
+        const auto size = std::min(content.size(), kMaxContentSize);
+        appendRecord(out, type, id, content.substr(0, size));
+        content.remove_prefix(size);
+    }
+    appendRecord(out, type, id, {});
+}
+
+// a name-value pair of FCGI_GET_VALUES_RESULT, false at the end or if it is malformed
+static bool readParam(std::string_view &in, std::string_view &name, std::string_view &value)
+{
+    std::size_t lengths[2];
+    for (auto &length : lengths)
+    {
+        if (in.empty())
+            return false;
+        const auto first = static_cast<uint8_t>(in[0]);
+        if (first < 128)
+        {
+            length = first;
+            in.remove_prefix(1);
+            continue;
+        }
+        if (in.size() < 4)
+            return false;
+        length = (static_cast<std::size_t>(first & 0x7f) << 24) | (static_cast<std::size_t>(static_cast<uint8_t>(in[1])) << 16) |
+                 (static_cast<std::size_t>(static_cast<uint8_t>(in[2])) << 8) | static_cast<uint8_t>(in[3]);
+        in.remove_prefix(4);
+    }
+    if (in.size() < lengths[0] + lengths[1])
+        return false;
+    name = in.substr(0, lengths[0]);
+    value = in.substr(lengths[0], lengths[1]);
+    in.remove_prefix(lengths[0] + lengths[1]);
+    return true;
+}
+
+FastCgiPool::FastCgiPool(int epoll_fd)
+    : epoll_fd_(epoll_fd), backend_fds_(FastCgi::instance().backendCount())
+{
+}
+
+FastCgiPool::~FastCgiPool()
+{
+    for (std::size_t fd = 0; fd < connections_.size(); fd++)
+        if (connections_[fd])
+            ::close(fd);
+}
+
+int FastCgiPool::connectLocked(int backend)
+{
+    const int fd = FastCgi::instance().connectTo(backend);
+    if (fd == -1)
+        return -1;
+    FastCgi::instance().backend(backend).connects.fetch_add(1, std::memory_order_relaxed);
+    if (fd >= static_cast<int>(connections_.size()))
+        connections_.resize(fd + 1);
+    auto connection = std::make_unique<Connection>();
+    connection->backend = backend;
+    connection->requests.resize(kMaxRequestsPerConnection);
+    // whether requests may share the connection, asked ahead of the first one
+    std::string values;
+    FastCgi::appendParam(values, "FCGI_MPXS_CONNS", "");
+    FastCgi::appendParam(values, "FCGI_MAX_REQS", "");
+    appendRecord(connection->write_buffer, kGetValues, 0, values);
+    if (epollAddOneShot(epoll_fd_, EPOLLOUT | EPOLLRDHUP, fd) == -1)
+    {
+        LOG_ERROR("Epoll add failed for FastCGI fd(", fd, "), reason: ", logErrStr(errno));
+        ::close(fd);
+        return -1;
+    }
+    connections_[fd] = std::move(connection);
+    backend_fds_[backend].push_back(fd);
+    return fd;
+}
+
+int FastCgiPool::pickLocked(int backend)
+{
+    int best = -1;
+    for (const int fd : backend_fds_[backend])
+    {
+        const auto &connection = *connections_[fd];
+        if (connection.active < connection.max_requests && (best == -1 || connection.active < connections_[best]->active))
+            best = fd;
+    }
+    if (best != -1)
+        return best;
+    if (backend_fds_[backend].size() >= kMaxConnections)
+    {
+        LOG_WARNING("All ", kMaxConnections, " connections to FastCGI backend ", FastCgi::instance().backend(backend).name, " are busy");
+        errno = EAGAIN;
+        return -1;
+    }
+    return connectLocked(backend);
+}
+
+FastCgiPool::RequestPtr FastCgiPool::begin(int backend, int client_fd, std::string_view params, const RequestBody &body)
+{
+    // a spilled body is read before the lock is taken
+    std::string spilled_body;
+    if (body.isSpilled())
+    {
+        spilled_body.resize(body.size());
+        std::size_t done = 0;
+        while (done < spilled_body.size())
+        {
+            const long retval = ::pread(body.fd(), spilled_body.data() + done, spilled_body.size() - done, done);
+            if (retval <= 0)
+            {
+                LOG_ERROR("Failed to read request body, reason: ", retval == 0 ? "EOF" : logErrStr(errno));
+                return nullptr;
+            }
+            done += retval;
+        }
+    }
+
+    auto &fastcgi = FastCgi::instance();
+    const std::lock_guard lock(mutex_);
+    const int fd = pickLocked(backend);
+    if (fd == -1)
+        return nullptr;
+    auto &connection = *connections_[fd];
+    const auto slot = std::find(connection.requests.begin(), connection.requests.end(), nullptr);
+    auto request = std::make_shared<Request>();
+    request->fd = fd;
+    request->id = static_cast<uint16_t>(slot - connection.requests.begin() + 1);
+    request->backend = backend;
+    request->client_fd = client_fd;
+    request->is_reused = connection.served != 0;
+    *slot = request;
+    connection.active++;
+
+    auto &counters = fastcgi.backend(backend);
+    counters.requests.fetch_add(1, std::memory_order_relaxed);
+    counters.outstanding.fetch_add(1, std::memory_order_relaxed);
+    if (connection.active > 1)
+        counters.multiplexed.fetch_add(1, std::memory_order_relaxed);
+
+    const char begin_body[8] = {0, static_cast<char>(kResponder), static_cast<char>(kKeepConn), 0, 0, 0, 0, 0};
+    appendRecord(connection.write_buffer, kBeginRequest, request->id, std::string_view(begin_body, sizeof(begin_body)));
+    appendStream(connection.write_buffer, kParams, request->id, params);
+    appendStream(connection.write_buffer, kStdin, request->id, body.isSpilled() ? std::string_view(spilled_body) : body.memory());
+    // a failed write shows up as an error event of the connection
+    if (!connection.is_connecting)
+        flushLocked(fd, connection);
+    armLocked(fd, connection);
+    return request;
+}
+
+FastCgiPool::Status FastCgiPool::take(const RequestPtr &request, std::string &data)
+{
+    const std::lock_guard lock(mutex_);
+    if (!request->stdout_data.empty())
+    {
+        data.swap(request->stdout_data);
+        request->stdout_data.clear();
+        if (request->fd != -1)
+            unpauseLocked(request->fd, *connections_[request->fd]);
+        return Status::DATA;
+    }
+    if (request->is_failed)
+        return Status::FAILED;
+    return request->is_ended ? Status::ENDED : Status::WAITING;
+}
+
+bool FastCgiPool::wait(const RequestPtr &request)
+{
+    const std::lock_guard lock(mutex_);
+    if (!request->stdout_data.empty() || request->is_ended || request->is_failed)
+        return false;
+    request->is_waiting = true;
+    return true;
+}
+
+void FastCgiPool::end(const RequestPtr &request)
+{
+    const std::lock_guard lock(mutex_);
+    request->client_fd = -1;
+    request->is_waiting = false;
+    if (request->fd == -1)
+        return;
+    // the backend may still run the script, its records are dropped until FCGI_END_REQUEST
+    FastCgi::instance().backend(request->backend).aborts.fetch_add(1, std::memory_order_relaxed);
+    request->stdout_data = std::string();
+    auto &connection = *connections_[request->fd];
+    appendRecord(connection.write_buffer, kAbortRequest, request->id, {});
+    unpauseLocked(request->fd, connection);
+    if (!connection.is_connecting)
+        flushLocked(request->fd, connection);
+    armLocked(request->fd, connection);
+}
+
+bool FastCgiPool::flushLocked(int fd, Connection &connection)
+{
+    std::size_t sent = 0;
+    while (sent < connection.write_buffer.size())
+    {
+        const long retval = ::send(fd, connection.write_buffer.data() + sent, connection.write_buffer.size() - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (retval == -1)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                LOG_DEBUG("Failed to write to FastCGI backend ", FastCgi::instance().backend(connection.backend).name, ", reason: ", logErrStr(errno));
+                return false;
+            }
+            break;
+        }
+        sent += retval;
+    }
+    connection.write_buffer.erase(0, sent);
+    return true;
+}
+
+void FastCgiPool::unpauseLocked(int fd, Connection &connection)
+{
+    if (!connection.is_paused)
+        return;
+    connection.is_paused = hasFullQueueLocked(connection);
+    if (!connection.is_paused)
+        armLocked(fd, connection);
+}
+
+bool FastCgiPool::hasFullQueueLocked(const Connection &connection)
+{
+    return std::any_of(connection.requests.begin(), connection.requests.end(), [](const RequestPtr &request)
+                       { return request && request->stdout_data.size() >= kMaxBuffered; });
+}
+
+void FastCgiPool::armLocked(int fd, const Connection &connection)
+{
+    // a paused connection is not even watched for EOF, which would fire until it is read
+    uint32_t events = connection.is_paused ? 0 : EPOLLIN | EPOLLRDHUP;
+    if (connection.is_connecting || !connection.write_buffer.empty())
+        events |= EPOLLOUT;
+    if (epollModOneShot(epoll_fd_, events, fd) == -1)
+        LOG_ERROR("Epoll modify failed for FastCGI fd(", fd, "), reason: ", logErrStr(errno));
+}
+
+bool FastCgiPool::readLocked(int fd, Connection &connection, std::vector<int> &woken)
+{
+    // a few reads per event, the other connections of the worker get their turn
+    static constexpr int kReadsPerEvent = 4;
+    thread_local std::array<char, 64 * 1024> chunk;
+    for (int i = 0; i < kReadsPerEvent && !connection.is_paused; i++)
+    {
+        const long retval = ::recv(fd, chunk.data(), chunk.size(), MSG_DONTWAIT);
+        if (retval == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return true;
+        if (retval <= 0)
+        {
+            LOG_DEBUG("FastCGI backend ", FastCgi::instance().backend(connection.backend).name, " closed the connection, reason: ",
+                      retval == 0 ? "EOF" : logErrStr(errno));
+            return false;
+        }
+
+        // the records of a read are taken from the chunk unless one started before it
+        if (!connection.read_buffer.empty())
+            connection.read_buffer.append(chunk.data(), retval);
+        std::string_view in = connection.read_buffer.empty() ? std::string_view(chunk.data(), retval) : connection.read_buffer;
+        std::size_t pos = 0;
+        while (in.size() - pos >= kHeaderSize)
+        {
+            const auto *header = reinterpret_cast<const uint8_t *>(in.data() + pos);
+            const uint16_t id = (header[2] << 8) | header[3];
+            const std::size_t content_size = (header[4] << 8) | header[5];
+            if (in.size() - pos < kHeaderSize + content_size + header[6])
+                break;
+            if (header[0] != kVersion ||
+                !handleRecordLocked(connection, header[1], id, in.substr(pos + kHeaderSize, content_size), woken))
+            {
+                LOG_WARNING("Invalid record from FastCGI backend ", FastCgi::instance().backend(connection.backend).name);
+                return false;
+            }
+            pos += kHeaderSize + content_size + header[6];
+        }
+        if (connection.read_buffer.empty())
+            connection.read_buffer.assign(in.substr(pos));
+        else
+            connection.read_buffer.erase(0, pos);
+    }
+    return true;
+}
+
+bool FastCgiPool::handleRecordLocked(Connection &connection, int type, uint16_t id, std::string_view content,
+                                     std::vector<int> &woken)
+{
+    if (id == 0)
+    {
+        if (type != kGetValuesResult)
+            return true;
+        bool is_multiplexed = false;
+        int max_requests = kMaxRequestsPerConnection;
+        std::string_view name, value;
+        while (readParam(content, name, value))
+        {
+            if (name == "FCGI_MPXS_CONNS")
+                is_multiplexed = value == "1";
+            else if (name == "FCGI_MAX_REQS")
+                max_requests = std::clamp(std::atoi(std::string(value).c_str()), 1, kMaxRequestsPerConnection);
+        }
+        connection.max_requests = is_multiplexed ? max_requests : 1;
+        return true;
+    }
+    if (id > connection.requests.size() || !connection.requests[id - 1])
+        return true; // a request the backend did not get, ignored like the spec says
+    const auto request = connection.requests[id - 1];
+
+    switch (type)
+    {
+    case kStdout:
+        // nobody takes the output of an aborted request
+        if (request->client_fd == -1 || content.empty())
+            return true;
+        request->stdout_data.append(content);
+        if (request->stdout_data.size() >= kMaxBuffered)
+            connection.is_paused = true;
+        wakeLocked(*request, woken);
+        return true;
+    case kStderr:
+        if (!content.empty())
+            LOG_WARNING("FastCGI backend ", FastCgi::instance().backend(connection.backend).name, ": ",
+                        content.substr(0, std::min<std::size_t>(content.find('\n'), 256)));
+        return true;
+    case kEndRequest:
+        if (content.size() < 8)
+            return false;
+        // FCGI_CANT_MPX_CONN, FCGI_OVERLOADED or FCGI_UNKNOWN_ROLE if the backend refused it
+        request->protocol_status = static_cast<uint8_t>(content[4]);
+        if (request->protocol_status == 0)
+            request->is_ended = true;
+        else
+            request->is_failed = true;
+        wakeLocked(*request, woken);
+        detachLocked(connection, request);
+        return true;
+    default:
+        return true;
+    }
+}
+
+void FastCgiPool::detachLocked(Connection &connection, const RequestPtr &request)
+{
+    connection.requests[request->id - 1].reset();
+    connection.active--;
+    connection.served++;
+    request->fd = -1;
+    // its queue is no longer the connection's concern, the caller arms the connection
+    if (connection.is_paused)
+        connection.is_paused = hasFullQueueLocked(connection);
+    FastCgi::instance().backend(connection.backend).outstanding.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void FastCgiPool::wakeLocked(Request &request, std::vector<int> &woken)
+{
+    if (request.is_waiting && request.client_fd != -1)
+    {
+        request.is_waiting = false;
+        woken.push_back(request.client_fd);
+    }
+}
+
+void FastCgiPool::closeLocked(int fd, std::vector<int> &woken)
+{
+    auto &connection = *connections_[fd];
+    auto &counters = FastCgi::instance().backend(connection.backend);
+    for (auto &request : connection.requests)
+    {
+        if (!request)
+            continue;
+        request->is_failed = true;
+        request->is_unconnected = connection.is_connecting;
+        request->fd = -1;
+        if (request->client_fd != -1)
+            counters.failures.fetch_add(1, std::memory_order_relaxed);
+        counters.outstanding.fetch_sub(1, std::memory_order_relaxed);
+        wakeLocked(*request, woken);
+    }
+    auto &fds = backend_fds_[connection.backend];
+    fds.erase(std::find(fds.begin(), fds.end(), fd));
+    epollDel(epoll_fd_, fd);
+    ::close(fd);
+    connections_[fd].reset();
+}
+
+bool FastCgiPool::dispatch(int fd, uint32_t events, std::vector<int> &woken)
+{
+    const std::lock_guard lock(mutex_);
+    if (fd >= static_cast<int>(connections_.size()) || !connections_[fd])
+        return false;
+
+    auto &connection = *connections_[fd];
+    if (connection.is_connecting)
+    {
+        int error = 0;
+        socklen_t error_len = sizeof(error);
+        if (!(events & EPOLLOUT) || (events & (EPOLLERR | EPOLLHUP)) ||
+            ::getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &error_len) == -1 || error != 0)
+        {
+            LOG_WARNING("Failed to connect to FastCGI backend ", FastCgi::instance().backend(connection.backend).name,
+                        ", reason: ", logErrStr(error ? error : ECONNREFUSED));
+            closeLocked(fd, woken);
+            return true;
+        }
+        connection.is_connecting = false;
+    }
+    // a backend that hung up is read to the end even while the connection is paused
+    if (events & (EPOLLHUP | EPOLLERR))
+        connection.is_paused = false;
+    if (!flushLocked(fd, connection) ||
+        ((events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) && !readLocked(fd, connection, woken)))
+    {
+        closeLocked(fd, woken);
+        return true;
+    }
+    armLocked(fd, connection);
+    return true;
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <cinttypes>
+
+#include "./util/Noncopyable.h"
+
+class RequestBody;
+
+// The FastCGI connections of one worker, registered in the worker's epoll
+// set (one shot, like the client sockets) and kept open between requests
+// (FCGI_KEEP_CONN). A new connection asks the backend for FCGI_MPXS_CONNS
+// and FCGI_MAX_REQS first; until the answer, or if the backend does not
+// multiplex, it serves one request at a time, otherwise up to
+// min(FCGI_MAX_REQS, kMaxRequestsPerConnection) under their own request ids.
+// A request takes the connection of its backend with the fewest requests
+// that has room, or a new one.
+//
+// The worker reads the connections (dispatch()) and sorts the records by
+// request id: FCGI_STDOUT content is queued for the request, and its client
+// context is woken if it waits for it (wait()); the context takes the queue
+// (take()) into its output. A request with kMaxBuffered queued stops the
+// reading of its connection until it is taken, a slow client holds its
+// connection back rather than growing the queue. A client that goes away
+// ends its request with FCGI_ABORT_REQUEST, the id is free again with the
+// FCGI_END_REQUEST of the backend.
+class FastCgiPool : NonCopyable
+{
+public:
+    // connections a worker opens to one backend, a request finding all of them busy gets a 503
+    static constexpr std::size_t kMaxConnections = 64;
+    static constexpr int kMaxRequestsPerConnection = 32;
+    // stdout queued for one request before its connection is read again
+    static constexpr std::size_t kMaxBuffered = 256 * 1024;
+
+    // a request on a connection, guarded by the pool's mutex
+    struct Request
+    {
+        int fd{-1};         // of the connection, -1 once the request is over there
+        uint16_t id{0};
+        int backend{-1};
+        int client_fd{-1};  // -1 once the client went away
+        bool is_reused{false}; // the connection served a request before
+        std::string stdout_data;
+        bool is_waiting{false};
+        bool is_ended{false};   // FCGI_END_REQUEST with FCGI_REQUEST_COMPLETE
+        bool is_failed{false};  // the connection broke, or the backend refused the request
+        bool is_unconnected{false}; // failed because the connection never came up, nothing was sent
+        int protocol_status{0}; // of FCGI_END_REQUEST
+    };
+    using RequestPtr = std::shared_ptr<Request>;
+
+    enum class Status
+    {
+        WAITING, // nothing new
+        DATA,    // stdout
+        ENDED,
+        FAILED,
+    };
+
+    explicit FastCgiPool(int epoll_fd);
+    ~FastCgiPool();
+
+    // sends the request to backend, params is the FCGI_PARAMS stream (name-value pairs) and body
+    // is complete; nullptr if it cannot connect, with errno EAGAIN if all connections are busy
+    [[nodiscard]] RequestPtr begin(int backend, int client_fd, std::string_view params, const RequestBody &body);
+    // moves the stdout queued so far to data, ENDED or FAILED once all of it was taken
+    [[nodiscard]] Status take(const RequestPtr &request, std::string &data);
+    // the client context is woken by the next record; false if one came meanwhile, take() again
+    [[nodiscard]] bool wait(const RequestPtr &request);
+    // the client is done with request, the backend gets FCGI_ABORT_REQUEST if it is not over
+    void end(const RequestPtr &request);
+
+    // false if fd is no FastCGI connection, woken receives the client fds of the requests with news
+    [[nodiscard]] bool dispatch(int fd, uint32_t events, std::vector<int> &woken);
+
+private:
+    struct Connection
+    {
+        int backend{-1};
+        bool is_connecting{true};
+        bool is_paused{false}; // a request has kMaxBuffered queued
+        int max_requests{1};
+        int active{0};
+        unsigned served{0};
+        std::vector<RequestPtr> requests; // by id - 1
+        std::string read_buffer;
+        std::string write_buffer;
+    };
+
+    const int epoll_fd_;
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<Connection>> connections_; // by fd
+    std::vector<std::vector<int>> backend_fds_;            // by backend
+
+    // a new connection to backend, -1 if it cannot connect
+    [[nodiscard]] int connectLocked(int backend);
+    // the connection of backend for one more request, -1 with errno set if there is none
+    [[nodiscard]] int pickLocked(int backend);
+    // writes what the socket takes of the write buffer, false on errors
+    bool flushLocked(int fd, Connection &connection);
+    void armLocked(int fd, const Connection &connection);
+    // reading goes on once no request has kMaxBuffered queued any more
+    void unpauseLocked(int fd, Connection &connection);
+    [[nodiscard]] static bool hasFullQueueLocked(const Connection &connection);
+    // false on EOF, errors and malformed records
+    [[nodiscard]] bool readLocked(int fd, Connection &connection, std::vector<int> &woken);
+    [[nodiscard]] bool handleRecordLocked(Connection &connection, int type, uint16_t id, std::string_view content,
+                                          std::vector<int> &woken);
+    // the request is over at the backend, its id is free
+    void detachLocked(Connection &connection, const RequestPtr &request);
+    void closeLocked(int fd, std::vector<int> &woken);
+    static void wakeLocked(Request &request, std::vector<int> &woken);
+};
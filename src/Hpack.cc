@@ -0,0 +1,473 @@
+#include <algorithm>
+#include <array>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <cctype>
+#include <cstdint>
+
+#include "./Hpack.h"
+#include "./util/PerfectHash.h"
+
+struct StaticEntry
+{
+    std::string_view name;
+    std::string_view value;
+};
+
+// RFC 7541 appendix A, index 1 is kStaticTable[0]
+static constexpr StaticEntry kStaticTable[] = {
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""},
+};
+static constexpr std::size_t kStaticTableSize = std::size(kStaticTable);
+
+// the first entry of each static name, built by the compiler
+static constexpr PerfectHashTable<kStaticTableSize> kStaticNameIndex(keysOf(kStaticTable, &StaticEntry::name));
+
+struct HuffmanCode
+{
+    uint32_t code;
+    int length;
+};
+
+// RFC 7541 appendix B, symbols 0-255 and EOS
+static constexpr HuffmanCode kHuffmanCodes[] = {
+    {0x1ff8, 13}, {0x7fffd8, 23}, {0xfffffe2, 28}, {0xfffffe3, 28}, {0xfffffe4, 28}, {0xfffffe5, 28},
+    {0xfffffe6, 28}, {0xfffffe7, 28}, {0xfffffe8, 28}, {0xffffea, 24}, {0x3ffffffc, 30}, {0xfffffe9, 28},
+    {0xfffffea, 28}, {0x3ffffffd, 30}, {0xfffffeb, 28}, {0xfffffec, 28}, {0xfffffed, 28}, {0xfffffee, 28},
+    {0xfffffef, 28}, {0xffffff0, 28}, {0xffffff1, 28}, {0xffffff2, 28}, {0x3ffffffe, 30}, {0xffffff3, 28},
+    {0xffffff4, 28}, {0xffffff5, 28}, {0xffffff6, 28}, {0xffffff7, 28}, {0xffffff8, 28}, {0xffffff9, 28},
+    {0xffffffa, 28}, {0xffffffb, 28}, {0x14, 6}, {0x3f8, 10}, {0x3f9, 10}, {0xffa, 12},
+    {0x1ff9, 13}, {0x15, 6}, {0xf8, 8}, {0x7fa, 11}, {0x3fa, 10}, {0x3fb, 10},
+    {0xf9, 8}, {0x7fb, 11}, {0xfa, 8}, {0x16, 6}, {0x17, 6}, {0x18, 6},
+    {0x0, 5}, {0x1, 5}, {0x2, 5}, {0x19, 6}, {0x1a, 6}, {0x1b, 6},
+    {0x1c, 6}, {0x1d, 6}, {0x1e, 6}, {0x1f, 6}, {0x5c, 7}, {0xfb, 8},
+    {0x7ffc, 15}, {0x20, 6}, {0xffb, 12}, {0x3fc, 10}, {0x1ffa, 13}, {0x21, 6},
+    {0x5d, 7}, {0x5e, 7}, {0x5f, 7}, {0x60, 7}, {0x61, 7}, {0x62, 7},
+    {0x63, 7}, {0x64, 7}, {0x65, 7}, {0x66, 7}, {0x67, 7}, {0x68, 7},
+    {0x69, 7}, {0x6a, 7}, {0x6b, 7}, {0x6c, 7}, {0x6d, 7}, {0x6e, 7},
+    {0x6f, 7}, {0x70, 7}, {0x71, 7}, {0x72, 7}, {0xfc, 8}, {0x73, 7},
+    {0xfd, 8}, {0x1ffb, 13}, {0x7fff0, 19}, {0x1ffc, 13}, {0x3ffc, 14}, {0x22, 6},
+    {0x7ffd, 15}, {0x3, 5}, {0x23, 6}, {0x4, 5}, {0x24, 6}, {0x5, 5},
+    {0x25, 6}, {0x26, 6}, {0x27, 6}, {0x6, 5}, {0x74, 7}, {0x75, 7},
+    {0x28, 6}, {0x29, 6}, {0x2a, 6}, {0x7, 5}, {0x2b, 6}, {0x76, 7},
+    {0x2c, 6}, {0x8, 5}, {0x9, 5}, {0x2d, 6}, {0x77, 7}, {0x78, 7},
+    {0x79, 7}, {0x7a, 7}, {0x7b, 7}, {0x7ffe, 15}, {0x7fc, 11}, {0x3ffd, 14},
+    {0x1ffd, 13}, {0xffffffc, 28}, {0xfffe6, 20}, {0x3fffd2, 22}, {0xfffe7, 20}, {0xfffe8, 20},
+    {0x3fffd3, 22}, {0x3fffd4, 22}, {0x3fffd5, 22}, {0x7fffd9, 23}, {0x3fffd6, 22}, {0x7fffda, 23},
+    {0x7fffdb, 23}, {0x7fffdc, 23}, {0x7fffdd, 23}, {0x7fffde, 23}, {0xffffeb, 24}, {0x7fffdf, 23},
+    {0xffffec, 24}, {0xffffed, 24}, {0x3fffd7, 22}, {0x7fffe0, 23}, {0xffffee, 24}, {0x7fffe1, 23},
+    {0x7fffe2, 23}, {0x7fffe3, 23}, {0x7fffe4, 23}, {0x1fffdc, 21}, {0x3fffd8, 22}, {0x7fffe5, 23},
+    {0x3fffd9, 22}, {0x7fffe6, 23}, {0x7fffe7, 23}, {0xffffef, 24}, {0x3fffda, 22}, {0x1fffdd, 21},
+    {0xfffe9, 20}, {0x3fffdb, 22}, {0x3fffdc, 22}, {0x7fffe8, 23}, {0x7fffe9, 23}, {0x1fffde, 21},
+    {0x7fffea, 23}, {0x3fffdd, 22}, {0x3fffde, 22}, {0xfffff0, 24}, {0x1fffdf, 21}, {0x3fffdf, 22},
+    {0x7fffeb, 23}, {0x7fffec, 23}, {0x1fffe0, 21}, {0x1fffe1, 21}, {0x3fffe0, 22}, {0x1fffe2, 21},
+    {0x7fffed, 23}, {0x3fffe1, 22}, {0x7fffee, 23}, {0x7fffef, 23}, {0xfffea, 20}, {0x3fffe2, 22},
+    {0x3fffe3, 22}, {0x3fffe4, 22}, {0x7ffff0, 23}, {0x3fffe5, 22}, {0x3fffe6, 22}, {0x7ffff1, 23},
+    {0x3ffffe0, 26}, {0x3ffffe1, 26}, {0xfffeb, 20}, {0x7fff1, 19}, {0x3fffe7, 22}, {0x7ffff2, 23},
+    {0x3fffe8, 22}, {0x1ffffec, 25}, {0x3ffffe2, 26}, {0x3ffffe3, 26}, {0x3ffffe4, 26}, {0x7ffffde, 27},
+    {0x7ffffdf, 27}, {0x3ffffe5, 26}, {0xfffff1, 24}, {0x1ffffed, 25}, {0x7fff2, 19}, {0x1fffe3, 21},
+    {0x3ffffe6, 26}, {0x7ffffe0, 27}, {0x7ffffe1, 27}, {0x3ffffe7, 26}, {0x7ffffe2, 27}, {0xfffff2, 24},
+    {0x1fffe4, 21}, {0x1fffe5, 21}, {0x3ffffe8, 26}, {0x3ffffe9, 26}, {0xffffffd, 28}, {0x7ffffe3, 27},
+    {0x7ffffe4, 27}, {0x7ffffe5, 27}, {0xfffec, 20}, {0xfffff3, 24}, {0xfffed, 20}, {0x1fffe6, 21},
+    {0x3fffe9, 22}, {0x1fffe7, 21}, {0x1fffe8, 21}, {0x7ffff3, 23}, {0x3fffea, 22}, {0x3fffeb, 22},
+    {0x1ffffee, 25}, {0x1ffffef, 25}, {0xfffff4, 24}, {0xfffff5, 24}, {0x3ffffea, 26}, {0x7ffff4, 23},
+    {0x3ffffeb, 26}, {0x7ffffe6, 27}, {0x3ffffec, 26}, {0x3ffffed, 26}, {0x7ffffe7, 27}, {0x7ffffe8, 27},
+    {0x7ffffe9, 27}, {0x7ffffea, 27}, {0x7ffffeb, 27}, {0xffffffe, 28}, {0x7ffffec, 27}, {0x7ffffed, 27},
+    {0x7ffffee, 27}, {0x7ffffef, 27}, {0x7fffff0, 27}, {0x3ffffee, 26},
+    {0x3fffffff, 30},
+};
+static constexpr int kHuffmanEos = 256;
+static_assert(std::size(kHuffmanCodes) == kHuffmanEos + 1);
+
+struct HuffmanNode
+{
+    int child[2]{0, 0}; // 0: no child, the root is never a child
+    int symbol{-1};
+};
+
+static const std::vector<HuffmanNode> &huffmanTree()
+{
+    static const auto tree = []
+    {
+        std::vector<HuffmanNode> nodes(1);
+        for (int symbol = 0; symbol <= kHuffmanEos; symbol++)
+        {
+            const auto [code, length] = kHuffmanCodes[symbol];
+            int node = 0;
+            for (int bit = length - 1; bit >= 0; bit--)
+            {
+                const int branch = (code >> bit) & 1;
+                if (nodes[node].child[branch] == 0)
+                {
+                    nodes[node].child[branch] = nodes.size();
+                    nodes.emplace_back();
+                }
+                node = nodes[node].child[branch];
+            }
+            nodes[node].symbol = symbol;
+        }
+        return nodes;
+    }();
+    return tree;
+}
+
+static bool huffmanDecode(std::string_view in, std::string &out)
+{
+    const auto &tree = huffmanTree();
+    int node = 0, depth = 0;
+    bool is_all_ones = true;
+    for (const unsigned char byte : in)
+    {
+        for (int bit = 7; bit >= 0; bit--)
+        {
+            const int branch = (byte >> bit) & 1;
+            node = tree[node].child[branch];
+            if (node == 0)
+                return false;
+            depth++;
+            is_all_ones = is_all_ones && branch == 1;
+            if (const int symbol = tree[node].symbol; symbol >= 0)
+            {
+                if (symbol == kHuffmanEos)
+                    return false;
+                out.push_back(static_cast<char>(symbol));
+                node = 0;
+                depth = 0;
+                is_all_ones = true;
+            }
+        }
+    }
+    // padding is a prefix of EOS shorter than one byte
+    return depth < 8 && is_all_ones;
+}
+
+static bool decodeInteger(std::string_view in, std::size_t &pos, int prefix_bits, std::size_t &value)
+{
+    if (pos >= in.size())
+        return false;
+    const std::size_t max_prefix = (1u << prefix_bits) - 1;
+    value = static_cast<unsigned char>(in[pos++]) & max_prefix;
+    if (value < max_prefix)
+        return true;
+
+    for (int shift = 0; pos < in.size(); shift += 7)
+    {
+        // nothing legitimate needs more than 32 bits
+        if (shift > 28)
+            return false;
+        const unsigned char byte = in[pos++];
+        value += static_cast<std::size_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+static bool decodeString(std::string_view in, std::size_t &pos, std::string &out)
+{
+    if (pos >= in.size())
+        return false;
+    const bool is_huffman = static_cast<unsigned char>(in[pos]) & 0x80;
+    std::size_t length;
+    if (!decodeInteger(in, pos, 7, length) || length > in.size() - pos)
+        return false;
+
+    const auto data = in.substr(pos, length);
+    pos += length;
+    if (is_huffman)
+        return huffmanDecode(data, out);
+    out.assign(data);
+    return true;
+}
+
+static void encodeInteger(std::string &out, unsigned char flags, int prefix_bits, std::size_t value)
+{
+    const std::size_t max_prefix = (1u << prefix_bits) - 1;
+    if (value < max_prefix)
+    {
+        out.push_back(static_cast<char>(flags | value));
+        return;
+    }
+    out.push_back(static_cast<char>(flags | max_prefix));
+    value -= max_prefix;
+    while (value >= 0x80)
+    {
+        out.push_back(static_cast<char>(0x80 | (value & 0x7f)));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+static void encodeString(std::string &out, std::string_view str)
+{
+    encodeInteger(out, 0, 7, str.size());
+    out.append(str);
+}
+
+void HpackDynamicTable::add(std::string_view name, std::string_view value)
+{
+    const std::size_t entry_size = name.size() + value.size() + kEntryOverhead;
+    if (entry_size > max_size_)
+    {
+        // an entry larger than the table empties it and is not added
+        evict(0);
+        return;
+    }
+    // copy first, name or value may refer to an entry about to be evicted
+    HpackHeader header{std::string(name), std::string(value)};
+    evict(max_size_ - entry_size);
+    entries_.push_front(std::move(header));
+    size_ += entry_size;
+}
+
+void HpackDynamicTable::setMaxSize(std::size_t max_size)
+{
+    max_size_ = max_size;
+    evict(max_size);
+}
+
+void HpackDynamicTable::evict(std::size_t max_size)
+{
+    while (size_ > max_size)
+    {
+        const auto &entry = entries_.back();
+        size_ -= entry.name.size() + entry.value.size() + kEntryOverhead;
+        entries_.pop_back();
+    }
+}
+
+bool HpackDecoder::lookup(std::size_t index, std::string_view &name, std::string_view &value) const
+{
+    if (index == 0)
+        return false;
+    if (index <= kStaticTableSize)
+    {
+        name = kStaticTable[index - 1].name;
+        value = kStaticTable[index - 1].value;
+        return true;
+    }
+    index -= kStaticTableSize + 1;
+    if (index >= table_.count())
+        return false;
+    name = table_.at(index).name;
+    value = table_.at(index).value;
+    return true;
+}
+
+bool HpackDecoder::decode(std::string_view block, std::vector<HpackHeader> &headers, std::size_t max_list_size)
+{
+    std::size_t pos = 0, list_size = 0;
+    bool is_size_update_allowed = true;
+    while (pos < block.size())
+    {
+        const unsigned char byte = block[pos];
+        std::size_t index;
+        if ((byte & 0xe0) == 0x20)
+        {
+            // dynamic table size update, only at the start of a block and
+            // within our SETTINGS_HEADER_TABLE_SIZE (the default)
+            if (!is_size_update_allowed || !decodeInteger(block, pos, 5, index) || index > HpackDynamicTable::kDefaultMaxSize)
+                return false;
+            table_.setMaxSize(index);
+            continue;
+        }
+        is_size_update_allowed = false;
+
+        HpackHeader header;
+        if (byte & 0x80)
+        {
+            // indexed header field
+            std::string_view name, value;
+            if (!decodeInteger(block, pos, 7, index) || !lookup(index, name, value))
+                return false;
+            header.name.assign(name);
+            header.value.assign(value);
+        }
+        else
+        {
+            // literal with incremental indexing (01), without indexing (0000) or never indexed (0001)
+            const bool is_indexing = byte & 0x40;
+            if (!decodeInteger(block, pos, is_indexing ? 6 : 4, index))
+                return false;
+            if (index == 0)
+            {
+                if (!decodeString(block, pos, header.name))
+                    return false;
+            }
+            else
+            {
+                std::string_view name, value;
+                if (!lookup(index, name, value))
+                    return false;
+                header.name.assign(name);
+            }
+            if (!decodeString(block, pos, header.value))
+                return false;
+            if (is_indexing)
+                table_.add(header.name, header.value);
+        }
+
+        list_size += header.name.size() + header.value.size() + HpackDynamicTable::kEntryOverhead;
+        if (list_size > max_list_size)
+            return false;
+        headers.push_back(std::move(header));
+    }
+    return true;
+}
+
+void HpackEncoder::setMaxTableSize(std::size_t max_size)
+{
+    // never grow beyond the default, the table is only a cache for us
+    max_size = std::min(max_size, HpackDynamicTable::kDefaultMaxSize);
+    if (max_size == pending_max_size_ && !is_size_update_pending_)
+        return;
+    pending_min_size_ = is_size_update_pending_ ? std::min(pending_min_size_, max_size) : max_size;
+    pending_max_size_ = max_size;
+    is_size_update_pending_ = true;
+}
+
+static bool isConnectionSpecific(std::string_view name)
+{
+    return name == "connection" || name == "keep-alive" || name == "proxy-connection" ||
+           name == "transfer-encoding" || name == "upgrade";
+}
+
+// values that change with every response only pollute the dynamic table
+static bool isIndexable(std::string_view name, std::string_view value)
+{
+    return name != "content-length" && name != "content-range" && name != "etag" &&
+           name != "last-modified" && name != "expires" && name != "date" && name != "set-cookie" &&
+           value.find("boundary=") == std::string_view::npos;
+}
+
+void HpackEncoder::encode(unsigned status_code, const std::vector<std::string> &name_values, std::string &out)
+{
+    if (is_size_update_pending_)
+    {
+        // a reduction followed by a growth signals the smallest size first, RFC 7541 sec 4.2
+        if (pending_min_size_ < pending_max_size_)
+            encodeInteger(out, 0x20, 5, pending_min_size_);
+        encodeInteger(out, 0x20, 5, pending_max_size_);
+        table_.setMaxSize(pending_max_size_);
+        is_size_update_pending_ = false;
+    }
+
+    encodeHeader(":status", std::to_string(status_code), true, out);
+
+    std::string name;
+    for (std::size_t i = 0; i + 1 < name_values.size(); i += 2)
+    {
+        name.assign(name_values[i]);
+        std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c)
+                       { return std::tolower(c); });
+        if (isConnectionSpecific(name))
+            continue;
+
+        std::string_view value = name_values[i + 1];
+        while (!value.empty() && (value.front() == ' ' || value.front() == '\t'))
+            value.remove_prefix(1);
+        encodeHeader(name, value, isIndexable(name, value), out);
+    }
+}
+
+void HpackEncoder::encodeHeader(std::string_view name, std::string_view value, bool is_indexable, std::string &out)
+{
+    std::size_t name_index = 0;
+    if (const int first = kStaticNameIndex.find(name); first != -1)
+    {
+        name_index = first + 1;
+        // entries with the same name are adjacent in the static table
+        for (std::size_t i = name_index; i <= kStaticTableSize && kStaticTable[i - 1].name == name; i++)
+            if (kStaticTable[i - 1].value == value)
+            {
+                encodeInteger(out, 0x80, 7, i);
+                return;
+            }
+    }
+
+    for (std::size_t i = 0; i < table_.count(); i++)
+    {
+        const auto &entry = table_.at(i);
+        if (entry.name != name)
+            continue;
+        if (entry.value == value)
+        {
+            encodeInteger(out, 0x80, 7, kStaticTableSize + 1 + i);
+            return;
+        }
+        if (name_index == 0)
+            name_index = kStaticTableSize + 1 + i;
+    }
+
+    if (is_indexable)
+        encodeInteger(out, 0x40, 6, name_index);
+    else
+        encodeInteger(out, 0x00, 4, name_index);
+    if (name_index == 0)
+        encodeString(out, name);
+    encodeString(out, value);
+    if (is_indexable)
+        table_.add(name, value);
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <deque>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// HPACK (RFC 7541) header compression for HTTP/2: the static table, a
+// dynamic table per direction, integer and string literals. The decoder
+// understands Huffman coded strings, the encoder always sends raw literals
+// and relies on the tables for the repeated response headers.
+
+struct HpackHeader
+{
+    std::string name;
+    std::string value;
+};
+
+class HpackDynamicTable
+{
+public:
+    static constexpr std::size_t kDefaultMaxSize = 4096;
+    static constexpr std::size_t kEntryOverhead = 32;
+
+    // index 0 is the most recently added entry
+    [[nodiscard]] const HpackHeader &at(std::size_t index) const { return entries_[index]; }
+    [[nodiscard]] std::size_t count() const noexcept { return entries_.size(); }
+    [[nodiscard]] std::size_t maxSize() const noexcept { return max_size_; }
+
+    void add(std::string_view name, std::string_view value);
+    void setMaxSize(std::size_t max_size);
+
+private:
+    std::deque<HpackHeader> entries_;
+    std::size_t size_{0};
+    std::size_t max_size_{kDefaultMaxSize};
+
+    void evict(std::size_t max_size);
+};
+
+class HpackDecoder
+{
+public:
+    // decodes one complete header block, false on a COMPRESSION_ERROR
+    [[nodiscard]] bool decode(std::string_view block, std::vector<HpackHeader> &headers, std::size_t max_list_size);
+
+private:
+    HpackDynamicTable table_;
+
+    [[nodiscard]] bool lookup(std::size_t index, std::string_view &name, std::string_view &value) const;
+};
+
+class HpackEncoder
+{
+public:
+    // SETTINGS_HEADER_TABLE_SIZE of the peer, announced at the start of the next block
+    void setMaxTableSize(std::size_t max_size);
+
+    // appends the block for a response head, names are lowercased and
+    // connection specific headers are dropped
+    void encode(unsigned status_code, const std::vector<std::string> &name_values, std::string &out);
+
+private:
+    HpackDynamicTable table_;
+    std::size_t pending_max_size_{HpackDynamicTable::kDefaultMaxSize};
+    std::size_t pending_min_size_{HpackDynamicTable::kDefaultMaxSize};
+    bool is_size_update_pending_{false};
+
+    void encodeHeader(std::string_view name, std::string_view value, bool is_indexable, std::string &out);
+};
@@ -0,0 +1,702 @@
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <cctype>
+#include <cstdint>
+
+#include "./Http2Session.h"
+#include "./RequestHandler.h"
+#include "./HttpTypes.h"
+#include "./Logger.h"
+
+namespace
+{
+    enum FrameType : uint8_t
+    {
+        DATA = 0x0,
+        HEADERS = 0x1,
+        PRIORITY = 0x2,
+        RST_STREAM = 0x3,
+        SETTINGS = 0x4,
+        PUSH_PROMISE = 0x5,
+        PING = 0x6,
+        GOAWAY = 0x7,
+        WINDOW_UPDATE = 0x8,
+        CONTINUATION = 0x9,
+    };
+
+    enum FrameFlag : uint8_t
+    {
+        FLAG_END_STREAM = 0x1,
+        FLAG_ACK = 0x1,
+        FLAG_END_HEADERS = 0x4,
+        FLAG_PADDED = 0x8,
+        FLAG_PRIORITY = 0x20,
+    };
+
+    enum ErrorCode : uint32_t
+    {
+        NO_ERROR = 0x0,
+        PROTOCOL_ERROR = 0x1,
+        INTERNAL_ERROR = 0x2,
+        FLOW_CONTROL_ERROR = 0x3,
+        STREAM_CLOSED = 0x5,
+        FRAME_SIZE_ERROR = 0x6,
+        REFUSED_STREAM = 0x7,
+        COMPRESSION_ERROR = 0x9,
+        ENHANCE_YOUR_CALM = 0xb,
+    };
+
+    enum SettingId : uint16_t
+    {
+        SETTINGS_HEADER_TABLE_SIZE = 0x1,
+        SETTINGS_ENABLE_PUSH = 0x2,
+        SETTINGS_MAX_CONCURRENT_STREAMS = 0x3,
+        SETTINGS_INITIAL_WINDOW_SIZE = 0x4,
+        SETTINGS_MAX_FRAME_SIZE = 0x5,
+        SETTINGS_MAX_HEADER_LIST_SIZE = 0x6,
+    };
+}
+
+static constexpr uint32_t kMaxAllowedFrameSize = 16777215;
+
+static uint32_t readUint32(std::string_view data)
+{
+    const auto *p = reinterpret_cast<const unsigned char *>(data.data());
+    return (uint32_t{p[0]} << 24) | (uint32_t{p[1]} << 16) | (uint32_t{p[2]} << 8) | p[3];
+}
+
+static void appendUint32(std::string &out, uint32_t value)
+{
+    out.push_back(static_cast<char>(value >> 24));
+    out.push_back(static_cast<char>(value >> 16));
+    out.push_back(static_cast<char>(value >> 8));
+    out.push_back(static_cast<char>(value));
+}
+
+static void appendSetting(std::string &out, uint16_t id, uint32_t value)
+{
+    out.push_back(static_cast<char>(id >> 8));
+    out.push_back(static_cast<char>(id));
+    appendUint32(out, value);
+}
+
+static void appendFrameHeader(std::string &out, uint32_t length, uint8_t type, uint8_t flags, uint32_t stream_id)
+{
+    out.push_back(static_cast<char>(length >> 16));
+    out.push_back(static_cast<char>(length >> 8));
+    out.push_back(static_cast<char>(length));
+    out.push_back(static_cast<char>(type));
+    out.push_back(static_cast<char>(flags));
+    appendUint32(out, stream_id & 0x7fffffff);
+}
+
+// HTTP2-Settings is base64url without padding, RFC 7540 sec 3.2.1
+static bool decodeBase64Url(std::string_view in, std::string &out)
+{
+    uint32_t bits = 0;
+    int bit_count = 0;
+    for (const char c : in)
+    {
+        int value;
+        if (c >= 'A' && c <= 'Z')
+            value = c - 'A';
+        else if (c >= 'a' && c <= 'z')
+            value = c - 'a' + 26;
+        else if (c >= '0' && c <= '9')
+            value = c - '0' + 52;
+        else if (c == '-' || c == '+')
+            value = 62;
+        else if (c == '_' || c == '/')
+            value = 63;
+        else if (c == '=')
+            break;
+        else
+            return false;
+
+        bits = (bits << 6) | value;
+        bit_count += 6;
+        if (bit_count >= 8)
+        {
+            bit_count -= 8;
+            out.push_back(static_cast<char>(bits >> bit_count));
+        }
+    }
+    return true;
+}
+
+static bool isConnectionSpecific(std::string_view name)
+{
+    return name == "connection" || name == "keep-alive" || name == "proxy-connection" ||
+           name == "transfer-encoding" || name == "upgrade";
+}
+
+Http2Session::Http2Session(std::string_view root_dir)
+    : root_dir_(root_dir)
+{
+    // the server connection preface
+    std::string settings;
+    appendSetting(settings, SETTINGS_MAX_CONCURRENT_STREAMS, kMaxConcurrentStreams);
+    appendSetting(settings, SETTINGS_MAX_HEADER_LIST_SIZE, kMaxHeaderListSize);
+    queueFrame(SETTINGS, 0, 0, settings);
+}
+
+bool Http2Session::startUpgraded(const HttpParser &request, std::string_view settings)
+{
+    std::string payload;
+    if (!decodeBase64Url(settings, payload) || payload.size() % 6 != 0)
+        return false;
+    // the 101 response acknowledges these settings implicitly
+    if (!applySettings(payload))
+        return false;
+
+    auto stream = std::make_unique<Stream>();
+    stream->id = 1;
+    stream->send_window = peer_initial_window_size_;
+    stream->request_head.assign(request.head());
+    last_stream_id_ = 1;
+
+    auto &ref = *stream;
+    streams_.emplace(1, std::move(stream));
+    handleRequest(ref);
+    return true;
+}
+
+bool Http2Session::receive(std::string_view data)
+{
+    if (is_goaway_sent_)
+        return false;
+
+    input_.append(data);
+    std::size_t pos = 0;
+    if (!is_preface_received_)
+    {
+        const auto length = std::min(input_.size(), kConnectionPreface.size());
+        if (input_.compare(0, length, kConnectionPreface.substr(0, length)) != 0)
+        {
+            input_.clear();
+            return connectionError(PROTOCOL_ERROR, "invalid connection preface");
+        }
+        if (length < kConnectionPreface.size())
+            return true;
+        pos = length;
+        is_preface_received_ = true;
+    }
+
+    while (input_.size() - pos >= kFrameHeaderSize)
+    {
+        const auto *header = reinterpret_cast<const unsigned char *>(input_.data() + pos);
+        const uint32_t length = (uint32_t{header[0]} << 16) | (uint32_t{header[1]} << 8) | header[2];
+        const uint8_t type = header[3];
+        const uint8_t flags = header[4];
+        const uint32_t stream_id = readUint32(std::string_view(input_).substr(pos + 5, 4)) & 0x7fffffff;
+
+        // we never raise SETTINGS_MAX_FRAME_SIZE
+        if (length > kDefaultMaxFrameSize)
+        {
+            input_.clear();
+            return connectionError(FRAME_SIZE_ERROR, "frame too large");
+        }
+        if (input_.size() - pos - kFrameHeaderSize < length)
+            break;
+
+        if (!handleFrame(type, flags, stream_id, std::string_view(input_).substr(pos + kFrameHeaderSize, length)))
+        {
+            input_.clear();
+            return false;
+        }
+        pos += kFrameHeaderSize + length;
+    }
+    input_.erase(0, pos);
+    return true;
+}
+
+bool Http2Session::handleFrame(uint8_t type, uint8_t flags, uint32_t stream_id, std::string_view payload)
+{
+    if (header_stream_id_ != 0 && type != CONTINUATION)
+        return connectionError(PROTOCOL_ERROR, "expected CONTINUATION");
+    if (!is_settings_received_ && (type != SETTINGS || (flags & FLAG_ACK)))
+        return connectionError(PROTOCOL_ERROR, "first frame is not SETTINGS");
+
+    switch (type)
+    {
+    case DATA:
+        return handleData(flags, stream_id, payload);
+    case HEADERS:
+        return handleHeaders(flags, stream_id, payload);
+    case CONTINUATION:
+        return handleContinuation(flags, stream_id, payload);
+    case SETTINGS:
+        return handleSettings(flags, stream_id, payload);
+    case WINDOW_UPDATE:
+        return handleWindowUpdate(stream_id, payload);
+    case PRIORITY:
+        // priorities are not used for scheduling
+        if (stream_id == 0)
+            return connectionError(PROTOCOL_ERROR, "PRIORITY on stream 0");
+        if (payload.size() != 5)
+            resetStream(stream_id, FRAME_SIZE_ERROR);
+        return true;
+    case RST_STREAM:
+        if (stream_id == 0 || stream_id > last_stream_id_)
+            return connectionError(PROTOCOL_ERROR, "RST_STREAM on idle stream");
+        if (payload.size() != 4)
+            return connectionError(FRAME_SIZE_ERROR, "RST_STREAM size");
+        streams_.erase(stream_id);
+        return true;
+    case PING:
+        if (stream_id != 0)
+            return connectionError(PROTOCOL_ERROR, "PING on a stream");
+        if (payload.size() != 8)
+            return connectionError(FRAME_SIZE_ERROR, "PING size");
+        if (!(flags & FLAG_ACK))
+            queueFrame(PING, FLAG_ACK, 0, payload);
+        return true;
+    case GOAWAY:
+        if (stream_id != 0)
+            return connectionError(PROTOCOL_ERROR, "GOAWAY on a stream");
+        is_goaway_received_ = true;
+        return true;
+    case PUSH_PROMISE:
+        return connectionError(PROTOCOL_ERROR, "PUSH_PROMISE from client");
+    default:
+        // unknown frame types are ignored
+        return true;
+    }
+}
+
+bool Http2Session::handleData(uint8_t flags, uint32_t stream_id, std::string_view payload)
+{
+    if (stream_id == 0)
+        return connectionError(PROTOCOL_ERROR, "DATA on stream 0");
+    if ((flags & FLAG_PADDED) && (payload.empty() || static_cast<unsigned char>(payload[0]) >= payload.size()))
+        return connectionError(PROTOCOL_ERROR, "DATA padding");
+
+    // bodies are discarded, give the whole frame (padding included) back to the connection window
+    if (!payload.empty())
+        queueWindowUpdate(0, payload.size());
+
+    const auto iter = streams_.find(stream_id);
+    if (iter == streams_.end() || iter->second->is_request_complete)
+    {
+        if (stream_id > last_stream_id_)
+            return connectionError(PROTOCOL_ERROR, "DATA on idle stream");
+        resetStream(stream_id, STREAM_CLOSED);
+        return true;
+    }
+
+    auto &stream = *iter->second;
+    if (flags & FLAG_END_STREAM)
+        handleRequest(stream);
+    else if (!payload.empty())
+        queueWindowUpdate(stream_id, payload.size());
+    return true;
+}
+
+bool Http2Session::handleHeaders(uint8_t flags, uint32_t stream_id, std::string_view payload)
+{
+    if (stream_id == 0 || stream_id % 2 == 0)
+        return connectionError(PROTOCOL_ERROR, "HEADERS on a server stream id");
+
+    std::size_t begin = 0, pad_length = 0;
+    if (flags & FLAG_PADDED)
+    {
+        if (payload.empty())
+            return connectionError(PROTOCOL_ERROR, "HEADERS padding");
+        pad_length = static_cast<unsigned char>(payload[0]);
+        begin = 1;
+    }
+    if (flags & FLAG_PRIORITY)
+        begin += 5;
+    if (begin + pad_length > payload.size())
+        return connectionError(PROTOCOL_ERROR, "HEADERS padding");
+
+    if (const auto iter = streams_.find(stream_id); iter != streams_.end())
+    {
+        // trailers must end the request
+        if (iter->second->is_request_complete || !(flags & FLAG_END_STREAM))
+            return connectionError(PROTOCOL_ERROR, "HEADERS on a half closed stream");
+    }
+    else if (stream_id <= last_stream_id_)
+        return connectionError(STREAM_CLOSED, "HEADERS on a closed stream");
+
+    header_block_.assign(payload.substr(begin, payload.size() - begin - pad_length));
+    if (flags & FLAG_END_HEADERS)
+        return handleHeaderBlock(stream_id, flags & FLAG_END_STREAM);
+
+    header_stream_id_ = stream_id;
+    is_header_end_stream_ = flags & FLAG_END_STREAM;
+    return true;
+}
+
+bool Http2Session::handleContinuation(uint8_t flags, uint32_t stream_id, std::string_view payload)
+{
+    if (header_stream_id_ == 0 || stream_id != header_stream_id_)
+        return connectionError(PROTOCOL_ERROR, "unexpected CONTINUATION");
+    if (header_block_.size() + payload.size() > kMaxHeaderListSize)
+        return connectionError(ENHANCE_YOUR_CALM, "header block too large");
+
+    header_block_.append(payload);
+    if (!(flags & FLAG_END_HEADERS))
+        return true;
+    header_stream_id_ = 0;
+    return handleHeaderBlock(stream_id, is_header_end_stream_);
+}
+
+bool Http2Session::handleHeaderBlock(uint32_t stream_id, bool is_end_stream)
+{
+    // decode even if the stream is refused, the HPACK state is per connection
+    std::vector<HpackHeader> headers;
+    const bool is_decoded = decoder_.decode(header_block_, headers, kMaxHeaderListSize);
+    header_block_.clear();
+    if (!is_decoded)
+        return connectionError(COMPRESSION_ERROR, "invalid header block");
+
+    if (const auto iter = streams_.find(stream_id); iter != streams_.end())
+    {
+        // trailers are ignored like the body
+        handleRequest(*iter->second);
+        return true;
+    }
+
+    last_stream_id_ = stream_id;
+    // after shutdown() the peer may not have seen the GOAWAY yet
+    if (is_shutdown_ || streams_.size() >= kMaxConcurrentStreams)
+    {
+        resetStream(stream_id, REFUSED_STREAM);
+        return true;
+    }
+
+    auto stream = std::make_unique<Stream>();
+    stream->id = stream_id;
+    stream->send_window = peer_initial_window_size_;
+    if (!makeRequestHead(headers, stream->request_head))
+    {
+        LOG_DEBUG("Malformed HTTP/2 request on stream ", stream_id);
+        resetStream(stream_id, PROTOCOL_ERROR);
+        return true;
+    }
+
+    auto &ref = *stream;
+    streams_.emplace(stream_id, std::move(stream));
+    if (is_end_stream)
+        handleRequest(ref);
+    return true;
+}
+
+bool Http2Session::makeRequestHead(const std::vector<HpackHeader> &headers, std::string &head)
+{
+    std::string_view method, path, authority;
+    std::string fields;
+    bool is_regular_seen = false;
+    for (const auto &[name, value] : headers)
+    {
+        // CR, LF or NUL would smuggle extra lines into the HTTP/1.1 head
+        if (name.empty() || value.find_first_of(std::string_view("\r\n\0", 3)) != std::string::npos)
+            return false;
+
+        if (name[0] == ':')
+        {
+            if (is_regular_seen)
+                return false;
+            if (name == ":method")
+                method = value;
+            else if (name == ":path")
+                path = value;
+            else if (name == ":authority")
+                authority = value;
+            else if (name != ":scheme")
+                return false;
+            continue;
+        }
+
+        is_regular_seen = true;
+        if (isConnectionSpecific(name) ||
+            std::any_of(name.begin(), name.end(), [](unsigned char c)
+                        { return std::isupper(c) || c <= ' ' || c == ':' || c >= 0x7f; }))
+            return false;
+        if (name == "host" && !authority.empty())
+            continue;
+
+        fields.append(name).append(": ").append(value).append("\r\n");
+    }
+
+    if (method.empty() || path.empty() || path.find(' ') != std::string_view::npos)
+        return false;
+
+    head.assign(method).append(" ").append(path).append(" HTTP/1.1\r\n");
+    if (!authority.empty())
+        head.append("Host: ").append(authority).append("\r\n");
+    head.append(fields).append("\r\n");
+    return true;
+}
+
+void Http2Session::handleRequest(Stream &stream)
+{
+    stream.is_request_complete = true;
+    if (!stream.request.parse(std::move(stream.request_head)))
+        RequestHandler::setErrorResponse(stream.response, HttpStatusCode::BAD_REQUEST);
+    else
+        RequestHandler(stream.request, root_dir_, stream.response).handle();
+    if (stream.request.method() == HttpMethod::HEAD)
+        stream.response.stream.reset();
+
+    // HEADERS and CONTINUATION frames within the peer's frame size
+    std::string block;
+    auto &head = stream.response.head;
+    encoder_.encode(static_cast<unsigned>(head.statusCode()), head.headers(), block);
+    head.clear();
+
+    const bool is_body_empty = stream.response.body.empty() && !stream.response.stream;
+    std::string_view rest = block;
+    uint8_t type = HEADERS;
+    uint8_t flags = is_body_empty ? FLAG_END_STREAM : 0;
+    do
+    {
+        const auto fragment = rest.substr(0, peer_max_frame_size_);
+        rest.remove_prefix(fragment.size());
+        queueFrame(type, flags | (rest.empty() ? FLAG_END_HEADERS : 0), stream.id, fragment);
+        type = CONTINUATION;
+        flags = 0;
+    } while (!rest.empty());
+
+    if (is_body_empty)
+        streams_.erase(stream.id);
+    else
+        schedule(stream);
+}
+
+void Http2Session::schedule(Stream &stream)
+{
+    if (stream.is_scheduled || (stream.response.body.empty() && !stream.response.stream) || stream.send_window <= 0)
+        return;
+    stream.is_scheduled = true;
+    ready_streams_.push_back(stream.id);
+}
+
+bool Http2Session::pullBody(Stream &stream)
+{
+    auto &response = stream.response;
+    while (response.stream && response.body.size() < kMaxStreamBuffered)
+    {
+        const auto res = response.stream->fill(response.body, kStreamPieceSize);
+        if (res == ResponseStream::Result::FAILED)
+            return false;
+        if (res == ResponseStream::Result::DONE)
+            response.stream.reset();
+    }
+    return true;
+}
+
+bool Http2Session::handleSettings(uint8_t flags, uint32_t stream_id, std::string_view payload)
+{
+    if (stream_id != 0)
+        return connectionError(PROTOCOL_ERROR, "SETTINGS on a stream");
+    if (flags & FLAG_ACK)
+    {
+        if (!payload.empty())
+            return connectionError(FRAME_SIZE_ERROR, "SETTINGS ack with payload");
+        return true;
+    }
+    if (payload.size() % 6 != 0)
+        return connectionError(FRAME_SIZE_ERROR, "SETTINGS size");
+    if (!applySettings(payload))
+        return false;
+
+    is_settings_received_ = true;
+    queueFrame(SETTINGS, FLAG_ACK, 0, {});
+    return true;
+}
+
+bool Http2Session::applySettings(std::string_view payload)
+{
+    for (std::size_t pos = 0; pos + 6 <= payload.size(); pos += 6)
+    {
+        const auto id = static_cast<uint16_t>((static_cast<unsigned char>(payload[pos]) << 8) | static_cast<unsigned char>(payload[pos + 1]));
+        const uint32_t value = readUint32(payload.substr(pos + 2, 4));
+        switch (id)
+        {
+        case SETTINGS_HEADER_TABLE_SIZE:
+            encoder_.setMaxTableSize(value);
+            break;
+        case SETTINGS_ENABLE_PUSH:
+            if (value > 1)
+                return connectionError(PROTOCOL_ERROR, "SETTINGS_ENABLE_PUSH");
+            break;
+        case SETTINGS_INITIAL_WINDOW_SIZE:
+        {
+            if (value > kMaxWindowSize)
+                return connectionError(FLOW_CONTROL_ERROR, "SETTINGS_INITIAL_WINDOW_SIZE");
+            // the change applies to every open stream, RFC 7540 sec 6.9.2
+            const int64_t delta = static_cast<int64_t>(value) - peer_initial_window_size_;
+            for (auto &entry : streams_)
+            {
+                auto &stream = *entry.second;
+                if (stream.send_window + delta > kMaxWindowSize)
+                    return connectionError(FLOW_CONTROL_ERROR, "stream window overflow");
+                stream.send_window += delta;
+                schedule(stream);
+            }
+            peer_initial_window_size_ = value;
+            break;
+        }
+        case SETTINGS_MAX_FRAME_SIZE:
+            if (value < kDefaultMaxFrameSize || value > kMaxAllowedFrameSize)
+                return connectionError(PROTOCOL_ERROR, "SETTINGS_MAX_FRAME_SIZE");
+            peer_max_frame_size_ = value;
+            break;
+        default:
+            // unknown settings are ignored
+            break;
+        }
+    }
+    return true;
+}
+
+bool Http2Session::handleWindowUpdate(uint32_t stream_id, std::string_view payload)
+{
+    if (payload.size() != 4)
+        return connectionError(FRAME_SIZE_ERROR, "WINDOW_UPDATE size");
+    const uint32_t increment = readUint32(payload) & 0x7fffffff;
+
+    if (stream_id == 0)
+    {
+        if (increment == 0)
+            return connectionError(PROTOCOL_ERROR, "WINDOW_UPDATE of 0");
+        if (connection_send_window_ + increment > kMaxWindowSize)
+            return connectionError(FLOW_CONTROL_ERROR, "connection window overflow");
+        connection_send_window_ += increment;
+        return true;
+    }
+
+    const auto iter = streams_.find(stream_id);
+    if (iter == streams_.end())
+    {
+        if (stream_id > last_stream_id_)
+            return connectionError(PROTOCOL_ERROR, "WINDOW_UPDATE on idle stream");
+        return true;
+    }
+    auto &stream = *iter->second;
+    if (increment == 0)
+        resetStream(stream_id, PROTOCOL_ERROR);
+    else if (stream.send_window + increment > kMaxWindowSize)
+        resetStream(stream_id, FLOW_CONTROL_ERROR);
+    else
+    {
+        stream.send_window += increment;
+        schedule(stream);
+    }
+    return true;
+}
+
+void Http2Session::fillOutput(OutputBuffer &out)
+{
+    if (!frames_.empty())
+    {
+        out.append(std::move(frames_));
+        frames_.clear();
+    }
+
+    std::size_t queued = 0;
+    while (!ready_streams_.empty() && connection_send_window_ > 0 && queued < kMaxOutputBytes)
+    {
+        const auto stream_id = ready_streams_.front();
+        ready_streams_.pop_front();
+        const auto iter = streams_.find(stream_id);
+        if (iter == streams_.end())
+            continue;
+
+        auto &stream = *iter->second;
+        stream.is_scheduled = false;
+        if (!pullBody(stream))
+        {
+            resetStream(stream_id, INTERNAL_ERROR);
+            continue;
+        }
+        auto &body = stream.response.body;
+        const std::size_t length = std::min({body.size(),
+                                             static_cast<std::size_t>(std::max<int64_t>(stream.send_window, 0)),
+                                             static_cast<std::size_t>(connection_send_window_),
+                                             static_cast<std::size_t>(peer_max_frame_size_)});
+        // a streamed body may end without a last piece, an empty DATA frame ends the stream then
+        const bool is_end_stream = length == body.size() && !stream.response.stream;
+        if (length == 0 && !is_end_stream)
+            continue;
+
+        std::string header;
+        appendFrameHeader(header, length, DATA, is_end_stream ? FLAG_END_STREAM : 0, stream_id);
+        out.append(std::move(header));
+        body.moveFront(out, length);
+        stream.send_window -= length;
+        connection_send_window_ -= length;
+        queued += length;
+
+        if (is_end_stream)
+            streams_.erase(iter);
+        else
+            schedule(stream); // to the back, streams take turns
+    }
+}
+
+bool Http2Session::hasPendingOutput() const noexcept
+{
+    return !frames_.empty() || (!ready_streams_.empty() && connection_send_window_ > 0);
+}
+
+bool Http2Session::isFinished() const noexcept
+{
+    return is_goaway_sent_ || ((is_goaway_received_ || is_shutdown_) && streams_.empty());
+}
+
+void Http2Session::shutdown()
+{
+    if (is_shutdown_ || is_goaway_sent_)
+        return;
+
+    std::string payload;
+    appendUint32(payload, last_stream_id_);
+    appendUint32(payload, NO_ERROR);
+    queueFrame(GOAWAY, 0, 0, payload);
+    is_shutdown_ = true;
+}
+
+void Http2Session::queueFrame(uint8_t type, uint8_t flags, uint32_t stream_id, std::string_view payload)
+{
+    appendFrameHeader(frames_, payload.size(), type, flags, stream_id);
+    frames_.append(payload);
+}
+
+void Http2Session::queueWindowUpdate(uint32_t stream_id, uint32_t increment)
+{
+    std::string payload;
+    appendUint32(payload, increment);
+    queueFrame(WINDOW_UPDATE, 0, stream_id, payload);
+}
+
+void Http2Session::resetStream(uint32_t stream_id, uint32_t error_code)
+{
+    std::string payload;
+    appendUint32(payload, error_code);
+    queueFrame(RST_STREAM, 0, stream_id, payload);
+    streams_.erase(stream_id);
+}
+
+bool Http2Session::connectionError(uint32_t error_code, std::string_view reason)
+{
+    LOG_DEBUG("HTTP/2 connection error ", error_code, ": ", reason);
+    if (is_goaway_sent_)
+        return false;
+
+    std::string payload;
+    appendUint32(payload, last_stream_id_);
+    appendUint32(payload, error_code);
+    payload.append(reason);
+    queueFrame(GOAWAY, 0, 0, payload);
+    is_goaway_sent_ = true;
+    streams_.clear();
+    ready_streams_.clear();
+    return false;
+}
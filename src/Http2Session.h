@@ -0,0 +1,123 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "./Hpack.h"
+#include "./HttpParser.h"
+#include "./HttpResponse.h"
+#include "./OutputBuffer.h"
+#include "./util/Noncopyable.h"
+
+// Server side of one cleartext HTTP/2 connection (RFC 7540): frames in,
+// frames out, no socket I/O. Each stream's request is rebuilt as an
+// HTTP/1.1 head so RequestHandler serves it unchanged, and the response
+// body is cut into DATA frames by OutputBuffer::moveFront, so file bodies
+// are still sent by sendfile. Streams are served round-robin within the
+// peer's flow control windows; a body of unknown length (ResponseStream) is
+// made as its DATA frames go out. Request bodies are read and discarded,
+// priorities are ignored and server push is never used.
+class Http2Session : NonCopyable
+{
+public:
+    static constexpr std::string_view kConnectionPreface = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+    explicit Http2Session(std::string_view root_dir);
+
+    // the preface starts like a request head: "PRI * HTTP/2.0\r\n\r\n"
+    [[nodiscard]] static bool isPreface(std::string_view head) noexcept
+    {
+        return head.substr(0, 18) == kConnectionPreface.substr(0, 18);
+    }
+
+    // h2c upgrade: request becomes stream 1, settings is the HTTP2-Settings
+    // header (base64url SETTINGS payload); false if settings is malformed
+    [[nodiscard]] bool startUpgraded(const HttpParser &request, std::string_view settings);
+
+    // consumes received bytes, false on a connection error (GOAWAY is queued)
+    [[nodiscard]] bool receive(std::string_view data);
+
+    // appends queued frames and as much DATA as the windows allow
+    void fillOutput(OutputBuffer &out);
+    [[nodiscard]] bool hasPendingOutput() const noexcept;
+    // graceful GOAWAY: open streams are served, new ones refused
+    void shutdown();
+    // GOAWAY was exchanged and no stream is left
+    [[nodiscard]] bool isFinished() const noexcept;
+
+private:
+    static constexpr uint32_t kMaxConcurrentStreams = 128;
+    static constexpr uint32_t kDefaultWindowSize = 65535;
+    static constexpr uint32_t kMaxWindowSize = 0x7fffffff;
+    static constexpr uint32_t kDefaultMaxFrameSize = 16384;
+    static constexpr std::size_t kMaxHeaderListSize = 64 * 1024;
+    // DATA queued by one fillOutput(), the socket takes this much at once at most
+    static constexpr std::size_t kMaxOutputBytes = 256 * 1024;
+    // a streamed response body is made this far ahead of its DATA frames, in pieces of kStreamPieceSize
+    static constexpr std::size_t kMaxStreamBuffered = 64 * 1024;
+    static constexpr std::size_t kStreamPieceSize = 16 * 1024;
+    static constexpr std::size_t kFrameHeaderSize = 9;
+
+    struct Stream
+    {
+        uint32_t id;
+        std::string request_head; // HTTP/1.1 form of the request headers
+        HttpParser request;
+        HttpResponse response;
+        int64_t send_window;
+        bool is_request_complete{false};
+        bool is_scheduled{false}; // in ready_streams_
+    };
+
+    std::string_view root_dir_;
+    HpackDecoder decoder_;
+    HpackEncoder encoder_;
+
+    std::string input_;
+    std::string frames_; // control and HEADERS frames, sent before any DATA
+    std::unordered_map<uint32_t, std::unique_ptr<Stream>> streams_;
+    std::deque<uint32_t> ready_streams_; // streams with response DATA to send
+
+    // CONTINUATION state
+    std::string header_block_;
+    uint32_t header_stream_id_{0};
+    bool is_header_end_stream_{false};
+
+    uint32_t last_stream_id_{0};
+    int64_t connection_send_window_{kDefaultWindowSize};
+    uint32_t peer_initial_window_size_{kDefaultWindowSize};
+    uint32_t peer_max_frame_size_{kDefaultMaxFrameSize};
+
+    bool is_preface_received_{false};
+    bool is_settings_received_{false};
+    bool is_goaway_sent_{false};
+    bool is_goaway_received_{false};
+    bool is_shutdown_{false}; // GOAWAY NO_ERROR sent by shutdown()
+
+    [[nodiscard]] bool handleFrame(uint8_t type, uint8_t flags, uint32_t stream_id, std::string_view payload);
+    [[nodiscard]] bool handleData(uint8_t flags, uint32_t stream_id, std::string_view payload);
+    [[nodiscard]] bool handleHeaders(uint8_t flags, uint32_t stream_id, std::string_view payload);
+    [[nodiscard]] bool handleContinuation(uint8_t flags, uint32_t stream_id, std::string_view payload);
+    [[nodiscard]] bool handleSettings(uint8_t flags, uint32_t stream_id, std::string_view payload);
+    [[nodiscard]] bool handleWindowUpdate(uint32_t stream_id, std::string_view payload);
+    [[nodiscard]] bool applySettings(std::string_view payload);
+    [[nodiscard]] bool handleHeaderBlock(uint32_t stream_id, bool is_end_stream);
+
+    // rebuilds the request line and headers, false if the request is malformed
+    [[nodiscard]] static bool makeRequestHead(const std::vector<HpackHeader> &headers, std::string &head);
+    void handleRequest(Stream &stream);
+    void schedule(Stream &stream);
+    // the next pieces of a streamed response body, false if it broke off
+    [[nodiscard]] bool pullBody(Stream &stream);
+
+    void queueFrame(uint8_t type, uint8_t flags, uint32_t stream_id, std::string_view payload);
+    void queueWindowUpdate(uint32_t stream_id, uint32_t increment);
+    void resetStream(uint32_t stream_id, uint32_t error_code);
+    // queues GOAWAY and returns false for the caller to pass on
+    [[nodiscard]] bool connectionError(uint32_t error_code, std::string_view reason);
+};
@@ -1,4 +1,6 @@
 #include <algorithm>
+#include <array>
+#include <charconv>
 #include <string>
 #include <string_view>
 #include <functional>
@@ -10,32 +12,43 @@
 #include <cstdlib>
 
 #include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
 #include <sys/epoll.h>
-#include <sys/sendfile.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <fcntl.h>
 #include <unistd.h>
 
 #include "./util/utils.h"
+#include "./util/Ascii.h"
 #include "./util/FdHolder.h"
 #include "./HttpContext.h"
 #include "./HttpParser.h"
+#include "./RequestHandler.h"
 #include "./HttpResponseBuilder.h"
+#include "./Http2Session.h"
 #include "./HttpTypes.h"
 #include "./TcpSocket.h"
 #include "./Logger.h"
-#include "./Mime.h"
+#include "./LatencyRecorder.h"
+#include "./RateLimiter.h"
 #include "./DefaultErrorPages.h"
+#include "./Proxy.h"
+#include "./FastCgi.h"
 
 HttpContext::HttpContext(std::unique_ptr<TcpSocket> &&socket,
                          int epoll_fd,
                          std::function<void(int)> remove_connection_callback,
                          std::string_view root_dir,
-                         TimerQueue::TimerId timer_id)
-    : socket_(std::move(socket)), epoll_fd_(epoll_fd),
+                         TimerQueue &timers,
+                         TimerQueue::TimerId timer_id,
+                         UpstreamPool *upstreams,
+                         FastCgiPool *fastcgi_pool)
+    : upstreams_(upstreams), fastcgi_pool_(fastcgi_pool), socket_(std::move(socket)), epoll_fd_(epoll_fd),
       remove_connection_callback_(std::move(remove_connection_callback)),
-      root_dir_(root_dir), timer_id_(timer_id)
+      root_dir_(root_dir), timers_(&timers), timer_id_(timer_id),
+      peer_addr_(RateLimiter::instance().peerAddr(socket_->fd()))
 {
     LOG_DEBUG("Construct HttpContext ", (long)this);
 }
@@ -43,7 +56,12 @@ HttpContext::HttpContext(std::unique_ptr<TcpSocket> &&socket,
 void HttpContext::doRead()
 {
     LOG_DEBUG("HttpContext doRead(), this = ", (long)this);
-    if (state_ == State::RECEIVE_HEAD)
+    LatencyRecorder::instance().record(RequestPhase::QUEUE, dispatch_ticks_);
+    if (state_ == State::HTTP2)
+        handleHttp2();
+    else if (state_ == State::TLS_HANDSHAKE)
+        handleTlsHandshake();
+    else if (state_ == State::RECEIVE_HEAD)
         handleStateRecvHead();
     else if (state_ == State::RECEIVE_BODY)
         handleStateRecvBody();
@@ -53,7 +71,38 @@ void HttpContext::doRead()
 
 void HttpContext::doWrite()
 {
-    const int retval = sendAll();
+    LatencyRecorder::instance().record(RequestPhase::QUEUE, dispatch_ticks_);
+    if (state_ == State::HTTP2)
+    {
+        handleHttp2();
+        return;
+    }
+    if (state_ == State::TLS_HANDSHAKE)
+    {
+        handleTlsHandshake();
+        return;
+    }
+    if (state_ == State::PROXY)
+    {
+        handleProxy();
+        return;
+    }
+    if (state_ == State::FASTCGI)
+    {
+        handleFastCgi();
+        return;
+    }
+    if (state_ == State::STREAM)
+    {
+        handleStream();
+        return;
+    }
+    sendResponse();
+}
+
+void HttpContext::sendResponse()
+{
+    const long retval = output_.sendTo(socket_->fd(), tls_.get());
     LOG_DEBUG("HttpContext doWrite(), retval = ", retval, ", this = ", (long)this);
     if (retval == -1)
     {
@@ -63,8 +112,9 @@ void HttpContext::doWrite()
         return;
     }
 
-    if (write_index_ != write_buffer_.size() || write_file_fd_)
+    if (!output_.empty())
     {
+        setDeadline(timeouts_.send_ms);
         // if (epollModOneShot(epoll_fd_, EPOLLOUT, socket_->fd()) == -1)
         // {
         //     LOG_ERROR("Epoll oneshot event EPOLLOUT modify failed for fd(", socket_->fd(), "), reason: ", logErrStr(errno));
@@ -78,9 +128,26 @@ void HttpContext::doWrite()
     }
     else
     {
-        if (parser_.isKeepAlive() && state_ != State::SEND_ERROR)
+        if (isKeepAlive() && state_ != State::SEND_ERROR)
         {
+            recordSendCompleted();
+            // requests the client pipelined behind this one were read with it
+            read_buffer_.erase(0, request_length_);
+            auto pipelined = std::move(read_buffer_);
             reset();
+            read_buffer_ = std::move(pipelined);
+            if (!read_buffer_.empty())
+            {
+                // no event comes for bytes already read
+                is_pipelined_ = true;
+                request_start_ticks_ = LatencyRecorder::instance().start();
+                setDeadline(timeouts_.header_ms);
+                handleStateRecvHead();
+                return;
+            }
+            if (!becomeIdle())
+                return;
+            setDeadline(timeouts_.keep_alive_ms);
             // if (epollModOneShot(epoll_fd_, EPOLLIN, socket_->fd()) == -1)
             if (epollModOneShot(epoll_fd_, EPOLLIN /*|EPOLLET*/, socket_->fd()) == -1)
             {
@@ -88,8 +155,18 @@ void HttpContext::doWrite()
                 remove_connection_callback_(socket_->fd());
             }
         }
+        else if (output_.hasPendingZeroCopy())
+        {
+            // the kernel still reads the body, wait for EPOLLERR before closing
+            if (epollModOneShot(epoll_fd_, 0, socket_->fd()) == -1)
+            {
+                LOG_ERROR("Epoll oneshot event modify failed for fd(", socket_->fd(), "), reason: ", logErrStr(errno));
+                remove_connection_callback_(socket_->fd());
+            }
+        }
         else
         {
+            recordSendCompleted();
             state_ = State::CLOSE;
             if (epollDel(epoll_fd_, socket_->fd()) == -1)
                 LOG_ERROR("Epoll event delete failed for fd(", socket_->fd(), "), reason: ", logErrStr(errno));
@@ -98,24 +175,132 @@ void HttpContext::doWrite()
     }
 }
 
+void HttpContext::doErrorQueue()
+{
+    output_.reapZeroCopy(socket_->fd());
+    if (state_ == State::SEND || state_ == State::SEND_ERROR || state_ == State::STREAM ||
+        state_ == State::PROXY || state_ == State::FASTCGI)
+        doWrite();
+    else
+        doRead();
+}
+
 void HttpContext::setContext(std::unique_ptr<TcpSocket> &&socket,
                              int epoll_fd,
                              std::function<void(int)> remove_connection_callback,
                              std::string_view root_dir,
-                             TimerQueue::TimerId timer_id)
+                             TimerQueue &timers,
+                             TimerQueue::TimerId timer_id,
+                             UpstreamPool *upstreams,
+                             FastCgiPool *fastcgi_pool)
 {
     socket_ = std::move(socket);
+    upstreams_ = upstreams;
+    fastcgi_pool_ = fastcgi_pool;
     epoll_fd_ = epoll_fd;
     remove_connection_callback_ = std::move(remove_connection_callback);
     root_dir_ = root_dir;
+    timers_ = &timers;
     timer_id_ = timer_id;
+    peer_addr_ = RateLimiter::instance().peerAddr(socket_->fd());
+    request_count_ = 0;
+    is_http2_.store(false, std::memory_order_relaxed);
+    idle_state_.store(IdleState::IDLE);
+    output_.resetZeroCopy();
     reset();
 }
 
+void HttpContext::resetContext()
+{
+    // a reset drops what the kernel has queued, MSG_ZEROCOPY pages included,
+    // before their holders are released
+    if (socket_ && output_.hasPendingZeroCopy())
+        LOGIF_BERROR(socket_->setLinger(true, 0), "Failed to set linger option for fd = ", socket_->fd());
+    output_.resetZeroCopy();
+    response_.stream.reset();
+    proxy_.reset();
+    fastcgi_.reset();
+    tls_ = nullptr;
+    socket_ = nullptr;
+}
+
+void HttpContext::drain()
+{
+    // an idle HTTP/1.x connection reads EOF and closes, a request sent meanwhile is still
+    // read from the queue and answered with Connection: close. A request under way is left
+    // alone, an upload would read EOF; is_draining_ closes it after its response. HTTP/2
+    // needs the socket for WINDOW_UPDATE, its session sends GOAWAY on its next activity.
+    if (is_http2_.load(std::memory_order_relaxed))
+        return;
+    auto expected = IdleState::IDLE;
+    if (idle_state_.compare_exchange_strong(expected, IdleState::SHUT_DOWN) && ::shutdown(socket_->fd(), SHUT_RD) == -1)
+        LOG_DEBUG("Failed to shutdown fd = ", socket_->fd(), ", reason: ", logErrStr(errno));
+}
+
+bool HttpContext::becomeIdle()
+{
+    idle_state_.store(IdleState::IDLE);
+    // drain() ran while the request was under way and skipped this connection
+    if (is_draining_.load())
+    {
+        closeConnection();
+        return false;
+    }
+    return true;
+}
+
+void HttpContext::startTls(std::unique_ptr<TlsStream> tls)
+{
+    // OpenSSL reads and writes the socket itself, accepted sockets are nonblocking already
+    tls_ = std::move(tls);
+    state_ = State::TLS_HANDSHAKE;
+}
+
+void HttpContext::handleTlsHandshake()
+{
+    switch (tls_->handshake())
+    {
+    case TlsStream::HandshakeResult::DONE:
+        if (tls_->isHttp2())
+        {
+            // ALPN h2, the client preface follows without an HTTP/1.1 request
+            http2_ = std::make_unique<Http2Session>(root_dir_);
+            state_ = State::HTTP2;
+            is_http2_.store(true, std::memory_order_relaxed);
+            handleHttp2();
+            return;
+        }
+        state_ = State::RECEIVE_HEAD;
+        if (epollModOneShot(epoll_fd_, EPOLLIN /*|EPOLLET*/, socket_->fd()) == -1)
+            LOG_ERROR("Epoll oneshot event EPOLLIN modify failed for fd(", socket_->fd(), "), reason: ", logErrStr(errno));
+        break;
+    case TlsStream::HandshakeResult::WANT_READ:
+        if (epollModOneShot(epoll_fd_, EPOLLIN /*|EPOLLET*/, socket_->fd()) == -1)
+            LOG_ERROR("Epoll oneshot event EPOLLIN modify failed for fd(", socket_->fd(), "), reason: ", logErrStr(errno));
+        break;
+    case TlsStream::HandshakeResult::WANT_WRITE:
+        if (epollModOneShot(epoll_fd_, EPOLLOUT /*|EPOLLET*/, socket_->fd()) == -1)
+            LOG_ERROR("Epoll oneshot event EPOLLOUT modify failed for fd(", socket_->fd(), "), reason: ", logErrStr(errno));
+        break;
+    case TlsStream::HandshakeResult::ERROR:
+        closeConnection();
+        break;
+    }
+}
+
+long HttpContext::recvSome(void *buf, std::size_t len)
+{
+    if (tls_)
+        return tls_->recv(buf, len);
+    return ::recv(socket_->fd(), buf, len, MSG_DONTWAIT);
+}
+
 int HttpContext::__recv(std::string &read_buf)
 {
+    // stops at kMaxHeadSize, what follows a head is left for the body
     int pos = 0, retval = 0, total = 0;
-    while ((retval = ::recv(socket_->fd(), temp_read_buffer_.begin() + pos, std::size(temp_read_buffer_) - pos, MSG_DONTWAIT)) > 0)
+    while (read_buf.size() < kMaxHeadSize &&
+           (retval = recvSome(temp_read_buffer_.begin() + pos, std::size(temp_read_buffer_) - pos)) > 0)
     {
         pos += retval;
         if (pos == std::size(temp_read_buffer_))
@@ -131,136 +316,246 @@ int HttpContext::__recv(std::string &read_buf)
         LOG_ERROR("Receive error, reason: ", logErrStr(errno));
         return -1;
     }
+    // EPOLLIN on a TLS socket may carry no application data
+    if (retval == -1 && total + pos == 0)
+        return -1;
 
     read_buf.reserve(read_buf.size() + pos);
-    std::copy(std::begin(temp_read_buffer_), std::begin(temp_read_buffer_) + pos, std::back_inserter(read_buffer_));
+    std::copy(std::begin(temp_read_buffer_), std::begin(temp_read_buffer_) + pos, std::back_inserter(read_buf));
     return total + pos;
 }
 
 HttpContext::HttpReadResult HttpContext::recvTillEnd()
 {
-    const int prev_buffer_size = read_buffer_.size();
-    if (const int retval = __recv(read_buffer_); retval == -1)
+    // pipelined bytes are searched from the start, and answered even if the client closed its side after them
+    const bool is_pipelined = is_pipelined_;
+    is_pipelined_ = false;
+    const int prev_buffer_size = is_pipelined ? 0 : read_buffer_.size();
+    const int retval = __recv(read_buffer_);
+    if (retval == -1 && errno != EAGAIN && errno != EWOULDBLOCK)
         return HttpReadResult::ERROR;
-    else if (retval == 0)
+    if (!is_pipelined && retval == -1)
+        return HttpReadResult::NOT_READY;
+    if (!is_pipelined && retval == 0)
         return HttpReadResult::PEER_CLOSED;
 
+    // the end of the head may have been split over two reads
     static constexpr char needle[] = "\r\n\r\n";
     thread_local auto searcher = std::boyer_moore_searcher(std::begin(needle), std::prev(std::end(needle)));
-    auto iter = std::search(read_buffer_.begin() + prev_buffer_size, read_buffer_.end(), searcher);
-    if (iter == read_buffer_.end())
-        return HttpReadResult::NOT_READY;
-    return HttpReadResult::READY;
+    auto iter = std::search(read_buffer_.begin() + std::max(prev_buffer_size - 3, 0), read_buffer_.end(), searcher);
+    if (iter != read_buffer_.end())
+        return HttpReadResult::READY;
+    if (retval == 0)
+        return HttpReadResult::PEER_CLOSED;
+    if (read_buffer_.size() >= kMaxHeadSize)
+    {
+        LOG_DEBUG("Request head over ", kMaxHeadSize, " bytes, fd = ", socket_->fd());
+        setDefaultErrorResponse(HttpStatusCode::BAD_REQUEST);
+        return HttpReadResult::REJECTED;
+    }
+    return HttpReadResult::NOT_READY;
 }
 
 HttpContext::HttpReadResult HttpContext::recvBody()
 {
-    const int recv_len = __recv(body_buffer_);
-    if (const int retval = __recv(read_buffer_); retval == -1)
-        return HttpReadResult::ERROR;
-    else if (retval == 0)
-        return HttpReadResult::PEER_CLOSED;
+    // a large body on its way to a file moves socket -> pipe -> file in the kernel
+    if (!tls_ && !is_body_chunked_ && body_.isOpen() && body_left_ >= kSpliceMinSize &&
+        body_.size() + body_left_ > body_.memoryLimit())
+    {
+        long retval = 0;
+        while (body_left_ > 0 && (retval = body_.spliceFrom(socket_->fd(), body_left_)) > 0)
+            body_left_ -= retval;
+        if (body_left_ == 0)
+            return HttpReadResult::READY;
+        if (retval == 0)
+            return HttpReadResult::PEER_CLOSED;
+        return errno == EAGAIN || errno == EWOULDBLOCK ? HttpReadResult::NOT_READY : HttpReadResult::ERROR;
+    }
 
-    to_read_body_bytes_ -= recv_len;
-    if (to_read_body_bytes_ <= 0)
+    thread_local std::array<char, 64 * 1024> buffer;
+    long retval;
+    while ((retval = recvSome(buffer.data(), buffer.size())) > 0)
     {
-        if (to_read_body_bytes_ < 0)
-        {
-            LOG_WARNING("Size of body_buffer_(", body_buffer_.size(), ") is larger than expected(", ((int)body_buffer_.size()) + to_read_body_bytes_, "), body_buffer_: ", body_buffer_);
-            body_buffer_.resize(body_buffer_.size() + to_read_body_bytes_);
-        }
-        return HttpReadResult::READY;
+        if (const auto res = consumeBody(std::string_view(buffer.data(), retval)); res != HttpReadResult::NOT_READY)
+            return res;
     }
-    return HttpReadResult::NOT_READY;
+    if (retval == 0)
+        return HttpReadResult::PEER_CLOSED;
+    return errno == EAGAIN || errno == EWOULDBLOCK ? HttpReadResult::NOT_READY : HttpReadResult::ERROR;
 }
 
-int HttpContext::sendAll()
+HttpContext::HttpReadResult HttpContext::startBody(int head_length)
 {
-    int retval;
-    if (write_index_ != write_buffer_.size())
+    const auto transfer_encoding = parser_.header(HttpHeader::TRANSFER_ENCODING);
+    const long long content_length = parser_.getContentLength();
+    is_body_chunked_ = !transfer_encoding.empty();
+    if (is_body_chunked_ && !equalsIgnoreCase(transfer_encoding, "chunked"))
     {
-        while ((retval = ::send(socket_->fd(), write_buffer_.data() + write_index_, write_buffer_.size() - write_index_, MSG_DONTWAIT)) > 0)
-            write_index_ += retval;
-
-        if (retval == -1 && errno != EAGAIN && errno != EWOULDBLOCK)
-        {
-            if (errno != EPIPE)
-                LOG_ERROR("Send error, reason: ", logErrStr(errno));
-            write_file_fd_ = nullptr;
-            return -1;
-        }
+        setDefaultErrorResponse(HttpStatusCode::NOT_IMPLEMENTED);
+        return HttpReadResult::REJECTED;
+    }
+    // both lengths at once is how requests get smuggled past a proxy, RFC 9112 sec 6.3
+    if (content_length < 0 || (is_body_chunked_ && !parser_.header(HttpHeader::CONTENT_LENGTH).empty()))
+    {
+        setDefaultErrorResponse(HttpStatusCode::BAD_REQUEST);
+        return HttpReadResult::REJECTED;
+    }
+    // before anything is allocated for it
+    if (static_cast<uint64_t>(content_length) > max_body_size_)
+    {
+        setDefaultErrorResponse(HttpStatusCode::PAYLOAD_TOO_LARGE);
+        return HttpReadResult::REJECTED;
     }
 
-    if (write_index_ == write_buffer_.size() && write_file_fd_)
+    const bool has_body = is_body_chunked_ || content_length > 0;
+    if (!has_body)
+        request_length_ = head_length;
+    if (!has_body && parser_.method() != HttpMethod::PUT && parser_.method() != HttpMethod::POST)
+        return HttpReadResult::READY;
+    if (!RequestHandler(parser_, root_dir_, response_, &body_).prepareBody())
     {
-        while ((retval = ::sendfile(socket_->fd(), write_file_fd_->first.fd(), &write_file_offset_, write_file_fd_->second)) > 0)
-            if (write_file_offset_ == write_file_fd_->second)
-                break;
+        commitResponse();
+        return HttpReadResult::REJECTED;
+    }
+    if (!has_body)
+        return HttpReadResult::READY;
 
-        if (retval == -1 && retval != EAGAIN && retval != EWOULDBLOCK)
-        {
-            if (errno != EPIPE)
-                LOG_ERROR("Send error, reason: ", logErrStr(errno));
-            write_file_fd_ = nullptr;
-            return -1;
-        }
+    body_left_ = content_length;
+    chunked_decoder_.clear(max_body_size_);
+    const auto received = std::string_view(read_buffer_).substr(head_length);
+    // the end of a chunked body is only known to the decoder, what follows it is dropped
+    if (!is_body_chunked_)
+        request_length_ = head_length + std::min<uint64_t>(content_length, received.size());
+    if (!received.empty())
+        return consumeBody(received);
+
+    // the client waits for this before it sends the body
+    const auto expect = parser_.header(HttpHeader::EXPECT);
+    if (parser_.version() == HttpVersion::HTTP11 && equalsIgnoreCase(expect, "100-continue"))
+    {
+        output_.append(HttpResponseBuilder(HttpStatusCode::CONTINUE).buildNoBodyOnce());
+        if (output_.sendTo(socket_->fd(), tls_.get()) == -1)
+            LOG_DEBUG("Failed to send 100 Continue to fd = ", socket_->fd());
+    }
+    return HttpReadResult::NOT_READY;
+}
 
-        if (write_file_offset_ == write_file_fd_->second)
-            write_file_fd_ = nullptr;
+HttpContext::HttpReadResult HttpContext::consumeBody(std::string_view data)
+{
+    auto status = HttpStatusCode::OK;
+    bool is_complete;
+    if (is_body_chunked_)
+    {
+        thread_local std::string decoded;
+        decoded.clear();
+        const auto result = chunked_decoder_.decode(data, decoded);
+        if (result == ChunkedDecoder::Result::ERROR)
+            status = HttpStatusCode::BAD_REQUEST;
+        else if (result == ChunkedDecoder::Result::TOO_LARGE)
+            status = HttpStatusCode::PAYLOAD_TOO_LARGE;
+        else if (body_.isOpen() && !body_.append(decoded))
+            status = HttpStatusCode::INTERNAL_SERVER_ERROR;
+        is_complete = result == ChunkedDecoder::Result::DONE;
+    }
+    else
+    {
+        const auto length = std::min<uint64_t>(body_left_, data.size());
+        body_left_ -= length;
+        if (body_.isOpen() && !body_.append(data.substr(0, length)))
+            status = HttpStatusCode::INTERNAL_SERVER_ERROR;
+        is_complete = body_left_ == 0;
     }
 
-    return write_index_;
+    if (status != HttpStatusCode::OK)
+    {
+        setDefaultErrorResponse(status);
+        return HttpReadResult::REJECTED;
+    }
+    return is_complete ? HttpReadResult::READY : HttpReadResult::NOT_READY;
 }
 
 void HttpContext::handleStateRecvHead()
 {
+    const bool is_idle = read_buffer_.empty();
+    if (is_idle)
+    {
+        request_start_ticks_ = LatencyRecorder::instance().start();
+        // after a drain() shutdown what is queued is still read, then EOF closes
+        auto expected = IdleState::IDLE;
+        idle_state_.compare_exchange_strong(expected, IdleState::BUSY);
+    }
+
     auto read_res = recvTillEnd();
+    if (is_idle && read_res == HttpReadResult::NOT_READY && read_buffer_.empty() &&
+        idle_state_.load() == IdleState::BUSY && !becomeIdle())
+        return;
+    // the keep-alive wait ends with the first byte, the rest of the head has to follow within
+    // header_ms however slowly it trickles in (the first request's timer runs from the accept)
+    if (is_idle && request_count_ != 0 && read_res == HttpReadResult::NOT_READY && !read_buffer_.empty())
+        setDeadline(timeouts_.header_ms);
     if (read_res == HttpReadResult::NOT_READY)
         epollModOneShot(epoll_fd_, EPOLLIN /*|EPOLLET*/, socket_->fd());
     else if (read_res == HttpReadResult::READY)
     {
         // LOG_DEBUG("Receive request header:\n", read_buffer_);
+        LatencyRecorder::instance().record(RequestPhase::RECV_HEAD, request_start_ticks_);
+        if (Http2Session::isPreface(read_buffer_))
+        {
+            LOG_DEBUG("HTTP/2 with prior knowledge, fd = ", socket_->fd());
+            http2_ = std::make_unique<Http2Session>(root_dir_);
+            state_ = State::HTTP2;
+            is_http2_.store(true, std::memory_order_relaxed);
+            if (!http2_->receive(read_buffer_))
+                LOG_DEBUG("HTTP/2 connection error in the first bytes, fd = ", socket_->fd());
+            read_buffer_.clear();
+            sendHttp2();
+            return;
+        }
+
+        const auto parse_start_ticks = LatencyRecorder::instance().start();
         const int parse_res = parser_.parse(read_buffer_);
+        LatencyRecorder::instance().record(RequestPhase::PARSE, parse_start_ticks);
         if (!parse_res)
         {
             LOG_DEBUG("Failed to parse request");
             setDefaultErrorResponse(HttpStatusCode::BAD_REQUEST);
         }
+        else if (++request_count_ > 1 && peer_addr_ != 0 && RateLimiter::instance().isEnabled() &&
+                 !RateLimiter::instance().acquire(peer_addr_))
+        {
+            if (RateLimiter::instance().action() == RateLimiter::Action::CLOSE)
+            {
+                closeConnection();
+                return;
+            }
+            RequestHandler::setErrorResponse(response_, HttpStatusCode::TOO_MANY_REQUESTS);
+            response_.head.addHeader("Retry-After", lexicalCast(RateLimiter::kRetryAfterSeconds));
+            commitResponse();
+        }
+        else if (upgradeToHttp2(parse_res))
+            return;
         else
         {
-            auto content_length = parser_.getContentLength();
-            if (content_length)
+            const auto body_res = startBody(parse_res);
+            if (body_res == HttpReadResult::NOT_READY)
             {
-                if (parser_.method() == HttpMethod::TRACE)
-                {
-                    setDefaultErrorResponse(HttpStatusCode::BAD_REQUEST);
-                    if (epollModOneShot(epoll_fd_, EPOLLOUT /*|EPOLLET*/, socket_->fd()) == -1)
-                        LOG_ERROR("Epoll oneshot event EPOLLOUT modify failed for fd(", socket_->fd(), "), reason: ", logErrStr(errno));
-                    return;
-                }
-                // LOG_DEBUG("Request content-length > 0, change state_ to State::RECEIVE_BODY");
-                body_buffer_.reserve(content_length);
-                if (parse_res < read_buffer_.size())
-                    body_buffer_.append(read_buffer_.substr(parse_res, content_length));
-
-                to_read_body_bytes_ = content_length - body_buffer_.size();
-                if (to_read_body_bytes_ > 0)
-                {
-                    state_ = State::RECEIVE_BODY;
-                    if (epollModOneShot(epoll_fd_, EPOLLIN /*|EPOLLET*/, socket_->fd()) == -1)
-                        LOG_ERROR("Epoll oneshot event EPOLLIN modify failed for fd(", socket_->fd(), "), reason: ", logErrStr(errno));
-                    return;
-                }
+                state_ = State::RECEIVE_BODY;
+                setDeadline(timeouts_.body_ms);
+                if (epollModOneShot(epoll_fd_, EPOLLIN /*|EPOLLET*/, socket_->fd()) == -1)
+                    LOG_ERROR("Epoll oneshot event EPOLLIN modify failed for fd(", socket_->fd(), "), reason: ", logErrStr(errno));
+                return;
             }
-            handleRequest();
+            if (body_res == HttpReadResult::READY)
+                handleRequest();
         }
 
         if (epollModOneShot(epoll_fd_, EPOLLOUT /*|EPOLLET*/, socket_->fd()) == -1)
             LOG_ERROR("Epoll oneshot event EPOLLOUT modify failed for fd(", socket_->fd(), "), reason: ", logErrStr(errno));
     }
-    else if (read_res == HttpReadResult::ERROR)
+    else if (read_res == HttpReadResult::ERROR || read_res == HttpReadResult::REJECTED)
     {
-        setDefaultErrorResponse(HttpStatusCode::INTERNAL_SERVER_ERROR);
+        if (read_res == HttpReadResult::ERROR)
+            setDefaultErrorResponse(HttpStatusCode::INTERNAL_SERVER_ERROR);
         if (epollModOneShot(epoll_fd_, EPOLLOUT /*|EPOLLET*/, socket_->fd()) == -1)
         {
             LOG_ERROR("Epoll oneshot event EPOLLOUT modify failed for fd(", socket_->fd(), "), reason: ", logErrStr(errno));
@@ -283,10 +578,14 @@ void HttpContext::handleStateRecvBody()
 {
     auto read_res = recvBody();
     if (read_res == HttpReadResult::NOT_READY)
+    {
+        setDeadline(timeouts_.body_ms);
         epollModOneShot(epoll_fd_, EPOLLIN /*|EPOLLET*/, socket_->fd());
-    else if (read_res == HttpReadResult::READY)
+    }
+    else if (read_res == HttpReadResult::READY || read_res == HttpReadResult::REJECTED)
     {
-        handleRequest();
+        if (read_res == HttpReadResult::READY)
+            handleRequest();
         // if (epollModOneShot(epoll_fd_, EPOLLOUT, socket_->fd()) == -1)
         //     LOG_ERROR("Epoll oneshot event EPOLLOUT modify failed for fd(", socket_->fd(), "), reason: ", logErrStr(errno));
         if (epollModOneShot(epoll_fd_, EPOLLOUT /*|EPOLLET*/, socket_->fd()) == -1)
@@ -320,166 +619,428 @@ void HttpContext::handleStateRecvBody()
 
 void HttpContext::handleRequest()
 {
-    // LOG_DEBUG("Handle request, method=",
-    //           kHttpMethodStr[static_cast<int>(parser_.method())],
-    //           ", version=HTTP", static_cast<int>(parser_.version()), ", url=", parser_.url());
+    if (upstreams_)
+    {
+        if (const auto *route = Proxy::instance().match(parser_.url()))
+        {
+            startProxy(*route);
+            return;
+        }
+    }
+    if (fastcgi_pool_)
+    {
+        if (const auto *route = FastCgi::instance().match(parser_.url()))
+        {
+            startFastCgi(*route);
+            return;
+        }
+    }
+    RequestHandler(parser_, root_dir_, response_, &body_).handle();
+    body_.clear();
+    commitResponse();
+}
+
+bool HttpContext::isKeepAlive() const
+{
+    return parser_.isKeepAlive() && !is_draining_.load(std::memory_order_relaxed) &&
+           (max_keep_alive_requests_ == 0 || request_count_ < max_keep_alive_requests_);
+}
+
+std::string HttpContext::keepAliveParams() const
+{
+    std::string params = logstr("timeout=", std::max(1, timeouts_.keep_alive_ms / 1000));
+    if (max_keep_alive_requests_ != 0)
+        params.append(", max=").append(lexicalCast(max_keep_alive_requests_ - request_count_));
+    return params;
+}
 
-    if (static_cast<int>(parser_.version()) > static_cast<int>(HttpVersion::HTTP11))
+void HttpContext::commitResponse()
+{
+    if (response_.stream)
     {
-        LOG_DEBUG("Http version ", static_cast<int>(parser_.version()), " is not supported");
-        setDefaultErrorResponse(HttpStatusCode::HTTP_VERSION_NOT_SUPPORTED);
-        return;
+        // a body of unknown length: chunks for HTTP/1.1, an HTTP/1.0 client reads to the close
+        is_stream_chunked_ = parser_.version() == HttpVersion::HTTP11;
+        if (is_stream_chunked_)
+            response_.head.addHeader("Transfer-Encoding", "chunked");
+        else
+            response_.is_close = true;
+    }
+    // error pages and forwarded responses come with a body, HEAD gets the head only
+    if (parser_.method() == HttpMethod::HEAD)
+    {
+        response_.stream.reset();
+        response_.body.clear();
     }
+    // while draining the client reconnects to the process that still accepts
+    if (!response_.is_close && !isKeepAlive())
+        response_.is_close = true;
+    if (response_.is_close)
+        response_.head.addHeader("Connection", "close");
+    else
+        response_.head.addHeader("Connection", "keep-alive").addHeader("Keep-Alive", keepAliveParams());
+    output_.append(response_.head.buildNoBodyOnce());
+    output_.append(std::move(response_.body));
+    if (response_.stream)
+        state_ = State::STREAM;
+    else
+        state_ = response_.is_close ? State::SEND_ERROR : State::SEND;
+    send_start_ticks_ = LatencyRecorder::instance().start();
+}
 
-    if (parser_.method() == HttpMethod::GET || parser_.method() == HttpMethod::HEAD)
-        handleMethodGetAndHead();
-    else if (parser_.method() == HttpMethod::TRACE)
-        handleMethodTrace();
+void HttpContext::handleStream()
+{
+    while (true)
+    {
+        while (response_.stream && output_.size() < kMaxStreamBuffered)
+        {
+            if (!fillStream())
+            {
+                closeConnection();
+                return;
+            }
+        }
+        if (!response_.stream)
+        {
+            state_ = response_.is_close ? State::SEND_ERROR : State::SEND;
+            sendResponse();
+            return;
+        }
+
+        // the next pieces are made once the socket took some of these
+        if (output_.sendTo(socket_->fd(), tls_.get()) == -1)
+        {
+            closeConnection();
+            return;
+        }
+        if (!output_.empty())
+        {
+            setDeadline(timeouts_.send_ms);
+            if (epollModOneShot(epoll_fd_, EPOLLOUT, socket_->fd()) == -1)
+            {
+                LOG_ERROR("Epoll oneshot event EPOLLOUT modify failed for fd(", socket_->fd(), "), reason: ", logErrStr(errno));
+                remove_connection_callback_(socket_->fd());
+            }
+            return;
+        }
+    }
+}
+
+bool HttpContext::fillStream()
+{
+    OutputBuffer piece;
+    const auto res = response_.stream->fill(piece, kStreamPieceSize);
+    if (res == ResponseStream::Result::FAILED)
+        return false;
+    if (is_stream_chunked_ && !piece.empty())
+    {
+        std::array<char, 20> size_line;
+        auto *end = std::to_chars(size_line.data(), size_line.data() + size_line.size() - 2, piece.size(), 16).ptr;
+        *end++ = '\r';
+        *end++ = '\n';
+        output_.append(std::string(size_line.data(), end));
+        output_.append(std::move(piece));
+        output_.append("\r\n");
+    }
     else
+        output_.append(std::move(piece));
+    if (res == ResponseStream::Result::DONE)
     {
-        LOG_DEBUG("Http method ", kHttpMethodStr[static_cast<int>(parser_.method())], " is not supported.");
-        setDefaultErrorResponse(HttpStatusCode::NOT_IMPLEMENTED);
-        return;
+        if (is_stream_chunked_)
+            output_.append("0\r\n\r\n");
+        response_.stream.reset();
+    }
+    return true;
+}
+
+// the client address for X-Forwarded-For
+static std::string peerName(int fd)
+{
+    sockaddr_storage addr;
+    socklen_t addr_len = sizeof(addr);
+    std::array<char, INET6_ADDRSTRLEN> name;
+    if (getpeername(fd, reinterpret_cast<sockaddr *>(&addr), &addr_len) == 0)
+    {
+        if (addr.ss_family == AF_INET && inet_ntop(AF_INET, &reinterpret_cast<sockaddr_in &>(addr).sin_addr, name.data(), name.size()))
+            return name.data();
+        if (addr.ss_family == AF_INET6 && inet_ntop(AF_INET6, &reinterpret_cast<sockaddr_in6 &>(addr).sin6_addr, name.data(), name.size()))
+            return name.data();
     }
+    return "unknown";
 }
 
-void HttpContext::handleMethodGetAndHead()
+void HttpContext::startProxy(const Proxy::Route &route)
 {
-    assert(parser_.method() == HttpMethod::GET || parser_.method() == HttpMethod::HEAD);
+    // the caller arms EPOLLOUT, doWrite() moves the exchange on from there
+    proxy_ = std::make_unique<ProxyExchange>(*upstreams_, route, socket_->fd());
+    proxy_->start(parser_, body_, peerName(socket_->fd()), tls_ != nullptr,
+                  isKeepAlive() ? keepAliveParams() : std::string(), !tls_ || tls_->isKernelSend());
+    state_ = State::PROXY;
+}
 
-    std::string full_url = std::string(root_dir_).append(parser_.url());
-    std::array<char, PATH_MAX> resolved_path;
-    if (parser_.url() == "/")
-        full_url.append("index.html", lengthOfNullEndStr("index.html"));
+void HttpContext::doUpstream()
+{
+    LatencyRecorder::instance().record(RequestPhase::QUEUE, dispatch_ticks_);
+    if (state_ == State::PROXY)
+        handleProxy();
+    else if (state_ == State::FASTCGI)
+        handleFastCgi();
+}
 
-    if (!realpath(full_url.c_str(), resolved_path.data()))
+void HttpContext::handleProxy()
+{
+    while (true)
     {
-        int save = errno;
-        if (save == ENOENT)
+        const auto res = proxy_->resume(output_);
+        if (res == ProxyExchange::Result::FAILED)
         {
-            LOG_DEBUG("Cannot find file ", full_url);
-            setDefaultErrorResponse(HttpStatusCode::NOT_FOUND,
-                                    std::string("Cannot open file ")
-                                        .append(parser_.url())
-                                        .append(". ")
-                                        .append(logErrStr(save)),
-                                    parser_.method() == HttpMethod::HEAD);
+            const auto status = proxy_->errorStatus();
+            proxy_.reset();
+            setDefaultErrorResponse(status);
+            sendResponse();
+            return;
         }
-        else
+        if (res == ProxyExchange::Result::ABORTED)
         {
-            LOG_WARNING("Unknown Error, errmsg = ", logErrStr(save));
-            setDefaultErrorResponse(HttpStatusCode::INTERNAL_SERVER_ERROR, logErrStr(save), parser_.method() == HttpMethod::HEAD);
+            proxy_.reset();
+            closeConnection();
+            return;
+        }
+        if (res == ProxyExchange::Result::DONE)
+        {
+            state_ = proxy_->isClientKeepAlive() ? State::SEND : State::SEND_ERROR;
+            proxy_.reset();
+            send_start_ticks_ = LatencyRecorder::instance().start();
+            sendResponse();
+            return;
         }
-        return;
-    }
 
-    std::string_view resolved_path_sv(resolved_path.data());
+        // one side at a time: the output goes out before the upstream is read again
+        if (!output_.empty() && output_.sendTo(socket_->fd(), tls_.get()) == -1)
+        {
+            proxy_.reset();
+            closeConnection();
+            return;
+        }
+        if (!output_.empty())
+        {
+            setDeadline(timeouts_.send_ms);
+            if (epollModOneShot(epoll_fd_, EPOLLOUT, socket_->fd()) == -1)
+            {
+                LOG_ERROR("Epoll oneshot event EPOLLOUT modify failed for fd(", socket_->fd(), "), reason: ", logErrStr(errno));
+                remove_connection_callback_(socket_->fd());
+            }
+            return;
+        }
+        if (res == ProxyExchange::Result::WAIT_CLIENT)
+            continue;
 
-    // check full_url is inside root_dir
-    if (resolved_path_sv.size() < root_dir_.size() ||
-        !std::equal(root_dir_.begin(), root_dir_.end(), resolved_path_sv.begin(), resolved_path_sv.begin() + root_dir_.size()))
-    {
-        LOG_INFO("Requested url is not inside root_dir, url = ", resolved_path_sv, ", root_dir = ", root_dir_);
-        setDefaultErrorResponse(HttpStatusCode::FORBIDDEN, "", parser_.method() == HttpMethod::HEAD);
+        setDeadline(Proxy::instance().timeout());
+        if (!proxy_->armUpstream())
+        {
+            proxy_.reset();
+            closeConnection();
+        }
         return;
     }
+}
 
-    if (!isRegularFile(resolved_path_sv))
+void HttpContext::startFastCgi(const FastCgi::Route &route)
+{
+    // the caller arms EPOLLOUT, doWrite() starts the request from there
+    fastcgi_ = std::make_unique<FastCgiExchange>(*fastcgi_pool_, route, socket_->fd());
+    if (!fastcgi_->start(parser_, body_, root_dir_, tls_ != nullptr,
+                         isKeepAlive() ? keepAliveParams() : std::string()))
     {
-        LOG_DEBUG("Requested url is not regular file, full_url = ", resolved_path_sv);
-        setDefaultErrorResponse(HttpStatusCode::NOT_FOUND, "", parser_.method() == HttpMethod::HEAD);
+        fastcgi_.reset();
+        setDefaultErrorResponse(HttpStatusCode::BAD_REQUEST);
         return;
     }
+    state_ = State::FASTCGI;
+}
 
-    // check has read permission to full_url
-    if (access(resolved_path_sv.data(), R_OK) == -1)
+void HttpContext::handleFastCgi()
+{
+    while (true)
     {
-        if (errno == EACCES)
-            LOG_DEBUG("No read permission on file ", resolved_path_sv);
-        else
-            LOG_WARNING("Failed to call access with parameter(", resolved_path_sv, "), reason: ", logErrStr(errno));
-        setDefaultErrorResponse(HttpStatusCode::INTERNAL_SERVER_ERROR, "", parser_.method() == HttpMethod::HEAD);
-        return;
+        const auto res = fastcgi_->resume(output_);
+        if (res == FastCgiExchange::Result::FAILED)
+        {
+            const auto status = fastcgi_->errorStatus();
+            fastcgi_.reset();
+            setDefaultErrorResponse(status);
+            sendResponse();
+            return;
+        }
+        if (res == FastCgiExchange::Result::ABORTED)
+        {
+            fastcgi_.reset();
+            closeConnection();
+            return;
+        }
+        if (res == FastCgiExchange::Result::DONE)
+        {
+            state_ = fastcgi_->isClientKeepAlive() ? State::SEND : State::SEND_ERROR;
+            fastcgi_.reset();
+            send_start_ticks_ = LatencyRecorder::instance().start();
+            sendResponse();
+            return;
+        }
+
+        if (!output_.empty() && output_.sendTo(socket_->fd(), tls_.get()) == -1)
+        {
+            fastcgi_.reset();
+            closeConnection();
+            return;
+        }
+        if (!output_.empty())
+        {
+            setDeadline(timeouts_.send_ms);
+            if (epollModOneShot(epoll_fd_, EPOLLOUT, socket_->fd()) == -1)
+            {
+                LOG_ERROR("Epoll oneshot event EPOLLOUT modify failed for fd(", socket_->fd(), "), reason: ", logErrStr(errno));
+                remove_connection_callback_(socket_->fd());
+            }
+            return;
+        }
+        if (res == FastCgiExchange::Result::WAIT_CLIENT)
+            continue;
+
+        // nothing may touch the context once the pool can wake it
+        setDeadline(FastCgi::instance().timeout());
+        if (fastcgi_->wait())
+            return;
     }
+}
+
+bool HttpContext::upgradeToHttp2(int head_length)
+{
+    // requests with a body and forwarded ones are answered over HTTP/1.1, and Connection
+    // must name both Upgrade and HTTP2-Settings, RFC 7540 sec 3.2
+    const auto upgrade = parser_.header(HttpHeader::UPGRADE);
+    const auto settings = parser_.header(HttpHeader::HTTP2_SETTINGS);
+    const auto connection = parser_.header(HttpHeader::CONNECTION);
+    if (parser_.version() != HttpVersion::HTTP11 || !equalsIgnoreCase(upgrade, "h2c") || settings.empty() ||
+        !HttpParser::hasToken(connection, "Upgrade") || !HttpParser::hasToken(connection, "HTTP2-Settings") ||
+        parser_.getContentLength() != 0 || !parser_.header(HttpHeader::TRANSFER_ENCODING).empty() ||
+        RequestHandler(parser_, root_dir_, response_).needsHttp1())
+        return false;
 
-    const int file_fd = ::open(resolved_path_sv.data(), O_RDONLY);
-    if (file_fd == -1)
+    auto session = std::make_unique<Http2Session>(root_dir_);
+    if (!session->startUpgraded(parser_, settings))
     {
-        LOG_WARNING("Failed to call open with parameter(", resolved_path_sv, "), reason: ", logErrStr(errno));
-        setDefaultErrorResponse(HttpStatusCode::INTERNAL_SERVER_ERROR, "", parser_.method() == HttpMethod::HEAD);
-        return;
+        LOG_DEBUG("Invalid HTTP2-Settings, stay on HTTP/1.1");
+        return false;
     }
 
-    struct stat file_stat;
-    explicit_bzero(&file_stat, sizeof(file_stat));
-    if (fstat(file_fd, &file_stat) == -1)
+    LOG_DEBUG("Upgrade to HTTP/2, fd = ", socket_->fd());
+    output_.append(HttpResponseBuilder(HttpStatusCode::SWITCHING_PROTOCOLS)
+                       .addHeader("Connection", "Upgrade")
+                       .addHeader("Upgrade", "h2c")
+                       .buildNoBodyOnce());
+    http2_ = std::move(session);
+    state_ = State::HTTP2;
+    is_http2_.store(true, std::memory_order_relaxed);
+    // the client preface may have arrived with the request
+    if (static_cast<std::size_t>(head_length) < read_buffer_.size() &&
+        !http2_->receive(std::string_view(read_buffer_).substr(head_length)))
+        LOG_DEBUG("HTTP/2 connection error in the first bytes, fd = ", socket_->fd());
+    read_buffer_.clear();
+    sendHttp2();
+    return true;
+}
+
+void HttpContext::handleHttp2()
+{
+    long retval;
+    while ((retval = recvSome(temp_read_buffer_.data(), temp_read_buffer_.size())) > 0)
+    {
+        // after a connection error only the queued GOAWAY is left to send
+        if (!http2_->receive(std::string_view(reinterpret_cast<const char *>(temp_read_buffer_.data()), retval)))
+            break;
+    }
+    if (retval == 0)
     {
-        LOG_WARNING("Failed to call fstat, reason: ", logErrStr(errno));
-        setDefaultErrorResponse(HttpStatusCode::INTERNAL_SERVER_ERROR, "", parser_.method() == HttpMethod::HEAD);
+        LOG_DEBUG("Peer connection closed");
+        closeConnection();
         return;
     }
-
-    if (parser_.method() == HttpMethod::GET)
+    if (retval == -1 && errno != EAGAIN && errno != EWOULDBLOCK)
     {
-        write_file_fd_ = std::make_unique<std::pair<FdHolder, std::size_t>>(file_fd, file_stat.st_size);
-        write_file_offset_ = 0;
+        LOG_ERROR("Receive error, reason: ", logErrStr(errno));
+        closeConnection();
+        return;
     }
+    sendHttp2();
+}
 
-    auto builder = response_builder_.addHeader("Content-Length", lexicalCast(file_stat.st_size))
-                       .addHeader("Content-Type", parser_.mime().data());
-    if (parser_.isKeepAlive())
-        builder.addHeader("Connection", "keep-alive");
+void HttpContext::sendHttp2()
+{
+    if (is_draining_.load(std::memory_order_relaxed))
+        http2_->shutdown();
+    // refill as long as the socket takes everything and the windows allow more
+    do
+    {
+        http2_->fillOutput(output_);
+        if (output_.sendTo(socket_->fd(), tls_.get()) == -1)
+        {
+            closeConnection();
+            return;
+        }
+    } while (output_.empty() && http2_->hasPendingOutput());
 
-    write_buffer_ = builder.buildOnce();
-    write_index_ = 0;
-    state_ = State::SEND;
-    // LOG_DEBUG("Set response header: ", write_buffer_);
+    if (output_.empty() && http2_->isFinished())
+    {
+        closeConnection();
+        return;
+    }
+    // the session is idle or waits for the client to take its output
+    setDeadline(output_.empty() ? timeouts_.keep_alive_ms : timeouts_.send_ms);
+    if (epollModOneShot(epoll_fd_, output_.empty() ? EPOLLIN : EPOLLIN | EPOLLOUT, socket_->fd()) == -1)
+    {
+        LOG_ERROR("Epoll oneshot event modify failed for fd(", socket_->fd(), "), reason: ", logErrStr(errno));
+        remove_connection_callback_(socket_->fd());
+    }
 }
 
-void HttpContext::handleMethodTrace()
+void HttpContext::closeConnection()
 {
-    auto builder = response_builder_.addHeader("Content-Type", "message/http")
-                       .addHeader("Content-Length", std::to_string(parser_.headLength()))
-                       .addHeader("Connection", "close")
-                       .setBody(read_buffer_.substr(0, parser_.headLength()));
-
-    write_buffer_ = builder.buildOnce();
-    write_index_ = 0;
-    state_ = State::SEND;
+    state_ = State::CLOSE;
+    if (epollDel(epoll_fd_, socket_->fd()) == -1)
+        LOG_ERROR("Epoll event delete failed for fd(", socket_->fd(), "), reason: ", logErrStr(errno));
+    remove_connection_callback_(socket_->fd());
 }
 
 void HttpContext::reset()
 {
     state_ = State::RECEIVE_HEAD;
     read_buffer_.clear();
+    request_length_ = std::string::npos;
+    is_pipelined_ = false;
+
+    body_.clear();
+    is_body_chunked_ = false;
+    body_left_ = 0;
 
-    body_buffer_.clear();
-    to_read_body_bytes_ = 0;
+    response_.clear();
+    http2_.reset();
+    proxy_.reset();
+    fastcgi_.reset();
 
-    response_builder_.clear();
+    output_.clear();
 
-    write_buffer_.clear();
-    write_index_ = 0;
-    write_file_fd_ = nullptr;
-    write_file_offset_ = 0;
+    dispatch_ticks_ = 0;
+    request_start_ticks_ = 0;
+    send_start_ticks_ = 0;
 }
 
-void HttpContext::setDefaultErrorResponse(HttpStatusCode error_status_code, const std::string body, bool is_method_head)
+void HttpContext::setDefaultErrorResponse(HttpStatusCode error_status_code)
 {
-    auto builder = response_builder_.setStatusCode(error_status_code);
-
-    if (!is_method_head)
-        builder.setDefaultErrorPage(error_status_code);
-
-    if (body.size())
-        builder.setBody(getErrorPageWithExtraMsg(error_status_code, body));
-    builder.addHeader("Content-Length", lexicalCast(builder.bodySize()))
-        .addHeader("Content-Type", getMime("html").data());
+    RequestHandler::setErrorResponse(response_, error_status_code);
+    commitResponse();
+}
 
-    if (is_method_head)
-        write_buffer_ = builder.buildNoBodyOnce();
-    else
-        write_buffer_ = builder.buildOnce();
-    write_index_ = 0;
-    state_ = State::SEND_ERROR;
+void HttpContext::recordSendCompleted()
+{
+    LatencyRecorder::instance().record(RequestPhase::SEND, send_start_ticks_);
+    LatencyRecorder::instance().record(RequestPhase::TOTAL, request_start_ticks_);
 }
\ No newline at end of file
@@ -1,20 +1,39 @@
 #pragma once
 
 #include <array>
+#include <atomic>
 #include <functional>
 #include <memory>
 #include <string>
 
 #include <inttypes.h>
+#include <sys/stat.h>
 
 #include "./HttpParser.h"
+#include "./ChunkedDecoder.h"
+#include "./RequestBody.h"
+#include "./Http2Session.h"
+#include "./ProxyExchange.h"
+#include "./FastCgiExchange.h"
 #include "./TimerQueue.h"
-#include "./HttpResponseBuilder.h"
+#include "./HttpResponse.h"
+#include "./OutputBuffer.h"
+#include "./LatencyRecorder.h"
+#include "./Tls.h"
 #include "./util/Noncopyable.h"
 
 class TcpSocket;
 class FdHolder;
 
+// deadlines of the connection phases
+struct ConnectionTimeouts
+{
+    int header_ms{5000};     // from the first byte of a request to the end of its head
+    int body_ms{10000};      // between two reads of a request body
+    int keep_alive_ms{5000}; // idle between a response and the next request
+    int send_ms{10000};      // between two writes of a response
+};
+
 class HttpContext : NonCopyable
 {
 public:
@@ -23,12 +42,28 @@ public:
                          int epoll_fd,
                          std::function<void(int)> remove_connection_callback,
                          std::string_view root_dir,
-                         TimerQueue::TimerId timer_id);
+                         TimerQueue &timers,
+                         TimerQueue::TimerId timer_id,
+                         UpstreamPool *upstreams,
+                         FastCgiPool *fastcgi_pool);
+
+    // the timer of a new connection runs for header_ms
+    static void setTimeouts(const ConnectionTimeouts &timeouts) noexcept { timeouts_ = timeouts; }
+    [[nodiscard]] static const ConnectionTimeouts &timeouts() noexcept { return timeouts_; }
+    // a request announcing or sending a larger body gets a 413
+    static void setMaxBodySize(uint64_t size) noexcept { max_body_size_ = size; }
+    // the response to the n-th request of a connection closes it, 0 for no limit
+    static void setMaxKeepAliveRequests(unsigned n) noexcept { max_keep_alive_requests_ = n; }
 
     [[nodiscard]] TimerQueue::TimerId getTimerId() const noexcept { return timer_id_; }
+    void setDispatchTicks(LatencyRecorder::Ticks ticks) noexcept { dispatch_ticks_ = ticks; }
 
     void doRead();
     void doWrite();
+    // EPOLLERR: MSG_ZEROCOPY completions (or a socket error the next read/write reports)
+    void doErrorQueue();
+    // an event of the upstream connection of a proxied request, or stdout of a FastCGI one
+    void doUpstream();
 
     ~HttpContext() { LOG_DEBUG("Destroy HttpContext ", (long)this); }
 
@@ -36,8 +71,19 @@ public:
                     int epoll_fd,
                     std::function<void(int)> remove_connection_callback,
                     std::string_view root_dir,
-                    TimerQueue::TimerId timer_id);
-    void resetContext() { socket_ = nullptr; }
+                    TimerQueue &timers,
+                    TimerQueue::TimerId timer_id,
+                    UpstreamPool *upstreams,
+                    FastCgiPool *fastcgi_pool);
+    void resetContext();
+    // the connection came in on a TLS address, the handshake runs on the next doRead()
+    void startTls(std::unique_ptr<TlsStream> tls);
+
+    // graceful shutdown: responses from now on close their connection
+    static void setDraining() noexcept { is_draining_.store(true, std::memory_order_relaxed); }
+    // called by the worker (under its context lock): an idle connection is woken to close,
+    // one with a request under way finishes it with Connection: close
+    void drain();
 
 private:
     static constexpr int kReserveBufferSize = 1024;
@@ -48,57 +94,139 @@ private:
         READY,
         ERROR,
         PEER_CLOSED,
+        REJECTED, // an error response is committed
     };
 
     enum class State
     {
+        TLS_HANDSHAKE,
         RECEIVE_HEAD,
         RECEIVE_BODY,
         SEND,
         SEND_ERROR,
+        STREAM, // response_.stream makes the body as output_ drains
+        HTTP2, // the connection belongs to http2_
+        PROXY, // proxy_ sends the response, either the socket or the upstream connection is armed
+        FASTCGI, // fastcgi_ sends the response, the socket is armed or the FastCgiPool wakes the context
         CLOSE,
     };
 
     HttpParser parser_;
-    HttpResponseBuilder response_builder_;
+    HttpResponse response_;
+    std::unique_ptr<Http2Session> http2_;
+    std::unique_ptr<ProxyExchange> proxy_;
+    UpstreamPool *upstreams_{nullptr}; // of the worker, nullptr without proxy routes
+    std::unique_ptr<FastCgiExchange> fastcgi_;
+    FastCgiPool *fastcgi_pool_{nullptr}; // of the worker, nullptr without FastCGI routes
 
     std::unique_ptr<TcpSocket> socket_;
+    std::unique_ptr<TlsStream> tls_; // nullptr on plain connections
 
     static constexpr std::size_t kTempReadBufferSize = 1024;
+    // a longer request head gets a 400
+    static constexpr std::size_t kMaxHeadSize = 64 * 1024;
     std::array<uint8_t, kTempReadBufferSize> temp_read_buffer_;
     std::string read_buffer_;
     // int read_index_;
 
-    std::string body_buffer_;
-    int to_read_body_bytes_;
+    // a body of kSpliceMinSize and more going to a file is spliced from the socket
+    static constexpr uint64_t kSpliceMinSize = 64 * 1024;
+    RequestBody body_; // closed if the body is dropped
+    ChunkedDecoder chunked_decoder_;
+    bool is_body_chunked_{false};
+    uint64_t body_left_{0}; // of Content-Length
 
-    std::string write_buffer_;
-    int write_index_;
-
-    std::unique_ptr<std::pair<FdHolder, std::size_t>> write_file_fd_;
-    off_t write_file_offset_;
+    OutputBuffer output_;
+    // a streamed body is made this far ahead of the socket at most, in pieces of kStreamPieceSize
+    static constexpr std::size_t kMaxStreamBuffered = 256 * 1024;
+    static constexpr std::size_t kStreamPieceSize = 16 * 1024;
+    bool is_stream_chunked_{false}; // HTTP/1.0 gets a streamed body until the close
 
     int epoll_fd_;
     std::function<void(int)> remove_connection_callback_;
     std::string_view root_dir_;
 
     State state_{State::RECEIVE_HEAD};
+    std::atomic_bool is_http2_{false}; // state_ is HTTP2, read by drain() on the worker thread
+    // whether a request is under way, drain() races the pool thread reading the connection
+    enum class IdleState : uint8_t
+    {
+        IDLE,      // waiting for a request, nothing of it read
+        BUSY,      // a request is read or answered
+        SHUT_DOWN, // drain() shut the reading side while it was idle
+    };
+    std::atomic<IdleState> idle_state_{IdleState::IDLE};
+
+    inline static std::atomic_bool is_draining_{false};
 
+    inline static ConnectionTimeouts timeouts_;
+    inline static uint64_t max_body_size_{1024 * 1024};
+    inline static unsigned max_keep_alive_requests_{1000};
+
+    TimerQueue *timers_{nullptr}; // of the worker, its callback removes the connection
     TimerQueue::TimerId timer_id_;
 
+    // client IPv4 address from the acceptor (0: not limited, a Unix socket peer), and requests
+    // so far (the accept paid for the first)
+    uint32_t peer_addr_{0};
+    unsigned request_count_{0};
+    // bytes of read_buffer_ the request took, what follows is a pipelined request; npos: all of them
+    std::size_t request_length_{std::string::npos};
+    bool is_pipelined_{false}; // read_buffer_ starts with pipelined bytes not searched yet
+
+    // phase boundaries for LatencyRecorder, 0 when not measured
+    LatencyRecorder::Ticks dispatch_ticks_{0};
+    LatencyRecorder::Ticks request_start_ticks_{0};
+    LatencyRecorder::Ticks send_start_ticks_{0};
+
+    // ::recv or TlsStream::recv
+    [[nodiscard]] long recvSome(void *buf, std::size_t len);
+    // bytes received, 0 if the peer closed, -1 on error or with errno EAGAIN if nothing was there
     [[nodiscard]] int __recv(std::string &read_buf);
     [[nodiscard]] HttpReadResult recvTillEnd();
     [[nodiscard]] HttpReadResult recvBody();
+    // with the parsed head, READY if there is no body or it came with the head
+    [[nodiscard]] HttpReadResult startBody(int head_length);
+    // received bytes of the body, the bytes after its end are dropped
+    [[nodiscard]] HttpReadResult consumeBody(std::string_view data);
 
-    [[nodiscard]] int sendAll();
-
+    void handleTlsHandshake();
     void handleStateRecvHead();
     void handleStateRecvBody();
 
     void handleRequest();
-    void handleMethodGetAndHead();
-    void handleMethodTrace();
+    // whether the connection stays open after the response: the client keeps it, it has
+    // requests left and the server does not drain
+    [[nodiscard]] bool isKeepAlive() const;
+    // the Keep-Alive header value: idle timeout and requests left
+    [[nodiscard]] std::string keepAliveParams() const;
+    // frames response_ as HTTP/1.1 into output_
+    void commitResponse();
+    // sends output_, then waits for the next request or closes
+    void sendResponse();
+    // waits for the next request, false if the connection was closed for a drain instead
+    [[nodiscard]] bool becomeIdle();
+    // sends response_.stream while it makes the body, then the rest like sendResponse()
+    void handleStream();
+    // the next piece of response_.stream into output_, false if the body broke off
+    [[nodiscard]] bool fillStream();
+
+    // the request goes to an upstream of route, the response is sent as it arrives
+    void startProxy(const Proxy::Route &route);
+    void handleProxy();
+    // the request goes to a FastCGI backend of route, its stdout is sent as it arrives
+    void startFastCgi(const FastCgi::Route &route);
+    void handleFastCgi();
+
+    // h2c via Upgrade, false if the request is served as HTTP/1.1 instead
+    [[nodiscard]] bool upgradeToHttp2(int head_length);
+    void handleHttp2();
+    void sendHttp2();
+    void closeConnection();
 
     void reset();
-    void setDefaultErrorResponse(HttpStatusCode, const std::string = "", bool is_method_head = false);
+    // moves the connection timer to ms from now
+    void setDeadline(int ms) { timers_->resetTimer(timer_id_, ms); }
+    void recordSendCompleted();
+    void setDefaultErrorResponse(HttpStatusCode);
 };
\ No newline at end of file
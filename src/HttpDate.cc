@@ -0,0 +1,67 @@
+#include <array>
+#include <string>
+#include <string_view>
+
+#include <cctype>
+#include <cstdio>
+#include <ctime>
+
+#include "./HttpDate.h"
+
+static constexpr std::array<const char *, 7> kWeekdays = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+static constexpr std::array<const char *, 12> kMonths = {"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                                         "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+
+std::string formatHttpDate(time_t time)
+{
+    tm tm_time;
+    gmtime_r(&time, &tm_time);
+
+    std::array<char, 32> buffer;
+    const int len = std::snprintf(buffer.data(), buffer.size(), "%s, %02d %s %04d %02d:%02d:%02d GMT",
+                                  kWeekdays[tm_time.tm_wday], tm_time.tm_mday, kMonths[tm_time.tm_mon],
+                                  tm_time.tm_year + 1900, tm_time.tm_hour, tm_time.tm_min, tm_time.tm_sec);
+    return std::string(buffer.data(), len);
+}
+
+static bool parseDigits(std::string_view str, std::size_t pos, std::size_t count, int &value)
+{
+    value = 0;
+    for (std::size_t i = pos; i < pos + count; i++)
+    {
+        if (!std::isdigit(static_cast<unsigned char>(str[i])))
+            return false;
+        value = value * 10 + (str[i] - '0');
+    }
+    return true;
+}
+
+bool parseHttpDate(std::string_view str, time_t &time)
+{
+    // "Sun, 06 Nov 1994 08:49:37 GMT"
+    static constexpr std::size_t kFixDateLength = 29;
+    if (str.size() != kFixDateLength || str.substr(3, 2) != ", " || str.substr(25) != " GMT" ||
+        str[7] != ' ' || str[11] != ' ' || str[16] != ' ' || str[19] != ':' || str[22] != ':')
+        return false;
+
+    tm tm_time{};
+    int month = 0;
+    while (month < 12 && str.substr(8, 3) != kMonths[month])
+        month++;
+    if (month == 12)
+        return false;
+    tm_time.tm_mon = month;
+
+    int year;
+    if (!parseDigits(str, 5, 2, tm_time.tm_mday) || !parseDigits(str, 12, 4, year) ||
+        !parseDigits(str, 17, 2, tm_time.tm_hour) || !parseDigits(str, 20, 2, tm_time.tm_min) ||
+        !parseDigits(str, 23, 2, tm_time.tm_sec))
+        return false;
+    tm_time.tm_year = year - 1900;
+
+    if (tm_time.tm_mday < 1 || tm_time.tm_mday > 31 || tm_time.tm_hour > 23 || tm_time.tm_min > 59 || tm_time.tm_sec > 60)
+        return false;
+
+    time = timegm(&tm_time);
+    return time != -1;
+}
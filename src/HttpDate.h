@@ -0,0 +1,13 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+#include <ctime>
+
+// IMF-fixdate, e.g. "Sun, 06 Nov 1994 08:49:37 GMT" # rfc7231 sec:7.1.1.1
+std::string formatHttpDate(time_t time);
+
+// accepts IMF-fixdate only, the obsolete rfc850 and asctime forms are
+// treated as invalid, returns false on failure
+bool parseHttpDate(std::string_view str, time_t &time);
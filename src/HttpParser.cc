@@ -1,31 +1,41 @@
-#include <unordered_map>
 #include <string_view>
 #include <string>
 #include <array>
+#include <bitset>
+#include <utility>
+#include <vector>
 #include <algorithm>
+#include <charconv>
 
 #include <cctype>
+#include <cstdint>
 #include <cstring>
 
 #include "./HttpTypes.h"
 #include "./HttpParser.h"
 #include "./util/utils.h"
+#include "./util/Ascii.h"
+#include "./util/PerfectHash.h"
 #include "./Logger.h"
 #include "./Mime.h"
 
 static bool parseMethod(std::string_view req, int &pos, HttpMethod &method);
 static bool parseUrl(std::string_view req, int &out_pos, std::string_view &url_out, std::string_view &query, std::string_view &mime);
 static bool parseVersion(std::string_view req, int &pos, HttpVersion &version);
-static bool parseHeaders(std::string_view req, int &pos, std::unordered_map<std::string_view, std::string_view> &headers);
+static bool parseHeaders(std::string_view req, int &pos, std::array<std::string_view, kHttpHeaderCount> &known_headers,
+                         std::vector<std::pair<std::string_view, std::string_view>> &other_headers);
 static bool ignoreOneSpace(std::string_view req, int &pos);
 static bool isCRLF(std::string_view req, int pos);
 static bool ignoreCRLF(std::string_view req, int &pos);
 static bool isNumber(std::string_view str);
 
+// header names are case-insensitive, HTTP/2 clients and many libraries send them in lowercase
+static constexpr PerfectHashTable<kHttpHeaderCount> kKnownHeaderIndex(keysOf(kHttpHeaderStr));
+
 int HttpParser::parse(std::string request)
 {
     clear();
-    headers_.reserve(10);
+    other_headers_.reserve(8);
 
     raw_ = std::move(request);
     int pos = 0;
@@ -50,7 +60,7 @@ int HttpParser::parse(std::string request)
         return false;
 
     // headers
-    if (!parseHeaders(raw_, pos, headers_))
+    if (!parseHeaders(raw_, pos, known_headers_, other_headers_))
         return false;
 
     // end of http request header
@@ -63,24 +73,49 @@ int HttpParser::parse(std::string request)
 
 bool HttpParser::isKeepAlive() const
 {
-    if (const auto iter = headers_.find("Connection"); iter != headers_.end() && iter->second != "close")
-        return true;
-    return false;
+    const auto connection = header(HttpHeader::CONNECTION);
+    if (version_ == HttpVersion::HTTP11)
+        return !hasToken(connection, "close");
+    return version_ == HttpVersion::HTTP10 && hasToken(connection, "keep-alive");
 }
 
-long long HttpParser::getContentLength() const
+bool HttpParser::hasToken(std::string_view list, std::string_view token)
 {
-    try
+    while (!list.empty())
     {
-        if (const auto iter = headers_.find("Content-Length"); iter != headers_.end() && isNumber(iter->second))
-            return std::atoll(iter->second.data());
-        return 0;
+        auto item = list.substr(0, list.find(','));
+        list.remove_prefix(std::min(list.size(), item.size() + 1));
+        while (!item.empty() && (item.front() == ' ' || item.front() == '\t'))
+            item.remove_prefix(1);
+        while (!item.empty() && (item.back() == ' ' || item.back() == '\t'))
+            item.remove_suffix(1);
+        if (equalsIgnoreCase(item, token))
+            return true;
     }
-    catch (const std::exception &e)
-    {
-        LOG_WARNING("Exception raised, what = ", e.what());
+    return false;
+}
+
+std::string_view HttpParser::getHeader(std::string_view name) const
+{
+    if (const int known = kKnownHeaderIndex.find(name); known != -1)
+        return known_headers_[known];
+    for (const auto &[other_name, value] : other_headers_)
+        if (equalsIgnoreCase(other_name, name))
+            return value;
+    return {};
+}
+
+long long HttpParser::getContentLength() const
+{
+    const auto content_length = header(HttpHeader::CONTENT_LENGTH);
+    if (content_length.empty())
         return 0;
-    }
+    // digits only (from_chars takes a sign), and within long long
+    long long length = -1;
+    if (!isNumber(content_length) ||
+        std::from_chars(content_length.data(), content_length.data() + content_length.size(), length).ec != std::errc())
+        return -1;
+    return length;
 }
 
 void HttpParser::clear()
@@ -88,46 +123,63 @@ void HttpParser::clear()
     method_ = HttpMethod::NOT_SET;
     version_ = HttpVersion::NOT_SET;
     url_ = "";
-    headers_.clear();
+    known_headers_.fill({});
+    other_headers_.clear();
     raw_.clear();
 }
 
+// up to 8 bytes of a method token as one number, so a switch compares whole methods at once
+static constexpr uint64_t packMethod(std::string_view token) noexcept
+{
+    uint64_t packed = 0;
+    for (std::size_t i = 0; i < token.size(); i++)
+        packed |= static_cast<uint64_t>(static_cast<unsigned char>(token[i])) << (i * 8);
+    return packed;
+}
+
 bool parseMethod(std::string_view req, int &pos, HttpMethod &method)
 {
-    static constexpr const char *kMethodStr[] = {
-        "GET",
-        "HEAD",
-        "POST",
-        "PUT",
-        "DELETE",
-        "TRACE",
-        "OPTIONS",
-        "CONNECT",
-        "PATCH",
-    };
-
-    static constexpr HttpMethod kMethodValue[] = {
-        HttpMethod::GET,
-        HttpMethod::HEAD,
-        HttpMethod::POST,
-        HttpMethod::PUT,
-        HttpMethod::DELETE,
-        HttpMethod::TRACE,
-        HttpMethod::OPTIONS,
-        HttpMethod::CONNECT,
-        HttpMethod::PATCH,
-    };
-    static_assert(std::size(kMethodStr) == std::size(kMethodValue));
-
-    for (int i = 0; i < std::size(kMethodStr); i++)
-        if (req.substr(pos, std::strlen(kMethodStr[i])) == kMethodStr[i])
-        {
-            method = kMethodValue[i];
-            pos += std::strlen(kMethodStr[i]);
-            return true;
-        }
+    // the longest method is 7 bytes, methods are case-sensitive (rfc7230 sec:3.1.1)
+    static constexpr std::size_t kMaxMethodLength = 7;
+    const std::string_view rest = req.substr(pos, kMaxMethodLength + 1);
+    const std::size_t length = rest.find(' ');
+    if (length == std::string_view::npos)
+        return false;
 
-    return false;
+    switch (packMethod(rest.substr(0, length)))
+    {
+    case packMethod("GET"):
+        method = HttpMethod::GET;
+        break;
+    case packMethod("HEAD"):
+        method = HttpMethod::HEAD;
+        break;
+    case packMethod("POST"):
+        method = HttpMethod::POST;
+        break;
+    case packMethod("PUT"):
+        method = HttpMethod::PUT;
+        break;
+    case packMethod("DELETE"):
+        method = HttpMethod::DELETE;
+        break;
+    case packMethod("TRACE"):
+        method = HttpMethod::TRACE;
+        break;
+    case packMethod("OPTIONS"):
+        method = HttpMethod::OPTIONS;
+        break;
+    case packMethod("CONNECT"):
+        method = HttpMethod::CONNECT;
+        break;
+    case packMethod("PATCH"):
+        method = HttpMethod::PATCH;
+        break;
+    default:
+        return false;
+    }
+    pos += static_cast<int>(length);
+    return true;
 }
 
 bool parseUrl(std::string_view req, int &out_pos, std::string_view &url_out, std::string_view &query, std::string_view &mime)
@@ -181,8 +233,8 @@ bool parseVersion(std::string_view req, int &pos, HttpVersion &version)
     return true;
 }
 
-static bool parseHeaders(std::string_view req, int &pos,
-                         std::unordered_map<std::string_view, std::string_view> &headers)
+static bool parseHeaders(std::string_view req, int &pos, std::array<std::string_view, kHttpHeaderCount> &known_headers,
+                         std::vector<std::pair<std::string_view, std::string_view>> &other_headers)
 {
     // rfc7230 sec:3.2
     // header-field   = field-name ":" OWS field-value OWS
@@ -194,7 +246,8 @@ static bool parseHeaders(std::string_view req, int &pos,
     // field-vchar    = VCHAR / obs-text
     // obs-fold       = CRLF 1*( SP / HTAB )
 
-    auto hint = headers.begin();
+    // an empty value cannot mark a slot as unseen, it is a value like any other
+    std::bitset<kHttpHeaderCount> is_seen;
     while (!isCRLF(req, pos))
     {
         const int next_crlf_pos = req.find("\r\n", pos);
@@ -209,7 +262,7 @@ static bool parseHeaders(std::string_view req, int &pos,
 
         // no whitespace between field-name and colon
         for (int i = pos; i < colon_pos; i++)
-            if (std::isspace(req[pos]))
+            if (std::isspace(req[i]))
                 return false;
 
         int value_start_pos = colon_pos + 1;
@@ -220,7 +273,26 @@ static bool parseHeaders(std::string_view req, int &pos,
         while (value_end_pos >= value_start_pos && std::isspace(req[value_end_pos]))
             value_end_pos--;
 
-        hint = headers.emplace_hint(hint, req.substr(pos, colon_pos - pos), req.substr(value_start_pos, value_end_pos - value_start_pos + 1));
+        const auto name = req.substr(pos, colon_pos - pos);
+        const auto value = req.substr(value_start_pos, value_end_pos - value_start_pos + 1);
+        // a repeated known header keeps its first value in the slot. Two framings could be
+        // read differently by a proxy in front, RFC 9112 sec 6.3: a repeated
+        // Transfer-Encoding, differing Content-Lengths and an empty one of both fail the request
+        const int known = kKnownHeaderIndex.find(name);
+        const bool is_framing = known == static_cast<int>(HttpHeader::TRANSFER_ENCODING) ||
+                                known == static_cast<int>(HttpHeader::CONTENT_LENGTH);
+        if (is_framing && value.empty())
+            return false;
+        if (known != -1 && !is_seen[known])
+        {
+            is_seen[known] = true;
+            known_headers[known] = value;
+        }
+        else if (known == static_cast<int>(HttpHeader::TRANSFER_ENCODING) ||
+                 (known == static_cast<int>(HttpHeader::CONTENT_LENGTH) && value != known_headers[known]))
+            return false;
+        else if (known != static_cast<int>(HttpHeader::CONTENT_LENGTH))
+            other_headers.emplace_back(name, value);
         pos = next_crlf_pos + 2;
     }
     return true;
@@ -1,8 +1,10 @@
 #pragma once
 
-#include <unordered_map>
+#include <array>
 #include <string_view>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include <cctype>
 
@@ -20,10 +22,30 @@ public:
     auto mime() const noexcept { return mime_; }
     auto query() const noexcept { return query_; }
     bool hasQuery() const noexcept { return query_.size() > 0; }
-    const auto &headers() const noexcept { return headers_; }
+    // a known header, empty if the request has none (the first one if it is repeated)
+    std::string_view header(HttpHeader name) const noexcept { return known_headers_[static_cast<std::size_t>(name)]; }
+    // any header, the name matches case-insensitively
+    std::string_view getHeader(std::string_view name) const;
+    // f(name, value) for every header: the known ones under their usual
+    // capitalization, then the others (and repeats) as they were sent
+    template <typename F>
+    void forEachHeader(const F &f) const
+    {
+        for (std::size_t i = 0; i < kHttpHeaderCount; i++)
+            if (!known_headers_[i].empty())
+                f(kHttpHeaderStr[i], known_headers_[i]);
+        for (const auto &[name, value] : other_headers_)
+            f(name, value);
+    }
     auto headLength() const noexcept { return head_length_; }
+    // whether the comma separated list (Connection, Transfer-Encoding, ...) has token, case-insensitively
+    static bool hasToken(std::string_view list, std::string_view token);
+    std::string_view head() const noexcept { return std::string_view(raw_).substr(0, head_length_); }
 
+    // whether the client keeps the connection, RFC 9112 sec 9.3: HTTP/1.1 unless it sends
+    // "Connection: close", HTTP/1.0 only if it sends "Connection: keep-alive"
     bool isKeepAlive() const;
+    // 0 without the header, -1 if it is not a number or does not fit
     long long getContentLength() const;
 
 private:
@@ -32,7 +54,9 @@ private:
     std::string_view url_;
     std::string_view query_;
     std::string_view mime_;
-    std::unordered_map<std::string_view, std::string_view> headers_;
+    // header values by HttpHeader, the names are matched while the head is scanned
+    std::array<std::string_view, kHttpHeaderCount> known_headers_{};
+    std::vector<std::pair<std::string_view, std::string_view>> other_headers_;
     std::string raw_;
     int head_length_{};
 };
\ No newline at end of file
@@ -0,0 +1,110 @@
+#include <algorithm>
+#include <string_view>
+#include <vector>
+
+#include <cctype>
+#include <cstdint>
+
+#include "./HttpRange.h"
+
+static std::string_view trimOWS(std::string_view sv)
+{
+    while (!sv.empty() && (sv.front() == ' ' || sv.front() == '\t'))
+        sv.remove_prefix(1);
+    while (!sv.empty() && (sv.back() == ' ' || sv.back() == '\t'))
+        sv.remove_suffix(1);
+    return sv;
+}
+
+// 1*DIGIT, false on empty input, other characters or overflow
+static bool parseBytePos(std::string_view sv, off_t &pos)
+{
+    if (sv.empty())
+        return false;
+
+    static constexpr off_t kMaxPos = (static_cast<uint64_t>(1) << 62);
+    pos = 0;
+    for (const char c : sv)
+    {
+        if (!std::isdigit(static_cast<unsigned char>(c)))
+            return false;
+        pos = pos * 10 + (c - '0');
+        if (pos > kMaxPos)
+            return false;
+    }
+    return true;
+}
+
+RangeParseResult parseRange(std::string_view header, off_t representation_size, std::vector<ByteRange> &ranges)
+{
+    ranges.clear();
+
+    static constexpr std::string_view kBytesUnit = "bytes=";
+    header = trimOWS(header);
+    if (header.size() <= kBytesUnit.size() ||
+        !std::equal(kBytesUnit.begin(), kBytesUnit.end(), header.begin(), [](char a, char b)
+                    { return a == std::tolower(static_cast<unsigned char>(b)); }))
+        return RangeParseResult::IGNORED;
+    header.remove_prefix(kBytesUnit.size());
+
+    std::size_t spec_count = 0;
+    while (!header.empty())
+    {
+        const auto comma_pos = header.find(',');
+        const auto spec = trimOWS(header.substr(0, comma_pos));
+        header.remove_prefix(comma_pos == std::string_view::npos ? header.size() : comma_pos + 1);
+        if (spec.empty())
+            continue;
+
+        if (++spec_count > kMaxByteRanges)
+            return RangeParseResult::IGNORED;
+
+        const auto dash_pos = spec.find('-');
+        if (dash_pos == std::string_view::npos)
+            return RangeParseResult::IGNORED;
+
+        off_t first, last;
+        if (dash_pos == 0)
+        {
+            // suffix-byte-range-spec, the final N bytes
+            off_t suffix_length;
+            if (!parseBytePos(spec.substr(1), suffix_length))
+                return RangeParseResult::IGNORED;
+            if (suffix_length == 0 || representation_size == 0)
+                continue;
+            first = representation_size - std::min(suffix_length, representation_size);
+            last = representation_size - 1;
+        }
+        else
+        {
+            if (!parseBytePos(spec.substr(0, dash_pos), first))
+                return RangeParseResult::IGNORED;
+            if (dash_pos + 1 == spec.size())
+                last = representation_size - 1;
+            else if (!parseBytePos(spec.substr(dash_pos + 1), last) || last < first)
+                return RangeParseResult::IGNORED;
+            if (first >= representation_size)
+                continue;
+            last = std::min(last, representation_size - 1);
+        }
+        ranges.push_back({first, last});
+    }
+
+    if (spec_count == 0)
+        return RangeParseResult::IGNORED;
+    if (ranges.empty())
+        return RangeParseResult::NOT_SATISFIABLE;
+
+    std::sort(ranges.begin(), ranges.end(), [](const ByteRange &lhs, const ByteRange &rhs)
+              { return lhs.first < rhs.first; });
+    std::size_t size = 1;
+    for (std::size_t i = 1; i < ranges.size(); i++)
+    {
+        if (ranges[i].first <= ranges[size - 1].last + 1)
+            ranges[size - 1].last = std::max(ranges[size - 1].last, ranges[i].last);
+        else
+            ranges[size++] = ranges[i];
+    }
+    ranges.resize(size);
+    return RangeParseResult::SATISFIABLE;
+}
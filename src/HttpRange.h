@@ -0,0 +1,30 @@
+#pragma once
+
+#include <string_view>
+#include <vector>
+
+#include <sys/types.h>
+
+// inclusive byte range of a representation, first <= last
+struct ByteRange
+{
+    off_t first;
+    off_t last;
+
+    [[nodiscard]] off_t length() const noexcept { return last - first + 1; }
+};
+
+enum class RangeParseResult
+{
+    IGNORED,         // no usable Range header, send the whole representation
+    SATISFIABLE,     // ranges holds at least one range
+    NOT_SATISFIABLE, // 416
+};
+
+// more ranges than this is treated as an abusive request and answered with 200
+inline constexpr std::size_t kMaxByteRanges = 16;
+
+// Range = "bytes=" 1#( first-byte-pos "-" [ last-byte-pos ] / "-" suffix-length ) # rfc7233 sec:2.1
+// Satisfiable ranges are sorted and overlapping or adjacent ones are
+// coalesced, so a multipart response never repeats bytes.
+RangeParseResult parseRange(std::string_view header, off_t representation_size, std::vector<ByteRange> &ranges);
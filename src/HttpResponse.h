@@ -0,0 +1,27 @@
+#pragma once
+
+#include <memory>
+
+#include "./HttpResponseBuilder.h"
+#include "./OutputBuffer.h"
+#include "./ResponseStream.h"
+
+// A response before it is framed for HTTP/1.1 or HTTP/2: status and headers
+// in head (without connection specific headers), body bytes in body. A body
+// of unknown length comes from stream after those bytes, head has no
+// Content-Length then.
+struct HttpResponse
+{
+    HttpResponseBuilder head;
+    OutputBuffer body;
+    std::unique_ptr<ResponseStream> stream;
+    bool is_close{false}; // the connection is closed once the response is sent
+
+    void clear()
+    {
+        head.clear();
+        body.clear();
+        stream.reset();
+        is_close = false;
+    }
+};
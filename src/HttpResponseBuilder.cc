@@ -11,7 +11,11 @@
 static const std::unordered_map<HttpStatusCode, const char *> kDefaultReason =
     {
         {HttpStatusCode::CONTINUE, "Continue"},
+        {HttpStatusCode::SWITCHING_PROTOCOLS, "Switching Protocols"},
         {HttpStatusCode::OK, "Ok"},
+        {HttpStatusCode::CREATED, "Created"},
+        {HttpStatusCode::NO_CONTENT, "No Content"},
+        {HttpStatusCode::PARTIAL_CONTENT, "Partial Content"},
         {HttpStatusCode::MOVED_PERMANENTLY, "Moved Permanently"},
         {HttpStatusCode::FOUND, "Found"},
         {HttpStatusCode::NOT_MODIFIED, "Not Modified"},
@@ -21,8 +25,13 @@ static const std::unordered_map<HttpStatusCode, const char *> kDefaultReason =
         {HttpStatusCode::FORBIDDEN, "Forbidden"},
         {HttpStatusCode::NOT_FOUND, "Not Found"},
         {HttpStatusCode::PROXY_AUTH_REQUIRED, "Proxy Authentication Required"},
+        {HttpStatusCode::CONFLICT, "Conflict"},
+        {HttpStatusCode::PAYLOAD_TOO_LARGE, "Payload Too Large"},
+        {HttpStatusCode::RANGE_NOT_SATISFIABLE, "Range Not Satisfiable"},
+        {HttpStatusCode::TOO_MANY_REQUESTS, "Too Many Requests"},
         {HttpStatusCode::INTERNAL_SERVER_ERROR, "Internal Server Error"},
         {HttpStatusCode::NOT_IMPLEMENTED, "Not Implemented"},
+        {HttpStatusCode::BAD_GATEWAY, "Bad Gateway"},
         {HttpStatusCode::SERVICE_UNAVAILABLE, "Service Unavailable"},
         {HttpStatusCode::HTTP_VERSION_NOT_SUPPORTED, "HTTP Version Not Supported"},
 };
@@ -24,6 +24,9 @@ public:
     HttpResponseBuilder &addHeader(std::string name, std::string value);
     HttpResponseBuilder &setBody(std::string body);
     auto bodySize() const noexcept { return body_.size(); }
+    auto statusCode() const noexcept { return status_code_; }
+    // name, value, name, value, ...
+    const auto &headers() const noexcept { return headers_; }
     std::string build();
     std::string buildOnce();
     std::string buildNoBody();
@@ -1,5 +1,9 @@
 #pragma once
 
+#include <cstddef>
+#include <iterator>
+#include <string_view>
+
 enum class HttpMethod
 {
     NOT_SET = 0,
@@ -27,6 +31,55 @@ inline constexpr const char *kHttpMethodStr[] = {
     "PATCH",
 };
 
+// request headers HttpParser keeps in slots of their own, found without a lookup
+enum class HttpHeader
+{
+    HOST = 0,
+    CONNECTION,
+    KEEP_ALIVE,
+    CONTENT_LENGTH,
+    CONTENT_TYPE,
+    TRANSFER_ENCODING,
+    EXPECT,
+    UPGRADE,
+    HTTP2_SETTINGS,
+    ACCEPT,
+    ACCEPT_ENCODING,
+    ACCEPT_LANGUAGE,
+    RANGE,
+    IF_RANGE,
+    IF_NONE_MATCH,
+    IF_MODIFIED_SINCE,
+    USER_AGENT,
+    REFERER,
+    COOKIE,
+};
+
+inline constexpr std::string_view kHttpHeaderStr[] = {
+    "Host",
+    "Connection",
+    "Keep-Alive",
+    "Content-Length",
+    "Content-Type",
+    "Transfer-Encoding",
+    "Expect",
+    "Upgrade",
+    "HTTP2-Settings",
+    "Accept",
+    "Accept-Encoding",
+    "Accept-Language",
+    "Range",
+    "If-Range",
+    "If-None-Match",
+    "If-Modified-Since",
+    "User-Agent",
+    "Referer",
+    "Cookie",
+};
+
+inline constexpr std::size_t kHttpHeaderCount = std::size(kHttpHeaderStr);
+static_assert(static_cast<std::size_t>(HttpHeader::COOKIE) + 1 == kHttpHeaderCount);
+
 enum class HttpVersion: unsigned
 {
     NOT_SET = 0,
@@ -39,7 +92,11 @@ enum class HttpVersion: unsigned
 enum class HttpStatusCode: unsigned
 {
     CONTINUE = 100,
+    SWITCHING_PROTOCOLS = 101,
     OK = 200,
+    CREATED = 201,
+    NO_CONTENT = 204,
+    PARTIAL_CONTENT = 206,
     MOVED_PERMANENTLY = 301,
     FOUND = 302,
     NOT_MODIFIED = 304,
@@ -49,8 +106,13 @@ enum class HttpStatusCode: unsigned
     FORBIDDEN = 403,
     NOT_FOUND = 404,
     PROXY_AUTH_REQUIRED = 407,
+    CONFLICT = 409,
+    PAYLOAD_TOO_LARGE = 413,
+    RANGE_NOT_SATISFIABLE = 416,
+    TOO_MANY_REQUESTS = 429,
     INTERNAL_SERVER_ERROR = 500,
     NOT_IMPLEMENTED = 501,
+    BAD_GATEWAY = 502,
     SERVICE_UNAVAILABLE = 503,
     HTTP_VERSION_NOT_SUPPORTED = 505,
 };
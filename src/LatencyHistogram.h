@@ -0,0 +1,101 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <algorithm>
+
+#include <cinttypes>
+
+// Log-linear histogram (HdrHistogram-style) with fixed memory.
+// Values below kSubBucketCount are recorded exactly, larger values keep
+// kSubBucketBits bits of precision (~6% relative error). Single writer,
+// any number of concurrent readers.
+class LatencyHistogram
+{
+public:
+    static constexpr int kSubBucketBits = 4;
+    static constexpr uint64_t kSubBucketCount = 1ull << kSubBucketBits;
+    static constexpr int kMaxValueBits = 48;
+    static constexpr std::size_t kBucketCount = (kMaxValueBits - kSubBucketBits + 1) * kSubBucketCount;
+
+    LatencyHistogram() = default;
+
+    void record(uint64_t value) noexcept
+    {
+        auto &counter = counts_[indexOf(value)];
+        counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        total_.store(total_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        if (value > max_.load(std::memory_order_relaxed))
+            max_.store(value, std::memory_order_relaxed);
+    }
+
+    // add counts of other into this histogram, only used on snapshots
+    void merge(const LatencyHistogram &other) noexcept
+    {
+        for (std::size_t i = 0; i < kBucketCount; i++)
+            counts_[i].store(counts_[i].load(std::memory_order_relaxed) + other.counts_[i].load(std::memory_order_relaxed),
+                             std::memory_order_relaxed);
+        total_.store(total_.load(std::memory_order_relaxed) + other.total_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        max_.store(std::max(max_.load(std::memory_order_relaxed), other.max_.load(std::memory_order_relaxed)), std::memory_order_relaxed);
+    }
+
+    void clear() noexcept
+    {
+        for (auto &counter : counts_)
+            counter.store(0, std::memory_order_relaxed);
+        total_.store(0, std::memory_order_relaxed);
+        max_.store(0, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] uint64_t count() const noexcept { return total_.load(std::memory_order_relaxed); }
+    [[nodiscard]] uint64_t max() const noexcept { return max_.load(std::memory_order_relaxed); }
+
+    // percentile in [0, 100], returns the upper bound of the bucket holding it
+    [[nodiscard]] uint64_t percentile(double percentile) const noexcept
+    {
+        const uint64_t total = count();
+        if (total == 0)
+            return 0;
+
+        uint64_t target = static_cast<uint64_t>(percentile / 100.0 * total + 0.5);
+        target = std::clamp<uint64_t>(target, 1, total);
+
+        uint64_t seen = 0;
+        for (std::size_t i = 0; i < kBucketCount; i++)
+        {
+            seen += counts_[i].load(std::memory_order_relaxed);
+            if (seen >= target)
+                return std::min(upperBoundOf(i), max());
+        }
+        return max();
+    }
+
+    [[nodiscard]] static std::size_t indexOf(uint64_t value) noexcept
+    {
+        if (value < kSubBucketCount)
+            return value;
+
+        const int msb = 63 - __builtin_clzll(value);
+        if (msb >= kMaxValueBits)
+            return kBucketCount - 1;
+
+        const int shift = msb - kSubBucketBits;
+        const uint64_t sub_bucket = (value >> shift) & (kSubBucketCount - 1);
+        return (shift + 1) * kSubBucketCount + sub_bucket;
+    }
+
+    [[nodiscard]] static uint64_t upperBoundOf(std::size_t index) noexcept
+    {
+        if (index < kSubBucketCount)
+            return index;
+
+        const int shift = index / kSubBucketCount - 1;
+        const uint64_t sub_bucket = index % kSubBucketCount;
+        return ((kSubBucketCount + sub_bucket + 1) << shift) - 1;
+    }
+
+private:
+    std::array<std::atomic<uint64_t>, kBucketCount> counts_{};
+    std::atomic<uint64_t> total_{0};
+    std::atomic<uint64_t> max_{0};
+};
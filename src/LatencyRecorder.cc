@@ -0,0 +1,93 @@
+#include <string>
+#include <memory>
+#include <mutex>
+
+#include <ctime>
+
+#include "./LatencyRecorder.h"
+#include "./Logger.h"
+
+static constexpr const char *kPhaseStr[] = {
+    "queue",
+    "recv_head",
+    "parse",
+    "resolve_file",
+    "send",
+    "total",
+};
+static_assert(std::size(kPhaseStr) == LatencyRecorder::kPhaseCount);
+
+static int64_t elapsedNs(const timespec &begin, const timespec &end)
+{
+    return (end.tv_sec - begin.tv_sec) * 1'000'000'000ll + (end.tv_nsec - begin.tv_nsec);
+}
+
+LatencyRecorder::LatencyRecorder()
+    : start_ticks_(now())
+{
+    clock_gettime(CLOCK_MONOTONIC, &start_time_);
+}
+
+LatencyRecorder::PhaseHistograms &LatencyRecorder::localHistograms()
+{
+    thread_local std::shared_ptr<PhaseHistograms> local;
+    if (!local)
+    {
+        local = std::make_shared<PhaseHistograms>();
+        const std::lock_guard lock(mutex_);
+        histograms_.push_back(local);
+    }
+    return *local;
+}
+
+double LatencyRecorder::nanosecondsPerTick() const noexcept
+{
+#if defined(__x86_64__) || defined(__i386__)
+    timespec cur_time;
+    clock_gettime(CLOCK_MONOTONIC, &cur_time);
+    const Ticks cur_ticks = now();
+    if (cur_ticks <= start_ticks_)
+        return 1.0;
+    return static_cast<double>(elapsedNs(start_time_, cur_time)) / (cur_ticks - start_ticks_);
+#else
+    return 1.0;
+#endif
+}
+
+std::string LatencyRecorder::report() const
+{
+    PhaseHistograms merged;
+    {
+        const std::lock_guard lock(mutex_);
+        for (const auto &histograms : histograms_)
+            for (int i = 0; i < kPhaseCount; i++)
+                merged[i].merge((*histograms)[i]);
+    }
+
+    const double us_per_tick = nanosecondsPerTick() / 1000.0;
+    const auto toUs = [us_per_tick](uint64_t ticks)
+    { return static_cast<uint64_t>(ticks * us_per_tick); };
+
+    // the samples recorded before recording was switched off are still reported
+    std::string res(isEnabled() ? "" : "latency recording is off\n");
+    res.append("phase count p50(us) p90(us) p99(us) p999(us) max(us)\n");
+    for (int i = 0; i < kPhaseCount; i++)
+    {
+        const auto &histogram = merged[i];
+        res.append(logstr(kPhaseStr[i], " ", histogram.count(),
+                          " ", toUs(histogram.percentile(50.0)),
+                          " ", toUs(histogram.percentile(90.0)),
+                          " ", toUs(histogram.percentile(99.0)),
+                          " ", toUs(histogram.percentile(99.9)),
+                          " ", toUs(histogram.max()), "\n"));
+    }
+    return res;
+}
+
+void LatencyRecorder::clear()
+{
+    const std::lock_guard lock(mutex_);
+    for (const auto &histograms : histograms_)
+        for (auto &histogram : *histograms)
+            histogram.clear();
+}
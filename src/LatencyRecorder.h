@@ -0,0 +1,84 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <cinttypes>
+#include <ctime>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "./LatencyHistogram.h"
+#include "./util/Singleton.h"
+
+enum class RequestPhase : int
+{
+    QUEUE = 0,    // epoll wakeup -> task picked by a ThreadPool thread
+    RECV_HEAD,    // first read of a request -> complete header received
+    PARSE,        // HttpParser::parse
+    RESOLVE_FILE, // url -> opened file and response header
+    SEND,         // response ready -> last byte handed to the kernel
+    TOTAL,        // first read of a request -> last byte handed to the kernel
+    PHASE_COUNT,
+};
+
+// Per-thread latency histograms of every RequestPhase, merged on demand.
+// Recording is disabled by default and costs one relaxed load when off.
+class LatencyRecorder : public Singleton<LatencyRecorder>
+{
+public:
+    using Ticks = uint64_t;
+    static constexpr int kPhaseCount = static_cast<int>(RequestPhase::PHASE_COUNT);
+
+    LatencyRecorder();
+
+    void setEnabled(bool is_enabled) noexcept { is_enabled_.store(is_enabled, std::memory_order_relaxed); }
+    [[nodiscard]] bool isEnabled() const noexcept { return is_enabled_.load(std::memory_order_relaxed); }
+
+    [[nodiscard]] static Ticks now() noexcept
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+        return ts.tv_sec * 1'000'000'000ull + ts.tv_nsec;
+#endif
+    }
+
+    // returns 0 when recording is disabled, pass the result to record()
+    [[nodiscard]] Ticks start() const noexcept { return isEnabled() ? now() : 0; }
+
+    void record(RequestPhase phase, Ticks start_ticks) noexcept
+    {
+        if (start_ticks == 0 || !isEnabled())
+            return;
+        const Ticks end = now();
+        localHistograms()[static_cast<int>(phase)].record(end > start_ticks ? end - start_ticks : 0);
+    }
+
+    // merged p50/p90/p99/p999/max of every phase, in microseconds
+    [[nodiscard]] std::string report() const;
+    void clear();
+
+private:
+    using PhaseHistograms = std::array<LatencyHistogram, kPhaseCount>;
+
+    std::atomic_bool is_enabled_{false};
+
+    mutable std::mutex mutex_;
+    std::vector<std::shared_ptr<PhaseHistograms>> histograms_;
+
+    // reference points for converting ticks to nanoseconds
+    Ticks start_ticks_;
+    timespec start_time_;
+
+    PhaseHistograms &localHistograms();
+    [[nodiscard]] double nanosecondsPerTick() const noexcept;
+};
@@ -0,0 +1,116 @@
+#include <atomic>
+#include <mutex>
+#include <string>
+
+#include "./LoadShedder.h"
+#include "./HttpResponseBuilder.h"
+#include "./HttpTypes.h"
+#include "./Logger.h"
+#include "./Mime.h"
+#include "./util/utils.h"
+
+static constexpr const char *kReasonStr[] = {"soft_limit", "worker_limit", "queue_delay"};
+
+LoadShedder::LoadShedder()
+{
+    HttpResponseBuilder builder(HttpStatusCode::SERVICE_UNAVAILABLE);
+    builder.setDefaultErrorPage(HttpStatusCode::SERVICE_UNAVAILABLE);
+    builder.addHeader("Retry-After", lexicalCast(kRetryAfterSeconds))
+        .addHeader("Content-Length", lexicalCast(builder.bodySize()))
+        .addHeader("Content-Type", getMime("html").data())
+        .addHeader("Connection", "close");
+    response_ = builder.build();
+}
+
+void LoadShedder::setLimits(std::size_t soft_limit, std::size_t hard_limit, std::size_t worker_soft_limit)
+{
+    soft_limit_ = soft_limit;
+    hard_limit_ = hard_limit;
+    worker_soft_limit_ = worker_soft_limit;
+    if (soft_limit || hard_limit || worker_soft_limit)
+        LOG_INFO("Connection limits: soft = ", soft_limit, ", hard = ", hard_limit, ", per worker soft = ", worker_soft_limit);
+}
+
+void LoadShedder::setQueueDelayTarget(int64_t target_ns, int64_t interval_ns)
+{
+    queue_target_ns_ = target_ns;
+    queue_interval_ns_ = interval_ns;
+    interval_start_ns_.store(now(), std::memory_order_relaxed);
+    if (target_ns)
+        LOG_INFO("Queue delay target = ", target_ns / 1000, "us, interval = ", interval_ns / 1000, "us");
+}
+
+void LoadShedder::waitForCapacity()
+{
+    if (hard_limit_ == 0 || connections_.load(std::memory_order_relaxed) < hard_limit_)
+        return;
+
+    accept_pauses_.fetch_add(1, std::memory_order_relaxed);
+    std::unique_lock lock(capacity_mutex_);
+    capacity_cv_.wait(lock, [this]()
+                      { return connections_.load(std::memory_order_relaxed) < hard_limit_; });
+}
+
+void LoadShedder::onClosed()
+{
+    const auto prev = connections_.fetch_sub(1, std::memory_order_relaxed);
+    if (hard_limit_ != 0 && prev == hard_limit_)
+    {
+        // taking the lock orders the wakeup after a waiter's check
+        const std::lock_guard lock(capacity_mutex_);
+        capacity_cv_.notify_all();
+    }
+}
+
+bool LoadShedder::shouldShed(std::size_t worker_connections) noexcept
+{
+    Reason reason;
+    if (soft_limit_ != 0 && connections_.load(std::memory_order_relaxed) > soft_limit_)
+        reason = Reason::SOFT_LIMIT;
+    else if (worker_soft_limit_ != 0 && worker_connections >= worker_soft_limit_)
+        reason = Reason::WORKER_LIMIT;
+    else if (queue_target_ns_ != 0 && is_queue_congested_.load(std::memory_order_relaxed) &&
+             now() - interval_start_ns_.load(std::memory_order_relaxed) < 2 * queue_interval_ns_)
+        reason = Reason::QUEUE_DELAY; // a verdict older than an idle interval is void
+    else
+        return false;
+    shed_[static_cast<int>(reason)].fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+void LoadShedder::sendServiceUnavailable(int fd) const
+{
+    if (!sendPrebuiltAndDrain(fd, response_))
+        LOG_DEBUG("Failed to send 503 to fd = ", fd, ", reason: ", logErrStr(errno));
+}
+
+void LoadShedder::recordQueueDelay(int64_t enqueue_ns) noexcept
+{
+    const int64_t now_ns = now();
+    const int64_t delay = now_ns - enqueue_ns;
+    auto min = interval_min_ns_.load(std::memory_order_relaxed);
+    while (delay < min && !interval_min_ns_.compare_exchange_weak(min, delay, std::memory_order_relaxed))
+        ;
+
+    auto start = interval_start_ns_.load(std::memory_order_relaxed);
+    if (now_ns - start >= queue_interval_ns_ &&
+        interval_start_ns_.compare_exchange_strong(start, now_ns, std::memory_order_relaxed))
+    {
+        const bool is_congested = interval_min_ns_.exchange(std::numeric_limits<int64_t>::max(), std::memory_order_relaxed) > queue_target_ns_;
+        if (is_congested)
+            congested_intervals_.fetch_add(1, std::memory_order_relaxed);
+        is_queue_congested_.store(is_congested, std::memory_order_relaxed);
+    }
+}
+
+std::string LoadShedder::report() const
+{
+    std::string res = logstr("load_shedder connections=", connections_.load(std::memory_order_relaxed),
+                             " soft=", soft_limit_, " hard=", hard_limit_, " worker_soft=", worker_soft_limit_,
+                             " accept_pauses=", accept_pauses_.load(std::memory_order_relaxed),
+                             " congested_intervals=", congested_intervals_.load(std::memory_order_relaxed));
+    for (int i = 0; i < static_cast<int>(Reason::REASON_COUNT); i++)
+        res.append(logstr(" shed_", kReasonStr[i], "=", shed_[i].load(std::memory_order_relaxed)));
+    res.push_back('\n');
+    return res;
+}
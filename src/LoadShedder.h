@@ -0,0 +1,85 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <limits>
+#include <mutex>
+#include <string>
+
+#include <cinttypes>
+#include <ctime>
+
+#include "./util/Singleton.h"
+
+// Overload protection. A new connection is answered with a prebuilt 503
+// (Retry-After) and closed when the server holds more than the soft limit of
+// connections, its worker more than the per worker soft limit, or the worker
+// queues are congested. At the hard limit the acceptors stop accepting and
+// new connections wait in the listen backlog instead.
+//
+// Congestion is judged CoDel style on the ThreadPool queue delay (epoll
+// wakeup -> task start): the interval's minimum delay staying above the
+// target means a standing queue, not a burst.
+class LoadShedder : public Singleton<LoadShedder>
+{
+public:
+    enum class Reason : int
+    {
+        SOFT_LIMIT,
+        WORKER_LIMIT,
+        QUEUE_DELAY,
+        REASON_COUNT,
+    };
+
+    static constexpr int kRetryAfterSeconds = 1;
+
+    LoadShedder();
+
+    // 0 disables a limit
+    void setLimits(std::size_t soft_limit, std::size_t hard_limit, std::size_t worker_soft_limit);
+    // 0 disables queue delay tracking
+    void setQueueDelayTarget(int64_t target_ns, int64_t interval_ns);
+    [[nodiscard]] bool isQueueDelayTracked() const noexcept { return queue_target_ns_ != 0; }
+
+    // acceptor side, waitForCapacity() blocks while the hard limit is reached
+    void waitForCapacity();
+    void onAccepted() noexcept { connections_.fetch_add(1, std::memory_order_relaxed); }
+    void onClosed();
+
+    // for a new connection on a worker holding worker_connections, counts the decision
+    [[nodiscard]] bool shouldShed(std::size_t worker_connections) noexcept;
+    // the prebuilt 503, after draining what the client sent; the caller closes fd
+    void sendServiceUnavailable(int fd) const;
+
+    [[nodiscard]] static int64_t now() noexcept
+    {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1'000'000'000ll + ts.tv_nsec;
+    }
+    void recordQueueDelay(int64_t enqueue_ns) noexcept;
+
+    [[nodiscard]] std::string report() const;
+
+private:
+    std::size_t soft_limit_{0};
+    std::size_t hard_limit_{0};
+    std::size_t worker_soft_limit_{0};
+    std::string response_;
+
+    std::atomic<std::size_t> connections_{0};
+    std::mutex capacity_mutex_;
+    std::condition_variable capacity_cv_;
+
+    int64_t queue_target_ns_{0};
+    int64_t queue_interval_ns_{0};
+    std::atomic<int64_t> interval_start_ns_{0};
+    std::atomic<int64_t> interval_min_ns_{std::numeric_limits<int64_t>::max()};
+    std::atomic_bool is_queue_congested_{false};
+
+    // statistics
+    std::array<std::atomic<uint64_t>, static_cast<int>(Reason::REASON_COUNT)> shed_{};
+    std::atomic<uint64_t> accept_pauses_{0};
+    std::atomic<uint64_t> congested_intervals_{0};
+};
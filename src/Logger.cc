@@ -80,12 +80,21 @@ bool Logger::start()
     return true;
 }
 
+Logger::~Logger()
+{
+    if (!worker_)
+        return;
+    // log lines are never empty, an empty one tells work() everything before it is written
+    queue_.enqueue(std::string());
+    worker_->join();
+}
+
 void Logger::work()
 {
     while (true)
     {
         auto msg = queue_.dequeue();
-        if (!msg.has_value())
+        if (!msg.has_value() || msg->empty())
             return;
 
         log_stream_ << msg.value();
@@ -37,6 +37,8 @@ private:
     void work();
 
 public:
+    ~Logger();
+
     bool start();
     Logger &setLevel(LogLevel level) noexcept
     {
@@ -0,0 +1,208 @@
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "./MappedFileCache.h"
+#include "./Logger.h"
+
+// [start, end) of live mappings, read by the SIGBUS handler without locks
+static std::array<std::atomic<uintptr_t>, MappedFileCache::kMaxMappings> g_mapping_starts;
+static std::array<std::atomic<uintptr_t>, MappedFileCache::kMaxMappings> g_mapping_ends;
+static uintptr_t g_page_size = 4096;
+
+static int acquireSlot(const void *data, std::size_t size)
+{
+    const auto start = reinterpret_cast<uintptr_t>(data);
+    for (int i = 0; i < MappedFileCache::kMaxMappings; i++)
+    {
+        uintptr_t expected = 0;
+        if (g_mapping_starts[i].load(std::memory_order_relaxed) == 0 &&
+            g_mapping_starts[i].compare_exchange_strong(expected, start))
+        {
+            g_mapping_ends[i].store(start + size);
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void releaseSlot(int slot)
+{
+    g_mapping_ends[slot].store(0);
+    g_mapping_starts[slot].store(0);
+}
+
+static void handleSigbus(int, siginfo_t *info, void *)
+{
+    const auto addr = reinterpret_cast<uintptr_t>(info->si_addr);
+    for (int i = 0; i < MappedFileCache::kMaxMappings; i++)
+    {
+        const auto start = g_mapping_starts[i].load();
+        if (start == 0 || addr < start || addr >= g_mapping_ends[i].load())
+            continue;
+        // the file shrank under the mapping, the rest of the body reads as zeros
+        void *page = reinterpret_cast<void *>(addr & ~(g_page_size - 1));
+        if (mmap(page, g_page_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) != MAP_FAILED)
+            return;
+        break;
+    }
+
+    // not a mapped file, let the fault kill the process as usual
+    struct sigaction action{};
+    action.sa_handler = SIG_DFL;
+    sigaction(SIGBUS, &action, nullptr);
+}
+
+static bool isSameVersion(const struct stat &a, const struct stat &b)
+{
+    return a.st_ino == b.st_ino && a.st_size == b.st_size &&
+           a.st_mtim.tv_sec == b.st_mtim.tv_sec && a.st_mtim.tv_nsec == b.st_mtim.tv_nsec &&
+           a.st_ctim.tv_sec == b.st_ctim.tv_sec && a.st_ctim.tv_nsec == b.st_ctim.tv_nsec;
+}
+
+MappedFile::~MappedFile()
+{
+    releaseSlot(slot_);
+    if (munmap(const_cast<char *>(data_), size_) == -1)
+        LOG_WARNING("munmap failed, reason: ", logErrStr(errno));
+}
+
+bool MappedFileCache::start(std::size_t max_file_size, std::size_t memory_budget)
+{
+    if (isEnabled() || max_file_size == 0 || memory_budget == 0)
+        return false;
+
+    g_page_size = sysconf(_SC_PAGESIZE);
+    struct sigaction action{};
+    action.sa_sigaction = handleSigbus;
+    action.sa_flags = SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGBUS, &action, nullptr) == -1)
+    {
+        LOG_ERROR("Failed to install the SIGBUS handler, reason: ", logErrStr(errno));
+        return false;
+    }
+
+    max_file_size_ = max_file_size;
+    memory_budget_ = memory_budget;
+    LOG_INFO("MappedFileCache start, files up to ", max_file_size, " bytes, memory budget = ", memory_budget);
+    return true;
+}
+
+MappedFileCache::Mapping MappedFileCache::find(std::string_view path, const struct stat &file_stat)
+{
+    if (!isEnabled() || !isCandidate(file_stat))
+        return nullptr;
+
+    const std::lock_guard lock(mutex_);
+    return findLocked(std::string(path), file_stat);
+}
+
+MappedFileCache::Mapping MappedFileCache::map(std::string_view path, int fd, const struct stat &file_stat)
+{
+    if (!isEnabled() || !isCandidate(file_stat))
+        return nullptr;
+
+    std::string key(path);
+    {
+        const std::lock_guard lock(mutex_);
+        if (auto mapping = findLocked(key, file_stat))
+            return mapping;
+    }
+    misses_.fetch_add(1, std::memory_order_relaxed);
+
+    const std::size_t size = file_stat.st_size;
+    void *data = mmap(nullptr, size, PROT_READ, MAP_SHARED | MAP_POPULATE, fd, 0);
+    if (data == MAP_FAILED)
+    {
+        LOG_WARNING("Failed to mmap ", path, ", reason: ", logErrStr(errno));
+        failures_.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    const int slot = acquireSlot(data, size);
+    if (slot == -1)
+    {
+        munmap(data, size);
+        failures_.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    auto mapping = std::make_shared<const MappedFile>(static_cast<const char *>(data), size, slot);
+
+    const std::lock_guard lock(mutex_);
+    if (auto iter = entries_.find(key); iter != entries_.end())
+    {
+        // mapped by another thread meanwhile
+        if (isSameVersion(iter->second.stat, file_stat))
+            return iter->second.mapping;
+        eraseLocked(iter);
+    }
+
+    lru_.push_front(key);
+    Entry entry;
+    entry.mapping = mapping;
+    entry.stat = file_stat;
+    entry.lru_iter = lru_.begin();
+    entries_.emplace(std::move(key), std::move(entry));
+    memory_used_ += size;
+    evictLocked();
+    return mapping;
+}
+
+MappedFileCache::Mapping MappedFileCache::findLocked(const std::string &path, const struct stat &file_stat)
+{
+    const auto iter = entries_.find(path);
+    if (iter == entries_.end())
+        return nullptr;
+    if (!isSameVersion(iter->second.stat, file_stat))
+    {
+        eraseLocked(iter);
+        return nullptr;
+    }
+    lru_.splice(lru_.begin(), lru_, iter->second.lru_iter);
+    hits_.fetch_add(1, std::memory_order_relaxed);
+    return iter->second.mapping;
+}
+
+void MappedFileCache::eraseLocked(std::unordered_map<std::string, Entry>::iterator iter)
+{
+    memory_used_ -= iter->second.stat.st_size;
+    lru_.erase(iter->second.lru_iter);
+    entries_.erase(iter);
+}
+
+void MappedFileCache::evictLocked()
+{
+    while (memory_used_ > memory_budget_ && !lru_.empty())
+    {
+        eraseLocked(entries_.find(lru_.back()));
+        evictions_.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+std::string MappedFileCache::report() const
+{
+    std::size_t entry_count, memory_used;
+    {
+        const std::lock_guard lock(mutex_);
+        entry_count = entries_.size();
+        memory_used = memory_used_;
+    }
+
+    return logstr("mapped_file_cache entries=", entry_count,
+                  " memory=", memory_used, "/", memory_budget_,
+                  " hits=", hits_.load(std::memory_order_relaxed),
+                  " misses=", misses_.load(std::memory_order_relaxed),
+                  " evictions=", evictions_.load(std::memory_order_relaxed),
+                  " failures=", failures_.load(std::memory_order_relaxed), "\n");
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include <sys/stat.h>
+
+#include "./util/Noncopyable.h"
+#include "./util/Singleton.h"
+
+// A read-only MAP_SHARED mapping of a whole file, unmapped with the last reference.
+class MappedFile : NonCopyable
+{
+public:
+    MappedFile(const char *data, std::size_t size, int slot) noexcept : data_(data), size_(size), slot_(slot) {}
+    ~MappedFile();
+
+    [[nodiscard]] std::string_view view() const noexcept { return {data_, size_}; }
+
+private:
+    const char *data_;
+    std::size_t size_;
+    int slot_; // in the SIGBUS range table
+};
+
+// Files up to a size threshold are mapped once (MAP_POPULATE) and shared by
+// every response of the same version (inode, size, mtime, ctime), so a hit
+// costs the stat() the handler does anyway instead of open, fstat, sendfile
+// and close, and head and body leave in one writev. Mappings are evicted in
+// LRU order to stay within the budget; a response holding one keeps it alive.
+//
+// A file truncated under a mapping would SIGBUS whoever touches the lost
+// pages (only user space TLS does, writev fails with EFAULT instead). The
+// handler installed by start() replaces such pages with zero pages, the next
+// stat() sees the new size and drops the entry.
+class MappedFileCache : public Singleton<MappedFileCache>
+{
+public:
+    using Mapping = std::shared_ptr<const MappedFile>;
+
+    // mappings alive at once, bounded by the lock-free table the SIGBUS handler reads
+    static constexpr int kMaxMappings = 4096;
+
+    bool start(std::size_t max_file_size, std::size_t memory_budget);
+    [[nodiscard]] bool isEnabled() const noexcept { return max_file_size_ != 0; }
+    [[nodiscard]] bool isCandidate(const struct stat &file_stat) const noexcept
+    {
+        return file_stat.st_size > 0 && static_cast<std::size_t>(file_stat.st_size) <= max_file_size_;
+    }
+
+    // the mapping of this version of path, nullptr if there is none yet
+    [[nodiscard]] Mapping find(std::string_view path, const struct stat &file_stat);
+    // find(), or maps fd (opened from path, described by file_stat) and keeps it
+    [[nodiscard]] Mapping map(std::string_view path, int fd, const struct stat &file_stat);
+
+    [[nodiscard]] std::string report() const;
+
+private:
+    struct Entry
+    {
+        Mapping mapping;
+        // the version: inode, size, mtime and ctime (chmod changes it, hits skip access())
+        struct stat stat;
+        std::list<std::string>::iterator lru_iter;
+    };
+
+    std::size_t max_file_size_{0};
+    std::size_t memory_budget_{0};
+
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, Entry> entries_;
+    std::list<std::string> lru_; // most recently used first
+    std::size_t memory_used_{0};
+
+    // statistics
+    std::atomic<uint64_t> hits_{0};
+    std::atomic<uint64_t> misses_{0};
+    std::atomic<uint64_t> evictions_{0};
+    std::atomic<uint64_t> failures_{0};
+
+    [[nodiscard]] Mapping findLocked(const std::string &path, const struct stat &file_stat);
+    void eraseLocked(std::unordered_map<std::string, Entry>::iterator iter);
+    void evictLocked();
+};
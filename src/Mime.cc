@@ -1,61 +1,84 @@
-#include <unordered_map>
+#include <atomic>
+#include <cstdint>
+#include <iterator>
+#include <string>
 #include <string_view>
 
+#include "./Mime.h"
 #include "./Logger.h"
+#include "./util/PerfectHash.h"
 
-static const std::unordered_map<std::string_view, std::string_view> kMimeTable =
-    {
-        {"aac", "audio/aac"},
-        {"arc", "application/x-freearc"},
-        {"avi", "video/x-msvideo"},
-        {"bin", "application/octet-stream"},
-        {"bmp", "image/bmp"},
-        {"bz", "application/x-bzip"},
-        {"bz2", "application/x-bzip2"},
-        {"css", "text/css"},
-        {"csv", "text/csv"},
-        {"doc", "application/msword"},
-        {"docx", "application/vnd.openxmlformats-officedocument.wordprocessingml.document"},
-        {"eot", "application/vnd.ms-fontobject"},
-        {"epub", "application/epub+zip"},
-        {"gif", "image/gif"},
-        {"htm", "text/html"},
-        {"html", "text/html"},
-        {"ico", "image/vnd.microsoft.icon"},
-        {"jpeg", "image/jpeg"},
-        {"jpg", "image/jpeg"},
-        {"js", "text/javascript"},
-        {"json", "application/json"},
-        {"mjs", "text/javascript"},
-        {"mp3", "audio/mpeg"},
-        {"mp4", "video/mp4"},
-        {"mpeg", "video/mpeg"},
-        {"otf", "font/otf"},
-        {"png", "image/png"},
-        {"pdf", "application/pdf"},
-        {"ppt", "application/vnd.ms-powerpoint"},
-        {"rar", "application/x-rar-compressed"},
-        {"svg", "image/svg+xml"},
-        {"tar", "application/x-tar"},
-        {"ttf","font/ttf"},
-        {"txt","text/plain"},
-        {"wav","audio/wav"},
-        {"weba","audio/webm"},
-        {"webm","video/webm"},
-        {"webp","image/webp"},
-        {"woff","font/woff"},
-        {"woff2","font/woff2"},
-        {"xml","text/xml"},
-        {"zip","application/zip"},
+struct MimeEntry
+{
+    std::string_view ext_name;
+    std::string_view mime;
+};
+
+static constexpr MimeEntry kMimeTable[] = {
+    {"aac", "audio/aac"},
+    {"arc", "application/x-freearc"},
+    {"avi", "video/x-msvideo"},
+    {"bin", "application/octet-stream"},
+    {"bmp", "image/bmp"},
+    {"bz", "application/x-bzip"},
+    {"bz2", "application/x-bzip2"},
+    {"css", "text/css"},
+    {"csv", "text/csv"},
+    {"doc", "application/msword"},
+    {"docx", "application/vnd.openxmlformats-officedocument.wordprocessingml.document"},
+    {"eot", "application/vnd.ms-fontobject"},
+    {"epub", "application/epub+zip"},
+    {"gif", "image/gif"},
+    {"htm", "text/html"},
+    {"html", "text/html"},
+    {"ico", "image/vnd.microsoft.icon"},
+    {"jpeg", "image/jpeg"},
+    {"jpg", "image/jpeg"},
+    {"js", "text/javascript"},
+    {"json", "application/json"},
+    {"mjs", "text/javascript"},
+    {"mp3", "audio/mpeg"},
+    {"mp4", "video/mp4"},
+    {"mpeg", "video/mpeg"},
+    {"otf", "font/otf"},
+    {"png", "image/png"},
+    {"pdf", "application/pdf"},
+    {"ppt", "application/vnd.ms-powerpoint"},
+    {"rar", "application/x-rar-compressed"},
+    {"svg", "image/svg+xml"},
+    {"tar", "application/x-tar"},
+    {"ttf", "font/ttf"},
+    {"txt", "text/plain"},
+    {"wav", "audio/wav"},
+    {"weba", "audio/webm"},
+    {"webm", "video/webm"},
+    {"webp", "image/webp"},
+    {"woff", "font/woff"},
+    {"woff2", "font/woff2"},
+    {"xml", "text/xml"},
+    {"zip", "application/zip"},
 };
 
+// built by the compiler, extensions match case-insensitively ("JPG" is "jpg")
+static constexpr PerfectHashTable<std::size(kMimeTable)> kMimeIndex(keysOf(kMimeTable, &MimeEntry::ext_name));
+
 static constexpr std::string_view kDefaultMime = "application/octet-stream";
 
+// misses are counted instead of logged, a client can ask for any extension on every request
+static std::atomic<uint64_t> unknown_count{0};
+
 std::string_view getMime(std::string_view ext_name)
 {
-
-    if (const auto iter = kMimeTable.find(ext_name); iter != kMimeTable.end())
-        return iter->second;
-    LOG_WARNING("Unknow Mime ext name = ", ext_name);
+    if (const int index = kMimeIndex.find(ext_name); index != -1)
+        return kMimeTable[index].mime;
+    unknown_count.fetch_add(1, std::memory_order_relaxed);
     return kDefaultMime;
-}
\ No newline at end of file
+}
+
+std::string mimeReport()
+{
+    std::string res = logstr("mime extensions=", std::size(kMimeTable),
+                             " unknown=", unknown_count.load(std::memory_order_relaxed));
+    res.push_back('\n');
+    return res;
+}
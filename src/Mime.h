@@ -1,3 +1,10 @@
+#pragma once
+
+#include <string>
 #include <string_view>
 
-std::string_view getMime(std::string_view ext_name);
\ No newline at end of file
+// the Content-Type of a file extension (without the dot, any case), application/octet-stream if unknown
+std::string_view getMime(std::string_view ext_name);
+
+// a line for the stats dump: table size and how many lookups were unknown
+std::string mimeReport();
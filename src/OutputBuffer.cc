@@ -0,0 +1,331 @@
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include <cerrno>
+
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <linux/errqueue.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "./OutputBuffer.h"
+#include "./Logger.h"
+#include "./Tls.h"
+
+void OutputBuffer::append(std::string data)
+{
+    if (data.empty())
+        return;
+    Segment segment;
+    segment.length = data.size();
+    segment.owned = std::move(data);
+    size_ += segment.length;
+    segments_.push_back(std::move(segment));
+}
+
+void OutputBuffer::appendShared(std::shared_ptr<const void> holder, std::string_view data)
+{
+    if (data.empty())
+        return;
+    Segment segment;
+    segment.holder = std::move(holder);
+    segment.shared = data;
+    segment.length = data.size();
+    size_ += segment.length;
+    segments_.push_back(std::move(segment));
+}
+
+void OutputBuffer::appendFile(std::shared_ptr<FdHolder> file, off_t offset, std::size_t length)
+{
+    if (length == 0)
+        return;
+    Segment segment;
+    segment.file = std::move(file);
+    segment.offset = offset;
+    segment.length = length;
+    size_ += length;
+    segments_.push_back(std::move(segment));
+}
+
+void OutputBuffer::appendPipe(std::shared_ptr<FdHolder> pipe, std::size_t length)
+{
+    if (length == 0)
+        return;
+    Segment segment;
+    segment.file = std::move(pipe);
+    segment.is_pipe = true;
+    segment.length = length;
+    size_ += length;
+    segments_.push_back(std::move(segment));
+}
+
+void OutputBuffer::append(OutputBuffer &&other)
+{
+    for (auto &segment : other.segments_)
+        segments_.push_back(std::move(segment));
+    size_ += other.size_;
+    other.clear();
+}
+
+void OutputBuffer::moveFront(OutputBuffer &dst, std::size_t bytes)
+{
+    bytes = std::min(bytes, size_);
+    while (bytes > 0)
+    {
+        auto &segment = segments_.front();
+        const std::size_t len = std::min(bytes, segment.remaining());
+        if (segment.is_pipe)
+            dst.appendPipe(segment.file, len);
+        else if (segment.isFile())
+            dst.appendFile(segment.file, segment.offset + segment.pos, len);
+        else
+        {
+            if (len == segment.remaining() && !segment.holder)
+            {
+                // the whole rest of an owned string, move it instead of copying
+                dst.append(segment.pos == 0 ? std::move(segment.owned) : segment.owned.substr(segment.pos));
+            }
+            else
+            {
+                // share the owned string between both buffers
+                share(segment);
+                dst.appendShared(segment.holder, segment.memory().substr(0, len));
+            }
+        }
+        segment.pos += len;
+        size_ -= len;
+        bytes -= len;
+        if (segment.remaining() == 0)
+            segments_.pop_front();
+    }
+}
+
+void OutputBuffer::share(Segment &segment)
+{
+    if (segment.holder)
+        return;
+    auto owned = std::make_shared<const std::string>(std::move(segment.owned));
+    segment.shared = std::string_view(*owned).substr(0, segment.length);
+    segment.holder = std::move(owned);
+}
+
+long OutputBuffer::sendTo(int socket_fd, TlsStream *tls)
+{
+    const bool is_user_tls = tls != nullptr && !tls->isKernelSend();
+    if (hasPendingZeroCopy())
+        reapZeroCopy(socket_fd);
+    long total = 0;
+    while (!segments_.empty())
+    {
+        long retval;
+        if (is_user_tls)
+            retval = sendTls(*tls);
+        else if (segments_.front().is_pipe)
+            retval = sendPipe(socket_fd);
+        else if (segments_.front().isFile())
+            retval = sendFile(socket_fd);
+        else if (isZeroCopyCandidate(segments_.front(), tls))
+            retval = sendZeroCopy(socket_fd);
+        else
+            retval = sendMemory(socket_fd, tls);
+        if (retval == -1)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            if (errno != EPIPE && errno != ECONNRESET)
+                LOG_ERROR("Send error, reason: ", logErrStr(errno));
+            clear();
+            return -1;
+        }
+        if (retval == 0)
+            break;
+        total += retval;
+    }
+    return total;
+}
+
+long OutputBuffer::sendMemory(int socket_fd, const TlsStream *tls)
+{
+    // gather the leading memory segments into one sendmsg
+    std::array<iovec, kMaxIovecCount> iov;
+    int iov_count = 0;
+    bool is_file_following = false;
+    for (const auto &segment : segments_)
+    {
+        if (segment.isFile() || (iov_count > 0 && isZeroCopyCandidate(segment, tls)))
+        {
+            is_file_following = true;
+            break;
+        }
+        if (iov_count == kMaxIovecCount)
+            break;
+        const auto data = segment.memory();
+        iov[iov_count].iov_base = const_cast<char *>(data.data());
+        iov[iov_count].iov_len = data.size();
+        iov_count++;
+    }
+
+    msghdr msg;
+    explicit_bzero(&msg, sizeof(msg));
+    msg.msg_iov = iov.data();
+    msg.msg_iovlen = iov_count;
+
+    // MSG_MORE keeps the header in the socket until the sendfile body
+    // follows, otherwise Nagle holds the body for a delayed ACK
+    const long retval = ::sendmsg(socket_fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL | (is_file_following ? MSG_MORE : 0));
+    if (retval > 0)
+        consume(retval);
+    return retval;
+}
+
+long OutputBuffer::sendZeroCopy(int socket_fd)
+{
+    if (zerocopy_mode_ == ZeroCopyMode::UNKNOWN)
+    {
+        const int one = 1;
+        if (setsockopt(socket_fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == -1)
+        {
+            LOG_DEBUG("SO_ZEROCOPY not supported, reason: ", logErrStr(errno));
+            zerocopy_mode_ = ZeroCopyMode::DISABLED;
+            return sendMemory(socket_fd, nullptr);
+        }
+        zerocopy_mode_ = ZeroCopyMode::ENABLED;
+    }
+
+    auto &segment = segments_.front();
+    share(segment);
+    const auto data = segment.memory();
+    const long retval = ::send(socket_fd, data.data(), data.size(), MSG_DONTWAIT | MSG_NOSIGNAL | MSG_ZEROCOPY);
+    if (retval == -1 && errno == ENOBUFS)
+    {
+        // over the optmem limit for pinned pages, copy this time
+        return sendMemory(socket_fd, nullptr);
+    }
+    if (retval > 0)
+    {
+        zerocopy_pending_.emplace_back(zerocopy_next_id_++, segment.holder);
+        consume(retval);
+    }
+    return retval;
+}
+
+void OutputBuffer::reapZeroCopy(int socket_fd)
+{
+    while (!zerocopy_pending_.empty())
+    {
+        std::array<char, CMSG_SPACE(sizeof(sock_extended_err))> control;
+        msghdr msg;
+        explicit_bzero(&msg, sizeof(msg));
+        msg.msg_control = control.data();
+        msg.msg_controllen = control.size();
+        if (::recvmsg(socket_fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1)
+            return;
+
+        const cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        if (cmsg == nullptr)
+            continue;
+        const auto *err = reinterpret_cast<const sock_extended_err *>(CMSG_DATA(cmsg));
+        if (err->ee_errno != 0 || err->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+            continue;
+        if (err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+            zerocopy_mode_ = ZeroCopyMode::DISABLED;
+
+        // sends [ee_info, ee_data] are done, ids wrap around
+        const uint32_t last = err->ee_data;
+        while (!zerocopy_pending_.empty() && static_cast<int32_t>(last - zerocopy_pending_.front().first) >= 0)
+            zerocopy_pending_.pop_front();
+    }
+}
+
+void OutputBuffer::resetZeroCopy()
+{
+    zerocopy_mode_ = ZeroCopyMode::UNKNOWN;
+    zerocopy_next_id_ = 0;
+    zerocopy_pending_.clear();
+}
+
+long OutputBuffer::sendFile(int socket_fd)
+{
+    auto &segment = segments_.front();
+    off_t offset = segment.offset + segment.pos;
+    const long retval = ::sendfile(socket_fd, segment.file->fd(), &offset, segment.remaining());
+    if (retval == 0)
+    {
+        // file truncated under us, the promised length cannot be delivered
+        LOG_WARNING("File shrank while sending, fd = ", segment.file->fd());
+        errno = EIO;
+        return -1;
+    }
+    if (retval > 0)
+        consume(retval);
+    return retval;
+}
+
+long OutputBuffer::sendPipe(int socket_fd)
+{
+    auto &segment = segments_.front();
+    const long retval = ::splice(segment.file->fd(), nullptr, socket_fd, nullptr, segment.remaining(),
+                                 SPLICE_F_MOVE | SPLICE_F_NONBLOCK | (segments_.size() > 1 ? SPLICE_F_MORE : 0));
+    if (retval == 0)
+    {
+        errno = EIO;
+        return -1;
+    }
+    if (retval > 0)
+        consume(retval);
+    return retval;
+}
+
+long OutputBuffer::sendTls(TlsStream &tls)
+{
+    // a retry after EAGAIN starts at the same position with the same length,
+    // which is what SSL_write expects
+    auto &segment = segments_.front();
+    long retval;
+    if (!segment.isFile())
+    {
+        const auto data = segment.memory();
+        retval = tls.send(data.data(), data.size());
+    }
+    else
+    {
+        thread_local std::array<char, kTlsChunkSize> chunk;
+        const std::size_t len = std::min(segment.remaining(), chunk.size());
+        const long read_len = ::pread(segment.file->fd(), chunk.data(), len, segment.offset + segment.pos);
+        if (read_len != static_cast<long>(len))
+        {
+            LOG_WARNING("Failed to read file for TLS, fd = ", segment.file->fd());
+            errno = EIO;
+            return -1;
+        }
+        retval = tls.send(chunk.data(), len);
+    }
+    if (retval > 0)
+        consume(retval);
+    return retval;
+}
+
+void OutputBuffer::consume(std::size_t bytes)
+{
+    size_ -= bytes;
+    while (bytes > 0)
+    {
+        auto &segment = segments_.front();
+        const std::size_t len = std::min(bytes, segment.remaining());
+        segment.pos += len;
+        bytes -= len;
+        if (segment.remaining() == 0)
+            segments_.pop_front();
+    }
+}
+
+void OutputBuffer::clear()
+{
+    segments_.clear();
+    size_ = 0;
+}
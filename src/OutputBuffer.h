@@ -0,0 +1,114 @@
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include <cstdint>
+
+#include <sys/types.h>
+
+#include "./util/FdHolder.h"
+#include "./util/Noncopyable.h"
+
+class TlsStream;
+
+// Response bytes waiting for the socket: owned strings, memory kept alive by
+// a shared holder (cached or mapped bodies), file ranges sent by sendfile and
+// bytes in a pipe (proxied bodies) sent by splice.
+//
+// Memory segments of at least the zero copy size go out with MSG_ZEROCOPY:
+// the kernel reads the pages after sendmsg returns, so their holders move to
+// a pending list until the completion arrives on the socket error queue
+// (EPOLLERR). A socket whose completions say the kernel copied anyway
+// (loopback, no NIC support) goes back to plain sendmsg.
+class OutputBuffer : NonCopyable
+{
+public:
+    OutputBuffer() = default;
+
+    // process wide, 0 disables MSG_ZEROCOPY
+    static void setZeroCopyMinSize(std::size_t size) noexcept { zerocopy_min_size_ = size; }
+
+    void append(std::string data);
+    void appendShared(std::shared_ptr<const void> holder, std::string_view data);
+    void appendFile(std::shared_ptr<FdHolder> file, off_t offset, std::size_t length);
+    // length bytes waiting in a pipe, spliced to the socket; not for TLS in user space
+    void appendPipe(std::shared_ptr<FdHolder> pipe, std::size_t length);
+    // moves all segments of other to the end, other is left empty
+    void append(OutputBuffer &&other);
+    // moves the first bytes (at most size()) to the end of dst, splitting a segment if needed
+    void moveFront(OutputBuffer &dst, std::size_t bytes);
+
+    [[nodiscard]] bool empty() const noexcept { return segments_.empty(); }
+    [[nodiscard]] std::size_t size() const noexcept { return size_; }
+
+    // writes until the socket would block, returns bytes written or -1 on error;
+    // with tls and no kTLS the records are encrypted by OpenSSL instead
+    [[nodiscard]] long sendTo(int socket_fd, TlsStream *tls = nullptr);
+    // drops the segments, not the pending zero copy sends
+    void clear();
+
+    // the kernel may still read memory of completed sendTo() calls
+    [[nodiscard]] bool hasPendingZeroCopy() const noexcept { return !zerocopy_pending_.empty(); }
+    // reads the completions on the socket error queue and releases their holders
+    void reapZeroCopy(int socket_fd);
+    // a new socket: forgets the zero copy state of the previous one
+    void resetZeroCopy();
+
+private:
+    static constexpr int kMaxIovecCount = 16;
+    // one TLS record, file ranges are read in pieces of this size for SSL_write
+    static constexpr std::size_t kTlsChunkSize = 16 * 1024;
+
+    struct Segment
+    {
+        std::string owned;
+        std::shared_ptr<const void> holder;
+        std::string_view shared;
+        std::shared_ptr<FdHolder> file; // or the pipe
+        bool is_pipe{false};
+        off_t offset{0};
+        std::size_t length{0};
+        std::size_t pos{0}; // bytes already sent
+
+        [[nodiscard]] bool isFile() const noexcept { return file != nullptr; }
+        [[nodiscard]] std::string_view memory() const noexcept
+        {
+            return holder ? shared.substr(pos) : std::string_view(owned).substr(pos);
+        }
+        [[nodiscard]] std::size_t remaining() const noexcept { return length - pos; }
+    };
+
+    std::deque<Segment> segments_;
+    std::size_t size_{0};
+
+    inline static std::size_t zerocopy_min_size_{0};
+    enum class ZeroCopyMode
+    {
+        UNKNOWN, // SO_ZEROCOPY not set yet
+        ENABLED,
+        DISABLED,
+    };
+    ZeroCopyMode zerocopy_mode_{ZeroCopyMode::UNKNOWN};
+    uint32_t zerocopy_next_id_{0}; // the kernel numbers successful MSG_ZEROCOPY sends per socket
+    std::deque<std::pair<uint32_t, std::shared_ptr<const void>>> zerocopy_pending_;
+
+    // turns an owned string into a shared one, so that it can outlive the segment
+    static void share(Segment &segment);
+    // never on TLS: the kTLS ULP answers MSG_ZEROCOPY with EOPNOTSUPP
+    [[nodiscard]] bool isZeroCopyCandidate(const Segment &segment, const TlsStream *tls) const noexcept
+    {
+        return zerocopy_min_size_ != 0 && zerocopy_mode_ != ZeroCopyMode::DISABLED && tls == nullptr &&
+               !segment.isFile() && segment.remaining() >= zerocopy_min_size_;
+    }
+
+    [[nodiscard]] long sendMemory(int socket_fd, const TlsStream *tls);
+    [[nodiscard]] long sendZeroCopy(int socket_fd);
+    [[nodiscard]] long sendFile(int socket_fd);
+    [[nodiscard]] long sendPipe(int socket_fd);
+    [[nodiscard]] long sendTls(TlsStream &tls);
+    void consume(std::size_t bytes);
+};
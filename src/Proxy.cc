@@ -0,0 +1,271 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <string>
+#include <string_view>
+
+#include <cerrno>
+#include <cstring>
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+
+#include "./Proxy.h"
+#include "./Logger.h"
+#include "./util/FdHolder.h"
+
+bool Proxy::parseAddress(const std::string &name, sockaddr_storage &addr, socklen_t &addr_len)
+{
+    std::memset(&addr, 0, sizeof(addr));
+    static constexpr std::string_view kUnixPrefix = "unix:";
+    if (name.compare(0, kUnixPrefix.size(), kUnixPrefix) == 0)
+    {
+        auto &un = reinterpret_cast<sockaddr_un &>(addr);
+        const auto path = std::string_view(name).substr(kUnixPrefix.size());
+        if (path.empty() || path.size() >= sizeof(un.sun_path))
+            return false;
+        un.sun_family = AF_UNIX;
+        path.copy(un.sun_path, path.size());
+        addr_len = offsetof(sockaddr_un, sun_path) + path.size() + 1;
+        return true;
+    }
+
+    const auto colon = name.rfind(':');
+    if (colon == std::string::npos || colon == 0 || colon + 1 == name.size())
+        return false;
+    std::string host = name.substr(0, colon);
+    if (host.front() == '[' && host.back() == ']')
+        host = host.substr(1, host.size() - 2);
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *result = nullptr;
+    if (const int retval = getaddrinfo(host.c_str(), name.c_str() + colon + 1, &hints, &result); retval != 0)
+    {
+        LOG_ERROR("Failed to resolve upstream ", name, ", reason: ", gai_strerror(retval));
+        return false;
+    }
+    std::memcpy(&addr, result->ai_addr, result->ai_addrlen);
+    addr_len = result->ai_addrlen;
+    freeaddrinfo(result);
+    return true;
+}
+
+int Proxy::findOrAddUpstream(const std::string &name)
+{
+    for (std::size_t i = 0; i < upstreams_.size(); i++)
+        if (upstreams_[i]->name == name)
+            return i;
+    auto upstream = std::make_unique<Upstream>();
+    if (!parseAddress(name, upstream->addr, upstream->addr_len))
+        return -1;
+    upstream->name = name;
+    upstreams_.push_back(std::move(upstream));
+    return upstreams_.size() - 1;
+}
+
+bool Proxy::addRoute(std::string_view prefix, const std::vector<std::string> &upstreams)
+{
+    if (prefix.empty() || prefix.front() != '/' || upstreams.empty())
+    {
+        LOG_ERROR("Proxy prefix must start with '/' and have upstreams, prefix = ", prefix);
+        return false;
+    }
+    Route route;
+    route.prefix = std::string(prefix);
+    for (const auto &name : upstreams)
+    {
+        const int index = findOrAddUpstream(name);
+        if (index == -1)
+        {
+            LOG_ERROR("Invalid upstream address ", name, " for ", prefix);
+            return false;
+        }
+        route.upstreams.push_back(index);
+    }
+    routes_.push_back(std::move(route));
+    // the longest prefix is found first
+    std::stable_sort(routes_.begin(), routes_.end(), [](const Route &lhs, const Route &rhs)
+                     { return lhs.prefix.size() > rhs.prefix.size(); });
+    return true;
+}
+
+void Proxy::setHealthCheck(std::string path, int interval_ms)
+{
+    health_path_ = std::move(path);
+    health_interval_ms_ = interval_ms;
+}
+
+void Proxy::start()
+{
+    if (upstreams_.empty() || is_running_)
+        return;
+    is_running_ = true;
+    health_thread_ = std::thread([this]()
+                                 { checkHealth(); });
+}
+
+void Proxy::stop()
+{
+    {
+        const std::lock_guard lock(health_mutex_);
+        if (!is_running_)
+            return;
+        is_running_ = false;
+    }
+    health_cv_.notify_all();
+    health_thread_.join();
+}
+
+const Proxy::Route *Proxy::match(std::string_view url) const noexcept
+{
+    for (const auto &route : routes_)
+        if (url.substr(0, route.prefix.size()) == route.prefix)
+            return &route;
+    return nullptr;
+}
+
+int Proxy::pick(const Route &route, int skip) noexcept
+{
+    const auto count = route.upstreams.size();
+    const auto start = next_.fetch_add(1, std::memory_order_relaxed);
+    int best = -1, best_outstanding = 0;
+    bool is_best_healthy = false;
+    for (std::size_t i = 0; i < count; i++)
+    {
+        const int index = route.upstreams[(start + i) % count];
+        if (index == skip && count > 1)
+            continue;
+        const auto &candidate = *upstreams_[index];
+        const bool is_healthy = candidate.is_healthy.load(std::memory_order_relaxed);
+        const int outstanding = candidate.outstanding.load(std::memory_order_relaxed);
+        if (best == -1 || (is_healthy && !is_best_healthy) ||
+            (is_healthy == is_best_healthy && outstanding < best_outstanding))
+        {
+            best = index;
+            best_outstanding = outstanding;
+            is_best_healthy = is_healthy;
+        }
+    }
+    return best;
+}
+
+void Proxy::markDown(int index)
+{
+    auto &upstream = *upstreams_[index];
+    upstream.failures.fetch_add(1, std::memory_order_relaxed);
+    if (upstream.is_healthy.exchange(false, std::memory_order_relaxed))
+        LOG_WARNING("Upstream ", upstream.name, " is down, connect failed");
+}
+
+int Proxy::connectNonBlocking(const sockaddr_storage &addr, socklen_t addr_len)
+{
+    const int fd = ::socket(addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+    {
+        LOG_ERROR("Failed to create upstream socket, reason: ", logErrStr(errno));
+        return -1;
+    }
+    if (addr.ss_family != AF_UNIX)
+    {
+        const int on = 1;
+        ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+    if (::connect(fd, reinterpret_cast<const sockaddr *>(&addr), addr_len) == -1 && errno != EINPROGRESS)
+    {
+        // a Unix socket with a full backlog answers EAGAIN, which counts as down too
+        const int saved_errno = errno;
+        ::close(fd);
+        errno = saved_errno;
+        return -1;
+    }
+    return fd;
+}
+
+int Proxy::connectTo(int index) const
+{
+    const auto &upstream = *upstreams_[index];
+    const int fd = connectNonBlocking(upstream.addr, upstream.addr_len);
+    if (fd == -1)
+        LOG_DEBUG("Failed to connect to upstream ", upstream.name, ", reason: ", logErrStr(errno));
+    return fd;
+}
+
+bool Proxy::probe(int index) const
+{
+    const auto &upstream = *upstreams_[index];
+    const FdHolder fd(::socket(upstream.addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0));
+    if (fd.fd() == -1)
+        return false;
+    const timeval timeout{1, 0};
+    ::setsockopt(fd.fd(), SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    ::setsockopt(fd.fd(), SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (::connect(fd.fd(), reinterpret_cast<const sockaddr *>(&upstream.addr), upstream.addr_len) == -1)
+        return false;
+    if (health_path_.empty())
+        return true;
+
+    const std::string request = logstr("GET ", health_path_, " HTTP/1.1\r\nHost: ", upstream.name, "\r\nConnection: close\r\n\r\n");
+    if (::send(fd.fd(), request.data(), request.size(), MSG_NOSIGNAL) != static_cast<long>(request.size()))
+        return false;
+    std::array<char, 16> status_line;
+    std::size_t received = 0;
+    while (received < status_line.size())
+    {
+        const long retval = ::recv(fd.fd(), status_line.data() + received, status_line.size() - received, 0);
+        if (retval <= 0)
+            break;
+        received += retval;
+    }
+    // "HTTP/1.1 200 "
+    const std::string_view status(status_line.data(), received);
+    return status.size() >= 12 && status.compare(0, 5, "HTTP/") == 0 && (status[9] == '2' || status[9] == '3');
+}
+
+void Proxy::checkHealth()
+{
+    std::unique_lock lock(health_mutex_);
+    while (is_running_)
+    {
+        lock.unlock();
+        for (std::size_t i = 0; i < upstreams_.size(); i++)
+        {
+            const bool is_healthy = probe(i);
+            if (upstreams_[i]->is_healthy.exchange(is_healthy, std::memory_order_relaxed) != is_healthy)
+            {
+                if (is_healthy)
+                    LOG_INFO("Upstream ", upstreams_[i]->name, " is up");
+                else
+                    LOG_WARNING("Upstream ", upstreams_[i]->name, " is down, health check failed");
+            }
+        }
+        lock.lock();
+        health_cv_.wait_for(lock, std::chrono::milliseconds(health_interval_ms_), [this]()
+                            { return !is_running_; });
+    }
+}
+
+std::string Proxy::report() const
+{
+    std::string res;
+    for (const auto &upstream : upstreams_)
+    {
+        const auto requests = upstream->requests.load(std::memory_order_relaxed);
+        const auto reuses = upstream->reuses.load(std::memory_order_relaxed);
+        res.append(logstr("proxy upstream=", upstream->name,
+                          " healthy=", upstream->is_healthy.load(std::memory_order_relaxed),
+                          " outstanding=", upstream->outstanding.load(std::memory_order_relaxed),
+                          " requests=", requests,
+                          " connects=", upstream->connects.load(std::memory_order_relaxed),
+                          " reuses=", reuses,
+                          " reuse_ratio=", requests ? static_cast<double>(reuses) / requests : 0.0,
+                          " retries=", upstream->retries.load(std::memory_order_relaxed),
+                          " failures=", upstream->failures.load(std::memory_order_relaxed), "\n"));
+    }
+    return res;
+}
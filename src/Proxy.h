@@ -0,0 +1,109 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <cinttypes>
+
+#include <sys/socket.h>
+
+#include "./util/Singleton.h"
+
+// Reverse proxy setup shared by the workers: URL prefixes forwarded to
+// groups of upstream HTTP/1.1 servers (TCP or Unix socket), the upstreams'
+// health and counters. Each worker keeps its own connections to them, see
+// UpstreamPool.h; a request is forwarded by ProxyExchange.h.
+//
+// A request goes to the upstream with the fewest outstanding requests among
+// the healthy ones of its prefix. A health check thread probes every
+// upstream each interval, with a TCP connect or a GET of the health path
+// that must answer 2xx or 3xx; a failed connect of a request also marks the
+// upstream down until the next good probe. When all upstreams of a prefix
+// are down the least loaded one is tried anyway.
+class Proxy : public Singleton<Proxy>
+{
+public:
+    struct Upstream
+    {
+        std::string name; // as configured, "127.0.0.1:9000" or "unix:/run/app.sock"
+        sockaddr_storage addr;
+        socklen_t addr_len;
+
+        std::atomic<int> outstanding{0};
+        std::atomic_bool is_healthy{true};
+
+        // statistics
+        std::atomic<uint64_t> requests{0};
+        std::atomic<uint64_t> connects{0};
+        std::atomic<uint64_t> reuses{0};
+        std::atomic<uint64_t> retries{0};
+        std::atomic<uint64_t> failures{0};
+    };
+
+    struct Route
+    {
+        std::string prefix;
+        std::vector<int> upstreams;
+    };
+
+    // false (logged) if an upstream address cannot be resolved
+    bool addRoute(std::string_view prefix, const std::vector<std::string> &upstreams);
+    // "" probes with a TCP connect
+    void setHealthCheck(std::string path, int interval_ms);
+    // idle connections each worker keeps open to each upstream
+    void setMinIdle(int count) noexcept { min_idle_ = count; }
+    [[nodiscard]] int minIdle() const noexcept { return min_idle_; }
+    // between two reads or writes of the upstream connection
+    void setTimeout(int ms) noexcept { timeout_ms_ = ms; }
+    [[nodiscard]] int timeout() const noexcept { return timeout_ms_; }
+
+    // starts the health checks
+    void start();
+    void stop();
+    [[nodiscard]] bool empty() const noexcept { return routes_.empty(); }
+
+    // the route with the longest prefix of url, nullptr if none
+    [[nodiscard]] const Route *match(std::string_view url) const noexcept;
+    // the upstream for the next request of route, other than skip if there is another
+    [[nodiscard]] int pick(const Route &route, int skip = -1) noexcept;
+    [[nodiscard]] Upstream &upstream(int index) noexcept { return *upstreams_[index]; }
+    [[nodiscard]] std::size_t upstreamCount() const noexcept { return upstreams_.size(); }
+    // a request could not connect
+    void markDown(int index);
+
+    // a nonblocking socket connecting to the upstream, -1 on errors
+    [[nodiscard]] int connectTo(int index) const;
+
+    [[nodiscard]] std::string report() const;
+
+    // "unix:/path", "host:port" or "[v6]:port", FastCGI backends are named the same way
+    [[nodiscard]] static bool parseAddress(const std::string &name, sockaddr_storage &addr, socklen_t &addr_len);
+    // a nonblocking socket connecting to addr, -1 on errors
+    [[nodiscard]] static int connectNonBlocking(const sockaddr_storage &addr, socklen_t addr_len);
+
+private:
+    std::vector<Route> routes_;
+    std::vector<std::unique_ptr<Upstream>> upstreams_;
+    std::atomic<unsigned> next_{0}; // where pick() starts, spreads ties
+
+    int min_idle_{2};
+    int timeout_ms_{60000};
+
+    std::string health_path_;
+    int health_interval_ms_{2000};
+    std::thread health_thread_;
+    std::mutex health_mutex_;
+    std::condition_variable health_cv_;
+    bool is_running_{false};
+
+    // the upstream's index, adding it if it is new, -1 if name is no address
+    int findOrAddUpstream(const std::string &name);
+    void checkHealth();
+    [[nodiscard]] bool probe(int index) const;
+};
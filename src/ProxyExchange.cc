@@ -0,0 +1,501 @@
+#include <algorithm>
+#include <array>
+#include <string>
+#include <string_view>
+
+#include <cerrno>
+#include <cstdlib>
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "./ProxyExchange.h"
+#include "./HttpParser.h"
+#include "./OutputBuffer.h"
+#include "./RequestBody.h"
+#include "./Logger.h"
+#include "./util/utils.h"
+#include "./util/Ascii.h"
+
+// connection specific, RFC 9110 sec 7.6.1; Transfer-Encoding and Content-Length are set again
+static bool isHopByHop(std::string_view name)
+{
+    static constexpr std::string_view kNames[] = {"Connection", "Keep-Alive", "Proxy-Connection", "TE",
+                                                  "Transfer-Encoding", "Upgrade", "Content-Length", "Expect"};
+    for (const auto kName : kNames)
+        if (equalsIgnoreCase(name, kName))
+            return true;
+    return false;
+}
+
+ProxyExchange::~ProxyExchange()
+{
+    if (connection_.fd != -1)
+        finish(false);
+}
+
+void ProxyExchange::start(const HttpParser &request, const RequestBody &body, std::string_view client_addr,
+                          bool is_https, std::string_view client_keep_alive, bool can_splice)
+{
+    const auto method = request.method();
+    is_idempotent_ = method != HttpMethod::POST && method != HttpMethod::PATCH && method != HttpMethod::CONNECT;
+    is_head_request_ = method == HttpMethod::HEAD;
+    is_client_http11_ = request.version() == HttpVersion::HTTP11;
+    is_client_keep_alive_ = !client_keep_alive.empty();
+    client_keep_alive_.assign(client_keep_alive);
+    can_splice_ = can_splice;
+    body_ = &body;
+
+    request_head_.assign(kHttpMethodStr[static_cast<int>(method)]).append(" ").append(request.url());
+    if (request.hasQuery())
+        request_head_.append("?").append(request.query());
+    request_head_.append(" HTTP/1.1\r\n");
+
+    const auto connection = request.header(HttpHeader::CONNECTION);
+    std::string_view forwarded_for;
+    const auto appendHeader = [this, connection, &forwarded_for](std::string_view name, std::string_view value)
+    {
+        if (isHopByHop(name) || HttpParser::hasToken(connection, name))
+            return;
+        if (equalsIgnoreCase(name, "X-Forwarded-For"))
+        {
+            forwarded_for = value;
+            return;
+        }
+        request_head_.append(name).append(": ").append(value).append("\r\n");
+    };
+    request.forEachHeader(appendHeader);
+    request_head_.append("X-Forwarded-For: ");
+    if (!forwarded_for.empty())
+        request_head_.append(forwarded_for).append(", ");
+    request_head_.append(client_addr).append("\r\nX-Forwarded-Proto: ").append(is_https ? "https" : "http").append("\r\n");
+    if (body.size() != 0 || method == HttpMethod::POST || method == HttpMethod::PUT || method == HttpMethod::PATCH)
+        request_head_.append("Content-Length: ").append(lexicalCast(body.size())).append("\r\n");
+    request_head_.append("\r\n");
+}
+
+ProxyExchange::Result ProxyExchange::resume(OutputBuffer &output)
+{
+    while (true)
+    {
+        Result res;
+        switch (state_)
+        {
+        case State::CONNECT:
+        case State::CONNECTING:
+            res = connect();
+            break;
+        case State::SEND:
+            res = send();
+            break;
+        case State::RECEIVE_HEAD:
+            res = receiveHead(output);
+            break;
+        case State::RECEIVE_BODY:
+            res = receiveBody(output);
+            break;
+        default:
+            return Result::DONE;
+        }
+        // WAIT_CLIENT with an empty output is not a wait, the next state runs
+        if (res != Result::WAIT_CLIENT || !output.empty())
+            return res;
+    }
+}
+
+ProxyExchange::Result ProxyExchange::waitFor(uint32_t events)
+{
+    wait_events_ = events;
+    return Result::WAIT_UPSTREAM;
+}
+
+ProxyExchange::Result ProxyExchange::connect()
+{
+    auto &proxy = Proxy::instance();
+    if (state_ == State::CONNECTING)
+    {
+        int error = 0;
+        socklen_t error_len = sizeof(error);
+        if (::getsockopt(connection_.fd, SOL_SOCKET, SO_ERROR, &error, &error_len) == -1 || error != 0)
+        {
+            LOG_DEBUG("Failed to connect to upstream ", proxy.upstream(connection_.upstream).name, ", reason: ", logErrStr(error));
+            proxy.markDown(connection_.upstream);
+            return retryOrFail(true);
+        }
+        state_ = State::SEND;
+        return Result::WAIT_CLIENT;
+    }
+
+    const int upstream = proxy.pick(route_, failed_upstream_);
+    connection_ = pool_.acquire(upstream, client_fd_);
+    auto &counters = proxy.upstream(upstream);
+    counters.outstanding.fetch_add(1, std::memory_order_relaxed);
+    if (connection_.fd == -1)
+    {
+        connection_.upstream = upstream;
+        proxy.markDown(upstream);
+        return retryOrFail(true);
+    }
+    counters.requests.fetch_add(1, std::memory_order_relaxed);
+    if (connection_.is_reused)
+        counters.reuses.fetch_add(1, std::memory_order_relaxed);
+    sent_ = 0;
+    if (connection_.is_connecting)
+    {
+        state_ = State::CONNECTING;
+        return waitFor(EPOLLOUT);
+    }
+    state_ = State::SEND;
+    return Result::WAIT_CLIENT;
+}
+
+ProxyExchange::Result ProxyExchange::send()
+{
+    const uint64_t total = request_head_.size() + body_->size();
+    while (sent_ < total)
+    {
+        long retval;
+        if (sent_ < request_head_.size())
+        {
+            // the head and a body in memory in one call
+            std::array<iovec, 2> iov{{{request_head_.data() + sent_, request_head_.size() - sent_},
+                                      {const_cast<char *>(body_->memory().data()), body_->isSpilled() ? 0 : body_->memory().size()}}};
+            msghdr msg{};
+            msg.msg_iov = iov.data();
+            msg.msg_iovlen = iov.size();
+            retval = ::sendmsg(connection_.fd, &msg, MSG_NOSIGNAL);
+        }
+        else if (!body_->isSpilled())
+        {
+            const auto memory = body_->memory().substr(sent_ - request_head_.size());
+            retval = ::send(connection_.fd, memory.data(), memory.size(), MSG_NOSIGNAL);
+        }
+        else
+        {
+            off_t offset = sent_ - request_head_.size();
+            retval = ::sendfile(connection_.fd, body_->fd(), &offset, total - sent_);
+            if (retval == 0)
+                errno = EIO; // the spill file is shorter than the body
+        }
+
+        if (retval <= 0)
+        {
+            if (retval == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                return waitFor(EPOLLOUT);
+            LOG_DEBUG("Failed to send to upstream, reason: ", logErrStr(errno));
+            // a reused connection the upstream closed meanwhile did not take the request
+            return retryOrFail(connection_.is_reused && errno != EIO);
+        }
+        sent_ += retval;
+    }
+    state_ = State::RECEIVE_HEAD;
+    buffer_.clear();
+    return waitFor(EPOLLIN);
+}
+
+ProxyExchange::Result ProxyExchange::receiveHead(OutputBuffer &output)
+{
+    while (true)
+    {
+        const auto head_end = buffer_.find("\r\n\r\n");
+        if (head_end != std::string::npos)
+        {
+            // "HTTP/1.1 200 OK"
+            const std::string_view status_line(buffer_.data(), buffer_.find("\r\n"));
+            const int status = status_line.size() >= 12 && status_line.compare(0, 7, "HTTP/1.") == 0 ? std::atoi(buffer_.c_str() + 9) : 0;
+            if (status >= 100 && status < 200 && status != 101)
+            {
+                // interim response, the final one follows
+                buffer_.erase(0, head_end + 4);
+                continue;
+            }
+            if (status < 200 || status > 999 || !forwardHead(head_end + 4, status, output))
+            {
+                LOG_WARNING("Invalid response head from upstream ", Proxy::instance().upstream(connection_.upstream).name);
+                finish(false);
+                error_status_ = HttpStatusCode::BAD_GATEWAY;
+                return Result::FAILED;
+            }
+            state_ = State::RECEIVE_BODY;
+            return Result::WAIT_CLIENT;
+        }
+        if (buffer_.size() >= kMaxHeadSize)
+        {
+            LOG_WARNING("Response head from upstream ", Proxy::instance().upstream(connection_.upstream).name, " is too long");
+            finish(false);
+            return Result::FAILED;
+        }
+
+        const auto prev_size = buffer_.size();
+        buffer_.resize(std::min(kMaxHeadSize, prev_size + 4096));
+        const long retval = ::recv(connection_.fd, buffer_.data() + prev_size, buffer_.size() - prev_size, 0);
+        buffer_.resize(prev_size + std::max(retval, 0l));
+        if (retval == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return waitFor(EPOLLIN);
+        if (retval <= 0)
+        {
+            LOG_DEBUG("Upstream closed before its response, reason: ", retval == 0 ? "EOF" : logErrStr(errno));
+            // the request of a reused connection may have crossed the upstream closing it
+            return retryOrFail(connection_.is_reused && prev_size == 0 && is_idempotent_);
+        }
+    }
+}
+
+bool ProxyExchange::forwardHead(std::size_t head_length, int status, OutputBuffer &output)
+{
+    const std::string_view head(buffer_.data(), head_length - 2);
+    const bool is_upstream_http11 = head[7] == '1';
+    bool is_upstream_keep_alive = is_upstream_http11;
+    bool is_chunked = false, is_other_coding = false;
+    long long content_length = -1;
+
+    auto lines = head.substr(head.find("\r\n") + 2);
+    std::string out_head = std::string("HTTP/1.1").append(head.substr(8, head.find("\r\n") - 8)).append("\r\n");
+    while (!lines.empty())
+    {
+        const auto line = lines.substr(0, lines.find("\r\n"));
+        lines.remove_prefix(std::min(lines.size(), line.size() + 2));
+        const auto colon = line.find(':');
+        if (colon == std::string_view::npos || colon == 0)
+            return false;
+        const auto name = line.substr(0, colon);
+        auto value = line.substr(colon + 1);
+        while (!value.empty() && (value.front() == ' ' || value.front() == '\t'))
+            value.remove_prefix(1);
+
+        if (equalsIgnoreCase(name, "Connection"))
+        {
+            if (HttpParser::hasToken(value, "close"))
+                is_upstream_keep_alive = false;
+            else if (HttpParser::hasToken(value, "keep-alive"))
+                is_upstream_keep_alive = true;
+        }
+        else if (equalsIgnoreCase(name, "Transfer-Encoding"))
+        {
+            const auto last = value.substr(value.rfind(',') == std::string_view::npos ? 0 : value.rfind(',') + 1);
+            if (HttpParser::hasToken(last, "chunked"))
+                is_chunked = true;
+            else
+                is_other_coding = true;
+        }
+        else if (equalsIgnoreCase(name, "Content-Length"))
+        {
+            char *end;
+            const auto length = std::strtoll(value.data(), &end, 10);
+            if (end == value.data() || length < 0 || (content_length != -1 && content_length != length))
+                return false;
+            content_length = length;
+            if (is_head_request_)
+                out_head.append(line).append("\r\n");
+        }
+        else if (!isHopByHop(name))
+            out_head.append(line).append("\r\n");
+    }
+
+    const auto leftover = buffer_.size() - head_length;
+    if (is_head_request_ || status == 204 || status == 304)
+    {
+        body_mode_ = BodyMode::NONE;
+        if (leftover != 0)
+            is_upstream_keep_alive = false;
+    }
+    else if (is_chunked && !is_other_coding)
+    {
+        body_mode_ = BodyMode::CHUNKED;
+        chunked_decoder_.clear(UINT64_MAX);
+        if (is_client_http11_)
+            out_head.append("Transfer-Encoding: chunked\r\n");
+        else
+            is_client_keep_alive_ = false; // decoded, the end is the close
+    }
+    else if (content_length != -1 && !is_chunked && !is_other_coding)
+    {
+        body_mode_ = BodyMode::LENGTH;
+        body_left_ = content_length;
+        out_head.append("Content-Length: ").append(lexicalCast(content_length)).append("\r\n");
+    }
+    else
+    {
+        body_mode_ = BodyMode::UNTIL_CLOSE;
+        is_upstream_keep_alive = false;
+        is_client_keep_alive_ = false;
+    }
+    is_upstream_reusable_ = is_upstream_keep_alive;
+    if (is_client_keep_alive_)
+        out_head.append("Connection: keep-alive\r\nKeep-Alive: ").append(client_keep_alive_).append("\r\n\r\n");
+    else
+        out_head.append("Connection: close\r\n\r\n");
+    output.append(std::move(out_head));
+    buffer_.erase(0, head_length);
+    return true;
+}
+
+ProxyExchange::Result ProxyExchange::receiveBody(OutputBuffer &output)
+{
+    if (!buffer_.empty() || body_mode_ == BodyMode::NONE || (body_mode_ == BodyMode::LENGTH && body_left_ == 0))
+    {
+        // what came with the head, or the end of a response without a body
+        std::string data = std::move(buffer_);
+        buffer_.clear();
+        if (!forwardBody(data, output))
+        {
+            finish(false);
+            return Result::ABORTED;
+        }
+    }
+
+    while (true)
+    {
+        if (state_ == State::DONE)
+            return Result::DONE;
+        if (output.size() >= kMaxBuffered)
+            return Result::WAIT_CLIENT;
+
+        if (body_mode_ == BodyMode::LENGTH && can_splice_ && body_left_ >= kSpliceMinSize)
+        {
+            // the pipe is empty once the output is sent
+            if (!output.empty())
+                return Result::WAIT_CLIENT;
+            long moved;
+            if (!splice(output, moved))
+            {
+                finish(false);
+                return Result::ABORTED;
+            }
+            if (moved == -1)
+                return waitFor(EPOLLIN);
+            body_left_ -= moved;
+            if (body_left_ == 0)
+                finish(is_upstream_reusable_);
+            continue;
+        }
+
+        thread_local std::array<char, 16 * 1024> chunk;
+        std::size_t want = chunk.size();
+        if (body_mode_ == BodyMode::LENGTH)
+            want = std::min<uint64_t>(want, body_left_);
+        const long retval = ::recv(connection_.fd, chunk.data(), want, 0);
+        if (retval == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return waitFor(EPOLLIN);
+        if (retval == 0 && body_mode_ == BodyMode::UNTIL_CLOSE)
+        {
+            finish(false);
+            continue;
+        }
+        if (retval <= 0)
+        {
+            LOG_DEBUG("Upstream response broke off, reason: ", retval == 0 ? "EOF" : logErrStr(errno));
+            finish(false);
+            return Result::ABORTED;
+        }
+        if (!forwardBody(std::string_view(chunk.data(), retval), output))
+        {
+            finish(false);
+            return Result::ABORTED;
+        }
+    }
+}
+
+bool ProxyExchange::forwardBody(std::string_view data, OutputBuffer &output)
+{
+    switch (body_mode_)
+    {
+    case BodyMode::NONE:
+        finish(is_upstream_reusable_ && data.empty());
+        return true;
+    case BodyMode::LENGTH:
+    {
+        const auto length = std::min<uint64_t>(body_left_, data.size());
+        output.append(std::string(data.substr(0, length)));
+        body_left_ -= length;
+        if (body_left_ == 0)
+            finish(is_upstream_reusable_ && length == data.size());
+        return true;
+    }
+    case BodyMode::CHUNKED:
+    {
+        std::string_view in = data;
+        std::string decoded;
+        const auto result = chunked_decoder_.decode(in, decoded);
+        if (result == ChunkedDecoder::Result::ERROR || result == ChunkedDecoder::Result::TOO_LARGE)
+        {
+            LOG_WARNING("Invalid chunked body from upstream ", Proxy::instance().upstream(connection_.upstream).name);
+            return false;
+        }
+        // HTTP/1.1 clients get the chunks as they are
+        output.append(is_client_http11_ ? std::string(data.substr(0, data.size() - in.size())) : std::move(decoded));
+        if (result == ChunkedDecoder::Result::DONE)
+            finish(is_upstream_reusable_ && in.empty());
+        return true;
+    }
+    case BodyMode::UNTIL_CLOSE:
+        output.append(std::string(data));
+        return true;
+    }
+    return true;
+}
+
+bool ProxyExchange::splice(OutputBuffer &output, long &moved)
+{
+    if (!pipe_read_)
+    {
+        int fds[2];
+        if (pipe2(fds, O_CLOEXEC | O_NONBLOCK) == -1)
+        {
+            LOG_ERROR("pipe2 failed, reason: ", logErrStr(errno));
+            return false;
+        }
+        pipe_read_ = std::make_shared<FdHolder>(fds[0]);
+        pipe_write_ = std::make_unique<FdHolder>(fds[1]);
+    }
+    moved = ::splice(connection_.fd, nullptr, pipe_write_->fd(), nullptr, std::min<uint64_t>(body_left_, kPipeSize),
+                     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (moved > 0)
+    {
+        output.appendPipe(pipe_read_, moved);
+        return true;
+    }
+    if (moved == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return true;
+    LOG_DEBUG("Upstream response broke off, reason: ", moved == 0 ? "EOF" : logErrStr(errno));
+    return false;
+}
+
+ProxyExchange::Result ProxyExchange::retryOrFail(bool is_retryable)
+{
+    auto &proxy = Proxy::instance();
+    const int upstream = connection_.upstream;
+    const bool is_connect_failure = state_ == State::CONNECT || state_ == State::CONNECTING;
+    finish(false);
+    if (is_retryable && ++attempts_ < kMaxAttempts)
+    {
+        proxy.upstream(upstream).retries.fetch_add(1, std::memory_order_relaxed);
+        // a connect failure goes to another upstream, a stale connection to a new one
+        failed_upstream_ = is_connect_failure ? upstream : -1;
+        state_ = State::CONNECT;
+        return Result::WAIT_CLIENT;
+    }
+    proxy.upstream(upstream).failures.fetch_add(1, std::memory_order_relaxed);
+    error_status_ = HttpStatusCode::BAD_GATEWAY;
+    return Result::FAILED;
+}
+
+void ProxyExchange::finish(bool is_reusable)
+{
+    state_ = State::DONE;
+    if (connection_.upstream == -1)
+        return;
+    Proxy::instance().upstream(connection_.upstream).outstanding.fetch_sub(1, std::memory_order_relaxed);
+    if (connection_.fd != -1)
+    {
+        if (is_reusable)
+            pool_.release(connection_);
+        else
+            pool_.discard(connection_);
+    }
+    connection_ = UpstreamPool::Connection();
+}
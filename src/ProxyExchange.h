@@ -0,0 +1,134 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include <cinttypes>
+
+#include "./ChunkedDecoder.h"
+#include "./HttpTypes.h"
+#include "./Proxy.h"
+#include "./UpstreamPool.h"
+#include "./util/FdHolder.h"
+#include "./util/Noncopyable.h"
+
+class HttpParser;
+class OutputBuffer;
+class RequestBody;
+
+// One request forwarded to an upstream and its response streamed back. The
+// HttpContext drives it from the pool threads: resume() moves it on until
+// it has to wait, for the upstream (the context arms the connection once its
+// output is sent) or for the client to take the buffered output; only one of
+// the two sockets is armed at a time.
+//
+// The request body was received whole by the context (memory, or the spill
+// file, which goes out with sendfile). The response is forwarded as it
+// arrives: Content-Length bodies through a pipe with splice when the client
+// socket allows it, chunked bodies as they are for HTTP/1.1 clients and
+// decoded for HTTP/1.0 ones, bodies ended by close with Connection: close.
+// A reused connection the upstream closed meanwhile is retried once on a new
+// one, as is a connect failure on another upstream.
+class ProxyExchange : NonCopyable
+{
+public:
+    enum class Result
+    {
+        WAIT_UPSTREAM, // armUpstream() once the output is sent
+        WAIT_CLIENT,   // resume() once the output is sent
+        DONE,          // the whole response is in the output
+        FAILED,        // nothing went to the client, answer with errorStatus()
+        ABORTED,       // the response broke off, close the client
+    };
+
+    ProxyExchange(UpstreamPool &pool, const Proxy::Route &route, int client_fd)
+        : pool_(pool), route_(route), client_fd_(client_fd) {}
+    ~ProxyExchange();
+
+    // body is complete and stays valid until the exchange ends; client_keep_alive is the
+    // Keep-Alive value of the response, empty if the client connection closes after it;
+    // can_splice if the client socket takes pipe segments (plain or kTLS)
+    void start(const HttpParser &request, const RequestBody &body, std::string_view client_addr,
+               bool is_https, std::string_view client_keep_alive, bool can_splice);
+    [[nodiscard]] Result resume(OutputBuffer &output);
+    [[nodiscard]] bool armUpstream() { return pool_.arm(connection_, wait_events_); }
+
+    // after DONE, false if the response ends with the connection
+    [[nodiscard]] bool isClientKeepAlive() const noexcept { return is_client_keep_alive_; }
+    [[nodiscard]] HttpStatusCode errorStatus() const noexcept { return error_status_; }
+
+private:
+    static constexpr std::size_t kMaxHeadSize = 64 * 1024;
+    // output held for a slow client before the upstream is read again
+    static constexpr std::size_t kMaxBuffered = 256 * 1024;
+    // a Content-Length body with at least this much left is spliced
+    static constexpr uint64_t kSpliceMinSize = 64 * 1024;
+    static constexpr std::size_t kPipeSize = 64 * 1024;
+    static constexpr int kMaxAttempts = 2;
+
+    enum class State
+    {
+        CONNECT,
+        CONNECTING,
+        SEND,
+        RECEIVE_HEAD,
+        RECEIVE_BODY,
+        DONE,
+    };
+
+    enum class BodyMode
+    {
+        NONE,
+        LENGTH,
+        CHUNKED,
+        UNTIL_CLOSE,
+    };
+
+    UpstreamPool &pool_;
+    const Proxy::Route &route_;
+    const int client_fd_;
+    UpstreamPool::Connection connection_;
+    State state_{State::CONNECT};
+    uint32_t wait_events_{0};
+    int attempts_{0};
+    int failed_upstream_{-1};
+    HttpStatusCode error_status_{HttpStatusCode::BAD_GATEWAY};
+
+    bool is_idempotent_{false};
+    bool is_head_request_{false};
+    bool is_client_http11_{true};
+    bool is_client_keep_alive_{false};
+    std::string client_keep_alive_;
+    bool can_splice_{false};
+
+    std::string request_head_;
+    const RequestBody *body_{nullptr};
+    uint64_t sent_{0}; // of request_head_ and the body
+
+    std::string buffer_; // the response head, then body bytes that came with it
+    BodyMode body_mode_{BodyMode::NONE};
+    uint64_t body_left_{0};
+    ChunkedDecoder chunked_decoder_;
+    bool is_upstream_reusable_{false};
+
+    // upstream -> pipe -> client, made for the first body large enough
+    std::shared_ptr<FdHolder> pipe_read_;
+    std::unique_ptr<FdHolder> pipe_write_;
+
+    [[nodiscard]] Result connect();
+    [[nodiscard]] Result send();
+    [[nodiscard]] Result receiveHead(OutputBuffer &output);
+    [[nodiscard]] Result receiveBody(OutputBuffer &output);
+    // the response head in buffer_ ends at head_length, false if it is malformed
+    [[nodiscard]] bool forwardHead(std::size_t head_length, int status, OutputBuffer &output);
+    // body bytes from the upstream, false if they are malformed
+    [[nodiscard]] bool forwardBody(std::string_view data, OutputBuffer &output);
+    [[nodiscard]] bool splice(OutputBuffer &output, long &moved);
+
+    [[nodiscard]] Result waitFor(uint32_t events);
+    // the connection failed before a response byte went out: another attempt or FAILED
+    [[nodiscard]] Result retryOrFail(bool is_retryable);
+    // returns the connection to the pool (or closes it) and ends the request at the upstream
+    void finish(bool is_reusable);
+};
@@ -0,0 +1,166 @@
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <ctime>
+
+#include <sys/resource.h>
+
+#include "./RateLimiter.h"
+#include "./HttpResponseBuilder.h"
+#include "./HttpTypes.h"
+#include "./Logger.h"
+#include "./Mime.h"
+#include "./util/utils.h"
+
+static constexpr uint64_t kLimitedBit = uint64_t{1} << 32;
+
+static uint64_t hashAddr(uint32_t addr) noexcept
+{
+    // Fibonacci hashing, the high bits pick the shard and the set
+    return addr * 0x9E3779B97F4A7C15ull;
+}
+
+RateLimiter::RateLimiter()
+{
+    HttpResponseBuilder builder(HttpStatusCode::TOO_MANY_REQUESTS);
+    builder.setDefaultErrorPage(HttpStatusCode::TOO_MANY_REQUESTS);
+    builder.addHeader("Retry-After", lexicalCast(kRetryAfterSeconds))
+        .addHeader("Content-Length", lexicalCast(builder.bodySize()))
+        .addHeader("Content-Type", getMime("html").data())
+        .addHeader("Connection", "close");
+    response_ = builder.build();
+}
+
+bool RateLimiter::start(double rate, double burst, std::size_t max_clients, Action action)
+{
+    if (isEnabled() || rate <= 0 || max_clients == 0)
+        return false;
+
+    rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == -1)
+    {
+        LOG_ERROR("getrlimit failed, reason: ", logErrStr(errno));
+        return false;
+    }
+    peer_count_ = limit.rlim_cur;
+    peers_ = std::make_unique<std::atomic<uint64_t>[]>(peer_count_);
+
+    set_count_ = 1;
+    while (set_count_ * kWays * kShardCount < max_clients)
+        set_count_ <<= 1;
+    for (auto &shard : shards_)
+        shard.sets = std::make_unique<Set[]>(set_count_);
+
+    rate_ = rate;
+    burst_ = std::max(burst, 1.0);
+    action_ = action;
+    LOG_INFO("RateLimiter start, rate = ", rate, "/s, burst = ", burst_, ", clients = ", set_count_ * kWays * kShardCount,
+             ", table memory = ", set_count_ * kShardCount * sizeof(Set));
+    return true;
+}
+
+int64_t RateLimiter::now() noexcept
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec * 1'000'000'000ll + ts.tv_nsec;
+}
+
+bool RateLimiter::acquire(uint32_t addr) noexcept
+{
+    const uint64_t hash = hashAddr(addr);
+    auto &shard = shards_[hash >> 58];
+    const int64_t now_ns = now();
+
+    const std::lock_guard lock(shard.mutex);
+    auto &set = shard.sets[(hash >> 32) & (set_count_ - 1)];
+    int way = -1;
+    for (int i = 0; i < kWays; i++)
+    {
+        if ((set.used & (1u << i)) && set.buckets[i].addr == addr)
+        {
+            way = i;
+            break;
+        }
+    }
+
+    if (way == -1)
+    {
+        if (set.used != 0xff)
+            way = __builtin_ctz(~set.used & 0xffu);
+        else
+        {
+            // CLOCK: clear reference bits until the hand finds an unreferenced bucket
+            while (set.referenced & (1u << set.hand))
+            {
+                set.referenced &= ~(1u << set.hand);
+                set.hand = (set.hand + 1) % kWays;
+            }
+            way = set.hand;
+            set.hand = (set.hand + 1) % kWays;
+            shard.evictions++;
+        }
+        set.used |= 1u << way;
+        set.buckets[way] = Bucket{addr, static_cast<float>(burst_), now_ns};
+    }
+
+    set.referenced |= 1u << way;
+    auto &bucket = set.buckets[way];
+    bucket.tokens = std::min<double>(burst_, bucket.tokens + (now_ns - bucket.refill_ns) * rate_ / 1e9);
+    bucket.refill_ns = now_ns;
+    if (bucket.tokens < 1)
+    {
+        limited_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    bucket.tokens -= 1;
+    allowed_.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+void RateLimiter::setPeer(int fd, uint32_t addr, bool is_limited) noexcept
+{
+    if (static_cast<std::size_t>(fd) < peer_count_)
+        peers_[fd].store(addr | (is_limited ? kLimitedBit : 0), std::memory_order_release);
+}
+
+uint32_t RateLimiter::peerAddr(int fd) const noexcept
+{
+    if (static_cast<std::size_t>(fd) >= peer_count_)
+        return 0;
+    return static_cast<uint32_t>(peers_[fd].load(std::memory_order_acquire));
+}
+
+bool RateLimiter::isPeerLimited(int fd) const noexcept
+{
+    if (static_cast<std::size_t>(fd) >= peer_count_)
+        return false;
+    return peers_[fd].load(std::memory_order_acquire) & kLimitedBit;
+}
+
+void RateLimiter::sendTooManyRequests(int fd) const
+{
+    if (!sendPrebuiltAndDrain(fd, response_))
+        LOG_DEBUG("Failed to send 429 to fd = ", fd, ", reason: ", logErrStr(errno));
+}
+
+std::string RateLimiter::report() const
+{
+    std::size_t clients = 0;
+    uint64_t evictions = 0;
+    for (auto &shard : shards_)
+    {
+        const std::lock_guard lock(shard.mutex);
+        for (std::size_t i = 0; i < set_count_; i++)
+            clients += __builtin_popcount(shard.sets[i].used);
+        evictions += shard.evictions;
+    }
+
+    return logstr("rate_limiter clients=", clients, "/", set_count_ * kWays * kShardCount,
+                  " allowed=", allowed_.load(std::memory_order_relaxed),
+                  " limited=", limited_.load(std::memory_order_relaxed),
+                  " evictions=", evictions, "\n");
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <cinttypes>
+
+#include "./util/Singleton.h"
+
+// Per client IP token buckets. Every connection takes a token at accept,
+// which pays for its first request, and every further request on it takes
+// one more; a client without tokens is answered with a prebuilt 429
+// (Retry-After) or closed silently.
+//
+// The buckets live in a fixed table: kShardCount shards, each locked on its
+// own, made of sets of kWays buckets. An address hashes to one set and is
+// looked up in its kWays slots (two cache lines); a new address takes a free
+// slot or evicts one CLOCK style, so a referenced bucket gets a second
+// chance and an active client keeps its state while a scan of millions of
+// addresses only cycles the idle ones.
+class RateLimiter : public Singleton<RateLimiter>
+{
+public:
+    enum class Action
+    {
+        TOO_MANY_REQUESTS, // 429 and close
+        CLOSE,             // close without a response
+    };
+
+    static constexpr int kShardCount = 64;
+    static constexpr int kWays = 8;
+    static constexpr int kRetryAfterSeconds = 1;
+
+    RateLimiter();
+
+    // rate tokens per second up to burst for each of at least max_clients clients
+    bool start(double rate, double burst, std::size_t max_clients, Action action);
+    [[nodiscard]] bool isEnabled() const noexcept { return rate_ != 0; }
+    [[nodiscard]] Action action() const noexcept { return action_; }
+
+    // takes a token of addr (network byte order), false when the client is over its limit
+    [[nodiscard]] bool acquire(uint32_t addr) noexcept;
+
+    // the acceptors hand the peer address (0 for peers that are not limited) and the accept
+    // verdict to the workers by fd
+    void setPeer(int fd, uint32_t addr, bool is_limited) noexcept;
+    [[nodiscard]] uint32_t peerAddr(int fd) const noexcept;
+    [[nodiscard]] bool isPeerLimited(int fd) const noexcept;
+
+    // the prebuilt 429, after draining what the client sent; the caller closes fd
+    void sendTooManyRequests(int fd) const;
+
+    [[nodiscard]] std::string report() const;
+
+private:
+    struct Bucket
+    {
+        uint32_t addr;
+        float tokens;
+        int64_t refill_ns;
+    };
+
+    struct Set
+    {
+        std::array<Bucket, kWays> buckets;
+        uint8_t used{0};       // bit per way
+        uint8_t referenced{0}; // bit per way, the CLOCK reference bits
+        uint8_t hand{0};
+    };
+
+    struct alignas(64) Shard
+    {
+        mutable std::mutex mutex;
+        std::unique_ptr<Set[]> sets;
+        uint64_t evictions{0};
+    };
+
+    double rate_{0};
+    double burst_{0};
+    Action action_{Action::TOO_MANY_REQUESTS};
+    std::size_t set_count_{0}; // per shard, a power of two
+    std::array<Shard, kShardCount> shards_;
+    std::string response_;
+
+    // fd -> addr | is_limited << 32, sized by RLIMIT_NOFILE
+    std::unique_ptr<std::atomic<uint64_t>[]> peers_;
+    std::size_t peer_count_{0};
+
+    // statistics
+    std::atomic<uint64_t> allowed_{0};
+    std::atomic<uint64_t> limited_{0};
+
+    [[nodiscard]] static int64_t now() noexcept;
+};
@@ -0,0 +1,176 @@
+#include <random>
+#include <string>
+#include <string_view>
+
+#include <cerrno>
+#include <cstdlib>
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "./RequestBody.h"
+#include "./Logger.h"
+#include "./util/utils.h"
+
+// one per pool thread, empty whenever spliceFrom() returns
+struct SplicePipe
+{
+    int fds[2]{-1, -1};
+    ~SplicePipe()
+    {
+        if (fds[0] != -1)
+        {
+            ::close(fds[0]);
+            ::close(fds[1]);
+        }
+    }
+};
+
+static bool writeAll(int fd, std::string_view data)
+{
+    while (!data.empty())
+    {
+        const auto retval = ::write(fd, data.data(), data.size());
+        if (retval == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data.remove_prefix(retval);
+    }
+    return true;
+}
+
+void RequestBody::open(std::string dir, std::size_t memory_limit)
+{
+    clear();
+    dir_ = std::move(dir);
+    memory_limit_ = memory_limit;
+}
+
+void RequestBody::clear()
+{
+    if (file_fd_ != -1)
+        ::close(file_fd_);
+    if (!temp_path_.empty() && ::unlink(temp_path_.c_str()) == -1)
+        LOG_WARNING("Failed to unlink ", temp_path_, ", reason: ", logErrStr(errno));
+    file_fd_ = -1;
+    temp_path_.clear();
+    dir_.clear();
+    memory_ = std::string();
+    memory_limit_ = 0;
+    size_ = 0;
+}
+
+bool RequestBody::spill()
+{
+    file_fd_ = ::open(dir_.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0644);
+    if (file_fd_ == -1 && (errno == EOPNOTSUPP || errno == EISDIR || errno == EINVAL))
+    {
+        // the file system has no O_TMPFILE
+        temp_path_ = dir_ + "/.upload-XXXXXX";
+        file_fd_ = mkostemp(temp_path_.data(), O_CLOEXEC);
+        if (file_fd_ == -1)
+            temp_path_.clear();
+        else if (fchmod(file_fd_, 0644) == -1)
+            LOG_WARNING("Failed to chmod ", temp_path_, ", reason: ", logErrStr(errno));
+    }
+    if (file_fd_ == -1)
+    {
+        LOG_ERROR("Failed to create a body file in ", dir_, ", reason: ", logErrStr(errno));
+        return false;
+    }
+
+    const bool is_written = writeAll(file_fd_, memory_);
+    memory_ = std::string();
+    return is_written;
+}
+
+bool RequestBody::append(std::string_view data)
+{
+    size_ += data.size();
+    if (!isSpilled() && memory_.size() + data.size() <= memory_limit_)
+    {
+        memory_.append(data);
+        return true;
+    }
+    if (!isSpilled() && !spill())
+        return false;
+    if (!writeAll(file_fd_, data))
+    {
+        LOG_ERROR("Failed to write the body file in ", dir_, ", reason: ", logErrStr(errno));
+        return false;
+    }
+    return true;
+}
+
+long RequestBody::spliceFrom(int socket_fd, std::size_t len)
+{
+    thread_local SplicePipe pipe;
+    if (pipe.fds[0] == -1 && pipe2(pipe.fds, O_CLOEXEC | O_NONBLOCK) == -1)
+    {
+        LOG_ERROR("pipe2 failed, reason: ", logErrStr(errno));
+        pipe.fds[0] = pipe.fds[1] = -1;
+        return -1;
+    }
+    if (!isSpilled() && !spill())
+        return -1;
+
+    const long retval = ::splice(socket_fd, nullptr, pipe.fds[1], nullptr, len, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (retval <= 0)
+        return retval;
+
+    for (long left = retval; left > 0;)
+    {
+        const long moved = ::splice(pipe.fds[0], nullptr, file_fd_, nullptr, left, SPLICE_F_MOVE);
+        if (moved <= 0)
+        {
+            const int save = moved == 0 ? EIO : errno;
+            LOG_ERROR("Failed to splice into the body file in ", dir_, ", reason: ", logErrStr(save));
+            // the next connection of this thread gets an empty pipe
+            char buffer[4096];
+            while (::read(pipe.fds[0], buffer, sizeof(buffer)) > 0)
+                ;
+            errno = save;
+            return -1;
+        }
+        left -= moved;
+    }
+    size_ += retval;
+    return retval;
+}
+
+bool RequestBody::linkTo(const std::string &path, bool is_replacing)
+{
+    if (!isSpilled() && !spill())
+        return false;
+
+    if (!temp_path_.empty())
+    {
+        if (is_replacing ? ::rename(temp_path_.c_str(), path.c_str()) == -1
+                         : ::link(temp_path_.c_str(), path.c_str()) == -1 || ::unlink(temp_path_.c_str()) == -1)
+            return false;
+        temp_path_.clear();
+        return true;
+    }
+
+    const std::string fd_path = "/proc/self/fd/" + lexicalCast(file_fd_);
+    if (!is_replacing)
+        return ::linkat(AT_FDCWD, fd_path.c_str(), AT_FDCWD, path.c_str(), AT_SYMLINK_FOLLOW) == 0;
+
+    // linkat does not replace, a name next to path is renamed over it
+    thread_local std::mt19937_64 engine{std::random_device{}()};
+    const std::string link_path = path + ".upload-" + lexicalCast(engine());
+    if (::linkat(AT_FDCWD, fd_path.c_str(), AT_FDCWD, link_path.c_str(), AT_SYMLINK_FOLLOW) == -1)
+        return false;
+    if (::rename(link_path.c_str(), path.c_str()) == -1)
+    {
+        const int save = errno;
+        ::unlink(link_path.c_str());
+        errno = save;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+#include <cinttypes>
+
+#include "./util/Noncopyable.h"
+
+// A request body while it arrives: the first memory_limit bytes in memory,
+// then an unnamed file (O_TMPFILE) in dir that takes those and the rest, so
+// a large upload costs neither memory nor a copy at the end. The handler
+// picks dir and the limit with the request head; a limit of 0 writes to the
+// file system the body ends up in from the first byte, and linkTo() names
+// the file there.
+class RequestBody : NonCopyable
+{
+public:
+    RequestBody() = default;
+    ~RequestBody() { clear(); }
+
+    // nothing is created before data arrives
+    void open(std::string dir, std::size_t memory_limit);
+    [[nodiscard]] bool isOpen() const noexcept { return !dir_.empty(); }
+    void clear();
+
+    // false on write errors, the body is useless then
+    [[nodiscard]] bool append(std::string_view data);
+    // moves up to len bytes socket -> pipe -> file without copying them through user
+    // space; bytes moved, 0 if the peer closed, -1 on errors or with errno EAGAIN
+    [[nodiscard]] long spliceFrom(int socket_fd, std::size_t len);
+
+    [[nodiscard]] uint64_t size() const noexcept { return size_; }
+    [[nodiscard]] std::size_t memoryLimit() const noexcept { return memory_limit_; }
+    [[nodiscard]] bool isSpilled() const noexcept { return file_fd_ != -1; }
+    // the body while it is not spilled
+    [[nodiscard]] std::string_view memory() const noexcept { return memory_; }
+    // the spilled body, positioned at its end
+    [[nodiscard]] int fd() const noexcept { return file_fd_; }
+
+    // names the file path (in dir's file system), replacing a file there if is_replacing,
+    // false with errno set (EEXIST if path exists and !is_replacing)
+    [[nodiscard]] bool linkTo(const std::string &path, bool is_replacing);
+
+private:
+    std::string dir_;
+    std::size_t memory_limit_{0};
+    std::string memory_;
+    int file_fd_{-1};
+    // without O_TMPFILE support the file is named, and unlinked by clear() unless linked
+    std::string temp_path_;
+    uint64_t size_{0};
+
+    // moves memory_ to a new file
+    [[nodiscard]] bool spill();
+};
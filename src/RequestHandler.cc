@@ -0,0 +1,697 @@
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <cerrno>
+#include <cassert>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "./util/utils.h"
+#include "./util/FdHolder.h"
+#include "./RequestHandler.h"
+#include "./HttpParser.h"
+#include "./HttpResponse.h"
+#include "./HttpTypes.h"
+#include "./DefaultErrorPages.h"
+#include "./Logger.h"
+#include "./LatencyRecorder.h"
+#include "./Mime.h"
+#include "./ContentEncoding.h"
+#include "./Compression.h"
+#include "./CompressionCache.h"
+#include "./MappedFileCache.h"
+#include "./CachePolicy.h"
+#include "./ETag.h"
+#include "./HttpDate.h"
+#include "./HttpRange.h"
+#include "./Router.h"
+#include "./DirectoryListing.h"
+#include "./Proxy.h"
+#include "./FastCgi.h"
+
+void RequestHandler::handle()
+{
+    // LOG_DEBUG("Handle request, method=",
+    //           kHttpMethodStr[static_cast<int>(request_.method())],
+    //           ", version=HTTP", static_cast<int>(request_.version()), ", url=", request_.url());
+
+    if (static_cast<int>(request_.version()) > static_cast<int>(HttpVersion::HTTP11))
+    {
+        LOG_DEBUG("Http version ", static_cast<int>(request_.version()), " is not supported");
+        setErrorResponse(response_, HttpStatusCode::HTTP_VERSION_NOT_SUPPORTED);
+        return;
+    }
+
+    if (handleRoute())
+        return;
+    if (isForwarded())
+    {
+        // HttpContext forwards HTTP/1.x requests itself
+        setErrorResponse(response_, HttpStatusCode::NOT_IMPLEMENTED, "Forwarded over HTTP/1.1 only");
+        return;
+    }
+
+    if (request_.method() == HttpMethod::GET || request_.method() == HttpMethod::HEAD)
+    {
+        const auto resolve_start_ticks = LatencyRecorder::instance().start();
+        handleMethodGetAndHead();
+        LatencyRecorder::instance().record(RequestPhase::RESOLVE_FILE, resolve_start_ticks);
+    }
+    else if (request_.method() == HttpMethod::TRACE)
+        handleMethodTrace();
+    else if (request_.method() == HttpMethod::PUT && is_upload_enabled_ && body_ && body_->isOpen())
+        handleMethodPut();
+    else if (request_.method() == HttpMethod::POST && is_upload_enabled_ && body_ && body_->isOpen())
+        handleMethodPost();
+    else
+    {
+        LOG_DEBUG("Http method ", kHttpMethodStr[static_cast<int>(request_.method())], " is not supported.");
+        setErrorResponse(response_, HttpStatusCode::NOT_IMPLEMENTED);
+        return;
+    }
+}
+
+bool RequestHandler::handleRoute()
+{
+    const auto &router = Router::instance();
+    if (router.empty())
+        return false;
+    RouteParams params;
+    const auto *handler = router.lookup(request_.method(), request_.url(), params);
+    if (!handler)
+        return false;
+
+    (*handler)(request_, params, body_ && body_->isOpen() ? body_ : nullptr, response_);
+    if (request_.method() == HttpMethod::HEAD)
+        response_.body.clear();
+    return true;
+}
+
+bool RequestHandler::isForwarded() const
+{
+    return (!Proxy::instance().empty() && Proxy::instance().match(request_.url())) ||
+           (!FastCgi::instance().empty() && FastCgi::instance().match(request_.url()));
+}
+
+bool RequestHandler::needsHttp1() const
+{
+    if (isForwarded())
+        return true;
+    const auto method = request_.method();
+    if (method != HttpMethod::PUT && method != HttpMethod::POST && method != HttpMethod::PATCH)
+        return false;
+    RouteParams params;
+    return (is_upload_enabled_ && method != HttpMethod::PATCH) ||
+           (!Router::instance().empty() && Router::instance().lookup(method, request_.url(), params));
+}
+
+bool RequestHandler::prepareBody()
+{
+    if (request_.method() == HttpMethod::TRACE)
+    {
+        setErrorResponse(response_, HttpStatusCode::BAD_REQUEST);
+        return false;
+    }
+    RouteParams params;
+    if (!Router::instance().empty() && Router::instance().lookup(request_.method(), request_.url(), params))
+    {
+        // a form or an API call, small enough for memory in general
+        body_->open(P_tmpdir, kBodyMemoryLimit);
+        return true;
+    }
+    if (isForwarded())
+    {
+        // sent to the upstream or backend once complete
+        body_->open(P_tmpdir, kBodyMemoryLimit);
+        return true;
+    }
+    if (request_.method() != HttpMethod::PUT && request_.method() != HttpMethod::POST)
+        return true; // the body means nothing to a static file, it is dropped
+    if (!is_upload_enabled_)
+    {
+        setErrorResponse(response_, HttpStatusCode::NOT_IMPLEMENTED);
+        return false;
+    }
+
+    // checked before the body is received, handle() checks again as the tree may change meanwhile
+    auto dir = resolveUploadDir();
+    if (dir.empty())
+        return false;
+    // a large body is written to the directory's file system as it arrives, and only named at the end
+    body_->open(std::move(dir), kBodyMemoryLimit);
+    return true;
+}
+
+bool RequestHandler::isInsideRoot(std::string_view resolved_path) const noexcept
+{
+    return resolved_path.substr(0, root_dir_.size()) == root_dir_ &&
+           (resolved_path.size() == root_dir_.size() || root_dir_.back() == '/' || resolved_path[root_dir_.size()] == '/');
+}
+
+static int hexDigitValue(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f')
+        return (c | 0x20) - 'a' + 10;
+    return -1;
+}
+
+bool RequestHandler::decodePath()
+{
+    // the links of a directory listing are percent-encoded, a name with a space comes back as %20
+    const auto url = request_.url();
+    path_.clear();
+    path_.reserve(url.size());
+    for (std::size_t i = 0; i < url.size(); i++)
+    {
+        if (url[i] != '%')
+        {
+            path_.push_back(url[i]);
+            continue;
+        }
+        const int high = i + 2 < url.size() ? hexDigitValue(url[i + 1]) : -1;
+        const int low = high == -1 ? -1 : hexDigitValue(url[i + 2]);
+        // a NUL would cut the path short for realpath and open
+        if (low == -1 || (high | low) == 0)
+        {
+            LOG_DEBUG("Invalid percent-encoding in url = ", url);
+            setErrorResponse(response_, HttpStatusCode::BAD_REQUEST, "", request_.method() == HttpMethod::HEAD);
+            return false;
+        }
+        path_.push_back(static_cast<char>(high << 4 | low));
+        i += 2;
+    }
+    return true;
+}
+
+std::string RequestHandler::resolveUploadDir()
+{
+    if (!decodePath())
+        return {};
+    // PUT names a file in the directory of its URL, POST the directory itself
+    const bool is_put = request_.method() == HttpMethod::PUT;
+    const std::string_view url = path_;
+    std::string full_url = std::string(root_dir_).append(is_put ? url.substr(0, url.rfind('/') + 1) : url);
+    if (is_put && uploadFileName().empty())
+    {
+        setErrorResponse(response_, HttpStatusCode::CONFLICT, "PUT needs a file name");
+        return {};
+    }
+
+    std::array<char, PATH_MAX> resolved_path;
+    if (!realpath(full_url.c_str(), resolved_path.data()))
+    {
+        const int save = errno;
+        if (save == ENOENT || save == ENOTDIR)
+            setErrorResponse(response_, is_put ? HttpStatusCode::CONFLICT : HttpStatusCode::NOT_FOUND,
+                             std::string("No directory for ").append(url));
+        else
+            setErrorResponse(response_, HttpStatusCode::INTERNAL_SERVER_ERROR, logErrStr(save));
+        return {};
+    }
+
+    std::string_view resolved_path_sv(resolved_path.data());
+    if (!isInsideRoot(resolved_path_sv))
+    {
+        LOG_INFO("Upload url is not inside root_dir, url = ", resolved_path_sv, ", root_dir = ", root_dir_);
+        setErrorResponse(response_, HttpStatusCode::FORBIDDEN);
+        return {};
+    }
+
+    struct stat file_stat;
+    if (stat(resolved_path_sv.data(), &file_stat) == -1 || !S_ISDIR(file_stat.st_mode))
+    {
+        setErrorResponse(response_, HttpStatusCode::CONFLICT, std::string(url).append(" is not a directory"));
+        return {};
+    }
+    std::string res(resolved_path_sv);
+    if (is_put && stat(res.append("/").append(uploadFileName()).c_str(), &file_stat) == 0 && !S_ISREG(file_stat.st_mode))
+    {
+        setErrorResponse(response_, HttpStatusCode::CONFLICT, std::string(url).append(" is not a regular file"));
+        return {};
+    }
+    res.resize(resolved_path_sv.size());
+    return res;
+}
+
+std::string_view RequestHandler::uploadFileName() const
+{
+    const std::string_view url = path_;
+    const auto name = url.substr(url.rfind('/') + 1);
+    return name == "." || name == ".." ? std::string_view() : name;
+}
+
+void RequestHandler::handleMethodPut()
+{
+    const auto dir = resolveUploadDir();
+    if (dir.empty())
+        return;
+
+    const std::string path = std::string(dir).append("/").append(uploadFileName());
+    const bool is_replacing = access(path.c_str(), F_OK) == 0;
+    if (!body_->linkTo(path, true))
+    {
+        const int save = errno;
+        LOG_WARNING("Failed to store ", path, ", reason: ", logErrStr(save));
+        setErrorResponse(response_, HttpStatusCode::INTERNAL_SERVER_ERROR, logErrStr(save));
+        return;
+    }
+    LOG_DEBUG("Stored ", body_->size(), " bytes as ", path);
+
+    if (is_replacing)
+        response_.head.setStatusCode(HttpStatusCode::NO_CONTENT);
+    else
+        response_.head.setStatusCode(HttpStatusCode::CREATED)
+            .addHeader("Location", std::string(request_.url()))
+            .addHeader("Content-Length", "0");
+}
+
+void RequestHandler::handleMethodPost()
+{
+    const auto dir = resolveUploadDir();
+    if (dir.empty())
+        return;
+
+    thread_local std::mt19937_64 engine{std::random_device{}()};
+    static constexpr char kHexDigits[] = "0123456789abcdef";
+    static constexpr int kMaxNameTries = 4;
+    for (int i = 0; i < kMaxNameTries; i++)
+    {
+        std::string name("upload-");
+        for (auto num = engine(); num; num >>= 4)
+            name.push_back(kHexDigits[num & 0xf]);
+        if (body_->linkTo(std::string(dir).append("/").append(name), false))
+        {
+            LOG_DEBUG("Stored ", body_->size(), " bytes as ", dir, "/", name);
+            std::string location(request_.url());
+            if (location.back() != '/')
+                location.push_back('/');
+            response_.head.setStatusCode(HttpStatusCode::CREATED)
+                .addHeader("Location", location.append(name))
+                .addHeader("Content-Length", "0");
+            return;
+        }
+        if (errno != EEXIST)
+            break;
+    }
+    const int save = errno;
+    LOG_WARNING("Failed to store a POST body in ", dir, ", reason: ", logErrStr(save));
+    setErrorResponse(response_, HttpStatusCode::INTERNAL_SERVER_ERROR, logErrStr(save));
+}
+
+void RequestHandler::handleMethodGetAndHead()
+{
+    assert(request_.method() == HttpMethod::GET || request_.method() == HttpMethod::HEAD);
+
+    if (!decodePath())
+        return;
+    std::string full_url = std::string(root_dir_).append(path_);
+    std::array<char, PATH_MAX> resolved_path;
+    if (path_ == "/")
+        full_url.append("index.html", lengthOfNullEndStr("index.html"));
+
+    if (!realpath(full_url.c_str(), resolved_path.data()))
+    {
+        int save = errno;
+        if (save == ENOENT)
+        {
+            LOG_DEBUG("Cannot find file ", full_url);
+            setErrorResponse(response_, HttpStatusCode::NOT_FOUND,
+                                    std::string("Cannot open file ")
+                                        .append(request_.url())
+                                        .append(". ")
+                                        .append(logErrStr(save)),
+                                    request_.method() == HttpMethod::HEAD);
+        }
+        else
+        {
+            LOG_WARNING("Unknown Error, errmsg = ", logErrStr(save));
+            setErrorResponse(response_, HttpStatusCode::INTERNAL_SERVER_ERROR, logErrStr(save), request_.method() == HttpMethod::HEAD);
+        }
+        return;
+    }
+
+    std::string_view resolved_path_sv(resolved_path.data());
+
+    // check full_url is inside root_dir
+    if (!isInsideRoot(resolved_path_sv))
+    {
+        LOG_INFO("Requested url is not inside root_dir, url = ", resolved_path_sv, ", root_dir = ", root_dir_);
+        setErrorResponse(response_, HttpStatusCode::FORBIDDEN, "", request_.method() == HttpMethod::HEAD);
+        return;
+    }
+
+    struct stat file_stat;
+    explicit_bzero(&file_stat, sizeof(file_stat));
+    if (is_auto_index_enabled_ && stat(resolved_path_sv.data(), &file_stat) == 0 && S_ISDIR(file_stat.st_mode))
+    {
+        handleDirectory(std::string(resolved_path_sv));
+        return;
+    }
+    if (stat(resolved_path_sv.data(), &file_stat) == -1 || !S_ISREG(file_stat.st_mode))
+    {
+        LOG_DEBUG("Requested url is not regular file, full_url = ", resolved_path_sv);
+        setErrorResponse(response_, HttpStatusCode::NOT_FOUND, "", request_.method() == HttpMethod::HEAD);
+        return;
+    }
+
+    // validators come from stat, a 304 neither opens nor sends the file
+    const bool is_compressible = isCompressibleMime(request_.mime());
+    if (setNotModifiedResponseIfMatched(file_stat, is_compressible))
+        return;
+
+    // an identity body mapped before needs neither access() nor open()
+    MappedFileCache::Mapping mapping;
+    if (!is_compressible || request_.header(HttpHeader::ACCEPT_ENCODING).empty())
+        mapping = MappedFileCache::instance().find(resolved_path_sv, file_stat);
+
+    int body_fd = -1;
+    if (!mapping && (body_fd = openFile(resolved_path_sv, file_stat)) == -1)
+        return;
+
+    std::shared_ptr<FdHolder> body_file;
+    off_t body_size = file_stat.st_size;
+    ContentEncoding encoding = ContentEncoding::IDENTITY;
+    if (is_compressible && !mapping)
+    {
+        if (const auto accept_encoding = request_.header(HttpHeader::ACCEPT_ENCODING); !accept_encoding.empty())
+        {
+            for (const auto candidate : parseAcceptEncoding(accept_encoding))
+            {
+                if (candidate == ContentEncoding::IDENTITY)
+                    break;
+                if (const auto sidecar = openSidecar(resolved_path_sv, candidate, file_stat); sidecar.first != -1)
+                {
+                    close(body_fd);
+                    body_fd = sidecar.first;
+                    body_size = sidecar.second;
+                    encoding = candidate;
+                    break;
+                }
+            }
+        }
+    }
+
+    // no sidecar, serve a cached variant once it has been compressed
+    CompressionCache::Body cached_body;
+    if (is_compressible && !mapping && encoding == ContentEncoding::IDENTITY && CompressionCache::instance().isEnabled())
+    {
+        for (const auto candidate : parseAcceptEncoding(request_.header(HttpHeader::ACCEPT_ENCODING)))
+        {
+            if (candidate == ContentEncoding::IDENTITY)
+                break;
+            if (!isEncodingSupported(candidate))
+                continue;
+            if ((cached_body = CompressionCache::instance().get(resolved_path_sv, file_stat, candidate)))
+            {
+                body_size = cached_body->size();
+                encoding = candidate;
+            }
+            break;
+        }
+    }
+
+    if (!mapping)
+    {
+        // small identity bodies are mapped once and leave with the head in one writev
+        if (cached_body || (encoding == ContentEncoding::IDENTITY &&
+                            (mapping = MappedFileCache::instance().map(resolved_path_sv, body_fd, file_stat))))
+            close(body_fd);
+        else
+            body_file = std::make_shared<FdHolder>(body_fd);
+    }
+
+    const bool is_method_head = request_.method() == HttpMethod::HEAD;
+    const std::string etag = makeETag(file_stat, encoding);
+    std::vector<ByteRange> ranges;
+    RangeParseResult range_result = RangeParseResult::IGNORED;
+    if (const auto range = request_.header(HttpHeader::RANGE); !range.empty() && isIfRangeMatched(file_stat, etag))
+        range_result = parseRange(range, body_size, ranges);
+
+    if (range_result == RangeParseResult::NOT_SATISFIABLE)
+    {
+        response_.head.addHeader("Content-Range", std::string("bytes */").append(lexicalCast(body_size)));
+        setErrorResponse(response_, HttpStatusCode::RANGE_NOT_SATISFIABLE, "", is_method_head);
+        return;
+    }
+
+    auto &body = response_.body;
+    const auto appendBody = [&body, &cached_body, &mapping, &body_file](off_t offset, off_t length)
+    {
+        if (cached_body)
+            body.appendShared(cached_body, std::string_view(*cached_body).substr(offset, length));
+        else if (mapping)
+            body.appendShared(mapping, mapping->view().substr(offset, length));
+        else
+            body.appendFile(body_file, offset, length);
+    };
+
+    auto &builder = response_.head.addHeader("Accept-Ranges", "bytes")
+                       .addHeader("ETag", etag)
+                       .addHeader("Last-Modified", formatHttpDate(file_stat.st_mtim.tv_sec));
+    if (encoding != ContentEncoding::IDENTITY)
+        builder.addHeader("Content-Encoding", kContentEncodingStr[static_cast<int>(encoding)]);
+    if (is_compressible)
+        builder.addHeader("Vary", "Accept-Encoding");
+    addCachePolicyHeaders(builder);
+
+    if (range_result == RangeParseResult::IGNORED)
+    {
+        builder.addHeader("Content-Length", lexicalCast(body_size))
+            .addHeader("Content-Type", request_.mime().data());
+        if (!is_method_head)
+            appendBody(0, body_size);
+    }
+    else if (ranges.size() == 1)
+    {
+        const auto &range = ranges.front();
+        builder.setStatusCode(HttpStatusCode::PARTIAL_CONTENT)
+            .addHeader("Content-Range", contentRangeStr(range, body_size))
+            .addHeader("Content-Length", lexicalCast(range.length()))
+            .addHeader("Content-Type", request_.mime().data());
+        if (!is_method_head)
+            appendBody(range.first, range.length());
+    }
+    else
+    {
+        // multipart/byteranges # rfc7233 sec:4.1
+        const std::string boundary = makeMultipartBoundary();
+        std::vector<std::string> part_heads;
+        part_heads.reserve(ranges.size() + 1);
+        std::size_t content_length = 0;
+        for (const auto &range : ranges)
+        {
+            auto &part_head = part_heads.emplace_back("\r\n--");
+            part_head.append(boundary)
+                .append("\r\nContent-Type: ")
+                .append(request_.mime())
+                .append("\r\nContent-Range: ")
+                .append(contentRangeStr(range, body_size))
+                .append("\r\n\r\n");
+            content_length += part_head.size() + range.length();
+        }
+        content_length += part_heads.emplace_back(std::string("\r\n--").append(boundary).append("--\r\n")).size();
+
+        builder.setStatusCode(HttpStatusCode::PARTIAL_CONTENT)
+            .addHeader("Content-Length", lexicalCast(content_length))
+            .addHeader("Content-Type", std::string("multipart/byteranges; boundary=").append(boundary));
+        if (!is_method_head)
+        {
+            for (std::size_t i = 0; i < ranges.size(); i++)
+            {
+                body.append(std::move(part_heads[i]));
+                appendBody(ranges[i].first, ranges[i].length());
+            }
+            body.append(std::move(part_heads.back()));
+        }
+    }
+}
+
+bool RequestHandler::isIfRangeMatched(const struct stat &file_stat, std::string_view etag) const
+{
+    // If-Range = entity-tag / HTTP-date # rfc7233 sec:3.2
+    const auto if_range = request_.header(HttpHeader::IF_RANGE);
+    if (if_range.empty())
+        return true;
+    if (if_range.front() == '"' || if_range.front() == 'W')
+        return isETagStrongMatched(if_range, etag);
+
+    time_t time;
+    return parseHttpDate(if_range, time) && time == file_stat.st_mtim.tv_sec;
+}
+
+bool RequestHandler::setNotModifiedResponseIfMatched(const struct stat &file_stat, bool is_compressible)
+{
+    // If-None-Match takes precedence over If-Modified-Since # rfc7232 sec:6
+    std::string matched_etag;
+    if (const auto if_none_match = request_.header(HttpHeader::IF_NONE_MATCH); !if_none_match.empty())
+    {
+        // the client may hold any of the encoded representations
+        const int encoding_count = is_compressible ? kContentEncodingCount : 1;
+        for (int i = 0; i < encoding_count && matched_etag.empty(); i++)
+        {
+            auto etag = makeETag(file_stat, static_cast<ContentEncoding>(i));
+            if (isETagListMatched(if_none_match, etag))
+                matched_etag = std::move(etag);
+        }
+        if (matched_etag.empty())
+            return false;
+    }
+    else
+    {
+        time_t time;
+        const auto if_modified_since = request_.header(HttpHeader::IF_MODIFIED_SINCE);
+        if (if_modified_since.empty() || !parseHttpDate(if_modified_since, time) || file_stat.st_mtim.tv_sec > time)
+            return false;
+    }
+
+    auto &builder = response_.head.setStatusCode(HttpStatusCode::NOT_MODIFIED);
+    // without If-None-Match the representation held by the client is unknown, so no ETag
+    if (!matched_etag.empty())
+        builder.addHeader("ETag", matched_etag);
+    builder.addHeader("Last-Modified", formatHttpDate(file_stat.st_mtim.tv_sec));
+    if (is_compressible)
+        builder.addHeader("Vary", "Accept-Encoding");
+    addCachePolicyHeaders(builder);
+    return true;
+}
+
+void RequestHandler::addCachePolicyHeaders(HttpResponseBuilder &builder) const
+{
+    const auto *policy = CachePolicy::instance().lookup(request_.url(), request_.mime());
+    if (!policy)
+        return;
+    builder.addHeader("Cache-Control", policy->cache_control);
+    if (policy->max_age >= 0)
+        builder.addHeader("Expires", CachePolicy::expiresStr(*policy));
+}
+
+std::string RequestHandler::contentRangeStr(const ByteRange &range, off_t size)
+{
+    return std::string("bytes ").append(lexicalCast(range.first)).append("-").append(lexicalCast(range.last)).append("/").append(lexicalCast(size));
+}
+
+std::string RequestHandler::makeMultipartBoundary()
+{
+    thread_local std::mt19937_64 engine{std::random_device{}()};
+
+    static constexpr char kHexDigits[] = "0123456789abcdef";
+    std::string boundary("WebServerBoundary");
+    for (auto num = engine(); num; num >>= 4)
+        boundary.push_back(kHexDigits[num & 0xf]);
+    return boundary;
+}
+
+int RequestHandler::openFile(std::string_view path, struct stat &file_stat)
+{
+    const bool is_method_head = request_.method() == HttpMethod::HEAD;
+    // check has read permission to full_url
+    if (access(path.data(), R_OK) == -1)
+    {
+        if (errno == EACCES)
+            LOG_DEBUG("No read permission on file ", path);
+        else
+            LOG_WARNING("Failed to call access with parameter(", path, "), reason: ", logErrStr(errno));
+        setErrorResponse(response_, HttpStatusCode::INTERNAL_SERVER_ERROR, "", is_method_head);
+        return -1;
+    }
+
+    const int file_fd = ::open(path.data(), O_RDONLY);
+    if (file_fd == -1)
+    {
+        LOG_WARNING("Failed to call open with parameter(", path, "), reason: ", logErrStr(errno));
+        setErrorResponse(response_, HttpStatusCode::INTERNAL_SERVER_ERROR, "", is_method_head);
+        return -1;
+    }
+
+    if (fstat(file_fd, &file_stat) == -1)
+    {
+        LOG_WARNING("Failed to call fstat, reason: ", logErrStr(errno));
+        close(file_fd);
+        setErrorResponse(response_, HttpStatusCode::INTERNAL_SERVER_ERROR, "", is_method_head);
+        return -1;
+    }
+    return file_fd;
+}
+
+std::pair<int, off_t> RequestHandler::openSidecar(std::string_view path, ContentEncoding encoding, const struct stat &file_stat)
+{
+    const std::string sidecar_path = std::string(path).append(kContentEncodingSuffix[static_cast<int>(encoding)]);
+
+    // a symlinked sidecar could point outside root_dir_
+    const int fd = ::open(sidecar_path.c_str(), O_RDONLY | O_NOFOLLOW);
+    if (fd == -1)
+        return {-1, 0};
+
+    struct stat sidecar_stat;
+    explicit_bzero(&sidecar_stat, sizeof(sidecar_stat));
+    if (fstat(fd, &sidecar_stat) == -1 || !S_ISREG(sidecar_stat.st_mode) ||
+        sidecar_stat.st_mtim.tv_sec < file_stat.st_mtim.tv_sec)
+    {
+        LOG_DEBUG("Ignore missing or stale sidecar ", sidecar_path);
+        close(fd);
+        return {-1, 0};
+    }
+    return {fd, sidecar_stat.st_size};
+}
+
+void RequestHandler::handleDirectory(const std::string &path)
+{
+    const auto url = request_.url();
+    if (url.back() != '/')
+    {
+        // the relative links of the listing resolve against the URL with the slash
+        std::string location = std::string(url).append("/");
+        if (request_.hasQuery())
+            location.append("?").append(request_.query());
+        response_.head.setStatusCode(HttpStatusCode::MOVED_PERMANENTLY)
+            .addHeader("Location", std::move(location))
+            .addHeader("Content-Length", "0");
+        return;
+    }
+
+    auto listing = DirectoryListing::open(path, path_);
+    if (!listing)
+    {
+        const int save = errno;
+        LOG_DEBUG("Cannot open directory ", path, ", reason: ", logErrStr(save));
+        setErrorResponse(response_, save == EACCES ? HttpStatusCode::FORBIDDEN : HttpStatusCode::INTERNAL_SERVER_ERROR,
+                         "", request_.method() == HttpMethod::HEAD);
+        return;
+    }
+    // the length is known once the last entry is read, the body is streamed
+    response_.head.addHeader("Content-Type", "text/html; charset=utf-8")
+        .addHeader("Cache-Control", "no-cache");
+    response_.stream = std::move(listing);
+}
+
+void RequestHandler::handleMethodTrace()
+{
+    response_.head.addHeader("Content-Type", "message/http")
+        .addHeader("Content-Length", std::to_string(request_.headLength()));
+    response_.body.append(std::string(request_.head()));
+    response_.is_close = true;
+}
+
+void RequestHandler::setErrorResponse(HttpResponse &response, HttpStatusCode status_code, const std::string &msg, bool is_method_head)
+{
+    std::string page = msg.empty() ? std::string(getDefaultErrorPage(status_code)) : getErrorPageWithExtraMsg(status_code, msg);
+    response.head.setStatusCode(status_code)
+        .addHeader("Content-Length", lexicalCast(page.size()))
+        .addHeader("Content-Type", getMime("html").data());
+    if (!is_method_head)
+        response.body.append(std::move(page));
+    response.is_close = true;
+}
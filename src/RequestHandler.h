@@ -0,0 +1,95 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "./HttpParser.h"
+#include "./HttpRange.h"
+#include "./HttpResponse.h"
+#include "./HttpTypes.h"
+#include "./ContentEncoding.h"
+#include "./RequestBody.h"
+#include "./util/Noncopyable.h"
+
+// Turns one parsed request into an HttpResponse: routes of the Router, then
+// static files under root_dir (sidecars and cached compressed variants, Range,
+// conditional requests, Cache-Control policy), directory listings, uploads,
+// TRACE and error responses. It knows nothing
+// about the connection, so HTTP/1.1 and every HTTP/2 stream share it.
+//
+// A request body is received into body, which prepareBody() opens with the
+// head where the handler wants it (uploads go to their directory); handle()
+// runs once it is complete. Without a body (HTTP/2) uploads are refused.
+class RequestHandler : NonCopyable
+{
+public:
+    // a body up to this size stays in memory
+    static constexpr std::size_t kBodyMemoryLimit = 64 * 1024;
+
+    RequestHandler(const HttpParser &request, std::string_view root_dir, HttpResponse &response, RequestBody *body = nullptr)
+        : request_(request), root_dir_(root_dir), response_(response), body_(body) {}
+
+    // PUT stores the body as the file of the URL, POST as a new file in the directory of the URL
+    static void setUploadEnabled(bool is_enabled) noexcept { is_upload_enabled_ = is_enabled; }
+    // GET of a directory lists its entries (DirectoryListing) instead of a 404
+    static void setAutoIndexEnabled(bool is_enabled) noexcept { is_auto_index_enabled_ = is_enabled; }
+
+    // with the head of a request with a body, false after setting an error response; the
+    // body is dropped as it arrives if body stays closed
+    [[nodiscard]] bool prepareBody();
+    void handle();
+    // whether the request is forwarded or hands its body to a route or an upload, which
+    // HTTP/2 streams cannot do here, so an h2c upgrade is declined
+    [[nodiscard]] bool needsHttp1() const;
+
+    // error page with an optional extra message, the connection is closed afterwards
+    static void setErrorResponse(HttpResponse &response, HttpStatusCode status_code, const std::string &msg = "", bool is_method_head = false);
+
+private:
+    const HttpParser &request_;
+    std::string_view root_dir_;
+    HttpResponse &response_;
+    RequestBody *body_;
+    // the URL path with %XX escapes decoded, it names the file under root_dir_
+    std::string path_;
+
+    inline static bool is_upload_enabled_{false};
+    inline static bool is_auto_index_enabled_{false};
+
+    // false if no route matches, static files are served then
+    [[nodiscard]] bool handleRoute();
+    // the URL goes to a proxy upstream or a FastCGI backend, HttpContext runs those
+    [[nodiscard]] bool isForwarded() const;
+    void handleMethodGetAndHead();
+    // path is the resolved directory of the URL
+    void handleDirectory(const std::string &path);
+    void handleMethodTrace();
+    void handleMethodPut();
+    void handleMethodPost();
+
+    // whether a canonical path is root_dir_ or below it, not a sibling sharing its prefix
+    [[nodiscard]] bool isInsideRoot(std::string_view resolved_path) const noexcept;
+    // fills path_, false after setting an error response for a malformed escape or a NUL
+    [[nodiscard]] bool decodePath();
+    // the directory an upload is stored in, its canonical path; "" after setting an error response
+    [[nodiscard]] std::string resolveUploadDir();
+    // the final URL segment of a PUT, "" if there is none
+    [[nodiscard]] std::string_view uploadFileName() const;
+
+    // false if If-Range names another version of the file, the Range header is ignored then
+    [[nodiscard]] bool isIfRangeMatched(const struct stat &file_stat, std::string_view etag) const;
+    // evaluates If-None-Match/If-Modified-Since and sets a 304 response if the client copy is fresh
+    [[nodiscard]] bool setNotModifiedResponseIfMatched(const struct stat &file_stat, bool is_compressible);
+    void addCachePolicyHeaders(HttpResponseBuilder &builder) const;
+    [[nodiscard]] static std::string contentRangeStr(const ByteRange &range, off_t size);
+    [[nodiscard]] static std::string makeMultipartBoundary();
+
+    // checks read permission, opens path and refreshes file_stat, -1 after setting an error response
+    [[nodiscard]] int openFile(std::string_view path, struct stat &file_stat);
+    // opens path + sidecar suffix if it is not older than file_stat, returns <fd, size>, fd = -1 on failure
+    [[nodiscard]] static std::pair<int, off_t> openSidecar(std::string_view path, ContentEncoding encoding, const struct stat &file_stat);
+};
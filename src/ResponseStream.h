@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+
+#include "./util/Noncopyable.h"
+
+class OutputBuffer;
+
+// A response body made piece by piece while it is sent, for bodies whose size
+// is not known up front (directory listings, generated content). The
+// connection asks for the next piece once its output drained below its cap,
+// so a slow client holds the producer back instead of the body piling up in
+// memory, and the first bytes go out before the last ones exist.
+//
+// HTTP/1.1 sends the pieces as chunks (Transfer-Encoding: chunked), HTTP/1.0
+// until the connection closes, HTTP/2 in DATA frames within the windows.
+class ResponseStream : NonCopyable
+{
+public:
+    enum class Result
+    {
+        MORE,   // appended a piece, there is more
+        DONE,   // appended the last piece (possibly nothing)
+        FAILED, // the body broke off, the connection is closed (HTTP/2: the stream is reset)
+    };
+
+    virtual ~ResponseStream() = default;
+
+    // appends about max_bytes of the body to out
+    [[nodiscard]] virtual Result fill(OutputBuffer &out, std::size_t max_bytes) = 0;
+};
@@ -0,0 +1,167 @@
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "./Router.h"
+#include "./Logger.h"
+
+bool Router::add(HttpMethod method, std::string_view pattern, RouteHandler handler)
+{
+    if (pattern.empty() || pattern.front() != '/' || !handler)
+    {
+        LOG_ERROR("Route pattern must start with '/' and have a handler, pattern = ", pattern);
+        return false;
+    }
+
+    int node = 0;
+    int param_num = 0;
+    std::string_view rest = pattern;
+    while (!rest.empty())
+    {
+        if (rest.front() != ':' && rest.front() != '*')
+        {
+            const auto literal = rest.substr(0, rest.find_first_of(":*"));
+            node = insertLiteral(node, literal);
+            rest.remove_prefix(literal.size());
+            continue;
+        }
+
+        const bool is_rest = rest.front() == '*';
+        const auto name = rest.substr(1, rest.find('/') - 1);
+        rest.remove_prefix(name.size() + 1);
+        if (pattern[pattern.size() - rest.size() - name.size() - 2] != '/' || name.empty() ||
+            name.find_first_of(":*") != std::string_view::npos || (is_rest && !rest.empty()) ||
+            ++param_num > RouteParams::kMaxSize)
+        {
+            LOG_ERROR("Route parameters must be named, start a segment and \"*\" must end the pattern, pattern = ", pattern);
+            return false;
+        }
+        node = insertParam(node, is_rest, name);
+        if (node == -1)
+        {
+            LOG_ERROR("Route parameter names differ from an earlier route at the same position, pattern = ", pattern);
+            return false;
+        }
+    }
+
+    auto &slot = nodes_[node].handlers[static_cast<int>(method)];
+    if (slot != -1)
+    {
+        LOG_ERROR("Duplicate route ", kHttpMethodStr[static_cast<int>(method)], " ", pattern);
+        return false;
+    }
+    slot = handlers_.size();
+    handlers_.push_back(std::move(handler));
+    return true;
+}
+
+void Router::clear()
+{
+    nodes_.assign(1, Node());
+    handlers_.clear();
+}
+
+int Router::insertLiteral(int node, std::string_view literal)
+{
+    while (!literal.empty())
+    {
+        const auto &first_bytes = nodes_[node].first_bytes;
+        const auto pos = std::lower_bound(first_bytes.begin(), first_bytes.end(), literal.front()) - first_bytes.begin();
+        if (pos == static_cast<long>(first_bytes.size()) || first_bytes[pos] != literal.front())
+        {
+            const int child = nodes_.size();
+            nodes_.emplace_back().label = std::string(literal);
+            nodes_[node].children.insert(nodes_[node].children.begin() + pos, child);
+            nodes_[node].first_bytes.insert(nodes_[node].first_bytes.begin() + pos, literal.front());
+            return child;
+        }
+
+        int child = nodes_[node].children[pos];
+        const std::string_view label = nodes_[child].label;
+        const auto common = std::mismatch(label.begin(), label.end(), literal.begin(), literal.end()).first - label.begin();
+        if (common < static_cast<long>(label.size()))
+        {
+            // split the edge, the new node takes the common part
+            const int middle = nodes_.size();
+            Node split;
+            split.label = std::string(label.substr(0, common));
+            split.children.push_back(child);
+            split.first_bytes.push_back(label[common]);
+            nodes_[child].label.erase(0, common);
+            nodes_.push_back(std::move(split));
+            nodes_[node].children[pos] = middle;
+            child = middle;
+        }
+        literal.remove_prefix(common);
+        node = child;
+    }
+    return node;
+}
+
+int Router::insertParam(int node, bool is_rest, std::string_view name)
+{
+    const int existing = is_rest ? nodes_[node].rest_child : nodes_[node].param_child;
+    if (existing != -1)
+        return nodes_[existing].param_name == name ? existing : -1;
+
+    const int child = nodes_.size();
+    nodes_.emplace_back().param_name = std::string(name);
+    (is_rest ? nodes_[node].rest_child : nodes_[node].param_child) = child;
+    return child;
+}
+
+int Router::findHandler(int node, HttpMethod method) const noexcept
+{
+    const auto &handlers = nodes_[node].handlers;
+    const int handler = handlers[static_cast<int>(method)];
+    if (handler == -1 && method == HttpMethod::HEAD)
+        return handlers[static_cast<int>(HttpMethod::GET)];
+    return handler;
+}
+
+const RouteHandler *Router::lookup(HttpMethod method, std::string_view url, RouteParams &params) const
+{
+    params.size_ = 0;
+    if (handlers_.empty() || static_cast<int>(method) >= kMethodNum)
+        return nullptr;
+    const int handler = match(0, url, method, params);
+    return handler == -1 ? nullptr : &handlers_[handler];
+}
+
+int Router::match(int node, std::string_view path, HttpMethod method, RouteParams &params) const
+{
+    const auto &current = nodes_[node];
+    if (path.empty())
+    {
+        if (const int handler = findHandler(node, method); handler != -1)
+            return handler;
+    }
+    else if (const auto pos = current.first_bytes.find(path.front()); pos != std::string::npos)
+    {
+        const int child = current.children[pos];
+        const std::string_view label = nodes_[child].label;
+        if (path.substr(0, label.size()) == label)
+            if (const int handler = match(child, path.substr(label.size()), method, params); handler != -1)
+                return handler;
+    }
+
+    if (current.param_child != -1 && !path.empty() && path.front() != '/')
+    {
+        const auto segment = path.substr(0, path.find('/'));
+        params.items_[params.size_++] = {nodes_[current.param_child].param_name, segment};
+        if (const int handler = match(current.param_child, path.substr(segment.size()), method, params); handler != -1)
+            return handler;
+        params.size_--;
+    }
+
+    if (current.rest_child != -1)
+    {
+        if (const int handler = findHandler(current.rest_child, method); handler != -1)
+        {
+            params.items_[params.size_++] = {nodes_[current.rest_child].param_name, path};
+            return handler;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <array>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "./HttpTypes.h"
+#include "./util/Singleton.h"
+
+class HttpParser;
+class RequestBody;
+struct HttpResponse;
+
+// Path parameters of a matched route, name -> value. The values are views into
+// the request head, so they are valid while the handler runs.
+class RouteParams
+{
+public:
+    // a pattern with more parameters than this is rejected by Router::add()
+    static constexpr int kMaxSize = 8;
+
+    // "" if the route has no such parameter
+    [[nodiscard]] std::string_view get(std::string_view name) const noexcept
+    {
+        for (int i = 0; i < size_; i++)
+            if (items_[i].first == name)
+                return items_[i].second;
+        return {};
+    }
+    [[nodiscard]] int size() const noexcept { return size_; }
+
+private:
+    friend class Router;
+
+    std::array<std::pair<std::string_view, std::string_view>, kMaxSize> items_;
+    int size_{0};
+};
+
+// Sets the whole response, Content-Length included, like RequestHandler does for
+// files, or the head and a ResponseStream for a body of unknown length. body is the complete request body (nullptr over HTTP/2); it stays in
+// memory up to RequestHandler::kBodyMemoryLimit and is a file in the temp dir
+// above that.
+using RouteHandler = std::function<void(const HttpParser &request, const RouteParams &params,
+                                        const RequestBody *body, HttpResponse &response)>;
+
+// Dynamic handlers by method and URL path, consulted before static files.
+// Routes are added before the server starts and compiled into a radix trie
+// over the pattern bytes, lookups are read only, allocation free and take one
+// pass over the path (a literal edge that leads nowhere backtracks to a
+// parameter at the same position).
+//
+// Patterns:
+//   /login             exact path
+//   /users/:id         ":id" matches one non-empty segment
+//   /files/*path       "*path" matches the rest of the path, possibly empty
+// Parameters start a segment, and "*" ends the pattern. Literal edges win
+// over parameters and parameters over "*". A HEAD request without a HEAD
+// route takes the GET route and its body is dropped.
+class Router : public Singleton<Router>
+{
+public:
+    // false (logged) if pattern is malformed or the route exists already
+    bool add(HttpMethod method, std::string_view pattern, RouteHandler handler);
+    void clear();
+
+    [[nodiscard]] bool empty() const noexcept { return handlers_.empty(); }
+    [[nodiscard]] std::size_t size() const noexcept { return handlers_.size(); }
+
+    // the handler of the route matching url (without the query), nullptr if there is none
+    [[nodiscard]] const RouteHandler *lookup(HttpMethod method, std::string_view url, RouteParams &params) const;
+
+private:
+    static constexpr int kMethodNum = static_cast<int>(HttpMethod::PATCH) + 1;
+
+    struct Node
+    {
+        std::string label;                // literal bytes on the edge into this node
+        std::vector<int> children;        // literal edges, sorted by their first byte
+        std::string first_bytes;          // children[i] starts with first_bytes[i]
+        int param_child{-1};              // ":name" at this position
+        int rest_child{-1};               // "*name" at this position
+        std::string param_name;           // of a param or rest node
+        std::array<int, kMethodNum> handlers; // by method, -1 if none
+
+        Node() { handlers.fill(-1); }
+    };
+
+    std::vector<Node> nodes_{Node()};
+    std::vector<RouteHandler> handlers_;
+
+    [[nodiscard]] int insertLiteral(int node, std::string_view literal);
+    [[nodiscard]] int insertParam(int node, bool is_rest, std::string_view name);
+    [[nodiscard]] int findHandler(int node, HttpMethod method) const noexcept;
+    [[nodiscard]] int match(int node, std::string_view path, HttpMethod method, RouteParams &params) const;
+};
@@ -3,18 +3,25 @@
 #include <string_view>
 #include <optional>
 
+#include <cstddef>
+
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
 #include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 
 #include "./util/utils.h"
 #include "./TcpSocket.h"
 #include "./Logger.h"
 
-TcpSocket::TcpSocket()
+TcpSocket::TcpSocket(Domain domain)
 {
-    fd_ = socket(PF_INET, SOCK_STREAM, 0);
+    fd_ = socket(domain == Domain::UNIX ? PF_UNIX : PF_INET, SOCK_STREAM, 0);
 
     if (fd_ == -1)
     {
@@ -54,6 +61,73 @@ int TcpSocket::bind(std::string_view ip, int port) const
     return 0;
 }
 
+// a socket file left at the address by a process that is gone is unlinked; false if a
+// process still listens on it or the path is something else
+static bool removeStaleSocket(const sockaddr_un &addr, socklen_t addr_len)
+{
+    struct stat path_stat;
+    if (::lstat(addr.sun_path, &path_stat) == -1)
+    {
+        if (errno == ENOENT)
+            return true;
+        LOG_ERROR("Failed to stat ", addr.sun_path, ", reason: ", logErrStr(errno));
+        return false;
+    }
+    if (!S_ISSOCK(path_stat.st_mode))
+    {
+        LOG_ERROR(addr.sun_path, " exists and is not a socket");
+        return false;
+    }
+
+    // nonblocking, a listener with a full backlog answers EAGAIN instead of holding the start
+    const int probe_fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (probe_fd == -1)
+        return false;
+    const bool is_stale = ::connect(probe_fd, reinterpret_cast<const sockaddr *>(&addr), addr_len) == -1 && errno == ECONNREFUSED;
+    ::close(probe_fd);
+    if (!is_stale)
+    {
+        LOG_ERROR(addr.sun_path, " is in use by another process");
+        return false;
+    }
+    LOG_INFO("Remove stale socket ", addr.sun_path);
+    return ::unlink(addr.sun_path) == 0 || errno == ENOENT;
+}
+
+int TcpSocket::bindUnix(std::string_view path, mode_t mode) const
+{
+    sockaddr_un listen_addr;
+    explicit_bzero((void *)&listen_addr, sizeof(listen_addr));
+    if (path.empty() || path.size() >= sizeof(listen_addr.sun_path))
+    {
+        LOG_ERROR("Invalid Unix socket path = ", path);
+        return -1;
+    }
+
+    listen_addr.sun_family = AF_UNIX;
+    path.copy(listen_addr.sun_path, path.size());
+    // abstract names start with a NUL instead of '@' and have no terminating one
+    const bool is_abstract = path.front() == '@';
+    if (is_abstract)
+        listen_addr.sun_path[0] = '\0';
+    const socklen_t addr_len = offsetof(sockaddr_un, sun_path) + path.size() + (is_abstract ? 0 : 1);
+
+    if (!is_abstract && !removeStaleSocket(listen_addr, addr_len))
+        return -1;
+    if (::bind(fd_, (sockaddr *)&listen_addr, addr_len) == -1)
+    {
+        LOG_ERROR("Failed to bind(", path, "), reason: ", logErrStr(errno));
+        return -1;
+    }
+    // before listen(), nobody connects while the file has the umask's mode
+    if (!is_abstract && ::chmod(listen_addr.sun_path, mode) == -1)
+    {
+        LOG_ERROR("Failed to chmod(", path, "), reason: ", logErrStr(errno));
+        return -1;
+    }
+    return 0;
+}
+
 int TcpSocket::listen(int backlog) const
 {
     if (::listen(fd_, backlog) == -1)
@@ -85,9 +159,12 @@ std::optional<std::pair<std::string, uint16_t>> TcpSocket::getPeerAddress() cons
     return std::make_pair(std::string(buffer.data()), client_addr.sin_port);
 }
 
-int TcpSocket::accept() const 
+int TcpSocket::accept(sockaddr_storage *peer_addr) const
 {
-    const int retval = ::accept(fd_, nullptr, nullptr);
+    // nonblocking, so a sendfile to a client that stopped reading returns instead of
+    // holding a pool thread past the connection's send deadline
+    socklen_t addrlen = sizeof(sockaddr_storage);
+    const int retval = ::accept4(fd_, reinterpret_cast<sockaddr *>(peer_addr), peer_addr ? &addrlen : nullptr, SOCK_NONBLOCK);
     if (retval == -1)
     {
         if (errno != EAGAIN && errno != EWOULDBLOCK)
@@ -158,4 +235,30 @@ bool TcpSocket::setNonBlocking(bool is_non_blocking) const
     }
 
     return true;
-}
\ No newline at end of file
+}
+
+bool TcpSocket::setNoDelay(bool is_no_delay) const
+{
+    int no_delay = is_no_delay;
+    const int retval = setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+    if (retval == -1)
+    {
+        LOG_WARNING(logstr("Failed to setsockopt: TCP_NODELAY to ", no_delay, " on fd = ", fd(), ", reason = ", logErrStr(errno)));
+        return false;
+    }
+    return true;
+}
+
+bool TcpSocket::setRecvTimeout(int ms) const
+{
+    timeval timeout;
+    timeout.tv_sec = ms / 1000;
+    timeout.tv_usec = (ms % 1000) * 1000;
+    const int retval = setsockopt(fd_, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (retval == -1)
+    {
+        LOG_WARNING(logstr("Failed to setsockopt: SO_RCVTIMEO to ", ms, "ms on fd = ", fd(), ", reason = ", logErrStr(errno)));
+        return false;
+    }
+    return true;
+}
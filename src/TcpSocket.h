@@ -7,6 +7,8 @@
 #include <endian.h>
 
 #include <sys/socket.h>
+#include <sys/types.h>
+#include <netinet/in.h>
 
 #include "./util/Noncopyable.h"
 #include "./Logger.h"
@@ -18,14 +20,24 @@ public:
     static constexpr int kListenBackLogSize = SOMAXCONN;
     static constexpr int kDefaultLingerSecond = 5;
 
-    TcpSocket();
+    enum class Domain
+    {
+        INET,
+        UNIX,
+    };
+
+    explicit TcpSocket(Domain domain = Domain::INET);
     explicit TcpSocket(int fd) : fd_(fd) { LOG_DEBUG("Move socket ", fd); }
 
     [[nodiscard]] int bind(std::string_view ip, int port) const;
+    // a Unix domain socket at path, "@name" for the abstract namespace. A socket file nobody
+    // listens on anymore is replaced, the new file gets mode regardless of the umask.
+    [[nodiscard]] int bindUnix(std::string_view path, mode_t mode) const;
     [[nodiscard]] int listen(int backlog = kListenBackLogSize) const;
     int fd() const noexcept { return fd_; }
     std::optional<std::pair<std::string, uint16_t>> getPeerAddress() const;
-    [[nodiscard]] int accept() const;
+    // peer_addr receives the client address when given, AF_UNIX ones for Unix sockets
+    [[nodiscard]] int accept(sockaddr_storage *peer_addr = nullptr) const;
 
     ~TcpSocket();
 
@@ -33,6 +45,9 @@ public:
     [[nodiscard]] bool setReuseAddr(bool /*is_reuse*/) const;
     [[nodiscard]] bool setReusePort(bool /*is_reuse*/) const;
     [[nodiscard]] bool setNonBlocking(bool /*is_non_blocking*/) const;
+    [[nodiscard]] bool setNoDelay(bool /*is_no_delay*/) const;
+    // SO_RCVTIMEO, a blocking accept() returns with EAGAIN after ms
+    [[nodiscard]] bool setRecvTimeout(int ms) const;
 
 private:
     FdType fd_;
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <atomic>
 #include <vector>
 #include <thread>
 #include <mutex>
@@ -20,7 +21,7 @@ private:
     std::vector<std::thread> threads_;
     Queue<Task> queue_;
     std::mutex run_mutex_;
-    bool is_running_{false};
+    std::atomic_bool is_running_{false};
 
     [[nodiscard]] auto size() const noexcept { return threads_.size(); }
     [[nodiscard]] bool full() const noexcept { return size() == kMaxThreadNum; }
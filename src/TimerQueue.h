@@ -2,40 +2,56 @@
 
 #include <set>
 #include <unordered_map>
+#include <vector>
 #include <functional>
 #include <chrono>
 #include <atomic>
 #include <mutex>
 
+#include <cstdint>
+
+#include <unistd.h>
+
 #include "./util/Noncopyable.h"
 
-// OneShot timers
+// OneShot timers. The owning loop sleeps for what tick() returns; a timer
+// may fire up to kSlackMs late, so timers expiring close together are run by
+// one wakeup instead of one each.
 class TimerQueue : NonCopyable
 {
 public:
     using TimerId = unsigned;
-    TimerQueue() = default;
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr int kSlackMs = 10;
+
+    // wakeup_fd (an eventfd, -1 for none) is written when another thread moves a
+    // timer before the time the loop sleeps until
+    explicit TimerQueue(int wakeup_fd = -1) : wakeup_fd_(wakeup_fd) {}
 
     TimerId addTimer(std::function<void()> &&callback, int expire_ms)
     {
         const TimerId id = getId();
-        const auto now = std::chrono::system_clock::now();
-        const auto expire_time = now + std::chrono::milliseconds(expire_ms);
+        const auto expire_time = Clock::now() + std::chrono::milliseconds(expire_ms);
+        bool is_wakeup_needed;
 
         {
             const std::lock_guard lock(mutex_);
             auto [iter, _] = timers_.emplace(expire_time, id);
             indices_.emplace(id, iter);
             callbacks_.emplace(id, std::move(callback));
+            is_wakeup_needed = updateWaitUntil(expire_time);
         }
 
+        if (is_wakeup_needed)
+            wakeup();
         return id;
     }
 
     void resetTimer(TimerId timer_id, int expire_ms)
     {
-        const auto now = std::chrono::system_clock::now();
-        const auto expire_time = now + std::chrono::milliseconds(expire_ms);
+        const auto expire_time = Clock::now() + std::chrono::milliseconds(expire_ms);
+        bool is_wakeup_needed;
 
         {
             const std::lock_guard lock(mutex_);
@@ -47,7 +63,11 @@ public:
             auto hint = timers_.erase(timer_iter);
             timer_iter = timers_.emplace_hint(hint, expire_time, timer_id); // O(1) hint add
             ind_iter->second = timer_iter;
+            is_wakeup_needed = updateWaitUntil(expire_time);
         }
+
+        if (is_wakeup_needed)
+            wakeup();
     }
 
     void removeTimer(TimerId id)
@@ -63,9 +83,10 @@ public:
         indices_.erase(iter);
     }
 
-    long tick() // returns next expire ms from now, returns -1 if no timer
+    // runs the expired timers, returns ms to sleep for the next one (slack included), -1 if no timer
+    long tick()
     {
-        const auto now = std::chrono::system_clock::now();
+        const auto now = Clock::now();
         long res = -1;
         std::vector<std::function<void()>> callbacks;
 
@@ -85,7 +106,12 @@ public:
                 iter++;
             }
             if (iter != timers_.end())
-                res = std::chrono::duration_cast<std::chrono::milliseconds>(iter->first - now).count();
+            {
+                res = std::chrono::ceil<std::chrono::milliseconds>(iter->first - now).count() + kSlackMs;
+                wait_until_ = iter->first + std::chrono::milliseconds(kSlackMs);
+            }
+            else
+                wait_until_ = Clock::time_point::max();
 
             timers_.erase(timers_.begin(), iter);
         }
@@ -96,14 +122,43 @@ public:
         return res;
     }
 
+    // the loop is awake and calls tick() before it sleeps again, until then no wakeup is needed
+    void onWakeup()
+    {
+        const std::lock_guard lock(mutex_);
+        wait_until_ = Clock::time_point::min();
+    }
+
 private:
-    std::set<std::pair<std::chrono::time_point<std::chrono::system_clock>, TimerId>> timers_; // <expire time, timer_id>
+    std::set<std::pair<Clock::time_point, TimerId>> timers_; // <expire time, timer_id>
 
     using TimerIter = decltype(timers_)::iterator;
     std::unordered_map<TimerId, TimerIter> indices_;
     std::unordered_map<TimerId, std::function<void()>> callbacks_;
 
     std::mutex mutex_;
+    int wakeup_fd_;
+    Clock::time_point wait_until_{Clock::time_point::max()}; // guarded by mutex_
+
+    bool updateWaitUntil(Clock::time_point expire_time) noexcept
+    {
+        // a timer may fire kSlackMs late, the loop only needs a wakeup for an earlier one
+        if (expire_time + std::chrono::milliseconds(kSlackMs) >= wait_until_)
+            return false;
+        // awake, the loop's next tick() sees this timer
+        wait_until_ = Clock::time_point::min();
+        return true;
+    }
+
+    void wakeup() const noexcept
+    {
+        if (wakeup_fd_ == -1)
+            return;
+        const uint64_t one = 1;
+        const auto retval = write(wakeup_fd_, &one, sizeof(one));
+        (void)retval;
+    }
+
     static TimerId getId() noexcept
     {
         static std::atomic<TimerId> id{0};
@@ -0,0 +1,222 @@
+#include <fstream>
+#include <memory>
+#include <string>
+
+#include <cerrno>
+
+#ifdef WEBSERVER_WITH_OPENSSL
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#endif
+
+#include "./Tls.h"
+#include "./Logger.h"
+
+#ifdef WEBSERVER_WITH_OPENSSL
+
+static std::string opensslErrStr()
+{
+    char buf[256] = "unknown";
+    if (const auto err = ERR_get_error(); err != 0)
+        ERR_error_string_n(err, buf, sizeof(buf));
+    ERR_clear_error();
+    return buf;
+}
+
+// the kernel lists "tls" once the tls module is loaded
+static bool isKernelTlsAvailable()
+{
+    std::ifstream ulp("/proc/sys/net/ipv4/tcp_available_ulp");
+    std::string name;
+    while (ulp >> name)
+        if (name == "tls")
+            return true;
+    return false;
+}
+
+static int selectAlpn(SSL *, const unsigned char **out, unsigned char *out_len,
+                      const unsigned char *in, unsigned int in_len, void *)
+{
+    static constexpr unsigned char kProtocols[] = "\x02h2\x08http/1.1";
+    unsigned char *selected;
+    if (SSL_select_next_proto(&selected, out_len, kProtocols, sizeof(kProtocols) - 1, in, in_len) != OPENSSL_NPN_NEGOTIATED)
+        return SSL_TLSEXT_ERR_NOACK;
+    *out = selected;
+    return SSL_TLSEXT_ERR_OK;
+}
+
+TlsContext::~TlsContext()
+{
+    SSL_CTX_free(ctx_);
+}
+
+bool TlsContext::init(const std::string &cert_path, const std::string &key_path)
+{
+    ctx_ = SSL_CTX_new(TLS_server_method());
+    if (ctx_ == nullptr)
+    {
+        LOG_ERROR("SSL_CTX_new failed, reason: ", opensslErrStr());
+        return false;
+    }
+
+    SSL_CTX_set_min_proto_version(ctx_, TLS1_2_VERSION);
+    SSL_CTX_set_options(ctx_, SSL_OP_ENABLE_KTLS | SSL_OP_NO_RENEGOTIATION | SSL_OP_CIPHER_SERVER_PREFERENCE);
+    // OutputBuffer retries partial writes from its own segments
+    SSL_CTX_set_mode(ctx_, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER | SSL_MODE_RELEASE_BUFFERS);
+    // AES-GCM and ChaCha20-Poly1305 are the ciphers the kernel can take over
+    if (SSL_CTX_set_cipher_list(ctx_, "ECDHE+AESGCM:ECDHE+CHACHA20") != 1)
+    {
+        LOG_ERROR("SSL_CTX_set_cipher_list failed, reason: ", opensslErrStr());
+        return false;
+    }
+    SSL_CTX_set_alpn_select_cb(ctx_, selectAlpn, nullptr);
+
+    if (SSL_CTX_use_certificate_chain_file(ctx_, cert_path.c_str()) != 1)
+    {
+        LOG_ERROR("Failed to load certificate ", cert_path, ", reason: ", opensslErrStr());
+        return false;
+    }
+    if (SSL_CTX_use_PrivateKey_file(ctx_, key_path.c_str(), SSL_FILETYPE_PEM) != 1 || SSL_CTX_check_private_key(ctx_) != 1)
+    {
+        LOG_ERROR("Failed to load private key ", key_path, ", reason: ", opensslErrStr());
+        return false;
+    }
+
+    if (isKernelTlsAvailable())
+        LOG_INFO("TLS enabled, records are encrypted by the kernel (kTLS) when the cipher allows");
+    else
+        LOG_INFO("TLS enabled, kTLS is not available (load the tls module), records are encrypted in user space");
+    return true;
+}
+
+std::unique_ptr<TlsStream> TlsContext::newStream(int fd) const
+{
+    SSL *ssl = SSL_new(ctx_);
+    if (ssl == nullptr || SSL_set_fd(ssl, fd) != 1)
+    {
+        LOG_ERROR("Failed to create TLS session for fd = ", fd, ", reason: ", opensslErrStr());
+        SSL_free(ssl);
+        return nullptr;
+    }
+    SSL_set_accept_state(ssl);
+    return std::make_unique<TlsStream>(ssl);
+}
+
+TlsStream::~TlsStream()
+{
+    SSL_free(ssl_);
+}
+
+TlsStream::HandshakeResult TlsStream::handshake()
+{
+    ERR_clear_error();
+    const int retval = SSL_do_handshake(ssl_);
+    if (retval == 1)
+    {
+        is_kernel_send_ = BIO_get_ktls_send(SSL_get_wbio(ssl_));
+        const unsigned char *alpn;
+        unsigned int alpn_len;
+        SSL_get0_alpn_selected(ssl_, &alpn, &alpn_len);
+        is_http2_ = alpn_len == 2 && alpn[0] == 'h' && alpn[1] == '2';
+        LOG_DEBUG("TLS handshake done, ", SSL_get_version(ssl_), " ", SSL_get_cipher_name(ssl_),
+                  ", ktls send = ", is_kernel_send_, ", h2 = ", is_http2_);
+        return HandshakeResult::DONE;
+    }
+
+    switch (SSL_get_error(ssl_, retval))
+    {
+    case SSL_ERROR_WANT_READ:
+        return HandshakeResult::WANT_READ;
+    case SSL_ERROR_WANT_WRITE:
+        return HandshakeResult::WANT_WRITE;
+    default:
+        LOG_DEBUG("TLS handshake failed, reason: ", opensslErrStr());
+        return HandshakeResult::ERROR;
+    }
+}
+
+long TlsStream::recv(void *buf, std::size_t len)
+{
+    ERR_clear_error();
+    errno = 0;
+    const int retval = SSL_read(ssl_, buf, len);
+    if (retval > 0)
+        return retval;
+
+    switch (SSL_get_error(ssl_, retval))
+    {
+    case SSL_ERROR_WANT_READ:
+    case SSL_ERROR_WANT_WRITE:
+        errno = EAGAIN;
+        return -1;
+    case SSL_ERROR_ZERO_RETURN:
+        return 0;
+    case SSL_ERROR_SYSCALL:
+        // EOF without close_notify, most clients just close
+        if (errno == 0)
+            return 0;
+        return -1;
+    default:
+        LOG_DEBUG("SSL_read failed, reason: ", opensslErrStr());
+        errno = ECONNRESET;
+        return -1;
+    }
+}
+
+long TlsStream::send(const void *buf, std::size_t len)
+{
+    ERR_clear_error();
+    const int retval = SSL_write(ssl_, buf, len);
+    if (retval > 0)
+        return retval;
+
+    switch (SSL_get_error(ssl_, retval))
+    {
+    case SSL_ERROR_WANT_READ:
+    case SSL_ERROR_WANT_WRITE:
+        errno = EAGAIN;
+        return -1;
+    case SSL_ERROR_SYSCALL:
+        return -1;
+    default:
+        LOG_DEBUG("SSL_write failed, reason: ", opensslErrStr());
+        errno = EPIPE;
+        return -1;
+    }
+}
+
+#else
+
+TlsContext::~TlsContext() = default;
+
+bool TlsContext::init(const std::string &, const std::string &)
+{
+    LOG_ERROR("TLS is not available, build with WITH_OPENSSL=1");
+    return false;
+}
+
+std::unique_ptr<TlsStream> TlsContext::newStream(int) const
+{
+    return nullptr;
+}
+
+TlsStream::~TlsStream() = default;
+
+TlsStream::HandshakeResult TlsStream::handshake()
+{
+    return HandshakeResult::ERROR;
+}
+
+long TlsStream::recv(void *, std::size_t)
+{
+    errno = ENOTSUP;
+    return -1;
+}
+
+long TlsStream::send(const void *, std::size_t)
+{
+    errno = ENOTSUP;
+    return -1;
+}
+
+#endif
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "./util/Noncopyable.h"
+
+// OpenSSL types, so that only Tls.cc needs the OpenSSL headers
+struct ssl_st;
+struct ssl_ctx_st;
+
+class TlsStream;
+
+// Server side TLS with OpenSSL, compiled in with WEBSERVER_WITH_OPENSSL (see
+// Makefile). Sessions ask OpenSSL to hand the negotiated keys to the kernel
+// (kTLS): when that works the socket is written with plain sendmsg and
+// sendfile and the kernel encrypts, so file bodies stay zero-copy. Without
+// kernel support records are encrypted in user space by TlsStream::send.
+class TlsContext : NonCopyable
+{
+public:
+    TlsContext() = default;
+    ~TlsContext();
+
+    // loads a PEM certificate chain and private key
+    [[nodiscard]] bool init(const std::string &cert_path, const std::string &key_path);
+    // a server session on the connected socket fd, nullptr on failure
+    [[nodiscard]] std::unique_ptr<TlsStream> newStream(int fd) const;
+
+private:
+    ssl_ctx_st *ctx_{nullptr};
+};
+
+class TlsStream : NonCopyable
+{
+public:
+    enum class HandshakeResult
+    {
+        DONE,
+        WANT_READ,
+        WANT_WRITE,
+        ERROR,
+    };
+
+    explicit TlsStream(ssl_st *ssl) noexcept : ssl_(ssl) {}
+    ~TlsStream();
+
+    [[nodiscard]] HandshakeResult handshake();
+
+    // like ::recv and ::send on a non-blocking socket: bytes transferred,
+    // 0 when the peer closed, -1 with errno set (EAGAIN to wait for epoll)
+    [[nodiscard]] long recv(void *buf, std::size_t len);
+    [[nodiscard]] long send(const void *buf, std::size_t len);
+
+    // the kernel encrypts what is written to the socket (kTLS TX)
+    [[nodiscard]] bool isKernelSend() const noexcept { return is_kernel_send_; }
+    // "h2" was selected by ALPN, the client starts with the HTTP/2 preface
+    [[nodiscard]] bool isHttp2() const noexcept { return is_http2_; }
+
+private:
+    ssl_st *ssl_;
+    bool is_kernel_send_{false};
+    bool is_http2_{false};
+};
@@ -0,0 +1,186 @@
+#include <algorithm>
+
+#include <cerrno>
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "./UpstreamPool.h"
+#include "./Proxy.h"
+#include "./Logger.h"
+#include "./util/utils.h"
+
+UpstreamPool::UpstreamPool(int epoll_fd)
+    : epoll_fd_(epoll_fd), idle_(Proxy::instance().upstreamCount())
+{
+}
+
+UpstreamPool::~UpstreamPool()
+{
+    for (std::size_t fd = 0; fd < slots_.size(); fd++)
+        if (slots_[fd].upstream != -1)
+            ::close(fd);
+}
+
+UpstreamPool::Slot &UpstreamPool::slotLocked(int fd)
+{
+    if (fd >= static_cast<int>(slots_.size()))
+        slots_.resize(fd + 1);
+    return slots_[fd];
+}
+
+void UpstreamPool::warmUp()
+{
+    auto &proxy = Proxy::instance();
+    const std::lock_guard lock(mutex_);
+    for (std::size_t upstream = 0; upstream < proxy.upstreamCount(); upstream++)
+        for (int i = 0; i < proxy.minIdle(); i++)
+            openIdleLocked(upstream);
+}
+
+void UpstreamPool::openIdleLocked(int upstream)
+{
+    auto &proxy = Proxy::instance();
+    const int fd = proxy.connectTo(upstream);
+    if (fd == -1)
+    {
+        proxy.markDown(upstream);
+        return;
+    }
+    proxy.upstream(upstream).connects.fetch_add(1, std::memory_order_relaxed);
+    slotLocked(fd) = Slot{upstream, -1, 0, true, false};
+    idle_[upstream].push_back(fd);
+    if (epollAddOneShot(epoll_fd_, EPOLLOUT | EPOLLRDHUP, fd) == -1)
+    {
+        LOG_ERROR("Epoll add failed for upstream fd(", fd, "), reason: ", logErrStr(errno));
+        closeLocked(fd);
+    }
+}
+
+void UpstreamPool::removeIdleLocked(int fd)
+{
+    auto &idle = idle_[slots_[fd].upstream];
+    idle.erase(std::find(idle.begin(), idle.end(), fd));
+}
+
+void UpstreamPool::closeLocked(int fd)
+{
+    if (slots_[fd].owner == -1)
+        removeIdleLocked(fd);
+    slots_[fd] = Slot();
+    epollDel(epoll_fd_, fd);
+    ::close(fd);
+}
+
+UpstreamPool::Connection UpstreamPool::acquire(int upstream, int client_fd)
+{
+    auto &proxy = Proxy::instance();
+    const std::lock_guard lock(mutex_);
+    auto &idle = idle_[upstream];
+    while (!idle.empty())
+    {
+        const int fd = idle.back();
+        idle.pop_back();
+        auto &slot = slots_[fd];
+        char byte;
+        // an idle connection has nothing to read; EOF or stray bytes end it
+        if (!slot.is_connecting && ::recv(fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT) != -1)
+        {
+            slot = Slot();
+            epollDel(epoll_fd_, fd);
+            ::close(fd);
+            continue;
+        }
+        slot.owner = client_fd;
+        slot.is_armed = false;
+        if (idle.size() < static_cast<std::size_t>(proxy.minIdle()) && proxy.upstream(upstream).is_healthy.load(std::memory_order_relaxed))
+            openIdleLocked(upstream);
+        return Connection{fd, upstream, slot.requests++ != 0, slot.is_connecting};
+    }
+
+    const int fd = proxy.connectTo(upstream);
+    if (fd == -1)
+        return Connection{};
+    proxy.upstream(upstream).connects.fetch_add(1, std::memory_order_relaxed);
+    slotLocked(fd) = Slot{upstream, client_fd, 1, true, false};
+    if (epollAddOneShot(epoll_fd_, 0, fd) == -1)
+    {
+        LOG_ERROR("Epoll add failed for upstream fd(", fd, "), reason: ", logErrStr(errno));
+        closeLocked(fd);
+        return Connection{};
+    }
+    return Connection{fd, upstream, false, true};
+}
+
+void UpstreamPool::release(const Connection &connection)
+{
+    const std::lock_guard lock(mutex_);
+    auto &slot = slots_[connection.fd];
+    auto &idle = idle_[connection.upstream];
+    if (idle.size() >= kMaxIdle)
+    {
+        closeLocked(connection.fd);
+        return;
+    }
+    slot.owner = -1;
+    slot.is_connecting = false;
+    slot.is_armed = false;
+    idle.push_back(connection.fd);
+    if (epollModOneShot(epoll_fd_, EPOLLIN | EPOLLRDHUP, connection.fd) == -1)
+    {
+        LOG_ERROR("Epoll modify failed for upstream fd(", connection.fd, "), reason: ", logErrStr(errno));
+        closeLocked(connection.fd);
+    }
+}
+
+void UpstreamPool::discard(const Connection &connection)
+{
+    const std::lock_guard lock(mutex_);
+    closeLocked(connection.fd);
+}
+
+bool UpstreamPool::arm(const Connection &connection, uint32_t events)
+{
+    const std::lock_guard lock(mutex_);
+    slots_[connection.fd].is_armed = true;
+    if (epollModOneShot(epoll_fd_, events | EPOLLRDHUP, connection.fd) == -1)
+    {
+        LOG_ERROR("Epoll modify failed for upstream fd(", connection.fd, "), reason: ", logErrStr(errno));
+        slots_[connection.fd].is_armed = false;
+        return false;
+    }
+    return true;
+}
+
+int UpstreamPool::dispatch(int fd, uint32_t events)
+{
+    const std::lock_guard lock(mutex_);
+    if (fd >= static_cast<int>(slots_.size()) || slots_[fd].upstream == -1)
+        return kNotUpstream;
+
+    auto &slot = slots_[fd];
+    if (slot.owner != -1)
+    {
+        if (!slot.is_armed)
+            return kHandled;
+        slot.is_armed = false;
+        return slot.owner;
+    }
+
+    int error = 0;
+    socklen_t error_len = sizeof(error);
+    if (slot.is_connecting && (events & EPOLLOUT) && !(events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) &&
+        ::getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &error_len) == 0 && error == 0)
+    {
+        slot.is_connecting = false;
+        if (epollModOneShot(epoll_fd_, EPOLLIN | EPOLLRDHUP, fd) == -1)
+            closeLocked(fd);
+        return kHandled;
+    }
+    // the upstream closed an idle connection, or it never connected
+    if (slot.is_connecting)
+        Proxy::instance().markDown(slot.upstream);
+    closeLocked(fd);
+    return kHandled;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <mutex>
+#include <vector>
+
+#include <cinttypes>
+
+#include "./util/Noncopyable.h"
+
+// The upstream connections of one worker, all registered in the worker's
+// epoll set (one shot, like the client sockets). Idle connections wait for
+// EPOLLIN|EPOLLRDHUP, so one the upstream closes or writes to is dropped by
+// the worker; a connection in use belongs to the client fd of its request
+// until release() or discard(). Each worker keeps Proxy::minIdle() idle
+// connections per healthy upstream open, a request rarely waits for a
+// connect.
+//
+// The worker asks dispatch() first for every event: an event of a request's
+// connection counts only if the request armed it, so an event an idle
+// connection raised just before it was taken is not mistaken for one of the
+// request.
+class UpstreamPool : NonCopyable
+{
+public:
+    // more idle connections to one upstream are closed
+    static constexpr std::size_t kMaxIdle = 64;
+
+    struct Connection
+    {
+        int fd{-1};
+        int upstream{-1};
+        bool is_reused{false};     // served a request before
+        bool is_connecting{false}; // wait for EPOLLOUT and check SO_ERROR first
+    };
+
+    explicit UpstreamPool(int epoll_fd);
+    ~UpstreamPool();
+
+    // opens the idle connections of every upstream
+    void warmUp();
+
+    // an idle connection of upstream or a new one, fd = -1 if it cannot connect
+    [[nodiscard]] Connection acquire(int upstream, int client_fd);
+    // the response was complete, the connection waits for the next request
+    void release(const Connection &connection);
+    void discard(const Connection &connection);
+    // one shot events the request waits for on its connection
+    [[nodiscard]] bool arm(const Connection &connection, uint32_t events);
+
+    static constexpr int kNotUpstream = -1; // a client socket
+    static constexpr int kHandled = -2;     // an idle connection or an event nobody waits for
+    // the client fd of the request waiting for the event on fd, or kNotUpstream / kHandled
+    [[nodiscard]] int dispatch(int fd, uint32_t events);
+
+private:
+    struct Slot
+    {
+        int upstream{-1}; // -1 if fd is no upstream connection
+        int owner{-1};    // client fd, -1 while idle
+        unsigned requests{0};
+        bool is_connecting{false};
+        bool is_armed{false};
+    };
+
+    const int epoll_fd_;
+    std::mutex mutex_;
+    std::vector<Slot> slots_;            // by fd
+    std::vector<std::vector<int>> idle_; // by upstream, the most recently used last
+
+    // a new connection to upstream, added as idle
+    void openIdleLocked(int upstream);
+    void closeLocked(int fd);
+    void removeIdleLocked(int fd);
+    [[nodiscard]] Slot &slotLocked(int fd);
+};
@@ -1,4 +1,5 @@
 #include <array>
+#include <chrono>
 #include <memory>
 #include <functional>
 #include <shared_mutex>
@@ -6,37 +7,77 @@
 
 #include <cassert>
 #include <cinttypes>
-
-#include <sys/timerfd.h>
+#include <csignal>
+#include <cstddef>
+#include <cstdlib>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
 #include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
 
 #include "./WebServer.h"
 #include "./TcpSocket.h"
 #include "./ThreadPool.h"
 #include "./HttpContext.h"
+#include "./RequestHandler.h"
+#include "./Compression.h"
+#include "./CompressionCache.h"
+#include "./MappedFileCache.h"
+#include "./OutputBuffer.h"
+#include "./LoadShedder.h"
+#include "./RateLimiter.h"
+#include "./CachePolicy.h"
+#include "./Proxy.h"
+#include "./UpstreamPool.h"
+#include "./FastCgi.h"
+#include "./FastCgiPool.h"
+#include "./LatencyRecorder.h"
+#include "./Mime.h"
 #include "./util/utils.h"
 #include "./util/FdHolder.h"
 #include "./Logger.h"
 
-static timespec getTimeSpec(long ms)
+// false if the connection was closed for its client being over the rate limit
+static bool checkRateLimit(int client_fd, const sockaddr_storage &peer_addr)
 {
-    timespec ts;
-    ts.tv_sec = ms / 1000;
-    ts.tv_nsec = (ms % 1000) * 1'000'000;
-    return ts;
+    auto &rate_limiter = RateLimiter::instance();
+    if (!rate_limiter.isEnabled())
+        return true;
+    // buckets are per IPv4 address, a Unix socket peer is a local front proxy and not limited
+    if (peer_addr.ss_family != AF_INET)
+    {
+        rate_limiter.setPeer(client_fd, 0, false);
+        return true;
+    }
+
+    const uint32_t addr = reinterpret_cast<const sockaddr_in &>(peer_addr).sin_addr.s_addr;
+    const bool is_limited = !rate_limiter.acquire(addr);
+    if (is_limited && rate_limiter.action() == RateLimiter::Action::CLOSE)
+    {
+        ::close(client_fd);
+        LoadShedder::instance().onClosed();
+        return false;
+    }
+    // the worker answers a limited client with a 429 once its request is there
+    rate_limiter.setPeer(client_fd, addr, is_limited);
+    return true;
 }
 
-static int setTimerFd(int fd, long loop_ms)
-{
-    itimerspec timerspec;
-    explicit_bzero(&timerspec, sizeof(timerspec));
+static constexpr const char *kListenFdsEnv = "WEBSERVER_LISTEN_FDS";
+static constexpr const char *kUpgradeParentEnv = "WEBSERVER_UPGRADE_PARENT";
 
-    timerspec.it_interval = getTimeSpec(loop_ms);
-    timerspec.it_value = getTimeSpec(loop_ms);
-    return timerfd_settime(fd, 0, &timerspec, nullptr);
-}
+// how long an idle acceptor takes to see is_stopping
+static constexpr int kAcceptorStopCheckMs = 500;
 
-static void acceptorEventLoopBlock(const std::vector<FdHolder> &worker_epfds, const TcpSocket &listen_socket)
+static void acceptorEventLoopBlock(const std::vector<FdHolder> &worker_epfds, const TcpSocket &listen_socket,
+                                   const std::atomic_bool &is_stopping)
 {
     int worker_epfd_ind = 0;
     if (!listen_socket.setNonBlocking(false))
@@ -44,12 +85,23 @@ static void acceptorEventLoopBlock(const std::vector<FdHolder> &worker_epfds, co
         LOG_ERROR("failed to set non blocking for listen socket, fd = ", listen_socket.fd());
         return;
     }
+    LOGIF_BERROR(listen_socket.setRecvTimeout(kAcceptorStopCheckMs), "Failed to set receive timeout for fd = ", listen_socket.fd());
 
-    while (true)
+    while (!is_stopping.load(std::memory_order_relaxed))
     {
-        int client_fd = listen_socket.accept();
+        LoadShedder::instance().waitForCapacity();
+        sockaddr_storage peer_addr;
+        int client_fd = listen_socket.accept(&peer_addr);
         if (client_fd == -1)
+        {
+            // the receive timeout expired, look at is_stopping again
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                continue;
             break;
+        }
+        LoadShedder::instance().onAccepted();
+        if (!checkRateLimit(client_fd, peer_addr))
+            continue;
 
         if (epollAddOneShot(worker_epfds[worker_epfd_ind++].fd(), EPOLLIN | EPOLLRDHUP /*|EPOLLET*/, client_fd) == -1)
         {
@@ -60,12 +112,14 @@ static void acceptorEventLoopBlock(const std::vector<FdHolder> &worker_epfds, co
     }
 }
 
-static void acceptorEventLoopEpoll(const std::vector<FdHolder> &worker_epfds, const TcpSocket &listen_socket)
+static void acceptorEventLoopEpoll(const std::vector<FdHolder> &worker_epfds, const TcpSocket &listen_socket,
+                                   const std::atomic_bool &is_stopping)
 {
     const int epfd = epoll_create(1);
     if (epfd == -1)
     {
         LOG_ERROR("Failed to create epoll fd, reason: ", logErrStr(errno));
+        return;
     }
 
     if (epollAdd(epfd, EPOLLIN | EPOLLET, listen_socket.fd()) == -1)
@@ -80,11 +134,11 @@ static void acceptorEventLoopEpoll(const std::vector<FdHolder> &worker_epfds, co
     std::array<epoll_event, kMaxEventArrSize> events;
     int worker_epfd_ind = 0;
 
-    while (true)
+    while (!is_stopping.load(std::memory_order_relaxed))
     {
-        int event_count = epoll_wait(epfd, events.data(), events.size(), -1);
+        int event_count = epoll_wait(epfd, events.data(), events.size(), kAcceptorStopCheckMs);
         while (event_count == -1 && errno == EINTR)
-            event_count = epoll_wait(epfd, events.data(), events.size(), -1);
+            event_count = epoll_wait(epfd, events.data(), events.size(), kAcceptorStopCheckMs);
 
         if (event_count == -1)
         {
@@ -95,11 +149,16 @@ static void acceptorEventLoopEpoll(const std::vector<FdHolder> &worker_epfds, co
         if (event_count == 0)
             continue;
 
-        while (true) // loop until no connection can be accepted
+        while (!is_stopping.load(std::memory_order_relaxed)) // loop until no connection can be accepted
         {
-            int client_fd = listen_socket.accept();
+            LoadShedder::instance().waitForCapacity();
+            sockaddr_storage peer_addr;
+            int client_fd = listen_socket.accept(&peer_addr);
             if (client_fd == -1)
                 break;
+            LoadShedder::instance().onAccepted();
+            if (!checkRateLimit(client_fd, peer_addr))
+                continue;
 
             if (epollAddOneShot(worker_epfds[worker_epfd_ind++].fd(), EPOLLIN | EPOLLRDHUP /*|EPOLLET*/, client_fd) == -1)
             {
@@ -111,54 +170,177 @@ static void acceptorEventLoopEpoll(const std::vector<FdHolder> &worker_epfds, co
     }
 }
 
-void WebServer::acceptorLoop(std::string_view ip, uint16_t port)
+// fd is a listening socket of the address, for IPv4 the port is enough: the previous
+// process ran with the same addresses
+static bool isListeningOn(int fd, const std::string &ip, uint16_t port)
 {
-    LOG_INFO("Acceptor thread start on (", ip, ", ", port, ")");
+    int is_listening = 0;
+    socklen_t len = sizeof(is_listening);
+    sockaddr_storage addr;
+    socklen_t addr_len = sizeof(addr);
+    if (getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &is_listening, &len) == -1 || !is_listening ||
+        getsockname(fd, reinterpret_cast<sockaddr *>(&addr), &addr_len) == -1)
+        return false;
+    if (addr.ss_family == AF_INET)
+        return ntohs(reinterpret_cast<const sockaddr_in &>(addr).sin_port) == port;
+    if (addr.ss_family != AF_UNIX || port != 0)
+        return false;
 
-    auto listen_socket = TcpSocket();
-    LOGIF_BERROR(listen_socket.setReuseAddr(true), "Failed to set reuse addr option for fd = ", listen_socket.fd());
-    LOGIF_BERROR(listen_socket.setReusePort(true), "Failed to set reuse port option for fd = ", listen_socket.fd());
-    LOGIF_BERROR(listen_socket.setNonBlocking(true), "Failed to set nonblocking option for fd = ", listen_socket.fd());
+    // the name as given to addUnixListenAddress(), '@' for the NUL of an abstract one
+    const auto &un = reinterpret_cast<const sockaddr_un &>(addr);
+    std::string name(un.sun_path, addr_len - offsetof(sockaddr_un, sun_path));
+    if (!name.empty() && name.front() == '\0')
+        name.front() = '@';
+    else if (!name.empty() && name.back() == '\0')
+        name.pop_back();
+    return ip == logstr(WebServer::kUnixPrefix, name);
+}
 
-    if (listen_socket.bind(ip, port) == -1)
+bool WebServer::openListenSockets()
+{
+    // "fd,fd,..." in listen_addresses_ order, set by spawnUpgrade() of the previous process
+    std::vector<int> inherited_fds;
+    if (const char *env = getenv(kListenFdsEnv))
     {
-        LOG_ERROR("Failed to bind(", ip, ",", port, ")");
-        return;
+        char *end;
+        for (const char *p = env; *p != '\0'; p = *end == ',' ? end + 1 : end)
+        {
+            const long fd = std::strtol(p, &end, 10);
+            if (end == p)
+                break;
+            inherited_fds.push_back(fd);
+        }
+        unsetenv(kListenFdsEnv);
     }
 
-    if (listen_socket.listen() == -1)
+    for (std::size_t i = 0; i < listen_addresses_.size(); i++)
     {
-        LOG_ERROR("Failed to listen.");
-        return;
+        const auto &[ip, port] = listen_addresses_[i];
+        if (i < inherited_fds.size() && isListeningOn(inherited_fds[i], ip, port))
+        {
+            listen_sockets_.push_back(std::make_unique<TcpSocket>(inherited_fds[i]));
+            inherited_fds[i] = -1;
+            LOG_INFO("Listen on (", ip, ", ", port, ") with inherited fd = ", listen_sockets_.back()->fd());
+            continue;
+        }
+
+        if (port == 0)
+        {
+            if (!openUnixListenSocket(i))
+                return false;
+            continue;
+        }
+
+        auto listen_socket = std::make_unique<TcpSocket>();
+        LOGIF_BERROR(listen_socket->setReuseAddr(true), "Failed to set reuse addr option for fd = ", listen_socket->fd());
+        LOGIF_BERROR(listen_socket->setReusePort(true), "Failed to set reuse port option for fd = ", listen_socket->fd());
+        LOGIF_BERROR(listen_socket->setNonBlocking(true), "Failed to set nonblocking option for fd = ", listen_socket->fd());
+        // inherited by accepted sockets, OutputBuffer coalesces small writes with MSG_MORE itself
+        LOGIF_BERROR(listen_socket->setNoDelay(true), "Failed to set nodelay option for fd = ", listen_socket->fd());
+
+        if (listen_socket->bind(ip, port) == -1 || listen_socket->listen() == -1)
+        {
+            LOG_ERROR("Failed to listen on (", ip, ", ", port, ")");
+            return false;
+        }
+        listen_sockets_.push_back(std::move(listen_socket));
     }
 
+    // inherited sockets of addresses this process does not have
+    for (const int fd : inherited_fds)
+        if (fd != -1)
+            ::close(fd);
+    return true;
+}
+
+bool WebServer::openUnixListenSocket(std::size_t index)
+{
+    const auto &ip = listen_addresses_[index].first;
+    // a second bind of the path would fail, the acceptors of an address accept on one socket
+    if (index > 0 && listen_addresses_[index - 1].first == ip)
+    {
+        const int fd = ::dup(listen_sockets_.back()->fd());
+        if (fd == -1)
+        {
+            LOG_ERROR("Failed to dup the socket of ", ip, ", reason: ", logErrStr(errno));
+            return false;
+        }
+        listen_sockets_.push_back(std::make_unique<TcpSocket>(fd));
+        return true;
+    }
+
+    auto listen_socket = std::make_unique<TcpSocket>(TcpSocket::Domain::UNIX);
+    LOGIF_BERROR(listen_socket->setNonBlocking(true), "Failed to set nonblocking option for fd = ", listen_socket->fd());
+    if (listen_socket->bindUnix(std::string_view(ip).substr(kUnixPrefix.size()), unix_socket_mode_) == -1 ||
+        listen_socket->listen() == -1)
+    {
+        LOG_ERROR("Failed to listen on ", ip);
+        return false;
+    }
+    listen_sockets_.push_back(std::move(listen_socket));
+    return true;
+}
+
+void WebServer::acceptorLoop(std::size_t index)
+{
+    const auto &[ip, port] = listen_addresses_[index];
+    LOG_INFO("Acceptor thread start on (", ip, ", ", port, ")");
+
     if (is_acceptor_using_epoll)
-        acceptorEventLoopEpoll(worker_epfds_, listen_socket);
+        acceptorEventLoopEpoll(worker_epfds_, *listen_sockets_[index], is_stopping_);
     else
-        acceptorEventLoopBlock(worker_epfds_, listen_socket);
+        acceptorEventLoopBlock(worker_epfds_, *listen_sockets_[index], is_stopping_);
+    LOG_INFO("Acceptor thread stop on (", ip, ", ", port, ")");
+}
+
+bool WebServer::isTlsConnection(int fd) const
+{
+    sockaddr_storage addr;
+    socklen_t addr_len = sizeof(addr);
+    if (getsockname(fd, reinterpret_cast<sockaddr *>(&addr), &addr_len) == -1)
+    {
+        LOG_ERROR("getsockname failed for fd = ", fd, ", reason: ", logErrStr(errno));
+        return false;
+    }
+    // Unix addresses are plain HTTP
+    return addr.ss_family == AF_INET &&
+           std::find(tls_ports_.begin(), tls_ports_.end(), ntohs(reinterpret_cast<const sockaddr_in &>(addr).sin_port)) != tls_ports_.end();
 }
 
 void WebServer::workerLoop(int epfd)
 {
-    const int timerfd = timerfd_create(CLOCK_REALTIME, 0);
-    if (timerfd == -1)
+    // pool threads moving a connection timer before the epoll_wait timeout wake the loop
+    const int timer_wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (timer_wakeup_fd == -1)
     {
-        LOG_ERROR("Failed to create timerfd, reason: ", logErrStr(errno));
+        LOG_ERROR("Failed to create timer eventfd, reason: ", logErrStr(errno));
         return;
     }
-    const FdHolder timerfd_guard(timerfd);
+    const FdHolder timer_wakeup_fd_guard(timer_wakeup_fd);
 
     static constexpr int kMaxEventArrSize = 10000;
-    static constexpr int kConnectionTimeOutMs = 5000;
     std::array<epoll_event, kMaxEventArrSize> events;
     std::vector<std::unique_ptr<HttpContext>> contexts;
     std::vector<int> contexts_is_valid;
+    std::size_t connection_count = 0; // valid contexts, guarded by contexts_mtx
     std::mutex contexts_mtx;
-    TimerQueue timers;
+    TimerQueue timers(timer_wakeup_fd);
     ThreadPool pool;
     pool.start(worker_pool_size_);
+    // idle upstream connections wait in this epoll set too
+    std::unique_ptr<UpstreamPool> upstreams;
+    if (!Proxy::instance().empty())
+    {
+        upstreams = std::make_unique<UpstreamPool>(epfd);
+        upstreams->warmUp();
+    }
+    // so do the FastCGI connections, opened by the first requests
+    std::unique_ptr<FastCgiPool> fastcgi;
+    if (!FastCgi::instance().empty())
+        fastcgi = std::make_unique<FastCgiPool>(epfd);
+    std::vector<int> fastcgi_woken;
 
-    const auto eraseContext = [&contexts, &contexts_mtx, &contexts_is_valid, &timers](int fd)
+    const auto eraseContext = [&contexts, &contexts_mtx, &contexts_is_valid, &connection_count, &timers](int fd)
     {
         const std::lock_guard lock(contexts_mtx);
         LOG_DEBUG("EraseContext called, fd = ", fd);
@@ -168,12 +350,14 @@ void WebServer::workerLoop(int epfd)
             timers.removeTimer(contexts[fd]->getTimerId());
             contexts_is_valid[fd] = false;
             contexts[fd]->resetContext();
+            connection_count--;
+            LoadShedder::instance().onClosed();
             return true;
         }
         return false;
     };
 
-    const auto setContext = [this, &contexts, &contexts_mtx, &contexts_is_valid, epfd, &eraseContext](std::unique_ptr<TcpSocket> connection, TimerQueue::TimerId timer_id)
+    const auto setContext = [this, &contexts, &contexts_mtx, &contexts_is_valid, &connection_count, epfd, &eraseContext, &timers, &upstreams, &fastcgi](std::unique_ptr<TcpSocket> connection, TimerQueue::TimerId timer_id)
     {
         const auto fd = connection->fd();
 
@@ -200,7 +384,10 @@ void WebServer::workerLoop(int epfd)
                     [&eraseContext](int fd)
                     { eraseContext(fd); },
                     this->root_path_,
-                    timer_id);
+                    timers,
+                    timer_id,
+                    upstreams.get(),
+                    fastcgi.get());
             else
                 contexts[fd] = std::make_unique<HttpContext>(
                     std::move(connection),
@@ -208,8 +395,12 @@ void WebServer::workerLoop(int epfd)
                     [&eraseContext](int fd)
                     { eraseContext(fd); },
                     this->root_path_,
-                    timer_id);
+                    timers,
+                    timer_id,
+                    upstreams.get(),
+                    fastcgi.get());
             contexts_is_valid[fd] = true;
+            connection_count++;
 
             LOG_DEBUG("Set contexts[", fd, "], ptr = ", long(contexts[fd].get()), ", contexts.size() = ", contexts.size());
             return contexts[fd].get();
@@ -227,44 +418,105 @@ void WebServer::workerLoop(int epfd)
         return contexts_is_valid[fd] ? contexts[fd].get() : nullptr;
     };
 
-    if (epollAdd(epfd, EPOLLIN, timerfd) == -1)
+    const bool is_queue_delay_tracked = LoadShedder::instance().isQueueDelayTracked();
+
+    if (epollAdd(epfd, EPOLLIN, timer_wakeup_fd) == -1)
     {
-        LOG_ERROR("Failed to add epoll event EPOLLIN on timer_fd(fd=", timerfd, ")");
+        LOG_ERROR("Failed to add epoll event EPOLLIN on timer eventfd(fd=", timer_wakeup_fd, ")");
         return;
     }
-
-    static constexpr int kTimerExpirationInterval = 2000;
-    if (setTimerFd(timerfd, kTimerExpirationInterval) == -1)
+    // every worker sees the one write of start()
+    if (epollAdd(epfd, EPOLLIN | EPOLLET, drain_fd_) == -1)
     {
-        LOG_ERROR("Failed to set timer interval = ", kTimerExpirationInterval);
+        LOG_ERROR("Failed to add epoll event EPOLLIN on drain_fd(fd=", drain_fd_, ")");
         return;
     }
+    bool is_draining = false;
+    std::chrono::steady_clock::time_point drain_deadline;
 
+    // while draining, how often the connection count and the deadline are looked at
+    static constexpr int kDrainCheckMs = 50;
     while (true)
     {
-        int event_count = epoll_wait(epfd, events.data(), events.size(), -1);
+        // expired connections are closed, the loop sleeps until the next deadline
+        int timeout_ms = timers.tick();
+        if (is_draining && (timeout_ms == -1 || timeout_ms > kDrainCheckMs))
+            timeout_ms = kDrainCheckMs;
+
+        int event_count = epoll_wait(epfd, events.data(), events.size(), timeout_ms);
         while (event_count == -1 && errno == EINTR)
-            event_count = epoll_wait(epfd, events.data(), events.size(), -1);
+            event_count = epoll_wait(epfd, events.data(), events.size(), timeout_ms);
 
         if (event_count == -1)
         {
             LOG_ERROR("epoll_wait fails, reason: ", logErrStr(errno));
             return;
         }
+        timers.onWakeup();
 
-        bool has_timer_event = false;
         for (int i = 0; i < event_count; i++)
         {
             const auto &event = events[i];
+            if (upstreams)
+            {
+                // an upstream connection: idle ones are handled by the pool, the others wake their request
+                const int client_fd = upstreams->dispatch(event.data.fd, event.events);
+                if (client_fd >= 0)
+                {
+                    if (auto context = getContext(client_fd))
+                    {
+                        context->setDispatchTicks(LatencyRecorder::instance().start());
+                        pool.run([context]()
+                                 { context->doUpstream(); });
+                    }
+                }
+                if (client_fd != UpstreamPool::kNotUpstream)
+                    continue;
+            }
+            if (fastcgi)
+            {
+                // a FastCGI connection: its records go to their requests, which are woken
+                fastcgi_woken.clear();
+                if (fastcgi->dispatch(event.data.fd, event.events, fastcgi_woken))
+                {
+                    for (const int client_fd : fastcgi_woken)
+                    {
+                        if (auto context = getContext(client_fd))
+                        {
+                            context->setDispatchTicks(LatencyRecorder::instance().start());
+                            pool.run([context]()
+                                     { context->doUpstream(); });
+                        }
+                    }
+                    continue;
+                }
+            }
             if (event.events & EPOLLRDHUP || event.events & EPOLLHUP)
             {
                 LOG_DEBUG("Event EPOLLRDHUP or EPOLLHUP raised on fd ", event.data.fd);
                 if (eraseContext(event.data.fd))
                     epollDel(epfd, event.data.fd);
+                else if (getContext(event.data.fd) == nullptr)
+                {
+                    // closed before the first request, no context was made
+                    epollDel(epfd, event.data.fd);
+                    ::close(event.data.fd);
+                    LoadShedder::instance().onClosed();
+                }
+            }
+            else if (event.data.fd == timer_wakeup_fd)
+            {
+                uint64_t count;
+                LOGIF_PWARNING(read(timer_wakeup_fd, &count, sizeof(count)), "Failed to read timer eventfd, reason: ", logErrStr(errno));
             }
-            else if (event.data.fd == timerfd)
+            else if (event.data.fd == drain_fd_)
             {
-                has_timer_event = true;
+                is_draining = true;
+                drain_deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(drain_timeout_ms_);
+                const std::lock_guard lock(contexts_mtx);
+                for (std::size_t fd = 0; fd < contexts.size(); fd++)
+                    if (contexts_is_valid[fd])
+                        contexts[fd]->drain();
             }
             else if (event.events & EPOLLIN)
             {
@@ -274,17 +526,56 @@ void WebServer::workerLoop(int epfd)
                 LOG_DEBUG("Context ptr = ", context ? (long)context : 0l);
                 if (context == nullptr)
                 {
+                    const auto worker_connections = [&contexts_mtx, &connection_count]()
+                    {
+                        const std::lock_guard lock(contexts_mtx);
+                        return connection_count;
+                    }();
+                    const bool is_rate_limited = RateLimiter::instance().isEnabled() && RateLimiter::instance().isPeerLimited(fd);
+                    if (is_rate_limited || LoadShedder::instance().shouldShed(worker_connections))
+                    {
+                        // no context is made, a TLS client would not understand the plain 429 or 503
+                        if (!tls_context_ || !isTlsConnection(fd))
+                        {
+                            if (is_rate_limited)
+                                RateLimiter::instance().sendTooManyRequests(fd);
+                            else
+                                LoadShedder::instance().sendServiceUnavailable(fd);
+                        }
+                        epollDel(epfd, fd);
+                        ::close(fd);
+                        LoadShedder::instance().onClosed();
+                        continue;
+                    }
+
                     LOG_DEBUG("Create context on fd = ", fd);
                     context = setContext(
                         std::make_unique<TcpSocket>(fd),
                         timers.addTimer([fd, &eraseContext]()
                                         { eraseContext(fd); },
-                                        kConnectionTimeOutMs));
+                                        HttpContext::timeouts().header_ms));
+                    if (tls_context_ && isTlsConnection(fd))
+                    {
+                        auto tls = tls_context_->newStream(fd);
+                        if (tls == nullptr)
+                        {
+                            if (eraseContext(fd))
+                                epollDel(epfd, fd);
+                            continue;
+                        }
+                        context->startTls(std::move(tls));
+                    }
                 }
 
-                timers.resetTimer(context->getTimerId(), kConnectionTimeOutMs);
-                pool.run([context]()
-                         { context->doRead(); });
+                context->setDispatchTicks(LatencyRecorder::instance().start());
+                if (is_queue_delay_tracked)
+                    pool.run([context, enqueue_ns = LoadShedder::now()]()
+                             {
+                                 LoadShedder::instance().recordQueueDelay(enqueue_ns);
+                                 context->doRead(); });
+                else
+                    pool.run([context]()
+                             { context->doRead(); });
             }
             else if (event.events & EPOLLOUT)
             {
@@ -292,19 +583,44 @@ void WebServer::workerLoop(int epfd)
                 auto context = getContext(event.data.fd);
                 if (context)
                 {
-                    timers.resetTimer(context->getTimerId(), kConnectionTimeOutMs);
+                    context->setDispatchTicks(LatencyRecorder::instance().start());
+                    if (is_queue_delay_tracked)
+                        pool.run([context, enqueue_ns = LoadShedder::now()]()
+                                 {
+                                     LoadShedder::instance().recordQueueDelay(enqueue_ns);
+                                     context->doWrite(); });
+                    else
+                        pool.run([context]()
+                                 { context->doWrite(); });
+                }
+            }
+            else if (event.events & EPOLLERR)
+            {
+                LOG_DEBUG("EPOLLERR epfd = ", epfd, ", fd = ", event.data.fd);
+                auto context = getContext(event.data.fd);
+                if (context)
+                {
+                    context->setDispatchTicks(LatencyRecorder::instance().start());
                     pool.run([context]()
-                             { context->doWrite(); });
+                             { context->doErrorQueue(); });
                 }
             }
         }
 
-        if (has_timer_event)
+        if (is_draining)
         {
-            // LOG_DEBUG("Timer expired");
-            uint64_t buffer;
-            LOGIF_PWARNING(read(timerfd, &buffer, sizeof(buffer)), "Failed to read timerfd buffer, reason: ", logErrStr(errno));
-            timers.tick();
+            std::size_t left;
+            {
+                const std::lock_guard lock(contexts_mtx);
+                left = connection_count;
+            }
+            if (left == 0)
+                break;
+            if (std::chrono::steady_clock::now() >= drain_deadline)
+            {
+                LOG_WARNING("Drain timeout, close ", left, " connections of worker epfd = ", epfd);
+                break;
+            }
         }
     }
 
@@ -319,6 +635,7 @@ bool WebServer::start()
         return false;
     }
     LOG_INFO("Start WebServer");
+    LatencyRecorder::instance().setEnabled(is_latency_histogram_enabled_);
 
     if (!isDir(root_path_))
     {
@@ -327,7 +644,61 @@ bool WebServer::start()
     }
     root_path_ = std::filesystem::canonical(root_path_);
 
-    workers_.start(worker_size_);
+    if (!cache_policy_path_.empty() && !CachePolicy::instance().loadFile(cache_policy_path_))
+        return false;
+
+    for (auto &route : routes_)
+        if (!Router::instance().add(route.method, route.pattern, std::move(route.handler)))
+            return false;
+    for (const auto &[prefix, upstreams] : proxy_routes_)
+        if (!Proxy::instance().addRoute(prefix, upstreams))
+            return false;
+    if (!proxy_routes_.empty())
+        Proxy::instance().setHealthCheck(proxy_health_path_, proxy_health_interval_ms_);
+    for (const auto &[pattern, backends] : fastcgi_routes_)
+        if (!FastCgi::instance().addRoute(pattern, backends))
+            return false;
+    if (!routes_.empty())
+        LOG_INFO(routes_.size(), " routes before static files");
+
+    if (!tls_ports_.empty())
+    {
+        tls_context_ = std::make_unique<TlsContext>();
+        if (!tls_context_->init(tls_cert_path_, tls_key_path_))
+            return false;
+    }
+
+    if (is_precompress_on_start_)
+        LOG_INFO("Precompress ", root_path_, ", ", precompressDir(root_path_), " sidecars written");
+
+    OutputBuffer::setZeroCopyMinSize(zerocopy_min_size_);
+    HttpContext::setTimeouts(connection_timeouts_);
+    HttpContext::setMaxKeepAliveRequests(max_keep_alive_requests_);
+    HttpContext::setMaxBodySize(max_body_size_);
+    RequestHandler::setUploadEnabled(is_upload_enabled_);
+    RequestHandler::setAutoIndexEnabled(is_auto_index_enabled_);
+    LoadShedder::instance().setLimits(soft_connection_limit_, hard_connection_limit_, worker_soft_connection_limit_);
+    LoadShedder::instance().setQueueDelayTarget(queue_delay_target_ms_ * 1'000'000ll, queue_delay_interval_ms_ * 1'000'000ll);
+    if (rate_limit_ > 0)
+        RateLimiter::instance().start(rate_limit_, rate_limit_burst_, rate_limit_clients_,
+                                      is_rate_limit_silent_ ? RateLimiter::Action::CLOSE : RateLimiter::Action::TOO_MANY_REQUESTS);
+    if (mapped_file_max_size_)
+        MappedFileCache::instance().start(mapped_file_max_size_, mapped_file_budget_);
+
+    if (!openListenSockets())
+        return false;
+
+    const int control_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    drain_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (control_fd == -1 || drain_fd_ == -1)
+    {
+        LOG_ERROR("Failed to create eventfd, reason: ", logErrStr(errno));
+        return false;
+    }
+    const FdHolder control_fd_guard(control_fd);
+    const FdHolder drain_fd_guard(drain_fd_);
+    control_fd_.store(control_fd, std::memory_order_relaxed);
+
     for (int i = 0; i < worker_size_; i++)
     {
         const int worker_epfd = epoll_create(1);
@@ -337,16 +708,169 @@ bool WebServer::start()
             return false;
         }
         worker_epfds_.emplace_back(worker_epfd);
-        workers_.run([this, worker_epfd]()
-                     { this->workerLoop(worker_epfd); });
     }
 
-    for (const auto &[ip, port] : listen_addresses_)
-        acceptors_.emplace_back(&WebServer::acceptorLoop, this, ip, port);
+    // threads of their own, started once nothing above can fail: a return before the
+    // stop() calls at the end would leave them running and the process would not exit
+    if (compression_cache_budget_)
+        CompressionCache::instance().start(compression_cache_budget_, compression_thread_num_);
+    if (!proxy_routes_.empty())
+        Proxy::instance().start();
+
+    workers_.start(worker_size_);
+    for (const auto &worker_epfd : worker_epfds_)
+        workers_.run([this, epfd = worker_epfd.fd()]()
+                     { this->workerLoop(epfd); });
+
+    for (std::size_t i = 0; i < listen_sockets_.size(); i++)
+        acceptors_.emplace_back(&WebServer::acceptorLoop, this, i);
+
+    // started by an upgrade: the previous process stops accepting and drains now
+    if (const char *env = getenv(kUpgradeParentEnv))
+    {
+        const pid_t parent_pid = std::atoi(env);
+        unsetenv(kUpgradeParentEnv);
+        if (parent_pid == getppid() && kill(parent_pid, SIGTERM) == 0)
+            LOG_INFO("Upgrade done, previous process ", parent_pid, " drains");
+    }
+
+    waitForShutdown();
 
+    LOG_INFO("Shutdown, stop accepting and drain connections for up to ", drain_timeout_ms_, "ms");
+    is_stopping_.store(true, std::memory_order_relaxed);
     for (auto &thread : acceptors_)
         thread.join();
+    acceptors_.clear();
+    // an upgraded process holds its own descriptors of the sockets, queued connections stay
+    listen_sockets_.clear();
 
+    HttpContext::setDraining();
+    const uint64_t one = 1;
+    LOGIF_PERROR(write(drain_fd_, &one, sizeof(one)), "Failed to write drain eventfd, reason: ", logErrStr(errno));
     workers_.stop();
+    CompressionCache::instance().stop();
+    Proxy::instance().stop();
+    control_fd_.store(-1, std::memory_order_relaxed);
+    LOG_INFO("WebServer stopped");
     return true;
-}
\ No newline at end of file
+}
+
+static void wakeControlLoop(int control_fd) noexcept
+{
+    if (control_fd == -1)
+        return;
+    const int saved_errno = errno;
+    const uint64_t one = 1;
+    const auto retval = write(control_fd, &one, sizeof(one));
+    (void)retval;
+    errno = saved_errno;
+}
+
+void WebServer::requestStatsDump() noexcept
+{
+    is_stats_dump_requested_.store(true, std::memory_order_relaxed);
+    wakeControlLoop(control_fd_.load(std::memory_order_relaxed));
+}
+
+void WebServer::requestShutdown() noexcept
+{
+    is_shutdown_requested_.store(true, std::memory_order_relaxed);
+    wakeControlLoop(control_fd_.load(std::memory_order_relaxed));
+}
+
+void WebServer::requestUpgrade() noexcept
+{
+    is_upgrade_requested_.store(true, std::memory_order_relaxed);
+    wakeControlLoop(control_fd_.load(std::memory_order_relaxed));
+}
+
+void WebServer::waitForShutdown()
+{
+    // the timeout also notices an upgrade process that exited without taking over
+    static constexpr int kControlPollMs = 1000;
+    while (!is_shutdown_requested_.load(std::memory_order_relaxed))
+    {
+        pollfd control{control_fd_.load(std::memory_order_relaxed), POLLIN, 0};
+        if (poll(&control, 1, kControlPollMs) == 1)
+        {
+            uint64_t count;
+            LOGIF_PWARNING(read(control.fd, &count, sizeof(count)), "Failed to read control eventfd, reason: ", logErrStr(errno));
+        }
+
+        if (is_stats_dump_requested_.exchange(false, std::memory_order_relaxed))
+            LOG_INFO("Server stats:\n", LatencyRecorder::instance().report(), CompressionCache::instance().report(),
+                     MappedFileCache::instance().report(), LoadShedder::instance().report(),
+                     RateLimiter::instance().report(), Proxy::instance().report(),
+                     FastCgi::instance().report(), mimeReport());
+
+        if (is_upgrade_requested_.exchange(false, std::memory_order_relaxed))
+            spawnUpgrade();
+
+        int status;
+        if (upgrade_pid_ > 0 && waitpid(upgrade_pid_, &status, WNOHANG) == upgrade_pid_)
+        {
+            LOG_ERROR("Upgrade process ", upgrade_pid_, " exited (status ", status, ") before taking over, keep serving");
+            upgrade_pid_ = 0;
+        }
+    }
+}
+
+void WebServer::spawnUpgrade()
+{
+    if (upgrade_pid_ > 0)
+    {
+        LOG_WARNING("Upgrade process ", upgrade_pid_, " is still starting");
+        return;
+    }
+    if (upgrade_argv_.empty())
+    {
+        LOG_ERROR("Upgrade requested without an upgrade command");
+        return;
+    }
+
+    // the child may only make async-signal-safe calls before exec, so all is built here
+    std::vector<int> listen_fds;
+    std::string listen_fds_str;
+    for (const auto &listen_socket : listen_sockets_)
+    {
+        listen_fds.push_back(listen_socket->fd());
+        listen_fds_str.append(listen_fds_str.empty() ? "" : ",").append(lexicalCast(listen_socket->fd()));
+    }
+    std::vector<std::string> env = {logstr(kListenFdsEnv, "=", listen_fds_str), logstr(kUpgradeParentEnv, "=", getpid())};
+    for (char **var = environ; *var != nullptr; var++)
+    {
+        const std::string_view entry(*var);
+        if (entry.substr(0, entry.find('=')) != kListenFdsEnv && entry.substr(0, entry.find('=')) != kUpgradeParentEnv)
+            env.emplace_back(entry);
+    }
+    std::vector<char *> envp, argv;
+    for (auto &entry : env)
+        envp.push_back(entry.data());
+    envp.push_back(nullptr);
+    for (auto &arg : upgrade_argv_)
+        argv.push_back(arg.data());
+    argv.push_back(nullptr);
+    rlimit fd_limit;
+    const int max_fd = getrlimit(RLIMIT_NOFILE, &fd_limit) == 0 ? fd_limit.rlim_cur : 65536;
+
+    const pid_t pid = fork();
+    if (pid == -1)
+    {
+        LOG_ERROR("Failed to fork the upgrade process, reason: ", logErrStr(errno));
+        return;
+    }
+    if (pid == 0)
+    {
+        // only the listening sockets are passed on, connections and epoll fds are not
+        if (close_range(3, ~0u, CLOSE_RANGE_CLOEXEC) == -1)
+            for (int fd = 3; fd < max_fd; fd++)
+                fcntl(fd, F_SETFD, FD_CLOEXEC);
+        for (const int fd : listen_fds)
+            fcntl(fd, F_SETFD, 0);
+        execvpe(argv[0], argv.data(), envp.data());
+        _exit(127);
+    }
+
+    upgrade_pid_ = pid;
+    LOG_INFO("Upgrade process ", pid, " started: ", upgrade_argv_[0], ", listening sockets = ", listen_fds_str);
+}
@@ -1,22 +1,32 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <memory>
 #include <string>
 #include <string_view>
 #include <thread>
+#include <utility>
 #include <vector>
 
 #include <cinttypes>
 
-#include <sys/timerfd.h>
+#include <sys/types.h>
 
 #include "./ThreadPool.h"
+#include "./TcpSocket.h"
+#include "./HttpContext.h"
+#include "./Router.h"
 #include "./Logger.h"
+#include "./Tls.h"
 #include "./util/FdHolder.h"
 #include "./util/Noncopyable.h"
 
 class WebServer : NonCopyable
 {
 public:
+    static constexpr std::string_view kUnixPrefix = "unix:";
+
     WebServer() = default;
     WebServer &setLogPath(std::string path)
     {
@@ -49,6 +59,38 @@ public:
         return *this;
     }
 
+    // a Unix domain socket at path ("@name": abstract namespace) served like the TCP addresses,
+    // its count acceptors share one socket. A stale socket file is replaced at start and left
+    // in place at exit, where an upgraded process may still use it.
+    WebServer &addUnixListenAddress(const std::string &path, int count = 1)
+    {
+        for (int i = 0; i < count; i++)
+            listen_addresses_.emplace_back(logstr(kUnixPrefix, path), 0);
+        return *this;
+    }
+
+    // mode of the socket files of Unix addresses, e.g. 0660 for a front proxy in the group
+    WebServer &setUnixSocketMode(mode_t mode)
+    {
+        unix_socket_mode_ = mode;
+        return *this;
+    }
+
+    // connections on the address start with a TLS handshake, see setTlsCertificate()
+    WebServer &addTlsListenAddress(const std::string &ip, uint16_t port, int count = 1)
+    {
+        tls_ports_.push_back(port);
+        return addListenAddress(ip, port, count);
+    }
+
+    // PEM files of the certificate chain and private key of TLS addresses
+    WebServer &setTlsCertificate(std::string cert_path, std::string key_path)
+    {
+        tls_cert_path_ = std::move(cert_path);
+        tls_key_path_ = std::move(key_path);
+        return *this;
+    }
+
     WebServer &setWorkerThreadNum(int size)
     {
         worker_size_ = size;
@@ -61,9 +103,173 @@ public:
         return *this;
     }
 
+    // write missing .gz/.br/.zst sidecars of compressible files under root path in start()
+    WebServer &setPrecompressOnStart(bool is_precompress)
+    {
+        is_precompress_on_start_ = is_precompress;
+        return *this;
+    }
+
+    WebServer &setLatencyHistogramEnabled(bool is_enabled)
+    {
+        is_latency_histogram_enabled_ = is_enabled;
+        return *this;
+    }
+
+    // keep on-the-fly compressed variants of files without sidecars, 0 disables it
+    WebServer &setCompressionCache(std::size_t memory_budget, int thread_num = 1)
+    {
+        compression_cache_budget_ = memory_budget;
+        compression_thread_num_ = thread_num;
+        return *this;
+    }
+
+    // map files up to max_file_size bytes once and send them from memory, 0 keeps sendfile for all
+    WebServer &setMappedFileCache(std::size_t max_file_size, std::size_t memory_budget = 64 * 1024 * 1024)
+    {
+        mapped_file_max_size_ = max_file_size;
+        mapped_file_budget_ = memory_budget;
+        return *this;
+    }
+
+    // memory bodies of at least size bytes are sent with MSG_ZEROCOPY, 0 always copies
+    WebServer &setZeroCopyMinSize(std::size_t size)
+    {
+        zerocopy_min_size_ = size;
+        return *this;
+    }
+
+    // new connections past soft (server) or worker_soft (per worker) connections get a 503
+    // and are closed, at hard the acceptors pause; 0 disables a limit
+    WebServer &setConnectionLimits(std::size_t soft, std::size_t hard, std::size_t worker_soft = 0)
+    {
+        soft_connection_limit_ = soft;
+        hard_connection_limit_ = hard;
+        worker_soft_connection_limit_ = worker_soft;
+        return *this;
+    }
+
+    // a connection is closed when a request head is not complete header_ms after its first
+    // byte, a request body or a response makes no progress for body_ms or send_ms, or it
+    // is idle for keep_alive_ms between requests
+    WebServer &setConnectionTimeouts(int header_ms, int body_ms, int keep_alive_ms, int send_ms)
+    {
+        connection_timeouts_ = {header_ms, body_ms, keep_alive_ms, send_ms};
+        return *this;
+    }
+
+    // an HTTP/1.x connection is closed after its n-th response (Connection: close), 0 for no limit
+    WebServer &setMaxKeepAliveRequests(unsigned n)
+    {
+        max_keep_alive_requests_ = n;
+        return *this;
+    }
+
+    // a request with a larger body gets a 413, before any of it is received
+    WebServer &setMaxBodySize(uint64_t size)
+    {
+        max_body_size_ = size;
+        return *this;
+    }
+
+    // PUT and POST store their body under the root dir, see RequestHandler.h
+    WebServer &setUploadEnabled(bool is_enabled)
+    {
+        is_upload_enabled_ = is_enabled;
+        return *this;
+    }
+
+    // GET of a directory under the root dir lists it, see DirectoryListing.h
+    WebServer &setAutoIndexEnabled(bool is_enabled)
+    {
+        is_auto_index_enabled_ = is_enabled;
+        return *this;
+    }
+
+    // a dynamic handler, matched before static files; see Router.h for the patterns
+    WebServer &addRoute(HttpMethod method, std::string pattern, RouteHandler handler)
+    {
+        routes_.push_back({method, std::move(pattern), std::move(handler)});
+        return *this;
+    }
+
+    // requests under prefix go to the least loaded of upstreams ("host:port" or
+    // "unix:/path"), see Proxy.h
+    WebServer &addProxy(std::string prefix, std::vector<std::string> upstreams)
+    {
+        proxy_routes_.emplace_back(std::move(prefix), std::move(upstreams));
+        return *this;
+    }
+
+    // upstreams are probed every interval_ms with a GET of path, or a connect if path is ""
+    WebServer &setProxyHealthCheck(std::string path, int interval_ms = 2000)
+    {
+        proxy_health_path_ = std::move(path);
+        proxy_health_interval_ms_ = interval_ms;
+        return *this;
+    }
+
+    // requests matching pattern ("/prefix" or "*.ext") run on the least loaded of the
+    // FastCGI backends ("host:port" or "unix:/path"), see FastCgi.h
+    WebServer &addFastCgi(std::string pattern, std::vector<std::string> backends)
+    {
+        fastcgi_routes_.emplace_back(std::move(pattern), std::move(backends));
+        return *this;
+    }
+
+    // new connections get a 503 while the worker queue delay stays above target_ms for
+    // interval_ms (CoDel), 0 disables it
+    WebServer &setQueueDelayTarget(int target_ms, int interval_ms = 100)
+    {
+        queue_delay_target_ms_ = target_ms;
+        queue_delay_interval_ms_ = interval_ms;
+        return *this;
+    }
+
+    // each client IP may open connections and send requests at rate per second with bursts
+    // of burst; over it a client gets a 429, or is closed without one if is_silent, 0 disables it
+    WebServer &setRateLimit(double rate, double burst, bool is_silent = false, std::size_t max_clients = 65536)
+    {
+        rate_limit_ = rate;
+        rate_limit_burst_ = burst;
+        is_rate_limit_silent_ = is_silent;
+        rate_limit_clients_ = max_clients;
+        return *this;
+    }
+
+    // Cache-Control rules of static responses, see CachePolicy.h for the format
+    WebServer &setCachePolicyPath(std::string path)
+    {
+        cache_policy_path_ = std::move(path);
+        return *this;
+    }
+
+    // on shutdown, in-flight responses and idle keep-alive connections get ms to finish
+    WebServer &setDrainTimeout(int ms)
+    {
+        drain_timeout_ms_ = ms;
+        return *this;
+    }
+
+    // the command line requestUpgrade() starts, normally argv of this process
+    WebServer &setUpgradeCommand(std::vector<std::string> argv)
+    {
+        upgrade_argv_ = std::move(argv);
+        return *this;
+    }
+
+    // async-signal-safe, the stats are written to the log by the thread in start()
+    static void requestStatsDump() noexcept;
+    // async-signal-safe, start() stops accepting, drains the connections and returns
+    static void requestShutdown() noexcept;
+    // async-signal-safe, starts the upgrade command with the listening sockets; once it
+    // serves it sends this process SIGTERM
+    static void requestUpgrade() noexcept;
+
     int getTotalThreadNum() const noexcept
     {
-        return listen_addresses_.size() + worker_size_ * worker_pool_size_ + worker_size_;
+        return listen_addresses_.size() + worker_size_ * worker_pool_size_ + worker_size_ +
+               (compression_cache_budget_ ? compression_thread_num_ : 0);
     }
 
     bool start();
@@ -71,6 +277,8 @@ public:
 private:
     std::vector<std::thread> acceptors_;
     bool is_acceptor_using_epoll;
+    std::vector<std::unique_ptr<TcpSocket>> listen_sockets_; // in listen_addresses_ order
+    std::atomic_bool is_stopping_{false};                      // acceptors return
 
     ThreadPool workers_;
     int worker_size_{3};
@@ -83,8 +291,73 @@ private:
 
     std::string root_path_{"./root"};
 
+    bool is_precompress_on_start_{false};
+    bool is_latency_histogram_enabled_{false};
+
+    std::string cache_policy_path_;
+
+    std::size_t compression_cache_budget_{0};
+    std::size_t mapped_file_max_size_{0};
+    std::size_t mapped_file_budget_{0};
+    std::size_t zerocopy_min_size_{0};
+
+    std::size_t soft_connection_limit_{0};
+    std::size_t hard_connection_limit_{0};
+    std::size_t worker_soft_connection_limit_{0};
+    ConnectionTimeouts connection_timeouts_;
+    unsigned max_keep_alive_requests_{1000};
+    uint64_t max_body_size_{1024 * 1024};
+    bool is_upload_enabled_{false};
+    bool is_auto_index_enabled_{false};
+    struct Route
+    {
+        HttpMethod method;
+        std::string pattern;
+        RouteHandler handler;
+    };
+    std::vector<Route> routes_;
+    std::vector<std::pair<std::string, std::vector<std::string>>> proxy_routes_;
+    std::string proxy_health_path_;
+    int proxy_health_interval_ms_{2000};
+    std::vector<std::pair<std::string, std::vector<std::string>>> fastcgi_routes_;
+    int queue_delay_target_ms_{0};
+    int queue_delay_interval_ms_{100};
+
+    double rate_limit_{0};
+    double rate_limit_burst_{0};
+    bool is_rate_limit_silent_{false};
+    std::size_t rate_limit_clients_{65536};
+    int compression_thread_num_{1};
+
+    inline static std::atomic_bool is_stats_dump_requested_{false};
+    inline static std::atomic_bool is_shutdown_requested_{false};
+    inline static std::atomic_bool is_upgrade_requested_{false};
+    inline static std::atomic_int control_fd_{-1}; // eventfd waking waitForShutdown()
+
+    int drain_timeout_ms_{10000};
+    int drain_fd_{-1}; // eventfd, edge triggered in every worker epoll
+    std::vector<std::string> upgrade_argv_;
+    pid_t upgrade_pid_{0};
+
+    // (ip, port), (kUnixPrefix + path, 0) for Unix sockets
     std::vector<std::pair<std::string, uint16_t>> listen_addresses_;
+    mode_t unix_socket_mode_{0666};
+
+    std::vector<uint16_t> tls_ports_;
+    std::string tls_cert_path_;
+    std::string tls_key_path_;
+    std::unique_ptr<TlsContext> tls_context_; // nullptr without TLS addresses
+
+    // the accepted socket came in on a TLS address
+    [[nodiscard]] bool isTlsConnection(int fd) const;
+
+    // the sockets inherited from the process that started the upgrade, new ones for the rest
+    [[nodiscard]] bool openListenSockets();
+    [[nodiscard]] bool openUnixListenSocket(std::size_t index);
+    // handles upgrade requests until a shutdown is requested
+    void waitForShutdown();
+    void spawnUpgrade();
 
-    void acceptorLoop(std::string_view ip, uint16_t port);
+    void acceptorLoop(std::size_t index);
     void workerLoop(int epfd);
 };
\ No newline at end of file
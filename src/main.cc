@@ -1,26 +1,354 @@
 #include <iostream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
 
 #include <csignal>
+#include <cstdlib>
 
+#include <getopt.h>
 #include <unistd.h>
 
 #include "./WebServer.h"
+#include "./HttpResponse.h"
 
-int main()
+// "PREFIX=ADDR[,ADDR...]" of -X and -F
+static bool parseBackends(std::string_view arg, std::string &prefix, std::vector<std::string> &upstreams)
 {
+    const auto equals = arg.find('=');
+    if (equals == std::string_view::npos)
+        return false;
+    prefix = std::string(arg.substr(0, equals));
+    for (auto rest = arg.substr(equals + 1); !rest.empty();)
+    {
+        const auto comma = rest.find(',');
+        if (comma != 0)
+            upstreams.emplace_back(rest.substr(0, comma));
+        rest = comma == std::string_view::npos ? std::string_view() : rest.substr(comma + 1);
+    }
+    return !upstreams.empty();
+}
+
+// the buttons of root/index.html post to "0" (register) and "1" (log in)
+static RouteHandler redirectTo(std::string location)
+{
+    return [location = std::move(location)](const HttpParser &, const RouteParams &, const RequestBody *, HttpResponse &response)
+    {
+        response.head.setStatusCode(HttpStatusCode::FOUND)
+            .addHeader("Location", location)
+            .addHeader("Content-Length", "0");
+    };
+}
+
+static void printUsage(const char *prog)
+{
+    std::cerr << "Usage: " << prog << " [options]\n"
+              << "  -a IP       listen address (default 0.0.0.0)\n"
+              << "  -p PORT     listen port (default 12345), 0 for none\n"
+              << "  -u PATH     also listen on a Unix socket at PATH, @NAME for the abstract namespace, repeatable\n"
+              << "  -W MODE     octal mode of the -u socket files (default 0666)\n"
+              << "  -n N        acceptor threads on the address (default 3)\n"
+              << "  -r DIR      root dir (default ./root)\n"
+              << "  -t N        worker threads (default 3)\n"
+              << "  -w N        ThreadPool size of each worker (default 4)\n"
+              << "  -l LEVEL    log level: debug, info, warning, error (default info)\n"
+              << "  -L FILE     log path (default ./<time>.log)\n"
+              << "  -e          acceptors wait on epoll instead of blocking accept\n"
+              << "  -z          write missing compressed sidecars under root dir at start\n"
+              << "  -H          record request latency histograms for the SIGUSR1 stats dump\n"
+              << "  -P FILE     Cache-Control policy rules, e.g. conf/cache_policy.conf\n"
+              << "  -T PORT     TLS listen port on the same address, needs -C and -K\n"
+              << "  -C FILE     TLS certificate chain (PEM)\n"
+              << "  -K FILE     TLS private key (PEM)\n"
+              << "  -m KB       send files up to KB from shared mappings instead of sendfile, 0 disables it (default 16)\n"
+              << "  -Z KB       send memory bodies from KB on with MSG_ZEROCOPY, e.g. 128, 0 disables it (default 0)\n"
+              << "  -o N        soft connection limit, new connections past it get a 503 (default 0, no limit)\n"
+              << "  -O N        hard connection limit, acceptors pause at it (default 0, no limit)\n"
+              << "  -x N        soft connection limit of each worker (default 0, no limit)\n"
+              << "  -q MS       503 new connections while the worker queue delay stays above MS (default 0, off)\n"
+              << "  -R RATE     requests (and connections) per second of each client IP, 0 disables it (default 0)\n"
+              << "  -b N        burst of each client IP over -R (default 2 * RATE)\n"
+              << "  -s          close clients over -R without a 429\n"
+              << "  -M KB       largest request body, a larger one gets a 413 (default 1024)\n"
+              << "  -U          PUT stores the body as the file of the URL, POST as a new file in its directory\n"
+              << "  -I          GET of a directory lists its entries, sent while they are read\n"
+              << "  -i MS       a request head has to be complete MS after its first byte (default 5000)\n"
+              << "  -B MS       close a request body that makes no progress for MS (default 10000)\n"
+              << "  -k MS       close a keep-alive connection idle for MS between requests (default 5000)\n"
+              << "  -N N        close a keep-alive connection after N requests, 0 for no limit (default 1000)\n"
+              << "  -S MS       close a response the client takes nothing of for MS (default 10000)\n"
+              << "  -D SEC      on SIGTERM/SIGINT, time in-flight and idle connections get to finish (default 10)\n"
+              << "  -X P=A,...  forward URLs under prefix P to upstreams A (host:port, [v6]:port or unix:/path), repeatable\n"
+              << "  -y PATH     health check GET of the upstreams, 2xx/3xx is up (default: connect only)\n"
+              << "  -F P=A,...  run URLs under prefix P (or ending in .ext for P = *.ext) on FastCGI backends A, repeatable\n"
+              << "  -c MB       memory of the on-the-fly compression cache, 0 disables it (default 32)\n";
+}
+
+static bool parseLogLevel(std::string_view str, LogLevel &level)
+{
+    if (str == "debug")
+        level = LogLevel::DEBUG;
+    else if (str == "info")
+        level = LogLevel::INFO;
+    else if (str == "warning")
+        level = LogLevel::WARNING;
+    else if (str == "error")
+        level = LogLevel::ERROR;
+    else
+        return false;
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    std::string ip = "0.0.0.0";
+    uint16_t port = 12345;
+    int acceptor_num = 3;
+    std::string root_path = "./root";
+    int worker_num = 3;
+    int worker_pool_size = 4;
+    LogLevel log_level = LogLevel::INFO;
+    std::string log_path;
+    bool is_acceptor_using_epoll = false;
+    bool is_latency_histogram_enabled = false;
+    bool is_precompress_on_start = false;
+    std::size_t compression_cache_mb = 32;
+    std::size_t mapped_file_kb = 16;
+    std::size_t zerocopy_kb = 0;
+    std::size_t soft_connection_limit = 0;
+    std::size_t hard_connection_limit = 0;
+    std::size_t worker_soft_connection_limit = 0;
+    int queue_delay_target_ms = 0;
+    double rate_limit = 0;
+    double rate_limit_burst = 0;
+    bool is_rate_limit_silent = false;
+    ConnectionTimeouts connection_timeouts;
+    unsigned max_keep_alive_requests = 1000;
+    uint64_t max_body_kb = 1024;
+    bool is_upload_enabled = false;
+    bool is_auto_index_enabled = false;
+    int drain_timeout_sec = 10;
+    std::string cache_policy_path;
+    std::vector<std::string> unix_paths;
+    mode_t unix_socket_mode = 0666;
+    uint16_t tls_port = 0;
+    std::string tls_cert_path;
+    std::string tls_key_path;
+    std::vector<std::pair<std::string, std::vector<std::string>>> proxies;
+    std::string proxy_health_path;
+    std::vector<std::pair<std::string, std::vector<std::string>>> fastcgi_routes;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "a:p:u:W:n:r:t:w:l:L:ezHP:c:m:Z:o:O:x:q:R:b:sM:UIi:B:k:N:S:D:T:C:K:X:y:F:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'a':
+            ip = optarg;
+            break;
+        case 'p':
+            port = std::atoi(optarg);
+            break;
+        case 'u':
+            unix_paths.emplace_back(optarg);
+            break;
+        case 'W':
+            unix_socket_mode = std::strtol(optarg, nullptr, 8);
+            break;
+        case 'n':
+            acceptor_num = std::atoi(optarg);
+            break;
+        case 'r':
+            root_path = optarg;
+            break;
+        case 't':
+            worker_num = std::atoi(optarg);
+            break;
+        case 'w':
+            worker_pool_size = std::atoi(optarg);
+            break;
+        case 'l':
+            if (!parseLogLevel(optarg, log_level))
+            {
+                printUsage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'L':
+            log_path = optarg;
+            break;
+        case 'e':
+            is_acceptor_using_epoll = true;
+            break;
+        case 'z':
+            is_precompress_on_start = true;
+            break;
+        case 'H':
+            is_latency_histogram_enabled = true;
+            break;
+        case 'P':
+            cache_policy_path = optarg;
+            break;
+        case 'c':
+            compression_cache_mb = std::strtoul(optarg, nullptr, 10);
+            break;
+        case 'm':
+            mapped_file_kb = std::strtoul(optarg, nullptr, 10);
+            break;
+        case 'Z':
+            zerocopy_kb = std::strtoul(optarg, nullptr, 10);
+            break;
+        case 'o':
+            soft_connection_limit = std::strtoul(optarg, nullptr, 10);
+            break;
+        case 'O':
+            hard_connection_limit = std::strtoul(optarg, nullptr, 10);
+            break;
+        case 'x':
+            worker_soft_connection_limit = std::strtoul(optarg, nullptr, 10);
+            break;
+        case 'q':
+            queue_delay_target_ms = std::atoi(optarg);
+            break;
+        case 'R':
+            rate_limit = std::atof(optarg);
+            break;
+        case 'b':
+            rate_limit_burst = std::atof(optarg);
+            break;
+        case 's':
+            is_rate_limit_silent = true;
+            break;
+        case 'M':
+            max_body_kb = std::strtoull(optarg, nullptr, 10);
+            break;
+        case 'U':
+            is_upload_enabled = true;
+            break;
+        case 'I':
+            is_auto_index_enabled = true;
+            break;
+        case 'i':
+            connection_timeouts.header_ms = std::atoi(optarg);
+            break;
+        case 'B':
+            connection_timeouts.body_ms = std::atoi(optarg);
+            break;
+        case 'k':
+            connection_timeouts.keep_alive_ms = std::atoi(optarg);
+            break;
+        case 'N':
+            max_keep_alive_requests = std::atoi(optarg);
+            break;
+        case 'S':
+            connection_timeouts.send_ms = std::atoi(optarg);
+            break;
+        case 'D':
+            drain_timeout_sec = std::atoi(optarg);
+            break;
+        case 'T':
+            tls_port = std::atoi(optarg);
+            break;
+        case 'C':
+            tls_cert_path = optarg;
+            break;
+        case 'K':
+            tls_key_path = optarg;
+            break;
+        case 'X':
+        {
+            std::string prefix;
+            std::vector<std::string> upstreams;
+            if (!parseBackends(optarg, prefix, upstreams))
+            {
+                printUsage(argv[0]);
+                return 1;
+            }
+            proxies.emplace_back(std::move(prefix), std::move(upstreams));
+            break;
+        }
+        case 'y':
+            proxy_health_path = optarg;
+            break;
+        case 'F':
+        {
+            std::string pattern;
+            std::vector<std::string> backends;
+            if (!parseBackends(optarg, pattern, backends))
+            {
+                printUsage(argv[0]);
+                return 1;
+            }
+            fastcgi_routes.emplace_back(std::move(pattern), std::move(backends));
+            break;
+        }
+        default:
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
     std::cout << get_current_dir_name() << std::endl;
     std::signal(SIGPIPE, SIG_IGN);
+    std::signal(SIGUSR1, [](int)
+                { WebServer::requestStatsDump(); });
+    // SIGTERM drains and exits, SIGUSR2 starts this command line again on the same sockets,
+    // which sends SIGTERM here once it serves
+    std::signal(SIGTERM, [](int)
+                { WebServer::requestShutdown(); });
+    std::signal(SIGINT, [](int)
+                { WebServer::requestShutdown(); });
+    std::signal(SIGUSR2, [](int)
+                { WebServer::requestUpgrade(); });
+
+    if (port == 0 && unix_paths.empty())
+    {
+        printUsage(argv[0]);
+        return 1;
+    }
 
     WebServer server{};
-    server.addListenAddress("0.0.0.0", 12345, 3)
-        .setLogLevel(LogLevel::INFO)
-        .setRootPath("./root")
-        .setWorkerThreadNum(3)
-        .setWorkerPoolSize(4)
-        .setAcceptorUsingEpoll(false);
-        
-    std::cout << "server thread total = " << server.getTotalThreadNum() << std::endl;
-    server.start();
+    if (port != 0)
+        server.addListenAddress(ip, port, acceptor_num);
+    for (const auto &path : unix_paths)
+        server.addUnixListenAddress(path, acceptor_num);
+    server.setUnixSocketMode(unix_socket_mode)
+        .setLogLevel(log_level)
+        .setLogPath(log_path)
+        .setRootPath(root_path)
+        .setWorkerThreadNum(worker_num)
+        .setWorkerPoolSize(worker_pool_size)
+        .setAcceptorUsingEpoll(is_acceptor_using_epoll)
+        .setPrecompressOnStart(is_precompress_on_start)
+        .setLatencyHistogramEnabled(is_latency_histogram_enabled)
+        .setCachePolicyPath(cache_policy_path)
+        .setCompressionCache(compression_cache_mb * 1024 * 1024)
+        .setMappedFileCache(mapped_file_kb * 1024)
+        .setZeroCopyMinSize(zerocopy_kb * 1024)
+        .setConnectionLimits(soft_connection_limit, hard_connection_limit, worker_soft_connection_limit)
+        .setQueueDelayTarget(queue_delay_target_ms)
+        .setRateLimit(rate_limit, rate_limit_burst ? rate_limit_burst : 2 * rate_limit, is_rate_limit_silent)
+        .setMaxBodySize(max_body_kb * 1024)
+        .setUploadEnabled(is_upload_enabled)
+        .setAutoIndexEnabled(is_auto_index_enabled)
+        .setConnectionTimeouts(connection_timeouts.header_ms, connection_timeouts.body_ms,
+                               connection_timeouts.keep_alive_ms, connection_timeouts.send_ms)
+        .setMaxKeepAliveRequests(max_keep_alive_requests)
+        .setDrainTimeout(drain_timeout_sec * 1000)
+        .setUpgradeCommand({argv, argv + argc})
+        .addRoute(HttpMethod::POST, "/0", redirectTo("/register.html"))
+        .addRoute(HttpMethod::POST, "/1", redirectTo("/log.html"));
+    if (tls_port != 0)
+        server.addTlsListenAddress(ip, tls_port, acceptor_num)
+            .setTlsCertificate(tls_cert_path, tls_key_path);
+    for (auto &[prefix, upstreams] : proxies)
+        server.addProxy(std::move(prefix), std::move(upstreams));
+    if (!proxy_health_path.empty())
+        server.setProxyHealthCheck(proxy_health_path);
+    for (auto &[pattern, backends] : fastcgi_routes)
+        server.addFastCgi(std::move(pattern), std::move(backends));
 
-    return 0;
-}
\ No newline at end of file
+    std::cout << "server thread total = " << server.getTotalThreadNum() << std::endl;
+    return server.start() ? 0 : 1;
+}
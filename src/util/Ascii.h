@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+// Case folding for header names and tokens, which HTTP compares
+// case-insensitively. Only 'A'-'Z' fold, other bytes (UTF-8 included) are
+// compared as they are.
+
+constexpr unsigned char asciiToLower(char c) noexcept
+{
+    const auto byte = static_cast<unsigned char>(c);
+    return byte >= 'A' && byte <= 'Z' ? byte | 0x20 : byte;
+}
+
+// asciiToLower on the 8 bytes of a word at once: the high bit of a byte is set
+// by adding 0x3f if it is >= 'A' and by adding 0x25 if it is > 'Z', neither
+// sum carries into the next byte
+inline uint64_t asciiToLower8(uint64_t word) noexcept
+{
+    constexpr uint64_t kOnes = 0x0101010101010101ULL;
+    const uint64_t low7 = word & (kOnes * 0x7f);
+    const uint64_t is_upper = ((low7 + kOnes * 0x3f) ^ (low7 + kOnes * 0x25)) & ~word & (kOnes * 0x80);
+    return word | (is_upper >> 2);
+}
+
+inline bool equalsIgnoreCase(std::string_view lhs, std::string_view rhs) noexcept
+{
+    if (lhs.size() != rhs.size())
+        return false;
+    std::size_t i = 0;
+    uint64_t lhs_word, rhs_word;
+    for (; i + sizeof(uint64_t) <= lhs.size(); i += sizeof(uint64_t))
+    {
+        std::memcpy(&lhs_word, lhs.data() + i, sizeof(uint64_t));
+        std::memcpy(&rhs_word, rhs.data() + i, sizeof(uint64_t));
+        if (asciiToLower8(lhs_word) != asciiToLower8(rhs_word))
+            return false;
+    }
+    if (i == lhs.size())
+        return true;
+    lhs_word = rhs_word = 0;
+    std::memcpy(&lhs_word, lhs.data() + i, lhs.size() - i);
+    std::memcpy(&rhs_word, rhs.data() + i, rhs.size() - i);
+    return asciiToLower8(lhs_word) == asciiToLower8(rhs_word);
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string_view>
+
+#include "./Ascii.h"
+
+// A lookup table over a fixed set of keys whose hash function is picked by the
+// compiler: seeds are tried at compile time until every key has a slot of its
+// own, so a lookup hashes a few bytes once and compares with at most one key.
+// Keys match ASCII case-insensitively. Repeated keys (case-insensitively) keep
+// the index of their first occurrence.
+//
+//     static constexpr PerfectHashTable<3> kTable({"gif", "png", "jpg"});
+//     kTable.find("PNG") == 1, kTable.find("bmp") == -1
+//
+// Declare tables constexpr: the seed search then runs in the compiler, and a
+// key set without a seed fails the build.
+template <std::size_t N>
+class PerfectHashTable
+{
+public:
+    constexpr explicit PerfectHashTable(const std::array<std::string_view, N> &keys) : keys_(keys)
+    {
+        for (uint64_t seed = 1; seed <= kMaxSeeds; seed++)
+            if (place(seed))
+            {
+                seed_ = seed;
+                return;
+            }
+        throw std::logic_error("PerfectHashTable: no seed separates the keys");
+    }
+
+    // index of key in the keys, -1 if it is none of them
+    [[nodiscard]] int find(std::string_view key) const noexcept
+    {
+        const auto index = slots_[slotOf(key, seed_)];
+        if (index == kEmpty || !equalsIgnoreCase(keys_[index], key))
+            return -1;
+        return index;
+    }
+
+    [[nodiscard]] static constexpr std::size_t size() noexcept { return N; }
+
+private:
+    static_assert(N > 0 && N < 0xffff);
+
+    static constexpr int kSlotBits = [] {
+        int bits = 1;
+        while ((std::size_t{1} << bits) < N * 4)
+            bits++;
+        return bits;
+    }();
+    static constexpr std::size_t kSlots = std::size_t{1} << kSlotBits;
+    static constexpr uint16_t kEmpty = 0xffff;
+    static constexpr uint64_t kMaxSeeds = 100000;
+    static constexpr std::size_t kEdgeBytes = 4;
+
+    std::array<std::string_view, N> keys_;
+    std::array<uint16_t, kSlots> slots_{};
+    uint64_t seed_{0};
+
+    static constexpr bool isSameKey(std::string_view lhs, std::string_view rhs) noexcept
+    {
+        if (lhs.size() != rhs.size())
+            return false;
+        for (std::size_t i = 0; i < lhs.size(); i++)
+            if (asciiToLower(lhs[i]) != asciiToLower(rhs[i]))
+                return false;
+        return true;
+    }
+
+    // FNV-1a over the length and the lowercased first and last kEdgeBytes bytes
+    // (gperf style, keys differing only in the middle fail the build), the
+    // slot taken from the high bits of a multiplicative mix
+    static constexpr std::size_t slotOf(std::string_view key, uint64_t seed) noexcept
+    {
+        uint64_t hash = (0xcbf29ce484222325ULL ^ (seed * 0x9e3779b97f4a7c15ULL) ^ key.size()) * 0x100000001b3ULL;
+        const std::size_t head = key.size() < kEdgeBytes * 2 ? key.size() : kEdgeBytes;
+        for (std::size_t i = 0; i < head; i++)
+        {
+            hash ^= asciiToLower(key[i]);
+            hash *= 0x100000001b3ULL;
+        }
+        for (std::size_t i = key.size() < kEdgeBytes * 2 ? key.size() : key.size() - kEdgeBytes; i < key.size(); i++)
+        {
+            hash ^= asciiToLower(key[i]);
+            hash *= 0x100000001b3ULL;
+        }
+        return static_cast<std::size_t>((hash * 0x9e3779b97f4a7c15ULL) >> (64 - kSlotBits));
+    }
+
+    constexpr bool place(uint64_t seed)
+    {
+        for (auto &slot : slots_)
+            slot = kEmpty;
+        for (std::size_t i = 0; i < N; i++)
+        {
+            auto &slot = slots_[slotOf(keys_[i], seed)];
+            if (slot == kEmpty)
+                slot = static_cast<uint16_t>(i);
+            else if (!isSameKey(keys_[slot], keys_[i]))
+                return false;
+        }
+        return true;
+    }
+};
+
+// the keys of a constexpr table of entries, for a PerfectHashTable over it
+template <typename Entry, std::size_t N>
+constexpr std::array<std::string_view, N> keysOf(const Entry (&entries)[N], std::string_view Entry::*key)
+{
+    std::array<std::string_view, N> keys{};
+    for (std::size_t i = 0; i < N; i++)
+        keys[i] = entries[i].*key;
+    return keys;
+}
+
+// the keys of a constexpr array of names
+template <std::size_t N>
+constexpr std::array<std::string_view, N> keysOf(const std::string_view (&names)[N])
+{
+    std::array<std::string_view, N> keys{};
+    for (std::size_t i = 0; i < N; i++)
+        keys[i] = names[i];
+    return keys;
+}
@@ -42,9 +42,8 @@ public:
     std::optional<T> dequeue()
     {
         std::unique_lock lock(mutex_);
-        while (queue_.empty() || !is_running_)
-            cond_.wait(lock, [&]() -> bool
-                       { return !queue_.empty() || !is_running_; });
+        cond_.wait(lock, [&]() -> bool
+                   { return !queue_.empty() || !is_running_; });
 
         if (!is_running_)
             return std::nullopt;
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <array>
 #include <string>
 #include <string_view>
 #include <iostream>
@@ -10,6 +11,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/epoll.h>
+#include <sys/socket.h>
 #include <unistd.h>
 
 #include "../Logger.h"
@@ -50,6 +52,17 @@ inline int epollDel(uint32_t epfd, int fd)
     return epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
 }
 
+// answers a connection that is closed right after with a prebuilt response, false with errno
+// set if it was not sent. Reading the request first makes the close a FIN rather than a RST
+// that could discard the response
+inline bool sendPrebuiltAndDrain(int fd, std::string_view response)
+{
+    std::array<char, 4096> buffer;
+    while (::recv(fd, buffer.data(), buffer.size(), MSG_DONTWAIT) == static_cast<long>(buffer.size()))
+        ;
+    return ::send(fd, response.data(), response.size(), MSG_DONTWAIT | MSG_NOSIGNAL) != -1;
+}
+
 inline int hardwareConcurrency()
 {
     return get_nprocs();
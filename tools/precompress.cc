@@ -0,0 +1,36 @@
+// Writes precompressed sidecars (.gz, .br, .zst) of the compressible files
+// under a root dir, so the server can send them without compressing.
+//
+// usage: precompress.out [root dir]
+
+#include <iostream>
+#include <string>
+
+#include "../src/Compression.h"
+#include "../src/ContentEncoding.h"
+#include "../src/Logger.h"
+
+int main(int argc, char *argv[])
+{
+    const std::string root_dir = argc > 1 ? argv[1] : "./root";
+
+    // the Logger truncates its path on start, so it cannot share stdout/stderr
+    if (!Logger::instance().setLevel(LogLevel::ERROR).setPath("/dev/null").start())
+    {
+        std::cerr << "Failed to start logger" << std::endl;
+        return 1;
+    }
+
+    std::cout << "encoders:";
+    for (int i = 1; i < kContentEncodingCount; i++)
+        if (isEncodingSupported(static_cast<ContentEncoding>(i)))
+            std::cout << " " << kContentEncodingStr[i];
+    std::cout << std::endl;
+
+    const int written = precompressDir(root_dir);
+    if (written == -1)
+        return 1;
+    std::cout << written << " sidecars written under " << root_dir << std::endl;
+    std::cout.flush();
+    std::_Exit(0); // Logger has no stop path
+}